@@ -43,6 +43,7 @@
 #include <channels.h>
 #include "openh323buildopts.h"
 #include <ptlib/video.h>
+#include <ptclib/delaychan.h>
 
 /* The following classes have forward references to avoid including the VERY
    large header files for H225 and H245. If an application requires access
@@ -386,6 +387,164 @@ class H323Codec : public PObject
 
 #ifdef H323_AUDIO_CODECS
 
+/**This class paces the audio encoders of every call from one timer thread.
+   It is used instead of the raw audio channel blocking for a frame time, eg
+   on servers without sound devices. Each codec is ticked on an absolute
+   schedule so the channels do not drift, and codecs with the same frame
+   time wake together.
+ */
+class H323MediaClock : public PObject
+{
+  PCLASSINFO(H323MediaClock, PObject);
+
+  public:
+    enum { MaxPendingTicks = 4 };   ///< Ticks kept for a late reader before the schedule restarts
+
+    class Client
+    {
+      public:
+        Client() : m_due(0), m_interval(0), m_pending(0), m_active(FALSE) { }
+
+      protected:
+        PSyncPoint m_tick;
+        PInt64     m_due;
+        unsigned   m_interval;
+        unsigned   m_pending;
+        PBoolean   m_active;
+
+      friend class H323MediaClock;
+    };
+
+    H323MediaClock();
+    ~H323MediaClock();
+
+    /**Start ticking the client every interval milliseconds.
+      */
+    void Attach(
+      Client & client,      ///< Client to tick
+      unsigned interval     ///< Frame time in milliseconds
+    );
+
+    /**Stop ticking the client. Any Wait() on it returns FALSE.
+      */
+    void Detach(Client & client);
+
+    /**Wait for the next tick of the client.
+       Returns FALSE if the client has been detached.
+      */
+    PBoolean Wait(Client & client);
+
+    /**Number of attached clients.
+      */
+    PINDEX GetClientCount() const;
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, H323MediaClock, ClockMain);
+
+    std::list<Client *> m_clients;
+    mutable PMutex      m_mutex;
+    PSyncPoint          m_wakeup;
+    PThread *           m_thread;
+    PBoolean            m_shutdown;
+};
+
+
+class H323FramedAudioCodec;
+
+/**This class encodes one audio source once for any number of calls, eg
+   music on hold, announcements or a chaired conference speaker. The source
+   is read as 16 bit PCM and each frame is encoded once per media format,
+   by the encoder of the first call subscribed with that format, and the
+   encoded frame copied to the other calls using it. Each call still packs
+   the frames into its own RTP packets, so only the headers differ and
+   calls may use different frames per packet.
+
+   Transmit codecs are subscribed with H323AudioCodec::AttachFanOut(). The
+   fan out must outlive the codecs attached to it. It locks the encoding
+   codec's rawChannelMutex while encoding, so it is not to be called with
+   a codec's rawChannelMutex held.
+ */
+class H323AudioFanOut : public PObject
+{
+  PCLASSINFO(H323AudioFanOut, PObject);
+
+  public:
+    enum {
+      HistoryFrames = 8,        ///< Encoded frames kept for calls reading late
+      HistorySamples = 16000    ///< Source samples kept for formats starting later
+    };
+
+    H323AudioFanOut(
+      PChannel * source,        ///< Channel the 16 bit PCM is read from
+      unsigned sampleRate = 8000, ///< Sample rate of the source
+      PBoolean autoDelete = TRUE  ///< Delete the source with the fan out
+    );
+
+    ~H323AudioFanOut();
+
+    /**Add a transmit codec. Returns FALSE if it is not an encoder or its
+       sample rate differs from the source's.
+      */
+    PBoolean Subscribe(
+      H323FramedAudioCodec & codec  ///< Codec to feed
+    );
+
+    /**Remove a transmit codec. If another subscriber is encoding a frame
+       with the codec this waits for it to finish, so the codec may be
+       closed or destroyed once this returns.
+      */
+    void Unsubscribe(
+      H323FramedAudioCodec & codec  ///< Codec to remove
+    );
+
+    /**Get the next encoded frame for a codec, encoding it if no other
+       codec with the same format has yet. A length of zero is silence.
+       Returns FALSE if the source has ended or the codec is not subscribed.
+      */
+    PBoolean Read(
+      H323FramedAudioCodec & codec, ///< Subscribed codec
+      BYTE * buffer,                ///< Buffer for the encoded frame
+      unsigned & length             ///< Length of the encoded frame
+    );
+
+    /**Number of codecs subscribed.
+      */
+    PINDEX GetSubscriberCount() const;
+
+    /**Number of formats being encoded.
+      */
+    PINDEX GetStreamCount() const;
+
+  protected:
+    struct Stream {
+      std::list<H323FramedAudioCodec *> encoders; ///< Subscribers, the first encodes
+      unsigned   samplesPerFrame;
+      PInt64     firstSample;     ///< Source sample at which frame 0 starts
+      PInt64     nextFrame;       ///< Next frame to encode
+      PBYTEArray frames[HistoryFrames];
+      unsigned   lengths[HistoryFrames];
+    };
+    typedef std::map<PString, Stream *> StreamMap;
+
+    struct Subscriber {
+      Stream * stream;
+      PInt64   nextFrame;
+    };
+    typedef std::map<H323FramedAudioCodec *, Subscriber> SubscriberMap;
+
+    PBoolean Encode(Stream & stream);
+    PBoolean ReadSamples(PInt64 upTo);
+
+    PChannel *         source;
+    unsigned           sampleRate;
+    PBoolean           autoDelete;
+    StreamMap          streams;
+    SubscriberMap      subscribers;
+    std::vector<short> history;   ///< Ring of the most recent source samples
+    PInt64             samplesRead;
+    mutable PMutex     mutex;
+};
+
 
 /**This class defines a codec class that will use the standard platform PCM
    output device.
@@ -443,7 +602,18 @@ class H323AudioCodec : public H323Codec
     enum SilenceDetectionMode {
       NoSilenceDetection,
       FixedSilenceDetection,
-      AdaptiveSilenceDetection
+      AdaptiveSilenceDetection,
+      VoiceActivityDetection      ///< Adaptive threshold, plus noise rejection near the threshold
+    };
+
+    /**Per frame measurements used by VoiceActivityDetection.
+      */
+    struct SignalFeatures {
+      unsigned level;           ///< Mean absolute sample value
+      unsigned lowLevel;        ///< Mean absolute value below a quarter of the sample rate
+      unsigned highLevel;       ///< Mean absolute value above a quarter of the sample rate
+      unsigned zeroCrossings;   ///< Number of sign changes
+      unsigned samples;         ///< Number of samples measured
     };
 
     /**Enable/Disable silence detection.
@@ -501,11 +671,68 @@ class H323AudioCodec : public H323Codec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the band levels and zero crossings of the current frame.
+       This is called from within DetectSilence() in VoiceActivityDetection mode.
+
+       The default behaviour returns FALSE, and the average signal level alone is used.
+      */
+    virtual PBoolean GetSignalFeatures(SignalFeatures & features);
+
+    /**Calculate the mean absolute value of the samples.
+      */
+    static unsigned CalculateSignalLevel(const short * pcm, unsigned count);
+
+    /**Calculate the band levels and zero crossings of the samples in one pass.
+      */
+    static void CalculateSignalFeatures(const short * pcm, unsigned count, SignalFeatures & features);
+
+    /**Convert a linear signal level to the logarithmic (uLaw) scale of the threshold.
+      */
+    static unsigned ToLogLevel(unsigned level);
+
+    /**Whether the frame has the flat spectrum and zero crossing rate of broadband noise.
+      */
+    static PBoolean IsNoiseLike(const SignalFeatures & features);
+
    /**SetRawDataHeld is called when the call has been held and the raw
       data channel has been swapped out and released for another connection.
       */
     virtual PBoolean SetRawDataHeld(PBoolean hold);
 
+    /**Enable concealment of missing received frames and comfort noise in
+       receive gaps instead of digital silence.
+       The default behaviour does nothing.
+      */
+    virtual void EnableConcealment(
+      PBoolean /*enable*/      ///< Whether to conceal missing frames
+    ) { }
+
+    /**Called with the payload of a received RFC 3389 comfort noise packet.
+       The default behaviour does nothing.
+      */
+    virtual void OnComfortNoise(
+      const BYTE * /*payload*/, ///< Comfort noise payload
+      PINDEX /*size*/           ///< Payload size
+    ) { }
+
+    /**Take encoded frames from a shared H323AudioFanOut instead of reading
+       and encoding the raw data channel. NULL detaches the fan out.
+       The default behaviour returns FALSE as the codec cannot be fed.
+      */
+    virtual PBoolean AttachFanOut(
+      H323AudioFanOut * /*fanOut*/ ///< Fan out to subscribe to
+    ) { return FALSE; }
+
+    /**Send a WAV file prompt, encoded once per format by the
+       OpalPromptCache, in place of the raw data channel and then carry on
+       with the raw data. An empty name stops the prompt playing.
+       The default behaviour returns FALSE as the codec cannot play prompts.
+      */
+    virtual PBoolean AttachPrompt(
+      const PFilePath & /*name*/, ///< WAV file to play
+      PINDEX /*repeat*/ = 1       ///< Number of times to play it
+    ) { return FALSE; }
+
 #ifdef H323_AEC
 	/** Attach Acoustic Echo Cancellation.
 	*/
@@ -531,6 +758,9 @@ class H323AudioCodec : public H323Codec
     unsigned signalFramesReceived;  // Frames of signal received
     unsigned silenceFramesReceived; // Frames of silence received
     PBoolean	 IsRawDataHeld;
+
+    H323MediaClock *       mediaClock;      // Endpoint media clock pacing the encoder
+    H323MediaClock::Client mediaClockClient;
 };
 
 
@@ -543,6 +773,8 @@ class H323AudioCodec : public H323Codec
    functions as required for describing a specific codec.
  */
 class H323Aec;
+class H323AudioConcealer;
+class OpalPromptFrames;
 class H323FramedAudioCodec : public H323AudioCodec
 {
   PCLASSINFO(H323FramedAudioCodec, H323AudioCodec);
@@ -558,6 +790,14 @@ class H323FramedAudioCodec : public H323AudioCodec
       Direction direction       ///< Direction in which this instance runs
     );
 
+    ~H323FramedAudioCodec();
+
+    /**Close the codec.
+       This unsubscribes from any fan out, so no other call encodes with the
+       codec after it is closed, then closes the raw data channel.
+      */
+    virtual void Close();
+
     /**Encode the data from the appropriate device.
        This will encode data for transmission. The exact size and description
        of the data placed in the buffer is codec dependent but should be less
@@ -607,6 +847,10 @@ class H323FramedAudioCodec : public H323AudioCodec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the band levels and zero crossings of the current frame.
+      */
+    virtual PBoolean GetSignalFeatures(SignalFeatures & features);
+
 
     /**Encode a sample block into the buffer specified.
        The samples have been read and are waiting in the readBuffer member
@@ -636,13 +880,41 @@ class H323FramedAudioCodec : public H323AudioCodec
 
     /**
       Called when a frame is missed due to late arrival or other reasons
-      By default, this function fills the buffer with silence
+      By default, this function conceals the frame if EnableConcealment()
+      was called and otherwise fills the buffer with silence
       */
     virtual void DecodeSilenceFrame(
       void * buffer,  ///< Buffer from which encoded data is found
       unsigned length       ///< Length of encoded data buffer
-    )
-    { memset(buffer, 0, length); }
+    );
+
+    /**Enable packet loss concealment and comfort noise, see H323AudioConcealer.
+      */
+    virtual void EnableConcealment(
+      PBoolean enable          ///< Whether to conceal missing frames
+    );
+
+    /**Set the comfort noise used in receive gaps.
+      */
+    virtual void OnComfortNoise(
+      const BYTE * payload,    ///< Comfort noise payload
+      PINDEX size              ///< Payload size
+    );
+
+    /**Take encoded frames from a shared H323AudioFanOut.
+      */
+    virtual PBoolean AttachFanOut(
+      H323AudioFanOut * fanOut ///< Fan out to subscribe to
+    );
+
+#ifdef P_WAVFILE
+    /**Send the cached frames of a prompt instead of the raw data.
+      */
+    virtual PBoolean AttachPrompt(
+      const PFilePath & name,  ///< WAV file to play
+      PINDEX repeat = 1        ///< Number of times to play it
+    );
+#endif
 
 #ifdef H323_AEC
     /** Attach Acoustic Echo Cancellation.
@@ -656,12 +928,21 @@ class H323FramedAudioCodec : public H323AudioCodec
 #ifdef H323_AEC
     H323Aec * aec;     // Acoustic Echo Canceller
 #endif
+    H323AudioConcealer * concealer;  // Packet loss concealment
+    H323AudioFanOut * fanOut;        // Shared encoder feeding this codec
+    PAdaptiveDelay    fanOutDelay;   // Paces reads from the fan out or a prompt
+    OpalPromptFrames * prompt;       // Prompt sent instead of the raw data
+    PINDEX            promptFrame;
+    PINDEX            promptRepeat;
     PShortArray sampleBuffer;
     unsigned    bytesPerFrame;
 
     PINDEX      readBytes;
     unsigned    writeBytes;
     PINDEX      cntBytes;
+
+  friend class H323AudioFanOut;
+  friend class OpalPromptCache;
 };
 
 
@@ -720,6 +1001,24 @@ class H323StreamedAudioCodec : public H323FramedAudioCodec
      */
     virtual short Decode(int sample) const = 0;
 
+    /**Encode a block of samples for 8 bit codecs.
+       The default returns FALSE and Encode() is called for each sample.
+     */
+    virtual PBoolean EncodeBlock(
+      const short * samples,  ///< Samples to encode
+      BYTE * encoded,         ///< One encoded byte per sample
+      unsigned count          ///< Number of samples
+    ) const;
+
+    /**Decode a block of samples for 8 bit codecs.
+       The default returns FALSE and Decode() is called for each sample.
+     */
+    virtual PBoolean DecodeBlock(
+      const BYTE * encoded,   ///< One encoded byte per sample
+      short * samples,        ///< Decoded samples
+      unsigned count          ///< Number of samples
+    ) const;
+
   protected:
     unsigned bitsPerSample;
 };
@@ -1025,9 +1324,19 @@ class H323_ALawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual PBoolean EncodeBlock(const short * samples, BYTE * encoded, unsigned count) const
+      { EncodeSamples(samples, encoded, count); return TRUE; }
+    virtual PBoolean DecodeBlock(const BYTE * encoded, short * samples, unsigned count) const
+      { DecodeSamples(encoded, samples, count); return TRUE; }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    /**Convert a block of samples using lookup tables.
+     */
+    static void EncodeSamples(const short * samples, BYTE * encoded, unsigned count);
+    static void DecodeSamples(const BYTE * encoded, short * samples, unsigned count);
+
   protected:
     PBoolean sevenBit;
 };
@@ -1054,9 +1363,19 @@ class H323_muLawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual PBoolean EncodeBlock(const short * samples, BYTE * encoded, unsigned count) const
+      { EncodeSamples(samples, encoded, count); return TRUE; }
+    virtual PBoolean DecodeBlock(const BYTE * encoded, short * samples, unsigned count) const
+      { DecodeSamples(encoded, samples, count); return TRUE; }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    /**Convert a block of samples using lookup tables.
+     */
+    static void EncodeSamples(const short * samples, BYTE * encoded, unsigned count);
+    static void DecodeSamples(const BYTE * encoded, short * samples, unsigned count);
+
   protected:
     PBoolean sevenBit;
 };
@@ -48,22 +48,14 @@ extern "C" {
 #include <speex/speex_preprocess.h>
 }
 
-#include <map>
-
-class H323AEC {
-public:
-    struct BufferFrame {
-        BufferFrame();
-        BufferFrame(PINDEX sz);
-        ~BufferFrame();
-
-        PInt64      receiveTime;
-        PInt64      echoTime;
-        PBYTEArray  frame;
-    };
-};
-
-class H323_AECBuffer : public std::map< unsigned, H323AEC::BufferFrame >
+/** Far end reference buffer for the echo canceller.
+  * A fixed size ring of frames with a single writer (the playing channel)
+  * and a single reader (the recording channel). Neither side takes a lock
+  * or allocates once initialised. Each frame is stamped with the time it
+  * is expected to be heard, its receive time plus the playout delay, and
+  * the reader picks the newest frame that has been heard by now.
+  */
+class H323_AECBuffer
 {
 public:
     H323_AECBuffer();
@@ -76,12 +68,18 @@ public:
     void Receive(BYTE * buffer, unsigned & length);
 
 protected:
+    PBoolean IsOverwritten(unsigned index) const;
+
+    PINDEX m_bufferTime;                       // Playout delay in ms
+    PINDEX m_frameTime;                        // Frame duration in ms
+    PINDEX m_frameBytes;                       // Bytes per frame
+    unsigned m_slots;                          // Ring size, a power of 2
 
-    PINDEX m_bufferTime;
-    PMutex m_bufferMutex;
+    BYTE   * m_frames;                         // m_slots frames of m_frameBytes
+    PInt64 * m_echoTime;                       // When each frame is heard
 
-private:
-    unsigned m_curPos;
+    PAtomicInteger m_written;                  // Frames written, owned by Receive
+    unsigned m_read;                           // Next frame to read, owned by Send
 };
 
 
@@ -100,18 +98,14 @@ public:
   /**@name Construction */
   //@{
   /**Create a new canceler.
+     If _offload is non zero the echo cancellation and preprocessing run
+     on a worker thread, and the recording channel waits at most _offload
+     ms for each frame before sending it unprocessed.
    */
-     H323Aec(int _clock = 8000, int _sampletime = 20, int _buffers = 3);
+     H323Aec(int _clock = 8000, int _sampletime = 20, int _buffers = 3, unsigned _offload = 0);
      ~H323Aec();
   //@}
 
-     struct BufferFrame
-    {
-       PInt64      receiveTime;
-       PInt64      echoTime;
-       PBYTEArray  frame;
-    };
-
   /**@@name Basic operations */
   //@{
   /**Recording Channel. Should be called prior to encoding audio
@@ -122,11 +116,15 @@ public:
    */
     void Receive(BYTE * buffer, unsigned & length);
 
+  /**Number of frames sent unprocessed because the worker missed its budget.
+   */
+    unsigned GetOverruns() const { return m_overruns; }
   //@}
 
 protected:
+    void Cancel();
 
-  H323_AECBuffer           m_echoBuffer;
+    PDECLARE_NOTIFIER(PThread, H323Aec, WorkerMain);
 
   SpeexEchoState * m_echoState;
   SpeexPreprocessState * m_preprocessState;
@@ -142,6 +140,14 @@ protected:
 
   unsigned m_tail;                           // Tail of echo to search
 
+  // Offloaded operation
+  PThread      * m_worker;                   // NULL when cancelling inline
+  unsigned       m_offload;                  // Latency budget in ms
+  PSyncPoint     m_jobReady;
+  PSyncPoint     m_jobDone;
+  PAtomicInteger m_jobPending;               // Frame handed to the worker
+  PBoolean       m_shutdown;
+  unsigned       m_overruns;
 };
 
 // End Of File ///////////////////////////////////////////////////////////////
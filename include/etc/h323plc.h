@@ -0,0 +1,124 @@
+/*
+ * h323plc.h
+ *
+ * Packet loss concealment and comfort noise for the h323plus Library.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the General Public License (the  "GNU License"), in which case the
+ * provisions of GNU License are applicable instead of those
+ * above. If you wish to allow use of your version of this file only
+ * under the terms of the GNU License and not to allow others to use
+ * your version of this file under the MPL, indicate your decision by
+ * deleting the provisions above and replace them with the notice and
+ * other provisions required by the GNU License. If you do not delete
+ * the provisions above, a recipient may use your version of this file
+ * under either the MPL or the GNU License."
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is derived from and used in conjunction with the
+ * H323plus Project (www.h323plus.org/)
+ *
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _H323_PLC_H
+#define _H323_PLC_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <vector>
+
+/** Codec independent concealment of missing decoded audio.
+  * A gap starts with waveform substitution after G.711 Appendix I: the
+  * pitch of the last 20 ms of speech is found and its last period is
+  * repeated, widening to two and three periods after 10 and 20 ms to avoid
+  * a buzzy tone, and fading out between 10 and 60 ms. Underneath, comfort
+  * noise fades in at the level and spectrum of the last RFC 3389 comfort
+  * noise payload, or else at the background level tracked from the decoded
+  * audio. The first frame after a gap is overlap added with the synthetic
+  * signal so there is no click. Works on 16 bit linear PCM at any rate.
+  */
+class H323AudioConcealer : public PObject
+{
+  PCLASSINFO(H323AudioConcealer, PObject);
+
+  public:
+    enum {
+      MaxNoiseOrder = 10      ///< Highest comfort noise spectral model order used
+    };
+
+    H323AudioConcealer(
+      unsigned sampleRate     ///< Sample rate of the decoded audio
+    );
+
+    /**Pass a correctly decoded frame. Smooths the join after a concealed
+       gap in place, then keeps the frame as history for the next gap and
+       tracks the background level.
+      */
+    void Received(
+      short * samples,        ///< Decoded samples
+      unsigned count          ///< Number of samples
+    );
+
+    /**Fill in a missing frame.
+      */
+    void Conceal(
+      short * samples,        ///< Buffer for the concealed samples
+      unsigned count          ///< Number of samples
+    );
+
+    /**Set the comfort noise from an RFC 3389 payload, the noise level in
+       -dBov followed by the optional quantised reflection coefficients.
+       It is used for the gaps until speech is received again.
+      */
+    void SetComfortNoise(
+      const BYTE * payload,   ///< Comfort noise payload
+      PINDEX size             ///< Payload size
+    );
+
+  protected:
+    void StartGap();
+    float Synthesise();
+    float NextNoise();
+    void SaveHistory(const short * samples, unsigned count);
+
+    unsigned m_sampleRate;
+    unsigned m_pitchMin;                  ///< Shortest pitch period searched (200 Hz)
+    unsigned m_pitchMax;                  ///< Longest pitch period searched (66 Hz)
+    unsigned m_correlationSpan;           ///< Window matched when searching for the pitch
+    unsigned m_gapStep;                   ///< 10 ms in samples
+    unsigned m_fadeLength;                ///< Samples over which the substitution fades out
+
+    std::vector<float> m_history;         ///< Most recent output, newest last
+    std::vector<float> m_pitchBuffer;     ///< Three pitch periods plus overlap taken at the start of a gap
+    unsigned m_pitch;
+    unsigned m_overlap;                   ///< Quarter of the pitch period
+    unsigned m_position;                  ///< Read position in the three periods
+    unsigned m_missing;                   ///< Samples concealed in the current gap
+
+    float m_noiseFloor;                   ///< Tracked background rms
+    float m_noiseLevel;                   ///< Comfort noise rms when received by RFC 3389
+    PBoolean m_noiseReceived;
+    unsigned m_noiseOrder;
+    float m_lpc[MaxNoiseOrder];           ///< Comfort noise synthesis filter
+    float m_noiseState[MaxNoiseOrder];
+    float m_excitation;                   ///< Excitation gain so the filter output has the wanted level
+    DWORD m_noiseSeed;
+};
+
+#endif // _H323_PLC_H
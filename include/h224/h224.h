@@ -106,10 +106,21 @@ public:
     virtual void OnReceivedExtraCapabilities(const BYTE *capabilities, PINDEX size) =0;
     virtual void OnReceivedMessage(const H224_Frame & message) = 0;
 
+    /** Called on the shared H.224 dispatcher thread when a timer started
+        with StartTimer() expires.
+      */
+    virtual void OnTimer(unsigned /*id*/) { }
+
     static PStringArray GetHandlerNames(PPluginManager * pluginMgr = NULL);
     static H224_Handler * CreateHandler(const PString & handlerName, PPluginManager * pluginMgr = NULL);
 
 protected:
+    /** Start, or restart, a timer calling OnTimer() with the id after the
+        interval, and every interval after that if repeating.
+      */
+    void StartTimer(unsigned id, unsigned milliseconds, PBoolean repeat = FALSE);
+    void StopTimer(unsigned id);
+
     OpalH224Handler *        m_h224Handler;
     int                      m_direction;
     PString                  m_h224Display;
@@ -43,9 +43,11 @@
 #endif
 #include <channels.h>
 #include <map>
+#include <list>
 
 
 class H224_Frame;
+class H224_Handler;
 class OpalH224Handler;
 
 class OpalH224ReceiverThread : public PThread
@@ -89,6 +91,10 @@ public:
     
   virtual void StartTransmit();
   virtual void StopTransmit();
+  /** Start receiving. Sessions on plain UDP sockets are serviced by the
+      shared OpalH224Dispatcher, others by a receiver thread from
+      CreateH224ReceiverThread().
+    */
   virtual void StartReceive();
   virtual void StopReceive();
     
@@ -120,6 +126,16 @@ public:
 
   PBoolean OnReadFrame(RTP_DataFrame & frame);
   PBoolean OnWriteFrame(RTP_DataFrame & frame);
+
+  /** Decrypt and decode a received packet and pass the frame to OnReceivedFrame().
+      A packet with the same timestamp as the last one is a repeat and is ignored.
+    */
+  void OnReceivedPacket(RTP_DataFrame & packet, H224_Frame & frame, unsigned & lastTimeStamp);
+
+  /** Called by the shared dispatcher when the session has a packet to read.
+      Returns FALSE if the session has been closed.
+    */
+  PBoolean OnReceiveReady();
     
 protected:
 
@@ -133,6 +149,11 @@ protected:
     
   OpalH224ReceiverThread *receiverThread;
 
+  PBoolean receiveShared;
+  RTP_DataFrame *receivePacket;
+  H224_Frame *receiveFrame;
+  unsigned receiveTimeStamp;
+
   PMutex handlersMutex;
   std::map<BYTE, H224_Handler*> m_h224Handlers;
 
@@ -148,5 +169,70 @@ private:
     
 };
 
+
+/** Shared service for the H.224 channels of all calls.
+    One thread waits on the RTP sockets of every receiving H.224 channel and
+    dispatches the received frames, and runs the timers of the H.224 clients
+    such as the repeat and timeout of continuous H.281 camera commands.
+    The handlers and timers are called without the dispatcher locked, so
+    they may take their connection locks and start or stop timers.
+ */
+class OpalH224Dispatcher : public PObject
+{
+  PCLASSINFO(OpalH224Dispatcher, PObject);
+
+public:
+
+  static OpalH224Dispatcher & Instance();
+
+  /** Add the receiving side of a handler. Returns FALSE if the sockets of
+      its session cannot be waited on, as with multiplexed or tunnelled media.
+    */
+  PBoolean AddReceiver(OpalH224Handler * handler);
+
+  /// When this returns the handler is no longer being serviced
+  void RemoveReceiver(OpalH224Handler * handler);
+
+  /** Start, or restart, a timer calling H224_Handler::OnTimer() with the id
+      after the interval, and every interval after that if repeating.
+    */
+  void StartTimer(H224_Handler * client, unsigned id, unsigned milliseconds, PBoolean repeat);
+
+  /// When this returns the timer is stopped and its OnTimer() is not running
+  void StopTimer(H224_Handler * client, unsigned id);
+
+  /// Stop all timers of the client
+  void StopTimers(H224_Handler * client);
+
+protected:
+
+  OpalH224Dispatcher();
+  ~OpalH224Dispatcher();
+
+  void Start();
+  PInt64 RunTimers(PInt64 now);
+  void WaitIdle(const void * user);
+
+  PDECLARE_NOTIFIER(PThread, OpalH224Dispatcher, DispatchMain);
+
+  struct Timer {
+    H224_Handler * client;
+    unsigned       id;
+    PInt64         due;       ///< Tick in milliseconds
+    unsigned       repeat;    ///< Interval in milliseconds, zero if firing once
+  };
+
+  PMutex m_mutex;
+  std::list<OpalH224Handler *> m_receivers;
+  std::list<Timer> m_timers;
+  PSyncPoint m_wakeup;
+  PSyncPoint m_selected;
+  PBoolean m_selecting;
+  const void * m_running;     ///< Client or handler being called back, NULL if none
+  unsigned m_cycle;
+  PThread * m_thread;
+  PBoolean m_exit;
+};
+
 #endif // __H323_H224HANDLER_H
 
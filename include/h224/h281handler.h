@@ -213,11 +213,21 @@ public:
   /** Indicates to activate the given preset number
    */
   virtual void OnActivatePreset(BYTE presetNumber);
+
+  /** Repeats a running action every 400 msec and stops a received action
+      800 msec after it was last repeated
+   */
+  virtual void OnTimer(unsigned id);
     
 protected:
+
+  enum {
+    ContinueActionTimer,
+    StopActionTimer
+  };
         
-  PDECLARE_NOTIFIER(PTimer, H224_H281Handler, ContinueAction);
-  PDECLARE_NOTIFIER(PTimer, H224_H281Handler, StopActionLocally);
+  void ContinueAction();
+  void StopActionLocally();
     
   PBoolean remoteHasH281;
   BYTE localNumberOfPresets;
@@ -226,13 +236,11 @@ protected:
   H281VideoSource remoteVideoSources[6];
     
   H281_Frame transmitFrame;
-  PTimer transmitTimer;
 
   H281_Frame::PanDirection requestedPanDirection;
   H281_Frame::TiltDirection requestedTiltDirection;
   H281_Frame::ZoomDirection requestedZoomDirection;
   H281_Frame::FocusDirection requestedFocusDirection;
-  PTimer receiveTimer;
 
   PBoolean shutDown;
 };
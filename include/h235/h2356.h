@@ -44,6 +44,7 @@
 
 #include <ptlib.h>
 #include <ptlib/pluginmgr.h>
+#include <list>
 
 #ifdef H323_H235
 
@@ -58,6 +59,63 @@ struct H235_OIDiterator
 };
 class H235_DiffieHellman;
 typedef std::map<PString, H235_DiffieHellman*, H235_OIDiterator> H235_DHMap;
+typedef std::list<H235_DiffieHellman*> H235_DHKeyList;
+
+/** Pool of pre-generated Diffie-Hellman half keys.
+    Background threads keep a number of fresh key pairs per DH group (OID)
+    ready so new calls do not do the modular exponentiation on call setup.
+  */
+class H235_DHKeyPool : public PObject
+{
+    PCLASSINFO(H235_DHKeyPool, PObject);
+  public:
+
+    H235_DHKeyPool();
+    ~H235_DHKeyPool();
+
+    /** Start the pool. templates are the DH parameters for each OID (NULL entries allowed).
+        The pool takes ownership of the templates.
+      */
+    void Initialise(H235_DHMap & templates, PINDEX depth, PINDEX threads);
+
+    /** Stop the refill threads and release all keys
+      */
+    void Shutdown();
+
+    /** Whether the pool has been initialised
+      */
+    PBoolean IsActive() const { return m_active; }
+
+    /** Load a fresh key pair for every pooled OID into dhmap.
+        Any OID whose pool is empty has its pair generated on the calling
+        thread, without holding the pool lock.
+        Returns false if the pool is not active.
+      */
+    PBoolean LoadKeyPairs(H235_DHMap & dhmap);
+
+    /** Number of key pairs taken from the pool
+      */
+    unsigned GetPoolHits() const;
+
+    /** Number of key pairs that had to be generated on call setup because the pool was empty
+      */
+    unsigned GetPoolMisses() const;
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, H235_DHKeyPool, RefillMain);
+
+    H235_DHMap                      m_templates;
+    std::map<PString, H235_DHKeyList> m_keys;
+    PINDEX                          m_depth;
+    PList<PThread>                  m_threads;
+    PSyncPoint                      m_refill;
+    mutable PMutex                  m_mutex;
+    PBoolean                        m_active;
+    PBoolean                        m_shutdown;
+    unsigned                        m_hits;         // Guarded by m_mutex
+    unsigned                        m_misses;       // Guarded by m_mutex
+    unsigned                        m_generating;   // Calls generating from the templates
+};
 
 class H2356_Authenticator : public H235Authenticator
 {
@@ -87,6 +145,10 @@ class H2356_Authenticator : public H235Authenticator
     static void InitialiseCache(int cipherlength = 128, unsigned maxTokenLength = 1024);
     static void RemoveCache();
 
+    static void InitialiseKeyPool(PINDEX depth, PINDEX threads, int cipherlength = 128, unsigned maxTokenLength = 1024);
+    static void RemoveKeyPool();
+    static H235_DHKeyPool & GetKeyPool() { return m_dhKeyPool; }
+
     PBoolean IsMatch(const PString & identifier) const; 
 
     virtual PBoolean PrepareTokens(
@@ -146,6 +208,7 @@ protected:
 private:
 
     static H235_DHMap                m_dhCachedMap;
+    static H235_DHKeyPool            m_dhKeyPool;
     H235_DHMap                       m_dhLocalMap;
 
     PBoolean                         m_enabled;
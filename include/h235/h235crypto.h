@@ -126,6 +126,20 @@ public:
       */
     PINDEX DecryptInPlace(const BYTE * inData, PINDEX inLength, BYTE * outData, unsigned char * ivSequence, bool & rtpPadding);
 
+    /** Encrypt in a single pass over the buffer. data must have room for
+        length + GetEncryptBlockSize() bytes. Returns the ciphertext length.
+      */
+    PINDEX EncryptInPlace(BYTE * data, PINDEX length, unsigned char * ivSequence, bool & rtpPadding);
+
+    /** Decrypt in a single pass over the buffer. Returns the plaintext length
+        or 0 if the payload could not be decrypted.
+      */
+    PINDEX DecryptInPlace(BYTE * data, PINDEX length, unsigned char * ivSequence, bool & rtpPadding);
+
+    /** Encryption block size (maximum growth of the payload when encrypting)
+      */
+    int GetEncryptBlockSize() const { return m_enc_blockSize; }
+
     /** Generate a random key of a size suitable for the alogorithm
       */
     PBYTEArray GenerateRandomKey();   // Use internal Algorithm and set
@@ -126,6 +126,9 @@ public:
    /** Generate Half Key */
     PBoolean GenerateHalfKey();
 
+   /** Create a copy of the parameters with a newly generated half key */
+    H235_DiffieHellman * CreateNewKeyPair() const;
+
    /** Compute Session key */
     PBoolean ComputeSessionKey(PBYTEArray & SessionKey);
 
@@ -197,6 +200,14 @@ public:
 
   protected:
 
+    /**Create a key pair on the parameters, taking ownership of them, with
+       the other settings of an existing one.
+      */
+    H235_DiffieHellman(
+      dh_st * params,
+      const H235_DiffieHellman & settings
+    );
+
     PMutex vbMutex;                   /// Mutex
 
     dh_st * dh;                       /// Local DiffieHellman
@@ -584,10 +584,25 @@ class H2351_Authenticator : public H235Authenticator
     virtual void VerifyRandomNumber(bool value) { m_verifyRandomNumber = value; }
 
 protected:
+    /** Derive the HMAC key pads from the password.
+        These are kept until the password changes.
+      */
+    void DeriveKey();
+
+    /** Locate the hash field in an encoded PDU, starting at the given offset.
+        The offset found in the last PDU is tried before scanning.
+      */
+    PINDEX FindHashField(const BYTE * pdu, PINDEX length, const BYTE * hash, PINDEX start = 0);
+
     PBoolean m_requireGeneralID;
     PBoolean m_checkSendersID;
     PBoolean m_fullQ931Checking;
     PBoolean m_verifyRandomNumber;
+
+    PString  m_derivedPassword;     ///< Password the key pads were derived from
+    BYTE     m_innerPad[64];        ///< HMAC-SHA1 inner key block
+    BYTE     m_outerPad[64];        ///< HMAC-SHA1 outer key block
+    PINDEX   m_hashOffset;          ///< Hash field position in the last PDU
 };
 
 typedef H2351_Authenticator H235AuthProcedure1;  // Backwards interoperability
@@ -1733,6 +1733,19 @@ class H323Connection : public PObject
       unsigned bufferSize,   ///< Size of each sound buffer
       H323AudioCodec & codec ///< codec that is doing the opening
     );
+
+    /**Play a WAV file prompt to the remote party in place of the audio
+       being sent, then carry on with the audio. The frames are encoded once
+       for each format by the OpalPromptCache and shared by every call
+       playing the prompt. An empty name stops the prompt.
+
+       Returns FALSE if there is no transmitting audio channel, or its codec
+       cannot play the file.
+      */
+    virtual PBoolean PlayPrompt(
+      const PFilePath & name,   ///< WAV file to play
+      PINDEX repeat = 1         ///< Number of times to play it
+    );
 #endif
 
 #ifdef H323_VIDEO
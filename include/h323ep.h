@@ -71,6 +71,7 @@ class PSTUNClient;
 #endif
 
 class PHandleAggregator;
+class H323PluginCodecEngine;
 
 /* The following classes have forward references to avoid including the VERY
    large header files for H225 and H245. If an application requires access
@@ -1281,6 +1282,22 @@ class H323EndPoint : public PObject
       */
     virtual void EncryptionCacheRemove();
 
+    /**Initialise Encryption key pool
+       Use this to have background threads keep depth fresh Diffie-Hellman
+       half keys ready per DH group, so each call gets a new key pair without
+       generating it on call setup. MUST Call EncryptionKeyPoolRemove() to cleanup
+      */
+    virtual void EncryptionKeyPoolInitialise(PINDEX depth = 4, PINDEX threads = 1);
+
+    /**Remove Encryption key pool
+      */
+    virtual void EncryptionKeyPoolRemove();
+
+    /**Get the number of times a call had to generate its own key pair
+       because the key pool was empty
+      */
+    unsigned GetEncryptionKeyPoolMisses() const;
+
     /** On Media Encryption
         Fires when an encryption session negotiated
         Fires for each media session direction
@@ -1962,6 +1979,48 @@ class H323EndPoint : public PObject
       H323AudioCodec::SilenceDetectionMode mode ///< New default mode
     ) { defaultSilenceDetection = mode; }
 
+    /**Conceal lost received audio frames and fill receive gaps with comfort
+       noise instead of digital silence, see H323AudioConcealer. Codecs with
+       their own concealment keep using it. Default is FALSE.
+      */
+    void SetAudioConcealment(
+      PBoolean enable           ///< Whether to conceal missing frames
+    ) { audioConcealment = enable; }
+
+    /**Get whether received audio frames are concealed.
+      */
+    PBoolean GetAudioConcealment() const { return audioConcealment; }
+
+    /**Pace the audio encoders of all calls from a shared media clock.
+       Use this when the raw audio channels do not block for a frame time,
+       eg on servers without sound devices. Must be set before calls are made.
+       Disabling only affects codecs opened afterwards, the clock is kept
+       until the endpoint is destroyed as open codecs still tick from it.
+      */
+    void EnableMediaClock(
+      PBoolean enable = TRUE    ///< Whether to use the media clock
+    );
+
+    /**Get the shared media clock. Returns NULL if not enabled.
+      */
+    H323MediaClock * GetMediaClock() const { return mediaClockEnabled ? mediaClock : NULL; }
+
+    /**Run the frames of framed plugin audio codecs on a shared pool of
+       worker threads instead of each channel's own thread. Intended for
+       transcoding servers carrying many calls. A thread count of zero
+       disables the engine. Must be set before calls are made. A replaced
+       engine only stops taking codecs, those already on it keep running
+       and it is kept until the endpoint is destroyed.
+      */
+    void EnableCodecEngine(
+      unsigned threads,         ///< Number of worker threads, 0 to disable
+      unsigned maxBatch = 64    ///< Maximum frames processed per batch
+    );
+
+    /**Get the plugin codec engine. Returns NULL if not enabled.
+      */
+    H323PluginCodecEngine * GetCodecEngine() const { return codecEngine; }
+
 #endif  // H323_AUDIO_CODECS
 
     /**Get the default mode for sending User Input Indications.
@@ -2538,6 +2597,16 @@ class H323EndPoint : public PObject
     PBoolean AECEnabled()   {  return enableAEC; }
 
     void SetAECEnabled(PBoolean enabled)  { enableAEC = enabled; }
+
+    /**Run echo cancellation on a worker thread per call. The recording
+       channel waits at most budget ms per frame before sending it without
+       cancellation. A budget of zero runs the canceller inline.
+      */
+    void SetAECOffload(unsigned budget)  { aecOffload = budget; }
+
+    /**Get the echo cancellation worker latency budget in ms, 0 if inline.
+      */
+    unsigned GetAECOffload() const  { return aecOffload; }
 #endif
 
 #ifdef H323_TLS
@@ -2554,6 +2623,28 @@ class H323EndPoint : public PObject
     PBoolean TLS_Initialise(const PIPSocket::Address & binding = PIPSocket::GetDefaultIpAny(),
                             WORD port = DefaultTLSPort);
 
+    /**Set the server session cache size and session timeout in seconds.
+       A size of 0 disables session resumption for incoming connections.
+      */
+    PBoolean TLS_SetSessionCache(PINDEX size, unsigned timeout);
+
+    /**Set the number of remote addresses whose sessions are kept for
+       resuming outgoing connections. A size of 0 disables client resumption.
+      */
+    void TLS_SetClientSessionCache(PINDEX size);
+
+    /**Set the number of threads doing the accept handshakes for the TLS listener
+       and how many connections may wait for one. 0 threads handshakes on the listener thread.
+       Must be called before TLS_Initialise().
+      */
+    void TLS_SetHandshakeThreads(PINDEX threads, PINDEX queueSize = 32);
+    PINDEX GetTLSHandshakeThreads() const { return m_tlsHandshakeThreads; }
+    PINDEX GetTLSHandshakeQueueSize() const { return m_tlsHandshakeQueueSize; }
+
+    /**Get the client sessions kept for outgoing connections.
+      */
+    H323TLSSessionCache & GetTLSSessionCache() { return m_tlsSessionCache; }
+
     PBoolean InitialiseTransportContext();
     PSSLContext * GetTransportContext();
 
@@ -2940,6 +3031,11 @@ class H323EndPoint : public PObject
 
 #ifdef H323_AUDIO_CODECS
     H323AudioCodec::SilenceDetectionMode defaultSilenceDetection;
+    PBoolean audioConcealment;
+    H323MediaClock * mediaClock;
+    PBoolean mediaClockEnabled;
+    H323PluginCodecEngine * codecEngine;
+    std::vector<H323PluginCodecEngine *> retiredCodecEngines;
     unsigned minAudioJitterDelay;
     unsigned maxAudioJitterDelay;
 #ifdef P_AUDIO
@@ -3202,6 +3298,7 @@ class H323EndPoint : public PObject
 
 #ifdef H323_AEC
     PBoolean enableAEC;
+    unsigned aecOffload;
 #endif
 
 #ifdef H323_GNUGK
@@ -3215,6 +3312,9 @@ class H323EndPoint : public PObject
     H323TransportSecurity m_transportSecurity;
 #ifdef H323_TLS
     PSSLContext * m_transportContext;
+    H323TLSSessionCache m_tlsSessionCache;
+    PINDEX m_tlsHandshakeThreads;
+    PINDEX m_tlsHandshakeQueueSize;
 #endif
 
     void RegInvokeReRegistration();
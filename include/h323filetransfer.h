@@ -42,6 +42,7 @@
 
 #include <ptclib/delaychan.h>
 #include <list>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////////////////
 
@@ -326,6 +327,12 @@ class H323FileTransferCapability : public H323DataCapability
 		e_8192      = 8192
 	};
 
+	enum windowSizes {
+		e_StopAndWait   = 1,      ///< Wait for the ACK of each block
+		e_DefaultWindow = 16,
+		e_MaxWindow     = 32      ///< Less than half the 99 block numbers
+	};
+
   /**@name Operations */
   //@{
     /**Create the channel instance, allocating resources as required.
@@ -357,6 +364,15 @@ class H323FileTransferCapability : public H323DataCapability
      */
 	unsigned GetTransferMode() const  { return m_transferMode; }
 
+    /**Get the number of blocks that may be sent before the first is
+       acknowledged. A remote that does not signal a window is stop and wait.
+     */
+	unsigned GetWindowSize() const  { return m_windowSize; }
+
+    /**Set the number of blocks in flight to offer, 1 for stop and wait.
+     */
+	void SetWindowSize(unsigned size);
+
 	/**Set the List of files to send
 	 */
 	void SetFileTransferList(const H323FileTransferList & list);
@@ -366,6 +382,7 @@ class H323FileTransferCapability : public H323DataCapability
     unsigned				m_blockSize;          ///< Size indicator in capability negotiation
 	unsigned				m_blockOctets;        ///< Block Octet size
 	unsigned				m_transferMode;       ///< Mode of transfer Raw Tftp or RTP encaptulated
+	unsigned				m_windowSize;         ///< Blocks in flight, 1 for stop and wait
 	H323FileTransferList	m_filelist;           ///< File list to Request/Send
 
 };
@@ -448,13 +465,32 @@ class H323FileIOChannel : public PIndirectChannel
 
 	unsigned GetFileSize();
 
+    /**Map a file opened for reading into memory so blocks are sent from
+       the page cache without a read per block. Returns FALSE if the file
+       is empty or cannot be mapped, and Read() must be used instead.
+     */
+	PBoolean MapData();
+
+    /**Copy part of the mapped file. The mapping is only touched here under
+       the channel mutex, so Close() cannot unmap it during the copy, and the
+       file length is checked first as touching pages past the end of a file
+       truncated by another process raises SIGBUS. Returns FALSE if the file
+       is no longer mapped or is now too short.
+     */
+	PBoolean ReadMapped(PINDEX offset, void * buffer, PINDEX amount);
+
   protected:
 	PBoolean CheckFile(PFilePath _file, PBoolean read, fileError & errCode);
+	void UnmapData();
 
     PMutex chanMutex;
 	PBoolean fileopen;
 	unsigned filesize;
 	fileError IOError;
+	const BYTE * mappedData;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
 };
 
 
@@ -502,6 +538,14 @@ public:
   virtual void SetBlockSize(H323FileTransferCapability::blockSizes size);
   virtual void SetMaxBlockRate(unsigned rate);
 
+/////////////////////////
+// Set from the negotiated capability, more than one block in flight
+// switches from stop and wait to the windowed transfer
+
+  void SetWindowSize(unsigned size);
+  unsigned GetWindowSize() const
+        { return windowSize; }
+
 // User override to get events
 
   virtual void OnStateChange(transferState newState) {};
@@ -532,11 +576,23 @@ public:
 protected:
 
   PBoolean TransmitFrame(H323FilePacket & buffer, PBoolean final);
+  virtual PBoolean WriteFrame(PBoolean final);   ///< Send transmitFrame, may be overridden to simulate loss
   PBoolean ReceiveFrame(H323FilePacket & buffer, PBoolean & final);
 
   void ChangeState(transferState newState);
   void SetBlockState(receiveStates state);
 
+  // Windowed transfer
+  PBoolean TransmitWindow();
+  PBoolean TransmitBlock(unsigned index, PINDEX offset, const BYTE * data, PINDEX size);
+  void OnWindowAck(int blockNo);
+  void StartWindowReceive();
+  void OnWindowData(H323FilePacket & packet);
+  void QueueWindowAck(int blockNo);
+  void SendWindowAcks();
+  void WriteWindowData(const BYTE * data, PINDEX size);
+  void FlushWindowData();
+
   H323FileTransferList filelist;
 
   PThread * TransmitThread;
@@ -583,6 +639,38 @@ private:
   unsigned curFileSize;                        ///< Current File being Transmitted size
   unsigned curBlockSize;                       ///< Block size of current transmittion
   unsigned curProgSize;						   ///< Current amount of data sent/received
+
+  // Windowed transfer, blocks are counted from 1 for the whole file and
+  // sent as block numbers 1 to 99
+  struct WindowBlock {
+    WindowBlock() : offset(0), size(0), sent(0), transmissions(0), later(0), acked(FALSE), resend(FALSE) { }
+    PINDEX offset;                             ///< Position in the file
+    PINDEX size;
+    PBYTEArray data;                           ///< Copy of the block when the file is not mapped
+    PInt64 sent;                               ///< Tick of the last transmission in ms
+    unsigned transmissions;
+    unsigned later;                            ///< Later blocks acknowledged while this one was not
+    PBoolean acked;
+    PBoolean resend;                           ///< Presumed lost, retransmit without waiting for the timeout
+  };
+
+  unsigned windowSize;                         ///< Blocks in flight, 1 for stop and wait
+  PMutex windowMutex;
+  std::vector<WindowBlock> windowBlocks;       ///< Sent blocks by index modulo the window
+  unsigned windowBase;                         ///< First block not acknowledged
+  unsigned windowNext;                         ///< Next block not yet sent
+  unsigned windowLast;                         ///< Last block of the file
+  int srtt;                                    ///< Smoothed round trip time in ms
+  int rttvar;                                  ///< Round trip time variation in ms
+  int rto;                                     ///< Retransmission timeout in ms
+
+  std::vector<PBYTEArray> recvBlocks;          ///< Blocks received ahead of the next expected
+  std::vector<bool> recvHave;
+  unsigned recvNext;                           ///< Next block to write
+  std::list<int> pendingAcks;                  ///< ACKs for the transmit thread to send
+  int windowLastAck;                           ///< Block number of the last block of the previous file
+  PBYTEArray writeBuffer;                      ///< Blocks in order gathered into one file write
+  PINDEX writeFill;
 };
 
 #endif
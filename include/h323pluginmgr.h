@@ -102,6 +102,136 @@ class H323PluginCodecManager : public PPluginModuleManager
     bool m_skipRedefinitions;
 };
 
+#ifdef H323_AUDIO_CODECS
+
+/**Worker pool running the frames of plugin audio codecs for many channels.
+   Intended for transcoding servers with many calls using the same codecs.
+   Each codec context is pinned to one worker, and channels using the same
+   plugin codec are grouped onto the same worker where the load allows, so
+   the codec code and tables stay warm in that core's cache. Frames queued
+   while a worker is busy are processed as one batch, ordered by codec.
+
+   The channel thread blocks until its frame is done, so the plugin ABI is
+   unchanged and any existing framed audio plugin may be used.
+  */
+class H323PluginCodecEngine : public PObject
+{
+  PCLASSINFO(H323PluginCodecEngine, PObject);
+  public:
+    H323PluginCodecEngine(
+      unsigned threads,           ///< Number of worker threads
+      unsigned maxBatch = 64      ///< Maximum frames taken per batch
+    );
+    ~H323PluginCodecEngine();
+
+    /**Codec channel attached to the engine. One per codec context.
+       A channel has at most one frame outstanding at a time.
+      */
+    class Channel {
+      public:
+        Channel();
+        PBoolean IsAttached() const { return m_worker != P_MAX_INDEX; }
+      protected:
+        PINDEX m_worker;
+        const PluginCodec_Definition * m_codec;
+        PSyncPoint m_done;
+
+        // The outstanding frame
+        void * m_context;
+        const void * m_from;
+        unsigned * m_fromLen;
+        void * m_to;
+        unsigned * m_toLen;
+        unsigned * m_flags;
+        int m_result;
+        Channel * m_next;
+
+      friend class H323PluginCodecEngine;
+    };
+
+    /**Per codec counters.
+      */
+    struct CodecStatistics {
+      CodecStatistics() : channels(0), frames(0), batches(0), cpuTime(0) { }
+      unsigned channels;          ///< Channels currently attached
+      PUInt64  frames;            ///< Frames processed
+      PUInt64  batches;           ///< Batches containing frames of the codec
+      PUInt64  cpuTime;           ///< Microseconds of worker thread CPU time in the codec function
+    };
+    typedef std::map<PString, CodecStatistics> StatisticsMap;
+
+    /**Attach a channel for the codec, pinning it to a worker.
+       Returns FALSE if the engine is stopped or shutting down.
+      */
+    PBoolean Attach(
+      Channel & channel,                      ///< Channel to attach
+      const PluginCodec_Definition * codec    ///< Codec the channel uses
+    );
+
+    /**Detach a channel. Must not be called while a frame is outstanding,
+       the caller serialises this against its own Execute().
+      */
+    void Detach(
+      Channel & channel                       ///< Channel to detach
+    );
+
+    /**Run the codec function for a frame on the channel's worker and wait
+       for it to complete. Returns the codec function result, or 0 if the
+       channel is not attached.
+      */
+    int Execute(
+      Channel & channel,
+      void * context,
+      const void * from,
+      unsigned * fromLen,
+      void * to,
+      unsigned * toLen,
+      unsigned * flags
+    );
+
+    /**Get the counters for each codec, keyed by "source->destination".
+      */
+    StatisticsMap GetStatistics() const;
+
+    /**Get the number of channels attached.
+      */
+    PINDEX GetChannelCount() const;
+
+    /**Get the number of worker threads.
+      */
+    PINDEX GetWorkerCount() const { return m_workers.size(); }
+
+    /**Refuse any more channels. The attached ones keep running until
+       detached, the workers stop when the engine is destroyed.
+      */
+    void Stop();
+
+  protected:
+    struct Worker {
+      Worker() : m_thread(NULL), m_head(NULL), m_tail(NULL), m_channels(0) { }
+      PThread * m_thread;
+      PSyncPoint m_wakeup;
+      Channel * m_head;
+      Channel * m_tail;
+      unsigned m_channels;
+      std::map<const PluginCodec_Definition *, unsigned> m_codecs;
+      std::vector<Channel *> m_batch;
+    };
+
+    PDECLARE_NOTIFIER(PThread, H323PluginCodecEngine, WorkerMain);
+    void ProcessBatch(Worker & worker);
+    static bool CompareCodec(const Channel * a, const Channel * b);
+
+    std::vector<Worker *> m_workers;
+    unsigned m_maxBatch;
+    PBoolean m_shutdown;
+    PBoolean m_stopped;
+    mutable PMutex m_mutex;
+    std::map<const PluginCodec_Definition *, CodecStatistics> m_statistics;
+};
+
+#endif // H323_AUDIO_CODECS
+
 #if (PTLIB_VAR < 2140) || defined(_FACTORY_LOAD)
 static PFactory<PPluginModuleManager>::Worker<H323PluginCodecManager> h323PluginCodecManagerFactory("h323PluginCodecManager", true);
 #endif
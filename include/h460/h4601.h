@@ -54,6 +54,7 @@
 #include <ptlib/pluginmgr.h>
 #include <ptclib/url.h>
 #include <map>
+#include <vector>
 #include "ptlib_extras.h"
 
 
@@ -549,6 +550,20 @@ inline void DeleteFeatureList(const M & m)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/**Pre-resolved Feature plugin. Resolved once into the endpoint FeatureSet
+   so derived FeatureSets can create features without plugin name lookups.
+  */
+struct H460_FeaturePrototype
+{
+    PString                          name;   ///< Plugin name ie. Std18
+    H460_FeatureID                   id;     ///< Feature Identifier
+    PDevicePluginServiceDescriptor * desc;   ///< Plugin Factory
+};
+
+typedef std::vector<H460_FeaturePrototype> H460_FeaturePrototypes;
+
+///////////////////////////////////////////////////////////////////////////////
+
 /**This is a base class for H.323 Feature handling.
    This implements the service class session management as per H460 Series.
   */
@@ -643,6 +658,11 @@ class H460_Feature : public H225_FeatureDescriptor
       */
       virtual PBoolean FeatureAdvertised(int mtype);
 
+    /** Whether FeatureAdvertised() depends on call state. FeatureSets cache
+        the per message dispatch list unless this returns true.
+      */
+      virtual PBoolean FeatureAdvertisedDynamic() { return false; };
+
     /** Whether Supports Non-Call Supplementary Service
      */
        virtual PBoolean SupportNonCallService() const { return false; };
@@ -769,6 +789,11 @@ class H460_Feature : public H225_FeatureDescriptor
       */
     static PBoolean FeatureList(int type, H460FeatureList & plist, H323EndPoint * ep, PPluginManager * pluginMgr = NULL);
 
+    /** Resolve every Feature plugin to its identifier and factory. Used to build
+        the endpoint prototype table so per call FeatureSets avoid the plugin manager.
+      */
+    static PBoolean FeaturePrototypes(H460_FeaturePrototypes & plist, PPluginManager * pluginMgr = NULL);
+
     /** Attach the endpoint. Override this to link your own Endpoint Instance.
       */
     virtual void AttachEndPoint(H323EndPoint * _ep);
@@ -1100,6 +1125,15 @@ class H460_FeatureSet : public PObject
       */
     virtual PBoolean LoadFeature(const PString & featid);
 
+    /** Build the Feature prototype table. This is done once in the endpoint
+        FeatureSet at startup and shared read only by all derived FeatureSets.
+      */
+    void BuildPrototypes();
+
+    /** Get the Feature prototype table (from the base FeatureSet if derived)
+      */
+    const H460_FeaturePrototypes & GetPrototypes() const;
+
     /** Add a Feature to the Feature Set
     */
     PBoolean AddFeature(H460_Feature * Nfeat);
@@ -1163,10 +1197,23 @@ class H460_FeatureSet : public PObject
 
    PString PTracePDU(PINDEX id) const;
 
+   typedef std::vector<H460_Feature *> H460_FeatureDispatch;
+   typedef std::map<unsigned, H460_FeatureDispatch> H460_FeatureDispatchMap;
+
+   /** Get the features taking part in a message. List is cached until the FeatureSet changes.
+     */
+   H460_FeatureDispatch GetDispatchList(unsigned MessageID, PBoolean advertise);
+   void InvalidateDispatch();
+
    H460_Features  Features;
    H323EndPoint * ep;
    H460_FeatureSet * baseSet;
 
+   H460_FeaturePrototypes  m_prototypes;
+   H460_FeatureDispatchMap m_advertiseDispatch;
+   H460_FeatureDispatchMap m_genericDispatch;
+   PMutex                  m_dispatchMutex;
+
 };
 
 /////////////////////////////////////////////////////////////////////
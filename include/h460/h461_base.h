@@ -76,6 +76,7 @@ public:
     static PStringArray GetIdentifier();
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureAdvertisedDynamic() { return true; }  // Depends on the call H.461 mode
     virtual PBoolean CommonFeature();  // Remove this feature if required.
 
     // Messages
@@ -628,6 +628,14 @@ class OpalMediaFormat : public PCaselessString
       const OpalMediaFormat & mediaFormat  ///<  Media format to copy to master list
     );
 
+    /**Discard the index used to look up registered media formats by name.
+       Must be called after unregistering a media format from the factory
+       directly, the index is rebuilt on the next lookup. Waits for lookups
+       still using the old index, so the unregistered format may be deleted
+       once this returns.
+      */
+    static void RegistryChanged();
+
     /**
       * Add a new option to this media format
       */
@@ -640,8 +648,7 @@ class OpalMediaFormat : public PCaselessString
     /**
       * Remove all options
       */
-    void RemoveAllOptions()
-    { options.RemoveAll(); }
+    void RemoveAllOptions();
 
     /**
       * Determine if media format has the specified option.
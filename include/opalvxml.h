@@ -62,8 +62,18 @@ class G7231_File_Codec : public H323AudioCodec
 
     unsigned GetAverageSignalLevel();
 
+    /**Send the G.723.1 frames of a raw WAV file from the OpalPromptCache
+       in place of the raw data channel.
+      */
+    PBoolean AttachPrompt(const PFilePath & name, PINDEX repeat = 1);
+
   protected:
     int lastFrameLen;
+
+    OpalPromptFrames prompt;
+    PINDEX           promptFrame;
+    PINDEX           promptRepeat;
+    PAdaptiveDelay   promptDelay;
 };
 
 
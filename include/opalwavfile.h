@@ -34,6 +34,10 @@
 
 
 #include <ptclib/pwavfile.h>
+#include <map>
+#include <vector>
+
+class H323FramedAudioCodec;
 
 /**This class is similar to the PWavFile class found in the PWlib
    components library. However, it will tranparently convert all data
@@ -98,6 +102,184 @@ class OpalWAVFile : public PWAVFile
     );
 };
 
+
+/**A prompt split into the encoded frames sent by a codec. The frame data
+   is shared read only between copies, a frame of zero length is silence.
+  */
+class OpalPromptFrames : public PObject
+{
+  PCLASSINFO(OpalPromptFrames, PObject);
+  public:
+    OpalPromptFrames();
+
+    /**Get the number of frames.
+      */
+    PINDEX GetCount() const { return (PINDEX)ends.size(); }
+
+    /**Get a frame and its length.
+      */
+    const BYTE * GetFrame(
+      PINDEX index,             ///<  Frame number, less than GetCount()
+      PINDEX & length           ///<  Length of the frame
+    ) const;
+
+    /**Add a frame to the end.
+      */
+    void Append(
+      const BYTE * frame,       ///<  Encoded frame
+      PINDEX length             ///<  Length of the frame
+    );
+
+    /**Get the total bytes of all the frames.
+      */
+    PINDEX GetSize() const { return size; }
+
+  protected:
+    PBYTEArray          data;
+    std::vector<PINDEX> ends;
+    PINDEX              size;
+};
+
+
+/**Process wide cache of announcement audio. Each WAV file is read, and
+   converted to PCM if required, the first time it is played and the data
+   is then shared read only by every call playing it, each through its own
+   OpalPromptChannel, so hundreds of callers hearing the same greeting do
+   not each read and convert the file. A file is loaded again if its size
+   or modification time changes.
+
+   The frames each codec sends are cached too, per media format and frame
+   size, so a codec playing a prompt with H323AudioCodec::AttachPrompt()
+   does not encode it again for every call.
+  */
+class OpalPromptCache : public PObject
+{
+  PCLASSINFO(OpalPromptCache, PObject);
+  public:
+    /**Get the process wide prompt cache.
+      */
+    static OpalPromptCache & GetInstance();
+
+    /**Get the audio of a WAV file, loading it on first use. If raw is
+       FALSE the file must be 16 bit mono PCM, otherwise it is left in the
+       file's own format, e.g. G.723.1 frames for G7231_File_Codec.
+       The array shares the cached data and must not be modified.
+
+       Returns FALSE if the file could not be read.
+      */
+    PBoolean GetPrompt(
+      const PFilePath & name,   ///<  WAV file to play
+      PBYTEArray & data,        ///<  Shared reference to the audio data
+      PBoolean raw = FALSE,     ///<  Keep the file's own format
+      unsigned * sampleRate = NULL ///<  Sample rate of PCM audio
+    );
+
+    /**Get a prompt encoded a frame at a time for the encoder's media
+       format and frame size, encoding it on first use. The encoding is
+       done by a codec of its own, the encoder is not used or changed.
+
+       Returns FALSE if the file could not be read or encoded, or is not
+       PCM at the sample rate of the media format.
+      */
+    PBoolean GetEncodedPrompt(
+      const PFilePath & name,   ///<  WAV file to play
+      const H323FramedAudioCodec & encoder, ///<  Codec sending the prompt
+      OpalPromptFrames & frames ///<  Encoded frames
+    );
+
+    /**Get the frames stored for a format by SetFrames(), if they were made
+       from the same audio data as last returned by GetPrompt().
+      */
+    PBoolean GetFrames(
+      const PFilePath & name,   ///<  WAV file to play
+      const PString & format,   ///<  Format of the frames
+      const PBYTEArray & source,///<  Audio data the frames are made from
+      OpalPromptFrames & frames ///<  Cached frames
+    );
+
+    /**Store the frames made for a format from the audio data of a prompt.
+      */
+    void SetFrames(
+      const PFilePath & name,   ///<  WAV file to play
+      const PString & format,   ///<  Format of the frames
+      const PBYTEArray & source,///<  Audio data the frames are made from
+      const OpalPromptFrames & frames ///<  Frames to cache
+    );
+
+    /**Drop a file from the cache. Calls already playing it are unaffected.
+      */
+    void Remove(
+      const PFilePath & name    ///<  WAV file to drop
+    );
+
+    /**Drop every file from the cache.
+      */
+    void RemoveAll();
+
+    /**Get the number of bytes of audio held in the cache.
+      */
+    PINDEX GetMemoryUsed() const;
+
+  protected:
+    struct Entry {
+      PBYTEArray data;
+      PTime      modified;
+      PInt64     size;
+      unsigned   sampleRate;
+    };
+    typedef std::map<PString, Entry> EntryMap;
+
+    struct FrameEntry {
+      PBYTEArray       source;
+      OpalPromptFrames frames;
+    };
+    typedef std::map<PString, FrameEntry> FrameMap;
+
+    PBoolean Load(const PFilePath & name, PBoolean raw, PBYTEArray & data, unsigned & sampleRate);
+
+    EntryMap      entries;
+    FrameMap      frameEntries;
+    mutable PMutex mutex;
+};
+
+
+/**Read only channel playing a prompt from the OpalPromptCache, suitable as
+   the raw data channel of an audio codec. The last read of the prompt may
+   be short, the following read fails as end of file.
+  */
+class OpalPromptChannel : public PChannel
+{
+  PCLASSINFO(OpalPromptChannel, PChannel);
+  public:
+    OpalPromptChannel();
+
+    /**Play data already taken from the cache.
+      */
+    OpalPromptChannel(
+      const PBYTEArray & data,  ///<  Prompt audio
+      PINDEX repeat = 1         ///<  Number of times to play the prompt
+    );
+
+    /**Play a WAV file through the prompt cache.
+      */
+    PBoolean Open(
+      const PFilePath & name,   ///<  WAV file to play
+      PBoolean raw = FALSE,     ///<  Keep the file's own format
+      PINDEX repeat = 1         ///<  Number of times to play the prompt
+    );
+
+    virtual PBoolean IsOpen() const;
+    virtual PBoolean Read(void * buf, PINDEX len);
+    virtual PBoolean Write(const void * buf, PINDEX len);
+    virtual PBoolean Close();
+
+  protected:
+    PBYTEArray data;
+    PINDEX     position;
+    PINDEX     repeat;
+    PBoolean   open;
+};
+
 #endif // __OPALWAVFILE_H
 
 
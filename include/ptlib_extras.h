@@ -46,6 +46,8 @@
 #include <ptclib/delaychan.h>
 #include <algorithm>
 #include <queue>
+#include <list>
+#include <vector>
 #include <limits>
 
 #include <ptclib/pnat.h>
@@ -747,32 +749,102 @@ template <class D> class PSTLList : public PObject,
 
 #ifdef H323_FRAMEBUFFER
 
-class H323FRAME {
+class H323_FrameBuffer;
+
+/**Shared render clock for video frame buffers.
+   A single thread keeps the time each running H323_FrameBuffer is next due
+   and queues the buffer when it is, instead of every stream polling on its
+   own. The due buffers are decoded and rendered by a small pool of workers,
+   at most MaxWorkers however many streams there are. The clock itself never
+   calls into the codecs. Created on first use.
+  */
+class H323_FrameClock : public PObject
+{
+    PCLASSINFO(H323_FrameClock, PObject);
+
 public:
-   
-     struct Info {
-        unsigned  m_sequence;
-        unsigned  m_timeStamp;
-        PBoolean  m_marker;
-        PInt64    m_receiveTime;
-     };
+    enum {
+        MaxWorkers = 4                    // Render threads shared by all streams
+    };
 
-     int operator() ( const std::pair<H323FRAME::Info, PBYTEArray>& p1,
-                      const std::pair<H323FRAME::Info, PBYTEArray>& p2 ) {
-           return (p1.first.m_sequence > p2.first.m_sequence);
-     }
-};
+    static H323_FrameClock & Instance()
+    {
+        static H323_FrameClock clock;
+        return clock;
+    }
 
-typedef std::priority_queue< std::pair<H323FRAME::Info, PBYTEArray >, 
-        std::vector< std::pair<H323FRAME::Info, PBYTEArray> >,H323FRAME > RTP_Sortedframes;
+    void Attach(H323_FrameBuffer * buffer);
 
+    /// When this returns the buffer is no longer queued or being rendered
+    void Detach(H323_FrameBuffer * buffer);
+
+protected:
+    H323_FrameClock()
+    : m_work(0, INT_MAX), m_thread(NULL), m_exit(false)
+    {}
 
-class H323_FrameBuffer : public PThread
+    ~H323_FrameClock()
+    {
+        if (m_thread == NULL)
+            return;
+        m_exit = true;
+        m_wakeup.Signal();
+        m_thread->WaitForTermination();
+        delete m_thread;
+        for (size_t i = 0; i < m_workers.size(); ++i)
+            m_work.Signal();
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i]->WaitForTermination();
+            delete m_workers[i];
+        }
+    }
+
+    PDECLARE_NOTIFIER(PThread, H323_FrameClock, ClockMain);
+    PDECLARE_NOTIFIER(PThread, H323_FrameClock, WorkerMain);
+
+    PMutex m_mutex;
+    std::list<H323_FrameBuffer *> m_buffers;
+    std::list<H323_FrameBuffer *> m_due;      // Waiting for a worker
+    std::vector<PThread *> m_workers;
+    PSemaphore m_work;                        // Counts m_due
+    PSyncPoint m_wakeup;
+    PSyncPoint m_serviced;
+    PThread * m_thread;
+    PBoolean  m_exit;
+};
+
+
+/**Video reassembly buffer.
+   Packets are copied once into a pool of buffers indexed by sequence
+   number, and handed to FrameOut() in sequence order straight from the
+   pool by a worker of the shared render clock when the frame is due.
+  */
+class H323_FrameBuffer : public PObject
 {
-    PCLASSINFO(H323_FrameBuffer, PThread);
+    PCLASSINFO(H323_FrameBuffer, PObject);
 
 protected:
-    RTP_Sortedframes  m_buffer;
+    enum {
+        NumSlots = 1024                   // Power of 2 dividing the sequence number range
+    };
+
+    enum SlotState {
+        SlotEmpty,
+        SlotFilled,
+        SlotRendering
+    };
+
+    struct Slot {
+        PBYTEArray * m_packet;            // Pooled, allocated on first use
+        PINDEX    m_length;
+        unsigned  m_sequence;
+        unsigned  m_timeStamp;
+        PBoolean  m_marker;
+        PInt64    m_receiveTime;
+        SlotState m_state;
+    };
+
+    Slot *   m_slots;
     PBoolean m_threadRunning;
 
     unsigned m_frameMarker;           // Number of complete frames;
@@ -787,33 +859,71 @@ protected:
     float    m_lossThreshold;         // Percentage loss
     float    m_lossCount;             // Actual Packet lost
     float    m_frameCount;            // Number of Frames Received from last Fast Picture Update
-    unsigned m_lastSequence;          // Last Received Sequence Number
+    PBoolean m_playing;               // m_nextSequence is valid
+    unsigned m_nextSequence;          // Next sequence number to render
+    unsigned m_lastSequence;          // Highest sequence number received
     PInt64   m_RenderTimeStamp;       // local realTime to render.
+    PBoolean m_fup;                   // Fast picture update needed
 
     PMutex bufferMutex;
-    PAdaptiveDelay m_outputDelay;
-    PBoolean  m_exit;
+    Slot * m_render[NumSlots];        // Slots of the frame being rendered
+
+    PInt64     m_due;                 // Guarded by the clock's mutex, -1 while queued or rendering
+    PBoolean   m_servicing;           // Guarded by the clock's mutex, a worker is in Service()
+
+    static PBoolean SequenceBefore(unsigned a, unsigned b)
+    {
+        return (short)(WORD)(a - b) < 0;
+    }
 
 public:
     H323_FrameBuffer()
-    : PThread(10000, NoAutoDeleteThread, HighestPriority, "FrameBuffer"), m_threadRunning(false),
+    : m_slots(NULL), m_threadRunning(false),
       m_frameMarker(0), m_frameOutput(false), m_frameStartTime(0), 
       m_StartTimeStamp(0), m_calcClockRate(90),
       m_packetReceived(0), m_oddTimeCount(0), m_lateThreshold(5.0), m_increaseBuffer(false),
       m_lossThreshold(1.0), m_lossCount(0), m_frameCount(0), 
-      m_lastSequence(0), m_RenderTimeStamp(0), m_exit(false)
+      m_playing(false), m_nextSequence(0), m_lastSequence(0), m_RenderTimeStamp(0), m_fup(false),
+      m_due(0), m_servicing(false)
     {}
 
     ~H323_FrameBuffer()
     { 
-        if (m_threadRunning)
-            m_exit = true;  
+        Stop();
     }
 
     void Start()
     {
+        if (m_threadRunning)
+            return;
+
+        m_slots = new Slot[NumSlots];
+        for (PINDEX i = 0; i < NumSlots; ++i) {
+            m_slots[i].m_packet = NULL;
+            m_slots[i].m_length = 0;
+            m_slots[i].m_state = SlotEmpty;
+        }
+
         m_threadRunning=true;
-        Resume();
+        H323_FrameClock::Instance().Attach(this);
+    }
+
+    /**Stop rendering. Derived classes must call this in their destructor
+       so FrameOut() is not called on a partly destroyed object.
+      */
+    void Stop()
+    {
+        if (!m_threadRunning)
+            return;
+
+        H323_FrameClock::Instance().Detach(this);
+        m_threadRunning = false;
+
+        PWaitAndSignal m(bufferMutex);
+        for (PINDEX i = 0; i < NumSlots; ++i)
+            delete m_slots[i].m_packet;
+        delete [] m_slots;
+        m_slots = NULL;
     }
 
 	PBoolean IsRunning() 
@@ -821,132 +931,157 @@ public:
 		return m_threadRunning;
 	}
 
-    virtual void FrameOut(PBYTEArray & /*frame*/, PInt64 /*receiveTime*/, unsigned /*clock*/, PBoolean /*fup*/, PBoolean /*flow*/) {};
+    /**Create a pooled packet buffer. Called once per slot.
+      */
+    virtual PBYTEArray * CreatePacket() { return new PBYTEArray(); }
 
-    void Main() {
+    /**Render a packet. frame is the pooled buffer, valid only for the call,
+       and may be larger than the length bytes of the packet in it.
+       Called from a worker of the shared render clock.
 
-        PBYTEArray frame;
-        PTimeInterval lastMarker;
-        int delay=0;
-        PBoolean fup=false;
+       This replaces FrameOut(frame, receiveTime, clock, fup, flow) without
+       the length, which derived classes must change to, as an override of
+       the old signature is no longer called.
+      */
+    virtual void FrameOut(PBYTEArray & /*frame*/, PINDEX /*length*/, PInt64 /*receiveTime*/, unsigned /*clock*/, PBoolean /*fup*/, PBoolean /*flow*/) {};
 
-        while (!m_exit) {
-            while (m_frameOutput && m_frameMarker > 0) {
-                if (m_buffer.empty()) {
-                    if (m_frameMarker > 0)
-                        m_frameMarker--;
+    /**Render the next frame if it is due. Called from a render worker.
+       Returns the time the next frame is due.
+      */
+    PInt64 Service(PInt64 now)
+    {
+        PINDEX count = 0;
+        PBoolean marker = false;
+        unsigned lastTimeStamp = 0;
+        PBoolean fup;
+        unsigned clock;
+
+        {
+            PWaitAndSignal m(bufferMutex);
+
+            if (!m_frameOutput || m_frameMarker == 0)
+                return now + 5;
+
+            // fixed local render clock
+            if (m_RenderTimeStamp == 0)
+                m_RenderTimeStamp = now;
+            if (now < m_RenderTimeStamp)
+                return m_RenderTimeStamp;
+
+            // Take the packets up to the next marker, counting the gaps as lost
+            while (m_nextSequence != (WORD)(m_lastSequence + 1)) {
+                Slot & slot = m_slots[m_nextSequence & (NumSlots-1)];
+                m_nextSequence = (WORD)(m_nextSequence + 1);
+
+                if (slot.m_state != SlotFilled || slot.m_sequence != (WORD)(m_nextSequence - 1)) {
+                    PTRACE(5,"RTPBUF\tDetected loss of packet " << (WORD)(m_nextSequence - 1));
+                    m_lossCount++;
+                    continue;
+                }
+
+                slot.m_state = SlotRendering;
+                m_render[count++] = &slot;
+                lastTimeStamp = slot.m_timeStamp;
+                if (slot.m_marker) {
+                    marker = true;
                     break;
                 }
+            }
 
-                // fixed local render clock
-                if (m_RenderTimeStamp == 0)
-                    m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
-
-                PBoolean flow = false;
-
-                H323FRAME::Info info;
-                  bufferMutex.Wait();
-                    info = m_buffer.top().first;
-                    frame.SetSize(m_buffer.top().second.GetSize());
-                    memcpy(frame.GetPointer(), m_buffer.top().second, m_buffer.top().second.GetSize());
-                    unsigned lastTimeStamp = info.m_timeStamp;
-                    m_buffer.pop();
-                    if (info.m_marker && !m_buffer.empty()) { // Peek ahead for next timestamp
-                        delay = (m_buffer.top().first.m_timeStamp - lastTimeStamp)/(unsigned)m_calcClockRate;
-                        if (delay <= 0 || delay > 200 || (lastTimeStamp > m_buffer.top().first.m_timeStamp)) {
-                           delay = 0;
-                           m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
-                           fup = true;
-                        } 
-                    }
-                  bufferMutex.Signal();
-
-                  if (m_exit)
-                      break;
-
-                  m_frameCount++;
-                  if (m_lastSequence) {
-                     unsigned diff = info.m_sequence - m_lastSequence - 1;
-                     if (diff > 0) {
-                         PTRACE(5,"RTPBUF\tDetected loss of " << diff << " packets."); 
-                         m_lossCount = m_lossCount + diff;
-                     }
-                  }
-                  m_lastSequence = info.m_sequence;
+            if (marker)
+                m_frameMarker--;
+            else
+                m_frameMarker = 0;
 
-                  if (!fup) 
-                      fup = ((m_lossCount/m_frameCount)*100.0 > m_lossThreshold);
+            m_frameCount++;
+            if (!m_fup) 
+                m_fup = ((m_lossCount/m_frameCount)*100.0 > m_lossThreshold);
 
-                  FrameOut(frame, info.m_receiveTime, (unsigned)m_calcClockRate, fup, flow);
-                  frame.SetSize(0);
-                  if (fup) {
-                     m_lossCount = m_frameCount = 0;
-                     fup = false;
-                  }
+            // The update request goes out with the first packet rendered
+            fup = m_fup && count > 0;
+            if (fup) {
+                m_lossCount = m_frameCount = 0;
+                m_fup = false;
+            }
+            clock = (unsigned)m_calcClockRate;
+        }
 
-                  if (info.m_marker && m_frameMarker > 0) {
-                        if (m_increaseBuffer) {
-                            delay = delay*2;
-                            m_increaseBuffer=false;
-                        }
-                      m_RenderTimeStamp+=delay;
-                      PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-                      unsigned ldelay = (unsigned)((m_RenderTimeStamp > nowTime)? m_RenderTimeStamp - nowTime : 0);
-                      if (ldelay > 200 || m_frameMarker > 5) ldelay = 0;
-                      if (!ldelay)  m_RenderTimeStamp = nowTime;
-                      m_frameMarker--;
-                      m_outputDelay.Delay(ldelay);
-                  } else 
-                      PThread::Sleep(2);
+        PBoolean flow = false;
+        for (PINDEX i = 0; i < count; ++i) {
+            Slot & slot = *m_render[i];
+            FrameOut(*slot.m_packet, slot.m_length, slot.m_receiveTime, clock, fup, flow);
+            fup = false;
+        }
+
+        PWaitAndSignal m(bufferMutex);
+
+        for (PINDEX i = 0; i < count; ++i)
+            m_render[i]->m_state = SlotEmpty;
+
+        if (!marker)
+            return now + 5;
+
+        // Peek ahead for next timestamp
+        int delay = 0;
+        Slot & next = m_slots[m_nextSequence & (NumSlots-1)];
+        if (next.m_state == SlotFilled && next.m_sequence == m_nextSequence) {
+            delay = (int)(next.m_timeStamp - lastTimeStamp)/(int)m_calcClockRate;
+            if (delay <= 0 || delay > 200) {
+                delay = 0;
+                m_RenderTimeStamp = now;
+                m_fup = true;
             }
-            PThread::Sleep(5);
         }
-        bufferMutex.Wait();
-        while (!m_buffer.empty()) 
-           m_buffer.pop();
-        bufferMutex.Signal();
 
-        m_threadRunning = false;
+        if (m_increaseBuffer) {
+            delay = delay*2;
+            m_increaseBuffer=false;
+        }
+        m_RenderTimeStamp+=delay;
+
+        PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
+        if (m_RenderTimeStamp + 200 < nowTime || m_RenderTimeStamp > nowTime + 200 || m_frameMarker > 5)
+            m_RenderTimeStamp = nowTime;
+
+        return m_RenderTimeStamp;
     }
 
     virtual PBoolean FrameIn(unsigned seq,  unsigned time, PBoolean marker, unsigned payload, const PBYTEArray & frame)
     {
+        if (!m_threadRunning)
+            return false;
 
-        if (!m_threadRunning) {  // Start thread on first frame.
-            Resume();
-            m_threadRunning = true;
-        }
+        PInt64 now = PTimer::Tick().GetMilliSeconds();
 
-        if (m_exit)
+        PWaitAndSignal m(bufferMutex);
+
+        if (m_slots == NULL)
             return false;
 
-        PInt64 now = PTimer::Tick().GetMilliSeconds();
         // IF we haven't started or the clockrate goes out of bounds.
         if (!m_frameStartTime) {
             m_frameStartTime = time;
-            m_StartTimeStamp = PTimer::Tick().GetMilliSeconds();
+            m_StartTimeStamp = now;
         } else if (marker && m_frameOutput) {
-            m_calcClockRate = (float)(time - m_frameStartTime)/(PTimer::Tick().GetMilliSeconds() - m_StartTimeStamp);
+            m_calcClockRate = (float)(time - m_frameStartTime)/(now - m_StartTimeStamp);
             if (m_calcClockRate > 100 || m_calcClockRate < 40 || (m_calcClockRate == numeric_limits<unsigned int>::infinity( ))) {
                 PTRACE(4,"RTPBUF\tErroneous ClockRate: Resetting...");
                 m_calcClockRate = 90;
                 m_frameStartTime = time;
-                m_StartTimeStamp = PTimer::Tick().GetMilliSeconds();
+                m_StartTimeStamp = now;
             }
         }
-            
-        H323FRAME::Info info;
-           info.m_sequence = seq;
-           info.m_marker = marker;
-           info.m_timeStamp = time;
-           info.m_receiveTime = now;
-
-        PBYTEArray * m_frame = new PBYTEArray(payload+12);
-        memcpy(m_frame->GetPointer(),(PRemoveConst(PBYTEArray,&frame))->GetPointer(),payload+12);
 
-        bufferMutex.Wait();
+        seq = (WORD)seq;
         m_packetReceived++;
-        if (m_frameOutput && !m_buffer.empty() && info.m_sequence < m_buffer.top().first.m_sequence) {
+
+        if (!m_playing) {
+            m_playing = true;
+            m_nextSequence = seq;
+            m_lastSequence = seq;
+        }
+        else if (SequenceBefore(seq, m_nextSequence)) {
+            // Its frame has already been rendered
             m_oddTimeCount++;
             PTRACE(6,"RTPBUF\tLate Packet Received " << (m_oddTimeCount/m_packetReceived)*100.0 << "%");
             if ((m_oddTimeCount/m_packetReceived)*100.0 > m_lateThreshold) {
@@ -955,10 +1090,38 @@ public:
                 m_packetReceived=0;
                 m_oddTimeCount=0;
             }
+            return true;
+        }
+        else if ((WORD)(seq - m_nextSequence) >= NumSlots) {
+            PTRACE(4,"RTPBUF\tSequence jump to " << seq << ", restarting");
+            m_nextSequence = seq;
+            m_lastSequence = seq;
+            m_frameMarker = 0;
+        }
+
+        Slot & slot = m_slots[seq & (NumSlots-1)];
+        if (slot.m_state == SlotRendering) {
+            PTRACE(4,"RTPBUF\tBuffer overrun, dropping packet " << seq);
+            return true;
         }
-        m_buffer.push(pair<H323FRAME::Info, PBYTEArray>(info,*m_frame));
-        delete m_frame;
-        bufferMutex.Signal();
+
+        if (slot.m_packet == NULL)
+            slot.m_packet = CreatePacket();
+
+        PINDEX length = payload+12;
+        if (slot.m_packet->GetSize() < length)
+            slot.m_packet->SetSize(length);
+        memcpy(slot.m_packet->GetPointer(), (const BYTE *)frame, length);
+
+        slot.m_length = length;
+        slot.m_sequence = seq;
+        slot.m_timeStamp = time;
+        slot.m_marker = marker;
+        slot.m_receiveTime = now;
+        slot.m_state = SlotFilled;
+
+        if (SequenceBefore(m_lastSequence, seq))
+            m_lastSequence = seq;
 
         if (marker) {
            m_frameMarker++;
@@ -969,8 +1132,108 @@ public:
 
         return true;
     }
+
+    friend class H323_FrameClock;
 };
 
+
+inline void H323_FrameClock::Attach(H323_FrameBuffer * buffer)
+{
+    PWaitAndSignal m(m_mutex);
+
+    buffer->m_due = PTimer::Tick().GetMilliSeconds();
+    buffer->m_servicing = false;
+    m_buffers.push_back(buffer);
+    if (m_thread == NULL)
+        m_thread = PThread::Create(PCREATE_NOTIFIER(ClockMain), 0,
+                                   PThread::NoAutoDeleteThread,
+                                   PThread::HighestPriority,
+                                   "FrameClock");
+
+    // One worker per stream up to the limit
+    if (m_workers.size() < m_buffers.size() && m_workers.size() < MaxWorkers)
+        m_workers.push_back(PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0,
+                                            PThread::NoAutoDeleteThread,
+                                            PThread::HighPriority,
+                                            "FrameRender:%x"));
+    m_wakeup.Signal();
+}
+
+inline void H323_FrameClock::Detach(H323_FrameBuffer * buffer)
+{
+    PWaitAndSignal m(m_mutex);
+
+    m_buffers.remove(buffer);
+    m_due.remove(buffer);
+
+    // FrameOut() may not be called on the buffer once this returns
+    while (buffer->m_servicing) {
+        m_mutex.Signal();
+        m_serviced.Wait(10);
+        m_mutex.Wait();
+    }
+}
+
+inline void H323_FrameClock::ClockMain(PThread &, H323_INT)
+{
+    while (!m_exit) {
+        PInt64 now = PTimer::Tick().GetMilliSeconds();
+        PInt64 next = now + 100;
+
+        // A queued buffer is not due again until a worker has serviced
+        // it and rescheduled, however long that takes
+        m_mutex.Wait();
+        for (std::list<H323_FrameBuffer *>::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
+            H323_FrameBuffer & buffer = **i;
+            if (buffer.m_due < 0)
+                continue;
+            if (buffer.m_due <= now) {
+                buffer.m_due = -1;
+                m_due.push_back(&buffer);
+                m_work.Signal();
+            }
+            else if (buffer.m_due < next)
+                next = buffer.m_due;
+        }
+        m_mutex.Signal();
+
+        PInt64 delay = next - PTimer::Tick().GetMilliSeconds();
+        if (delay > 0)
+            m_wakeup.Wait(PTimeInterval(delay));
+    }
+}
+
+inline void H323_FrameClock::WorkerMain(PThread &, H323_INT)
+{
+    for (;;) {
+        m_work.Wait();
+        if (m_exit)
+            break;
+
+        H323_FrameBuffer * buffer;
+        {
+            PWaitAndSignal m(m_mutex);
+            // Detached while queued
+            if (m_due.empty())
+                continue;
+            buffer = m_due.front();
+            m_due.pop_front();
+            buffer->m_servicing = true;
+        }
+
+        // decoding and rendering holds no lock the other streams need
+        PInt64 due = buffer->Service(PTimer::Tick().GetMilliSeconds());
+
+        {
+            PWaitAndSignal m(m_mutex);
+            buffer->m_servicing = false;
+            buffer->m_due = due;
+        }
+        m_serviced.Signal();
+        m_wakeup.Signal();
+    }
+}
+
 #endif  // H323_FRAMEBUFFER
 
 #if PTLIB_VER < 2130
@@ -84,11 +84,11 @@ protected:
 	
 private:
 
-  inline PBoolean FindFlagEnd(const BYTE *buffer, PINDEX bufferSize, PINDEX & octetIndex, BYTE & bitIndex);
-  inline BYTE DecodeByte(const BYTE *buffer, BYTE *destination, PINDEX & octetIndex, BYTE & bitIndex, BYTE & onesCounter);
-  inline BYTE DecodeBit(const BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex);
+  inline PBoolean FindFlagEnd(const BYTE *buffer, PINDEX bufferSize, PINDEX & bitPosition) const;
+  static inline BYTE GetOctet(const BYTE *buffer, PINDEX bufferSize, PINDEX bitPosition);
 	
-  inline void EncodeOctet(BYTE octet, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex, BYTE & onesCounter) const;
+  inline void EncodeOctet(BYTE octet, BYTE *buffer, PINDEX & octetIndex, DWORD & bitBuffer, BYTE & bitCount, BYTE & onesCounter) const;
+  inline void EncodeBits(WORD bits, BYTE count, BYTE *buffer, PINDEX & octetIndex, DWORD & bitBuffer, BYTE & bitCount) const;
   inline void EncodeOctetNoEscape(BYTE octet, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex) const;
   inline void EncodeBit(BYTE bit, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex) const;
 	
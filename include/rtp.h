@@ -344,6 +344,7 @@ class RTP_MultiControlFrame : public PBYTEArray
  */
 class RTP_UDP;
 class RTP_UserData;
+class RTP_PacketTap;
 class RTP_Session : public PObject
 {
   PCLASSINFO(RTP_Session, PObject);
@@ -567,6 +568,19 @@ class RTP_Session : public PObject
       RTP_UserData * data   ///<  New user data to be used
     );
 
+    /**Get the tap receiving a copy of each data packet.
+      */
+    RTP_PacketTap * GetPacketTap() const { return packetTap; }
+
+    /**Set a tap to receive a copy of every data packet sent and received,
+       eg for call recording. NULL removes the tap. Once this returns the
+       previous tap is no longer being called. The tap is detached when the
+       session is destroyed.
+      */
+    void SetPacketTap(
+      RTP_PacketTap * tap   ///<  New packet tap
+    );
+
     /**Get the source output identifier.
       */
     DWORD GetSyncSourceOut() const { return syncSourceOut; }
@@ -746,6 +760,8 @@ class RTP_Session : public PObject
     PString            toolName;
     unsigned           referenceCount;
     RTP_UserData     * userData;
+    RTP_PacketTap    * packetTap;
+    PMutex             packetTapMutex;  // Held while the tap is called
 
 #ifdef H323_AUDIO_CODECS
     RTP_JitterBuffer * jitter;
@@ -867,6 +883,44 @@ class RTP_UserData : public PObject
 };
 
 
+/**This class receives a copy of every data packet sent and received by the
+   RTP session it is attached to with RTP_Session::SetPacketTap(). It is
+   called from the media threads, so must not block. A tap is attached to
+   one session at a time.
+  */
+class RTP_PacketTap : public PObject
+{
+  PCLASSINFO(RTP_PacketTap, PObject);
+
+  public:
+    RTP_PacketTap() : tapSession(NULL) { }
+
+    /**Stop receiving the packets of the session the tap is attached to, if
+       it still exists. Once this returns the tap is no longer being called
+       and may be deleted.
+      */
+    void Detach();
+
+    /**Indicate the tap is attached to a session that still exists.
+      */
+    PBoolean IsAttached() const { return tapSession != NULL; }
+
+    /**Called with each data packet, after the sequence number and sync
+       source of a packet being sent have been set.
+      */
+    virtual void OnTapPacket(
+      const RTP_Session & session,  ///<  Session of the packet
+      const RTP_DataFrame & frame,  ///<  Complete RTP packet
+      PBoolean transmit             ///<  Packet is being sent, not received
+    ) = 0;
+
+  protected:
+    RTP_Session * tapSession;
+
+  friend class RTP_Session;
+};
+
+
 
 /**This class is for encapsulating the IETF Real Time Protocol interface.
  */
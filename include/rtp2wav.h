@@ -37,6 +37,8 @@
 #include <ptclib/pwavfile.h>
 #include "rtp.h"
 
+#include <vector>
+
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -66,6 +68,133 @@ class OpalRtpToWavFile : public PWAVFile
 };
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+/**This class records every RTP session of a call, both directions, to a
+   single pcap-ng file. Packets are copied by the media threads into a fixed
+   lock free queue per session and direction, and a single background
+   thread shared by all recorders writes them out in large blocks, so the
+   media threads never wait on the disk. If the writer falls behind the
+   queue overflows and the packets are dropped and counted rather than
+   delaying the media.
+
+   Each packet is written as a raw IPv4 UDP datagram from 127.0.0.1 to
+   127.0.0.2, or the reverse for received packets, on port 5000 plus twice
+   the session ID, so it can be examined with the usual capture tools.
+   ExportWAV() mixes the G.711 audio of a recording into a WAV file.
+
+   A session may be released before the recorder is closed, its tap is
+   detached as the session is destroyed.
+  */
+class OpalRtpRecorder : public PObject
+{
+    PCLASSINFO(OpalRtpRecorder, PObject);
+  public:
+    enum {
+      DefaultSlots = 64,      ///< Packets queued per session and direction
+      MaxPacketSize = 1600    ///< Longer packets are truncated
+    };
+
+    OpalRtpRecorder(
+      unsigned slots = DefaultSlots   ///< Queue size, rounded up to a power of 2
+    );
+    ~OpalRtpRecorder();
+
+    /**Create the recording file.
+      */
+    PBoolean Open(
+      const PFilePath & filename
+    );
+
+    /**Indicate the recording file is open.
+      */
+    PBoolean IsOpen() const;
+
+    /**Start recording the packets of a session, in both directions.
+      */
+    PBoolean Attach(
+      RTP_Session & session
+    );
+
+    /**Stop recording all sessions and write out what is left.
+      */
+    void Close();
+
+    /**Get the number of packets recorded.
+      */
+    DWORD GetPacketCount() const;
+
+    /**Get the number of packets dropped as the writer fell behind.
+      */
+    DWORD GetDroppedCount() const;
+
+#ifdef H323_AUDIO_CODECS
+    /**Mix the G.711 packets of one session of a recording, both directions,
+       into a 16 bit 8 kHz WAV file. Packets are placed by the capture time
+       of the first packet in each direction and the RTP timestamps after it.
+      */
+    static PBoolean ExportWAV(
+      const PFilePath & recording,    ///< pcap-ng file written by a recorder
+      const PFilePath & wavFile,      ///< WAV file to create
+      unsigned sessionID = RTP_Session::DefaultAudioSessionID
+    );
+#endif
+
+  protected:
+    class Queue {
+      public:
+        Queue();
+        ~Queue();
+        void SetSize(unsigned slots);
+        void Push(const RTP_DataFrame & frame);   // media thread only
+        PBoolean Pop(PInt64 & time, const BYTE * & data, PINDEX & length, PINDEX & original); // writer only
+        void Release();                           // writer only
+
+        unsigned       interfaceId;
+        unsigned       port;
+        PBoolean       transmit;
+
+        PAtomicInteger m_written;     ///< Packets queued, owned by the media thread
+        PAtomicInteger m_read;        ///< Packets written out, owned by the writer
+        unsigned       m_slots;
+        BYTE         * m_data;
+        PINDEX       * m_lengths;
+        PINDEX       * m_originals;
+        PInt64       * m_times;
+        PAtomicInteger m_dropped;
+      private:
+        Queue(const Queue &) { }
+        void operator=(const Queue &) { }
+    };
+
+    class Tap : public RTP_PacketTap {
+        PCLASSINFO(Tap, RTP_PacketTap);
+      public:
+        Tap(unsigned sessionID, unsigned slots, unsigned firstInterface);
+        virtual void OnTapPacket(const RTP_Session & session, const RTP_DataFrame & frame, PBoolean transmit);
+
+        Queue          queues[2];    ///< Received then sent
+    };
+
+    void Drain(PBoolean flush);
+    void AppendInterface(const Queue & queue, unsigned sessionID);
+    void AppendPacket(const Queue & queue, PInt64 time, const BYTE * data, PINDEX length, PINDEX original);
+    BYTE * AppendBlock(DWORD type, PINDEX bodySize);
+
+    mutable PMutex    mutex;
+    PFile             file;
+    unsigned          slots;
+    std::vector<Tap *> taps;
+    PBYTEArray        pending;
+    PINDEX            pendingSize;
+    PTimeInterval     lastWrite;
+    DWORD             packetCount;
+    DWORD             droppedCount;
+
+  friend class OpalRtpRecorderWriter;
+};
+
+
 #endif // __RTP_RTP2WAV_H
 
 
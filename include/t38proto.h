@@ -41,6 +41,120 @@ class PASN_OctetString;
 
 #include "ptlib_extras.h"
 
+///////////////////////////////////////////////////////////////////////////////
+
+/**This class frames T.38 IFP packets in UDPTL, T.38 clause 9.1.
+   The aligned PER of a UDPTL packet is simple enough to write by hand, so
+   packets are built in a buffer kept from one packet to the next, with the
+   error recovery taken from a fixed ring of the last IFPs sent, and received
+   packets are parsed where they lie without creating any ASN objects. Both
+   redundancy and FEC error recovery are supported.
+  */
+class OpalT38UDPTL : public PObject
+{
+    PCLASSINFO(OpalT38UDPTL, PObject);
+  public:
+    enum {
+      HistorySize = 16,             ///< IFPs kept for error recovery, a power of two
+      MaxEntries = HistorySize - 1  ///< Most earlier IFPs a packet can protect
+    };
+
+    enum ErrorRecovery {
+      e_Redundancy,                 ///< Earlier IFPs repeated as secondary IFPs
+      e_ForwardErrorCorrection      ///< Earlier IFPs protected by XOR parity entries
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create a new UDPTL codec sending with redundancy.
+     */
+    OpalT38UDPTL();
+  //@}
+
+  /**@name Sending */
+  //@{
+    /**Set the error recovery of the packets built by Encode().
+      */
+    void SetErrorRecovery(
+      ErrorRecovery mode,           ///< Redundancy or FEC
+      unsigned span = 3             ///< Packets covered by each FEC entry
+    );
+
+    /**Build the UDPTL packet for the next sequence number around an encoded
+       IFP, protecting the previous packets. The level is the number of
+       later packets that repeat this IFP, or with FEC the number of FEC
+       entries in the later packets, each covering span packets.
+       Returns the packet, valid until the next call, or NULL if the IFP
+       is too large.
+      */
+    const BYTE * Encode(
+      const BYTE * ifp,             ///< PER encoded IFP packet
+      PINDEX size,                  ///< Size of the IFP
+      unsigned level,               ///< Protection of this IFP in later packets
+      PINDEX & length               ///< Length of the UDPTL packet
+    );
+
+    /**Get the sequence number of the last packet built.
+      */
+    unsigned GetSentSequenceNumber() const { return txSequence; }
+  //@}
+
+  /**@name Receiving */
+  //@{
+    /**Parse a received UDPTL packet. The primary IFP and the error recovery
+       point into the packet, which must not change while they are used.
+      */
+    PBoolean Decode(
+      const BYTE * data,            ///< Received packet
+      PINDEX length                 ///< Length of the packet
+    );
+
+    unsigned GetSequenceNumber() const { return rxSequence; }
+    const BYTE * GetPrimary() const { return primary; }
+    PINDEX GetPrimarySize() const { return primarySize; }
+
+    /**Get an IFP lost before the last decoded packet back from the
+       secondary IFPs or FEC entries of the packets received.
+      */
+    PBoolean Recover(
+      unsigned sequence,            ///< Sequence number of the lost packet
+      const BYTE * & ifp,           ///< Recovered IFP
+      PINDEX & size                 ///< Size of the recovered IFP
+    );
+  //@}
+
+  protected:
+    struct Entry {
+      Entry() : sequence(-1), size(0) { }
+      int        sequence;
+      PBYTEArray data;              ///< Grows to the largest IFP and stays
+      PINDEX     size;
+    };
+
+    static void Store(Entry & entry, unsigned sequence, const BYTE * data, PINDEX size);
+    static PINDEX EncodeLength(BYTE * ptr, PINDEX length);
+    static PBoolean DecodeLength(const BYTE * & ptr, const BYTE * end, PINDEX & length);
+
+    ErrorRecovery mode;
+    unsigned      fecSpan;
+
+    Entry         txHistory[HistorySize];
+    unsigned      txSequence;
+    unsigned      txDepth;          ///< Earlier packets the next packet protects
+    PBYTEArray    txPacket;
+
+    Entry         rxHistory[HistorySize];
+    unsigned      rxSequence;
+    const BYTE  * primary;
+    PINDEX        primarySize;
+    ErrorRecovery rxMode;
+    unsigned      rxCount;          ///< Secondary IFPs or FEC entries in the packet
+    unsigned      rxSpan;           ///< Packets covered by each FEC entry
+    const BYTE  * rxEntries[MaxEntries];
+    PINDEX        rxSizes[MaxEntries];
+};
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /**This class handles the processing of the T.38 protocol.
@@ -161,6 +275,14 @@ class OpalT38Protocol : public PObject
     );
   //@}
 
+    /**Set the UDPTL error recovery of sent packets, see OpalT38UDPTL.
+       Safe to call while packets are being sent.
+      */
+    void SetErrorRecovery(
+      OpalT38UDPTL::ErrorRecovery mode,
+      unsigned span = 3
+    );
+
     H323Transport * GetTransport() const { return transport; }
     void SetTransport(
       H323Transport * transport,
@@ -171,6 +293,10 @@ class OpalT38Protocol : public PObject
     PBoolean HandleRawIFP(
       const PASN_OctetString & pdu
     );
+    PBoolean HandleRawIFP(
+      const BYTE * data,
+      PINDEX size
+    );
 
     H323Transport * transport;
     PBoolean            autoDeleteTransport;
@@ -181,7 +307,8 @@ class OpalT38Protocol : public PObject
     unsigned highSpeedRedundancy;
 
     int               lastSentSequenceNumber;
-    H323List<PBYTEArray> redundantIFPs;
+    OpalT38UDPTL      udptl;
+    PMutex            writeMutex;
 };
 
 
@@ -791,6 +791,13 @@ class H323ListenerTCP : public H323Listener
       const PTimeInterval & timeout  ///<  Time to wait for incoming connection
     );
 
+    /**Open a transport on an accepted socket, including any security handshake.
+       The transport takes ownership of the socket. Returns NULL on failure.
+      */
+    H323Transport * OpenTransport(
+      PTCPSocket * socket            ///<  Socket returned by AcceptSocket()
+    );
+
     /**Get the local transport address on which this listener may be accessed.
       */
     virtual H323TransportAddress GetTransportAddress() const;
@@ -824,6 +831,12 @@ class H323ListenerTCP : public H323Listener
      */
     virtual void Main();
 
+    /**Wait for a new incoming socket connection.
+      */
+    PTCPSocket * AcceptSocket(
+      const PTimeInterval & timeout  ///<  Time to wait for incoming connection
+    );
+
 
     PTCPSocket listener;
     PIPSocket::Address localAddress;
@@ -835,6 +848,91 @@ class H323ListenerTCP : public H323Listener
 
 #ifdef H323_TLS
 
+struct ssl_session_st;
+
+/**This class keeps the client TLS sessions keyed by remote address, so
+   reconnecting to the same gatekeeper or endpoint can resume the session
+   instead of doing a full handshake.
+ */
+class H323TLSSessionCache : public PObject
+{
+  PCLASSINFO(H323TLSSessionCache, PObject);
+
+  public:
+    H323TLSSessionCache(
+      PINDEX maxSessions = 256    ///< Maximum number of remote addresses kept
+    );
+
+    ~H323TLSSessionCache();
+
+    /**Set the cached session for the remote address on the SSL object.
+       Returns true if there was a session to resume.
+      */
+    PBoolean Resume(ssl_st * ssl, const H323TransportAddress & remote);
+
+    /**Save the negotiated session of the SSL object for the remote address.
+      */
+    void Save(ssl_st * ssl, const H323TransportAddress & remote);
+
+    /**Remove the session for the remote address (ie the handshake failed).
+      */
+    void Remove(const H323TransportAddress & remote);
+
+    /**Set the maximum number of remote addresses. 0 disables the cache.
+      */
+    void SetMaxSessions(PINDEX maxSessions);
+
+    /**Release all the cached sessions.
+      */
+    void RemoveAll();
+
+  protected:
+    PMutex                              m_mutex;
+    std::map<PString, ssl_session_st *> m_sessions;
+    std::list<PString>                  m_order;        ///< Least recently saved first
+    PINDEX                              m_maxSessions;
+};
+
+
+/**This class runs the TLS accept handshakes of a listener on a bounded set of
+   worker threads, so slow or numerous handshakes do not hold up the listener.
+ */
+class H323TLSHandshakePool : public PObject
+{
+  PCLASSINFO(H323TLSHandshakePool, PObject);
+
+  public:
+    H323TLSHandshakePool(
+      H323EndPoint & endpoint,    ///< Endpoint that owns the listener
+      H323ListenerTCP & listener, ///< Listener the sockets were accepted on
+      PINDEX threads,             ///< Number of handshake threads
+      PINDEX maxQueue             ///< Maximum sockets waiting for a thread
+    );
+
+    ~H323TLSHandshakePool();
+
+    /**Queue an accepted socket for handshake. Returns false if the queue is full.
+      */
+    PBoolean Enqueue(PTCPSocket * socket);
+
+    /**Stop the threads and close any sockets still queued.
+      */
+    void Shutdown();
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, H323TLSHandshakePool, HandshakeMain);
+
+    H323EndPoint &           m_endpoint;
+    H323ListenerTCP &        m_listener;
+    std::list<PTCPSocket *>  m_queue;
+    PINDEX                   m_maxQueue;
+    PList<PThread>           m_threads;
+    PSyncPoint               m_ready;
+    PMutex                   m_mutex;
+    PBoolean                 m_shutdown;
+};
+
+
 /**This class manages H323 connections using TLS transport.
  */
 class H323ListenerTLS : public H323ListenerTCP
@@ -870,6 +968,13 @@ class H323ListenerTLS : public H323ListenerTCP
         Default sets the local address
       */
     virtual void SetTransportAddress(const H323TransportAddress & address);
+
+  protected:
+    /**Accept incoming connections and pass them to the handshake pool.
+     */
+    virtual void Main();
+
+    H323TLSHandshakePool * m_handshakePool;
 };
 
 #endif // H323_TLS
@@ -1014,6 +1119,9 @@ class H323TransportTCP : public H323TransportIP
 
 
     PTCPSocket * h245listener;
+#ifdef H323_TLS
+    PBoolean     m_tlsClient;    ///< We initiated the TLS session and may resume it
+#endif
 };
 
 
@@ -1423,10 +1423,30 @@ static int valid_for_protocol ( const struct PluginCodec_Definition *, void *, c
 
 /////////////////////////////////////////////////////////////////////////////
 
+// libavcodec is loaded by the first encoder or decoder rather than when the
+// plugin is loaded, so an endpoint only pays for it once the codec is used
+static bool LoadFFMPEGLibrary()
+{
+  if (FFMPEGLibraryInstance.IsLoaded())
+    return true;
+
+  if (!FFMPEGLibraryInstance.Load()) {
+    TRACE(1, "H.263\tCodec\tDisabled");
+    return false;
+  }
+
+  FFMPEGLibraryInstance.AvLogSetLevel(AV_LOG_DEBUG);
+  FFMPEGLibraryInstance.AvLogSetCallback(&logCallbackFFMPEG);
+  return true;
+}
+
 static void * create_encoder(const struct PluginCodec_Definition * codec)
 {
   H263_Base_EncoderContext * context;
 
+  if (!LoadFFMPEGLibrary())
+    return NULL;
+
   if (codec->rtpPayload == RTP_RFC2190_PAYLOAD)
     context = new H263_RFC2190_EncoderContext();
   else
@@ -1828,6 +1848,9 @@ static int encoder_get_output_data_size(const PluginCodec_Definition *, void *,
 
 static void * create_decoder(const struct PluginCodec_Definition * codec)
 {
+  if (!LoadFFMPEGLibrary())
+    return NULL;
+
   if (codec->rtpPayload == RTP_RFC2190_PAYLOAD)
     return new H263_RFC2190_DecoderContext();
   else
@@ -2337,20 +2360,16 @@ extern "C" {
       Trace::SetLevelUserPlane(0);
     }
 
-  if (!FFMPEGLibraryInstance.Load()) {
-    *count = 0;
-    TRACE(1, "H.263\tCodec\tDisabled");
-    return NULL;
-  }
-
-  FFMPEGLibraryInstance.AvLogSetLevel(AV_LOG_DEBUG);
-  FFMPEGLibraryInstance.AvLogSetCallback(&logCallbackFFMPEG);
-
     if (version < PLUGIN_CODEC_VERSION_OPTIONS) {
       *count = 0;
       TRACE(1, "H.263\tCodec\tDisabled - plugin version mismatch");
       return NULL;
     }
+    else if (!FFMPEGLibraryInstance.IsPresent()) {
+      *count = 0;
+      TRACE(1, "H.263\tCodec\tDisabled - libavcodec not found");
+      return NULL;
+    }
     else {
       *count = sizeof(h263CodecDefn) / sizeof(struct PluginCodec_Definition);
       TRACE(1, "H.263\tCodec\tEnabled with " << *count << " definitions");
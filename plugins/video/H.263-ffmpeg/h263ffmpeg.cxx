@@ -72,6 +72,7 @@
   #include <limits.h>
   #include <semaphore.h>
   #include <dlfcn.h>
+  #include <unistd.h>
   #define STRCMPI  strcasecmp
   typedef unsigned char BYTE;
 #endif
@@ -278,6 +279,38 @@ class DynaLink
       return InternalOpen(NULL, name); // Last ditch effort
     }
 
+    // Look for the file where Open() would, without loading it
+    bool Exists(const char *name)
+    {
+#ifdef _WIN32
+      // LoadLibrary() has its own search order
+      return Open(name);
+#else
+      const char * env;
+      if ((env = ::getenv("PTLIBPLUGINDIR")) == NULL &&
+          (env = ::getenv("PWLIBPLUGINDIR")) == NULL)
+        env = P_DEFAULT_PLUGIN_DIR;
+
+      char * dirs = (char *)alloca(strlen(env)+1);
+      strcpy(dirs, env);
+
+      const char * token = strtok(dirs, DIR_TOKENISER);
+      while (token != NULL) {
+        char path[1024];
+        if (strlen(token) + strlen(name) + 2 < sizeof(path)) {
+          strcpy(path, token);
+          if (path[strlen(path)-1] != DIR_SEPERATOR[0])
+            strcat(path, DIR_SEPERATOR);
+          strcat(path, name);
+          if (access(path, R_OK) == 0)
+            return true;
+        }
+        token = strtok(NULL, DIR_TOKENISER);
+      }
+      return false;
+#endif // _WIN32
+    }
+
   // split into directories on correct seperator
 
     bool InternalOpen(const char * dir, const char *name)
@@ -299,7 +332,7 @@ class DynaLink
       _hDLL = LoadLibrary(path);
 # endif // UNICODE
 #else
-      _hDLL = dlopen((const char *)path, RTLD_NOW);
+      _hDLL = dlopen((const char *)path, RTLD_LAZY);
       if (_hDLL == NULL) {
         char * err = (char *)  dlerror();
         if (err != NULL)
@@ -377,6 +410,7 @@ class FFMPEGLibrary
     ~FFMPEGLibrary();
 
     bool Load();
+    bool IsPresent();
 
     AVCodec *AvcodecFindEncoder(enum CodecID id);
     AVCodec *AvcodecFindDecoder(enum CodecID id);
@@ -394,6 +428,8 @@ class FFMPEGLibrary
     CriticalSection processLock;
 
   protected:
+    bool OpenLibrary();
+
     void (*Favcodec_init)(void);
     AVCodec *Favcodec_h263_encoder;
     AVCodec *Favcodec_h263p_encoder;
@@ -427,10 +463,9 @@ FFMPEGLibrary::FFMPEGLibrary()
   isLoadedOK = false;
 }
 
-bool FFMPEGLibrary::Load()
+bool FFMPEGLibrary::OpenLibrary()
 {
-  WaitAndSignal m(processLock);
-  if (IsLoaded())
+  if (DynaLink::IsLoaded())
     return true;
 
   if (!DynaLink::Open("avcodec")
@@ -449,6 +484,36 @@ bool FFMPEGLibrary::Load()
     return false;
   }
 
+  return true;
+}
+
+// Finding the library is enough to advertise the codecs, it is loaded by
+// the first codec created. It is only opened here if it cannot be found,
+// eg when it is only known to the dynamic linker's cache
+bool FFMPEGLibrary::IsPresent()
+{
+  WaitAndSignal m(processLock);
+  if (DynaLink::IsLoaded() || DynaLink::Exists("avcodec")
+#if defined(_WIN32)
+      || DynaLink::Exists("libavcodec")
+#else
+      || DynaLink::Exists("libavcodec.so")
+#endif
+     )
+    return true;
+
+  return OpenLibrary();
+}
+
+bool FFMPEGLibrary::Load()
+{
+  WaitAndSignal m(processLock);
+  if (IsLoaded())
+    return true;
+
+  if (!OpenLibrary())
+    return false;
+
   if (!GetFunction("avcodec_init", (Function &)Favcodec_init)) {
     //cerr << "Failed to load avcodec_int" << endl;
     return false;
@@ -1129,6 +1194,10 @@ int H263EncoderContext::EncodeFrames(const BYTE * src, unsigned & srcLen, BYTE *
 
 static void * create_encoder(const struct PluginCodec_Definition * /*codec*/)
 {
+  // libavcodec is loaded by the first codec instance, not with the plugin
+  if (!FFMPEGLibraryInstance.Load())
+    return NULL;
+
   return new H263EncoderContext;
 }
 
@@ -1423,6 +1492,9 @@ bool H263DecoderContext::DecodeFrames(const BYTE * src, unsigned & srcLen, BYTE
 
 static void * create_decoder(const struct PluginCodec_Definition *)
 {
+  if (!FFMPEGLibraryInstance.Load())
+    return NULL;
+
   return new H263DecoderContext;
 }
 
@@ -2295,8 +2367,8 @@ extern "C" {
 
   PLUGIN_CODEC_DLL_API struct PluginCodec_Definition * PLUGIN_CODEC_GET_CODEC_FN(unsigned * count, unsigned version)
   {
-    // check version numbers etc
-    if (version < PLUGIN_CODEC_VERSION_OPTIONS || !FFMPEGLibraryInstance.Load()) {
+    // check version numbers etc, and that libavcodec is there to be loaded later
+    if (version < PLUGIN_CODEC_VERSION_OPTIONS || !FFMPEGLibraryInstance.IsPresent()) {
       *count = 0;
       return NULL;
     }
@@ -299,6 +299,8 @@ void X264EncoderContext::ApplyOptions()
 #if X264_DELAYLOAD
   return;  // We apply options when we do our first encode
 #else
+  // pending packets reference the encoder's NAL buffers, drop them first
+  _txH264Frame->BeginNewFrame();
   if (_codec != NULL)
     X264_ENCODER_CLOSE(_codec);
 
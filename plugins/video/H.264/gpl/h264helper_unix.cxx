@@ -24,6 +24,9 @@
 #include "shared/pipes.h"
 #include "enc-ctx.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fstream>
 #include "trace.h"
 #include <stdlib.h> 
@@ -47,6 +50,10 @@ unsigned char * dst  = NULL;
 unsigned flags;
 int ret;
 
+unsigned char * shmBase = NULL;
+unsigned char * lastPacket = NULL;
+unsigned maxFrameSize = 1400;
+
 X264EncoderContext* x264;
 
 #ifndef X264_LINK_STATIC
@@ -80,11 +87,58 @@ void flushStream (std::ofstream & stream)
   if (stream.bad())  { TRACE (1, "H264\tIPC\tCP: Bad flag set on flushing - terminating"); closeAndExit(); }
 }
 
+bool openShm (const char * name)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) { TRACE (1, "H264\tIPC\tCP: Error when opening shared memory, using named pipes only"); return false; }
+
+  struct stat info;
+  void * base = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size >= (off_t)H264_SHM_SIZE)
+    base = mmap(NULL, H264_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) { TRACE (1, "H264\tIPC\tCP: Error when mapping shared memory, using named pipes only"); return false; }
+
+  shmBase = (unsigned char *)base;
+  return true;
+}
+
+// Encode as many packets of the current frame as fit into the shared packet
+// area, so the plugin only needs one round trip per frame instead of per packet
+unsigned encodeToShm ()
+{
+  unsigned char * packets = shmBase + H264_SHM_FRAME_SIZE;
+  unsigned offset = 0;
+  unsigned count = 0;
+
+  do {
+    h264ShmPacket * packet = (h264ShmPacket *)(packets + offset);
+    unsigned char * data = (unsigned char *)(packet + 1);
+
+    // the encoder reuses the RTP header of the previous packet
+    if (lastPacket != NULL && lastPacket != data)
+      memmove(data, lastPacket, headerLen);
+
+    ret = x264->EncodeFrames(shmBase, srcLen, data, dstLen, flags);
+    packet->len = dstLen;
+    packet->flags = flags;
+    packet->ret = ret;
+
+    lastPacket = data;
+    offset += H264_SHM_PACKET_SPAN(dstLen);
+    count++;
+  } while (ret != 0 && (flags & 1) == 0 &&
+           offset + H264_SHM_PACKET_SPAN(maxFrameSize + H264_SHM_MAX_HEADER) <= H264_SHM_PACKET_AREA);
+
+  return count;
+}
+
 
 int main(int argc, char *argv[])
 {
   unsigned status;
-  if (argc != 3) { fprintf(stderr, "Not to be executed directly - exiting\n"); exit (1); }
+  if (argc != 3 && argc != 4) { fprintf(stderr, "Not to be executed directly - exiting\n"); exit (1); }
 
   char * debug_level = getenv ("PTLIB_TRACE_CODECS");
   if (debug_level!=NULL) {
@@ -118,6 +172,9 @@ int main(int argc, char *argv[])
   status = 1;
 #endif
 
+  if (status != 0 && argc == 4 && openShm(argv[3]))
+    status = 2;
+
   readStream(dlStream, (char*)&msg, sizeof(msg));
   writeStream(ulStream,(char*)&msg, sizeof(msg)); 
   writeStream(ulStream,(char*)&status, sizeof(status)); 
@@ -251,8 +308,27 @@ int main(int argc, char *argv[])
           TRACE (1, "H264\tIPC\tCodec not created, yet");
         }
       break;
+    case ENCODE_FRAMES_SHM:
+        readStream(dlStream, (char*)&srcLen, sizeof(srcLen));
+        readStream(dlStream, (char*)&headerLen, sizeof(headerLen));
+        readStream(dlStream, (char*)&flags, sizeof(flags));
+        lastPacket = NULL;
+        // fall through intended
+    case ENCODE_FRAMES_BUFFERED_SHM:
+        {
+          unsigned count = 0;
+          if (!x264)
+            TRACE (1, "H264\tIPC\tCodec not created, yet");
+          else if (shmBase && srcLen <= H264_SHM_FRAME_SIZE && headerLen <= H264_SHM_MAX_HEADER)
+            count = encodeToShm();
+          writeStream(ulStream,(char*)&msg, sizeof(msg));
+          writeStream(ulStream,(char*)&count, sizeof(count));
+          flushStream(ulStream);
+        }
+      break;
     case SET_MAX_FRAME_SIZE:
         readStream(dlStream, (char*)&val, sizeof(val));
+        maxFrameSize = val;
         if (x264) {
           x264->SetMaxRTPFrameSize (val);
           writeStream(ulStream,(char*)&msg, sizeof(msg)); 
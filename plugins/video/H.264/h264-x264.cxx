@@ -849,6 +849,23 @@ static int adjust_to_BitRate (unsigned & width, unsigned & height, unsigned & fr
 
 /////////////////////////////////////////////////////////////////////////////
 
+// libavcodec is loaded by the first decoder rather than when the plugin is
+// loaded, so an endpoint only pays for it once the codec is actually used
+static bool LoadFFMPEGLibrary()
+{
+  if (FFMPEGLibraryInstance.IsLoaded())
+    return true;
+
+  if (!FFMPEGLibraryInstance.Load()) {
+    TRACE(1, "H264\tCodec\tDecoder disabled");
+    return false;
+  }
+
+  FFMPEGLibraryInstance.AvLogSetLevel(AV_LOG_DEBUG);
+  FFMPEGLibraryInstance.AvLogSetCallback(&logCallbackFFMPEG);
+  return true;
+}
+
 #endif  // _SIGNAL_ONLY
 
 static void * create_encoder(const struct PluginCodec_Definition * /*codec*/)
@@ -1355,6 +1372,9 @@ static int encoder_get_output_data_size(const PluginCodec_Definition *, void *,
 static void * create_decoder(const struct PluginCodec_Definition *)
 {
 #ifndef _SIGNAL_ONLY
+  if (!LoadFFMPEGLibrary())
+    return NULL;
+
   return new H264DecoderContext;
 #else
   return NULL;
@@ -1521,15 +1541,13 @@ PLUGIN_CODEC_DLL_API struct PluginCodec_Definition * PLUGIN_CODEC_GET_CODEC_FN(u
     Trace::SetLevelUserPlane(0);
   }
 
-  if (!FFMPEGLibraryInstance.Load()) {
+  // libavcodec is only opened here, it is loaded by the first decoder
+  if (!FFMPEGLibraryInstance.IsPresent()) {
     *count = 0;
-    TRACE(1, "H264\tCodec\tDisabled");
+    TRACE(1, "H264\tCodec\tDisabled - libavcodec not found");
     return NULL;
   }
 
-  FFMPEGLibraryInstance.AvLogSetLevel(AV_LOG_DEBUG);
-  FFMPEGLibraryInstance.AvLogSetCallback(&logCallbackFFMPEG);
-
 #endif  // _SIGNAL_ONLY
 
   if (version < PLUGIN_CODEC_VERSION_OPTIONS) {
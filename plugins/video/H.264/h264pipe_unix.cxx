@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include "trace.h"
 #include "rtpframe.h"
@@ -51,6 +53,12 @@ H264EncCtx::H264EncCtx()
   loaded = false;  
   pipesCreated = false;
   pipesOpened = false;
+  shmName[0] = 0;
+  shmBase = NULL;
+  shmMode = false;
+  shmFrame = false;
+  packetOffset = 0;
+  packetCount = 0;
   instances++;
 }
 
@@ -71,6 +79,9 @@ H264EncCtx::Load()
   }
   pipesCreated = true;  
 
+  // failing to get shared memory only costs us the pipe copies
+  createShm();
+
   if (!findGplProcess()) { 
 
     TRACE(1, "H264\tIPC\tPP: Couldn't find GPL process executable: " << GPL_PROCESS_FILENAME)
@@ -126,15 +137,26 @@ H264EncCtx::Load()
     return false;
   }
 
-  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication")
+  // both sides have the region mapped by now, so the name is no longer needed
+  if (shmName[0] != 0) {
+    shm_unlink(shmName);
+    shmName[0] = 0;
+  }
+  shmMode = (status == 2) && (shmBase != NULL);
+  if (!shmMode)
+    releaseShm();
+
+  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication" << (shmMode ? " using shared memory" : ""))
   loaded = true;  
   return true;
 }
 
 void H264EncCtx::call(unsigned msg)
 {
-  if (msg == H264ENCODERCONTEXT_CREATE) 
+  if (msg == H264ENCODERCONTEXT_CREATE) {
     startNewFrame = true;
+    packetCount = 0;
+  }
   writeStream((char*) &msg, sizeof(msg));
   flushStream();
   readStream((char*) &msg, sizeof(msg));
@@ -155,6 +177,14 @@ void H264EncCtx::call(unsigned msg, unsigned value)
      
 void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
 {
+  if (startNewFrame)
+    shmFrame = shmMode && (size ? size : srcLen) <= H264_SHM_FRAME_SIZE && headerLen <= H264_SHM_MAX_HEADER;
+
+  if (shmFrame) {
+    callShm(msg, src, srcLen, dst, dstLen, headerLen, flags, ret);
+    return;
+  }
+
   if (startNewFrame) {
 
     writeStream((char*) &msg, sizeof(msg));
@@ -193,6 +223,107 @@ void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_ch
     startNewFrame = false;
 }
 
+void H264EncCtx::callShm(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret)
+{
+  u_char * packets = shmBase + H264_SHM_FRAME_SIZE;
+
+  // the helper encodes a whole frame per request, so only go back to it
+  // for a new frame or once the packet area has been drained
+  if (startNewFrame || packetCount == 0) {
+
+    if (startNewFrame) {
+      unsigned len = size ? size : srcLen;
+      memcpy(shmBase, src, len);
+      memcpy(packets + sizeof(h264ShmPacket), dst, headerLen);
+
+      msg = ENCODE_FRAMES_SHM;
+      writeStream((char*) &msg, sizeof(msg));
+      writeStream((char*) &len, sizeof(len));
+      writeStream((char*) &headerLen, sizeof(headerLen));
+      writeStream((char*) &flags, sizeof(flags));
+    }
+    else {
+      msg = ENCODE_FRAMES_BUFFERED_SHM;
+      writeStream((char*) &msg, sizeof(msg));
+    }
+
+    flushStream();
+
+    packetCount = 0;
+    packetOffset = 0;
+    readStream((char*) &msg, sizeof(msg));
+    readStream((char*) &packetCount, sizeof(packetCount));
+  }
+
+  const h264ShmPacket * packet = (const h264ShmPacket *) (packets + packetOffset);
+  if (!pipesOpened || packetCount == 0 ||
+      packetOffset + sizeof(h264ShmPacket) > H264_SHM_PACKET_AREA ||
+      packetOffset + H264_SHM_PACKET_SPAN(packet->len) > H264_SHM_PACKET_AREA) {
+
+    TRACE(1, "H264\tIPC\tPP: No encoded packet returned by GPL process");
+    packetCount = 0;
+    dstLen = 0;
+    ret = 0;
+    startNewFrame = true;
+    return;
+  }
+
+  dstLen = packet->len;
+  memcpy(dst, packet + 1, dstLen);
+  flags = packet->flags;
+  ret = packet->ret;
+
+  packetOffset += H264_SHM_PACKET_SPAN(dstLen);
+  packetCount--;
+
+  if (flags & 1) 
+    startNewFrame = true;
+   else
+    startNewFrame = false;
+}
+
+bool H264EncCtx::createShm()
+{
+  snprintf(shmName, sizeof(shmName), "/x264-shm-%d-%u", getpid(), GetInstanceNumber());
+
+  int fd = shm_open(shmName, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to create shared memory, using named pipes only - " << strerror(errno));
+    shmName[0] = 0;
+    return false;
+  }
+
+  void * base = MAP_FAILED;
+  if (ftruncate(fd, H264_SHM_SIZE) == 0)
+    base = mmap(NULL, H264_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to map shared memory, using named pipes only - " << strerror(errno));
+    releaseShm();
+    return false;
+  }
+
+  shmBase = (u_char *) base;
+  return true;
+}
+
+void H264EncCtx::releaseShm()
+{
+  if (shmBase != NULL) {
+    munmap(shmBase, H264_SHM_SIZE);
+    shmBase = NULL;
+  }
+  if (shmName[0] != 0) {
+    shm_unlink(shmName);
+    shmName[0] = 0;
+  }
+  shmMode = false;
+  packetCount = 0;
+}
+
 bool H264EncCtx::createPipes()
 {
   umask(0);
@@ -236,6 +367,7 @@ void H264EncCtx::closeAndRemovePipes()
     if (std::remove((const char*) &dlName) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to remove DL named pipe - " << strerror(errno));
     pipesCreated = false;
   }
+  releaseShm();
 }
 
 void H264EncCtx::readStream (char* data, unsigned bytes)
@@ -317,7 +449,7 @@ void H264EncCtx::execGplProcess()
 {
   unsigned msg;
   unsigned status = 0;
-  if (execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, NULL) == -1) {
+  if (execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, shmBase != NULL ? shmName : NULL, NULL) == -1) {
 
     TRACE(1, "H264\tIPC\tPP: Error when trying to execute GPL process  " << gplProcess << " - " << strerror(errno));
     cpDLStream.open(dlName, std::ios::binary);
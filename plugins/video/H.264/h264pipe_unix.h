@@ -47,6 +47,9 @@ class H264EncCtx
   protected:
      bool createPipes();
      void closeAndRemovePipes();
+     bool createShm();
+     void releaseShm();
+     void callShm(unsigned msg , const u_char * src, unsigned & srcLen, u_char * dst, unsigned & dstLen, unsigned & headerLen, unsigned int & flags, int & ret);
      void writeStream (const char* data, unsigned bytes);
      void readStream (char* data, unsigned bytes);
      void flushStream ();
@@ -58,6 +61,7 @@ class H264EncCtx
      char dlName [512];
      char ulName [512];
      char gplProcess [512];
+     char shmName [64];
      std::ofstream dlStream;
      std::ifstream ulStream;
      unsigned width;
@@ -67,6 +71,13 @@ class H264EncCtx
      bool loaded;
      bool pipesCreated;
      bool pipesOpened;
+
+     // frame and packet payloads go through shared memory when the helper maps it
+     u_char * shmBase;
+     bool shmMode;
+     bool shmFrame;
+     unsigned packetOffset;
+     unsigned packetCount;
      
      // only for signaling failed execution of helper process
      std::ifstream cpDLStream;
@@ -144,9 +144,15 @@ void H264Frame::SetFromFrame (x264_nal_t *NALs, int numberOfNALs) {
       encodedNALS = _nalBuffer;
   }
 
-  uint8_t* currentPositionInFrame=(uint8_t*) _encodedFrame;
-  if (_NALs) free(_NALs);
-  _NALs = (h264_nal_t *)malloc(encodedNALS * sizeof(h264_nal_t));
+  if ((uint32_t)encodedNALS > _numberOfNALsReserved) {
+    h264_nal_t * reserved = (h264_nal_t *)realloc(_NALs, encodedNALS * sizeof(h264_nal_t));
+    if (reserved == NULL) {
+      TRACE(1, "H264\tENC\tCould not reserve " << encodedNALS << " NAL units");
+      return;
+    }
+    _NALs = reserved;
+    _numberOfNALsReserved = encodedNALS;
+  }
 
   _encodedFrameLen = 0;
   _numberOfNALsInFrame = 0;
@@ -154,24 +160,23 @@ void H264Frame::SetFromFrame (x264_nal_t *NALs, int numberOfNALs) {
 
   //TRACE (4, "H264\tEncap\tEncoded " << encodedNALS << " NALs");
 
-  // read the nals out of the encoder and create meta data about their location and size in the frame
+  // reference the nals in the encoder's output in place, the RTP packets are built straight from them
   for (currentNAL = 0; currentNAL < encodedNALS; currentNAL++) {
     int currentNALLen;
 //   currentNALLen = X264_NAL_ENCODE(currentPositionInFrame, &vopBufferLen, 1, &NALs[currentNAL]);
     currentNALLen = NALs[currentNAL].i_payload;
-    memcpy(currentPositionInFrame,NALs[currentNAL].p_payload,currentNALLen);
     if (currentNALLen > 0) 
     {
-      _NALs[_numberOfNALsInFrame].length = currentNALLen;
-      _NALs[_numberOfNALsInFrame].offset = _encodedFrameLen;
-      _NALs[_numberOfNALsInFrame].type = NALs[currentNAL].i_type;
+      const uint8_t* currentPositionInFrame = NALs[currentNAL].p_payload;
       uint32_t header = 0;
-      if (IsStartCode(currentPositionInFrame))
+      if (currentNALLen >= 4 && IsStartCode(currentPositionInFrame))
       {
 	header = currentPositionInFrame[2] == 1 ? 3 : 4;
       }
-      _NALs[_numberOfNALsInFrame].length -= header;
-      _NALs[_numberOfNALsInFrame].offset += header;
+      _NALs[_numberOfNALsInFrame].data = currentPositionInFrame + header;
+      _NALs[_numberOfNALsInFrame].length = currentNALLen - header;
+      _NALs[_numberOfNALsInFrame].offset = _encodedFrameLen + header;
+      _NALs[_numberOfNALsInFrame].type = NALs[currentNAL].i_type;
       TRACE_UP(4, "H264\tEncap\tLoaded NAL unit #" << currentNAL << " - type " << NALs[currentNAL].i_type);
   //    TRACE (4, "H264\tEncap\tLoaded NAL unit #" << currentNAL << " - type " << NALs[currentNAL].i_type << " size " << currentNALLen );
 
@@ -188,7 +193,6 @@ void H264Frame::SetFromFrame (x264_nal_t *NALs, int numberOfNALs) {
 
       _numberOfNALsInFrame++;
       _encodedFrameLen += currentNALLen;
-      currentPositionInFrame += currentNALLen;
     } 
     else
     {
@@ -206,7 +210,7 @@ bool H264Frame::GetRTPFrame(RTPFrame & frame, unsigned int & flags)
   if (_currentNAL < _numberOfNALsInFrame) 
   { 
     uint32_t curNALLen = _NALs[_currentNAL].length;
-    const uint8_t *curNALPtr = _encodedFrame + _NALs[_currentNAL].offset;
+    const uint8_t *curNALPtr = _NALs[_currentNAL].data;
     /*
      * We have 3 types of packets we can send:
      * fragmentation units - if the NAL is > max_payload_size
@@ -282,7 +286,7 @@ bool H264Frame::EncapsulateSTAP (RTPFrame & frame, unsigned int & flags) {
   uint8_t  maxNRI = 0;
   while (_currentNAL < highestNALNumberInSTAP) {
     curNALLen = _NALs[_currentNAL].length;
-    curNALPtr = _encodedFrame + _NALs[_currentNAL].offset;
+    curNALPtr = _NALs[_currentNAL].data;
 
     // store the nal length information
     frame.SetPayloadSize(frame.GetPayloadSize() + 2);
@@ -317,7 +321,7 @@ bool H264Frame::EncapsulateFU(RTPFrame & frame, unsigned int & flags) {
   if ((_currentNALFURemainingLen==0) || (_currentNALFURemainingDataPtr==NULL))
   {
     _currentNALFURemainingLen = _NALs[_currentNAL].length;
-    _currentNALFURemainingDataPtr = _encodedFrame + _NALs[_currentNAL].offset;
+    _currentNALFURemainingDataPtr = _NALs[_currentNAL].data;
     _currentNALFUHeader0 = (*_currentNALFURemainingDataPtr & 0x60) | 28;
     _currentNALFUHeader1 = *_currentNALFURemainingDataPtr & 0x1f;
     header[0] = _currentNALFUHeader0;
@@ -527,11 +531,16 @@ void H264Frame::AddDataToEncodedFrame (uint8_t *data, uint32_t dataLen, uint8_t
 
     if (_numberOfNALsInFrame + 1 >(_numberOfNALsReserved))
     {
-      _NALs = (h264_nal_t *)realloc(_NALs, (_numberOfNALsReserved + 1) * sizeof(h264_nal_t));
-      _numberOfNALsReserved++;
+      uint32_t reserve = _numberOfNALsReserved ? _numberOfNALsReserved * 2 : 16;
+      h264_nal_t * reserved = (h264_nal_t *)realloc(_NALs, reserve * sizeof(h264_nal_t));
+      if (reserved) {
+        _NALs = reserved;
+        _numberOfNALsReserved = reserve;
+      }
     }
-    if (_NALs)
+    if (_NALs && _numberOfNALsInFrame < _numberOfNALsReserved)
     {
+      _NALs[_numberOfNALsInFrame].data = _encodedFrame + _encodedFrameLen + 4;
       _NALs[_numberOfNALsInFrame].offset = _encodedFrameLen + 4;
       _NALs[_numberOfNALsInFrame].length = dataLen + 1;
       _NALs[_numberOfNALsInFrame].type = header & 0x1f;
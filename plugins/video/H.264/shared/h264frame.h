@@ -168,8 +168,12 @@ enum codecOutFlags {
 };
 	  
 
+// On transmit data points into the encoder's own NAL buffers, which stay
+// valid until the next encode call, so packets are built straight from them.
+// On receive it points into the reassembled encoded frame.
 typedef struct h264_nal_t
 {
+  const uint8_t * data;
   uint32_t offset;
   uint32_t length;
   uint8_t  type;
@@ -228,7 +232,7 @@ private:
   
   // for encapsulation
   uint32_t _currentNALFURemainingLen;
-  uint8_t* _currentNALFURemainingDataPtr;
+  const uint8_t* _currentNALFURemainingDataPtr;
   uint8_t  _currentNALFUHeader0;
   uint8_t  _currentNALFUHeader1;
 
@@ -48,6 +48,25 @@
 #define SET_PROFILE_LEVEL         13
 #define FASTUPDATE_REQUESTED	  14
 #define SET_MAX_NALSIZE           15
+#define ENCODE_FRAMES_SHM         16
+#define ENCODE_FRAMES_BUFFERED_SHM 17
+
+// Shared memory region handed to the helper as its third argument.
+// The source frame is placed at offset 0, the encoded RTP packets of a
+// frame are returned in the packet area following it, each one prefixed
+// by an h264ShmPacket record and padded to a 4 byte boundary.
+#define H264_SHM_FRAME_SIZE       (1920 * 1088 * 3 / 2 + 4096)
+#define H264_SHM_PACKET_AREA      (256 * 1024)
+#define H264_SHM_SIZE             (H264_SHM_FRAME_SIZE + H264_SHM_PACKET_AREA)
+#define H264_SHM_MAX_HEADER       256
+
+typedef struct {
+  unsigned len;
+  unsigned flags;
+  int      ret;
+} h264ShmPacket;
+
+#define H264_SHM_PACKET_SPAN(len) (sizeof(h264ShmPacket) + (((len) + 3) & ~3u))
 
 
 #endif /* __PIPE_H__ */
@@ -50,6 +50,10 @@
 #include <string>
 #endif
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 #ifndef PATH_SEP
 #ifdef _WIN32
 #pragma pack(16)
@@ -125,7 +129,7 @@ TRACE(1, "\tDYNA\tLoading " << path);
 # endif /* UNICODE */
 #else
   WITH_ALIGNED_STACK({  // must be called before using avcodec lib
-    _hDLL = dlopen((const char *)path, RTLD_NOW);
+    _hDLL = dlopen((const char *)path, RTLD_LAZY);
   });
 #endif /* _WIN32 */
 
@@ -149,6 +153,50 @@ TRACE(1, "\tDYNA\tLoading " << path);
   return true;
 }
 
+bool DynaLink::Exists(const char *name)
+{
+#ifdef _WIN32
+  // LoadLibrary() has its own search order
+  return Open(name);
+#else
+  static const char * const systemDirs[] = { "/usr/local/lib", "/usr/lib", "/lib", "/usr/lib64", "/lib64" };
+
+  char dirs[2048];
+  memset(dirs, 0, sizeof(dirs));
+  const char * env = ::getenv("PTLIBPLUGINDIR");
+  if (env != NULL)
+    strncpy(dirs, env, sizeof(dirs) - 1);
+  env = ::getenv("LD_LIBRARY_PATH");
+  if (env != NULL && strlen(dirs) + strlen(env) + 2 < sizeof(dirs)) {
+    strcat(dirs, PATH_SEP);
+    strcat(dirs, env);
+  }
+  if (strlen(dirs) + 3 < sizeof(dirs))
+    strcat(dirs, PATH_SEP ".");
+  for (size_t i = 0; i < sizeof(systemDirs)/sizeof(systemDirs[0]); i++) {
+    if (strlen(dirs) + strlen(systemDirs[i]) + 2 < sizeof(dirs)) {
+      strcat(dirs, PATH_SEP);
+      strcat(dirs, systemDirs[i]);
+    }
+  }
+
+  char * p = ::strtok(dirs, PATH_SEP);
+  while (p != NULL) {
+    char path[1024];
+    if (strlen(p) + strlen(name) + 5 < sizeof(path)) {
+      sprintf(path, "%s%s%s.so", p, p[strlen(p)-1] != DIR_SEPARATOR[0] ? DIR_SEPARATOR : "", name);
+      if (access(path, R_OK) == 0) {
+        TRACE(4, _codecString << "\tDYNA\tFound '" << path << "'");
+        return true;
+      }
+    }
+    p = ::strtok(NULL, PATH_SEP);
+  }
+
+  return false;
+#endif /* _WIN32 */
+}
+
 void DynaLink::Close()
 {
   if (_hDLL != NULL) {
@@ -201,6 +249,9 @@ FFMPEGLibrary::FFMPEGLibrary(FF_CodecID codec)
   if (_codec==CODEC_ID_MPEG4)
       snprintf( _codecString, sizeof(_codecString), "MPEG4");
   isLoadedOK = false;
+#ifdef USE_DLL_AVCODEC
+  seperateLibAvutil = false;
+#endif
 }
 
 FFMPEGLibrary::~FFMPEGLibrary()
@@ -219,13 +270,11 @@ FFMPEGLibrary::~FFMPEGLibrary()
        )
 #endif
 
-bool FFMPEGLibrary::Load(int ver)
+#ifdef USE_DLL_AVCODEC
+bool FFMPEGLibrary::OpenLibraries()
 {
-  WaitAndSignal m(processLock);
-  if (IsLoaded())
+  if (libAvcodec.IsLoaded())
     return true;
-#ifdef USE_DLL_AVCODEC
-  bool seperateLibAvutil = false;
 
   if (libAvcodec.Open("avcodec-52") || libAvcodec.Open("avcodec-51"))
     seperateLibAvutil = true;
@@ -238,9 +287,39 @@ bool FFMPEGLibrary::Load(int ver)
 
   if (seperateLibAvutil && !(libAvutil.Open("avutil-50") || libAvutil.Open("avutil-49")) ) {
     TRACE (1, _codecString << "\tDYNA\tFailed to load FFMPEG libavutil library");
+    libAvcodec.Close();
     return false;
   }
 
+  return true;
+}
+#endif
+
+bool FFMPEGLibrary::IsPresent()
+{
+  WaitAndSignal m(processLock);
+#ifdef USE_DLL_AVCODEC
+  // Listing the codecs does not load libavcodec unless it cannot be found
+  if (libAvcodec.IsLoaded() ||
+      libAvcodec.Exists("avcodec-52") || libAvcodec.Exists("avcodec-51") || libAvcodec.Exists("libavcodec"))
+    return true;
+
+  // eg only known to the dynamic linker's cache
+  return OpenLibraries();
+#else
+  return true;
+#endif
+}
+
+bool FFMPEGLibrary::Load(int ver)
+{
+  WaitAndSignal m(processLock);
+  if (IsLoaded())
+    return true;
+#ifdef USE_DLL_AVCODEC
+  if (!OpenLibraries())
+    return false;
+
   strcpy(libAvcodec._codecString, _codecString);
   strcpy(libAvutil._codecString,  _codecString);
 
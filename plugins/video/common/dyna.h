@@ -64,6 +64,12 @@ class DynaLink
 
     virtual bool Open(const char *name);
     bool InternalOpen(const char * dir, const char *name);
+
+    /** Look for the library file in the directories Open() searches, and the
+        usual system ones, without loading it. Libraries only known to the
+        dynamic linker's cache are not found.
+      */
+    bool Exists(const char *name);
     virtual void Close();
     bool GetFunction(const char * name, Function & func);
     
@@ -95,6 +101,12 @@ class FFMPEGLibrary
 
     bool Load(int ver = 0);
 
+    /** Check the libraries are there to be loaded later, so the codecs are
+        only advertised where they can be used. The files are looked for
+        without loading them, only opening them if they cannot be found.
+      */
+    bool IsPresent();
+
     AVCodec *AvcodecFindEncoder(enum FF_CodecID id);
     AVCodec *AvcodecFindDecoder(enum FF_CodecID id);
     AVCodecContext *AvcodecAllocContext(AVCodec * codec = NULL);
@@ -122,8 +134,11 @@ class FFMPEGLibrary
     char _codecString [32];
 
 #ifdef USE_DLL_AVCODEC
+    bool OpenLibraries();
+
     DynaLink libAvcodec;
     DynaLink libAvutil;
+    bool seperateLibAvutil;
 
     void (*Favcodec_init)(void);
     AVCodec *Favcodec_h263_encoder;
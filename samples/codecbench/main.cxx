@@ -0,0 +1,821 @@
+/*
+ * main.cxx
+ *
+ * Plugin codec benchmark for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+#include <math.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include "main.h"
+#include "../../version.h"
+
+PCREATE_PROCESS(CodecBenchProcess);
+
+#define WARMUP_FRAMES      10
+#define MAX_VIDEO_PACKETS  256     // Per frame
+#define MAX_KEPT_PACKETS   8192    // Replayed into the decoder
+#define MAX_VIDEO_WIDTH    1920
+#define MAX_VIDEO_HEIGHT   1088
+#define VIDEO_SOURCE_FRAMES 8      // Test frames used in turn
+
+
+// Monotonic microsecond clock, a wall clock step must not land in a timing
+static PUInt64 Timestamp()
+{
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (PUInt64)(now.QuadPart/frequency.QuadPart)*1000000 +
+         (PUInt64)(now.QuadPart%frequency.QuadPart)*1000000/frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (PUInt64)now.tv_sec*1000000 + now.tv_nsec/1000;
+#endif
+}
+
+
+#if defined(__GLIBC__)
+
+// Count every heap allocation in the process. The definitions below take
+// the place of the C library ones for the whole program, so the plugins
+// that are dlopened later (and operator new) allocate through them too.
+
+#define HAS_ALLOCATION_HOOK 1
+
+extern "C" {
+  extern void * __libc_malloc(size_t size);
+  extern void * __libc_calloc(size_t count, size_t size);
+  extern void * __libc_realloc(void * ptr, size_t size);
+}
+
+static volatile long AllocationCounter;
+
+extern "C" void * malloc(size_t size) __THROW
+{
+  __sync_fetch_and_add(&AllocationCounter, 1);
+  return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t count, size_t size) __THROW
+{
+  __sync_fetch_and_add(&AllocationCounter, 1);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void * realloc(void * ptr, size_t size) __THROW
+{
+  __sync_fetch_and_add(&AllocationCounter, 1);
+  return __libc_realloc(ptr, size);
+}
+
+#endif // __GLIBC__
+
+
+static PInt64 AllocationCount()
+{
+#if HAS_ALLOCATION_HOOK
+  return __sync_fetch_and_add(&AllocationCounter, 0);
+#elif PMEMORY_CHECK
+  PMemoryHeap::State state;
+  PMemoryHeap::GetState(state);
+  return state.allocationNumber;
+#else
+  return -1;
+#endif
+}
+
+
+// Deterministic test vectors, identical on every run and platform
+class TestSignal
+{
+  public:
+    TestSignal() : seed(0x12345678) { }
+
+    int Noise(int range)
+    {
+      seed = seed*1103515245 + 12345;
+      return (int)((seed >> 16) % (2*range + 1)) - range;
+    }
+
+    void Audio(short * samples, unsigned count, unsigned sampleRate, unsigned offset)
+    {
+      for (unsigned i = 0; i < count; i++) {
+        double t = (double)(offset + i)/sampleRate;
+        samples[i] = (short)(6000*sin(2*M_PI*440*t) + 3000*sin(2*M_PI*1250*t) + Noise(500));
+      }
+    }
+
+    void Video(BYTE * yuv, unsigned width, unsigned height, unsigned frame)
+    {
+      BYTE * y = yuv;
+      for (unsigned r = 0; r < height; r++)
+        for (unsigned c = 0; c < width; c++)
+          *y++ = (BYTE)(((r + c + frame*4) & 0xff) ^ (Noise(8) & 0x0f));
+
+      unsigned chroma = (width/2)*(height/2);
+      memset(yuv + width*height,          (BYTE)(96 + frame % 64), chroma);
+      memset(yuv + width*height + chroma, (BYTE)(160 - frame % 64), chroma);
+    }
+
+  protected:
+    unsigned seed;
+};
+
+
+///////////////////////////////////////////////////////////////
+
+CodecBenchProcess::CodecBenchProcess()
+  : PProcess("H323Plus", "codecbench", MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER),
+    frameCount(1000), videoWidth(352), videoHeight(288)
+{
+}
+
+
+void CodecBenchProcess::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse(
+             "f-frames:"
+             "h-help."
+             "j-json."
+             "m-match:"
+             "o-output:"
+             "-video-size:"
+#if PTRACING
+             "t-trace."
+             "-trace-file:"
+#endif
+          , FALSE);
+
+  if (args.HasOption('h')) {
+    cerr << "Usage : " << GetName() << " [options]\n"
+            "Options:\n"
+            "  -f --frames n           : Frames to encode and decode per codec (default 1000).\n"
+            "  -m --match str          : Only benchmark codecs whose name contains str.\n"
+            "  -j --json               : Output JSON instead of CSV.\n"
+            "  -o --output file        : Write the results to file instead of stdout.\n"
+            "     --video-size WxH     : Video frame size (default 352x288).\n"
+#if PTRACING
+            "  -t --trace              : Enable trace, use multiple times for more detail.\n"
+            "     --trace-file file    : Specify filename for trace output.\n"
+#endif
+            "  -h --help               : This help message.\n"
+            "\n"
+            "Plugins are loaded from the PTLIBPLUGINDIR directories. H.235.6 media\n"
+            "encryption is measured on audio and video sized RTP payloads too.\n";
+    return;
+  }
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption("trace-file") ? (const char *)args.GetOptionString("trace-file") : NULL,
+                     PTrace::Timestamp|PTrace::Thread|PTrace::FileAndLine);
+#endif
+
+  if (args.HasOption('f'))
+    frameCount = args.GetOptionString('f').AsUnsigned();
+  if (frameCount == 0)
+    frameCount = 1;
+
+  if (args.HasOption("video-size")) {
+    PStringArray size = args.GetOptionString("video-size").Tokenise("x");
+    if (size.GetSize() == 2) {
+      videoWidth  = size[0].AsUnsigned() & ~15;
+      videoHeight = size[1].AsUnsigned() & ~15;
+    }
+    if (videoWidth == 0 || videoHeight == 0 || videoWidth > MAX_VIDEO_WIDTH || videoHeight > MAX_VIDEO_HEIGHT) {
+      cerr << "Invalid video size " << args.GetOptionString("video-size") << endl;
+      return;
+    }
+  }
+
+  PString match = args.GetOptionString('m');
+
+  // Loads the plugins
+  PTRACE(2, "Bench\tLoaded " << H323PluginCodecManager::GetMediaFormats().GetSize() << " media formats");
+
+  PStringList encoders;
+  H323PluginCodecManager::CodecListing("L16|", encoders);
+  for (PINDEX i = 0; i < encoders.GetSize(); i++) {
+    PString name = "L16|" + encoders[i];
+    if (!match && name.Find(match) == P_MAX_INDEX)
+      continue;
+    const PluginCodec_Definition * encoder = GetDefinition(name);
+    const PluginCodec_Definition * decoder = GetDefinition(encoders[i] + "|L16");
+    if (encoder != NULL)
+      BenchmarkAudio(encoder, decoder);
+  }
+
+#ifdef H323_VIDEO
+  encoders.RemoveAll();
+  H323PluginCodecManager::CodecListing("YUV420P|", encoders);
+  for (PINDEX i = 0; i < encoders.GetSize(); i++) {
+    PString name = "YUV420P|" + encoders[i];
+    if (!match && name.Find(match) == P_MAX_INDEX)
+      continue;
+    const PluginCodec_Definition * encoder = GetDefinition(name);
+    const PluginCodec_Definition * decoder = GetDefinition(encoders[i] + "|YUV420P");
+    if (encoder != NULL)
+      BenchmarkVideo(encoder, decoder);
+  }
+#endif
+
+#ifdef H323_AUDIO_CODECS
+  // The built in G.711 codecs are not plugins
+  if (match.IsEmpty() || PString("G.711-ALaw-64k").Find(match) != P_MAX_INDEX)
+    BenchmarkG711("G.711-ALaw-64k", H323_ALawCodec::EncodeSamples, H323_ALawCodec::DecodeSamples,
+                  H323_ALawCodec::EncodeSample, H323_ALawCodec::DecodeSample);
+  if (match.IsEmpty() || PString("G.711-uLaw-64k").Find(match) != P_MAX_INDEX)
+    BenchmarkG711("G.711-uLaw-64k", H323_muLawCodec::EncodeSamples, H323_muLawCodec::DecodeSamples,
+                  H323_muLawCodec::EncodeSample, H323_muLawCodec::DecodeSample);
+#endif
+
+#ifdef H323_H235
+  static const struct {
+    const char * name;
+    const char * oid;
+    PINDEX       keyLength;
+  } algorithms[] = {
+    { "AES128", "2.16.840.1.101.3.4.1.2",  16 },
+    { "AES192", "2.16.840.1.101.3.4.1.22", 24 },
+    { "AES256", "2.16.840.1.101.3.4.1.42", 32 }
+  };
+  static const PINDEX payloadSizes[] = { 160, 1200 };  // G.711 20ms, a video packet
+  for (PINDEX a = 0; a < PARRAYSIZE(algorithms); a++) {
+    if (!match && PString(algorithms[a].name).Find(match) == P_MAX_INDEX)
+      continue;
+    for (PINDEX p = 0; p < PARRAYSIZE(payloadSizes); p++) {
+      BenchmarkCrypto(algorithms[a].name, algorithms[a].oid, algorithms[a].keyLength, payloadSizes[p], TRUE);
+      BenchmarkCrypto(algorithms[a].name, algorithms[a].oid, algorithms[a].keyLength, payloadSizes[p], FALSE);
+    }
+  }
+#endif
+
+  if (args.HasOption('o')) {
+    PTextFile file;
+    if (!file.Open(args.GetOptionString('o'), PFile::WriteOnly)) {
+      cerr << "Could not open " << args.GetOptionString('o') << endl;
+      return;
+    }
+    Output(file, args.HasOption('j'));
+  }
+  else
+    Output(cout, args.HasOption('j'));
+}
+
+
+const PluginCodec_Definition * CodecBenchProcess::GetDefinition(const PString & name)
+{
+  OpalFactoryCodec * codec = H323PluginCodecManager::CreateCodec(name);
+  if (codec == NULL)
+    return NULL;
+
+  // Plugin codecs are factory singletons, only the built in G.711 are created
+  // here and those are measured directly by BenchmarkG711()
+  const PluginCodec_Definition * defn = codec->GetDefinition();
+  if (defn == NULL)
+    delete codec;
+  return defn;
+}
+
+
+void CodecBenchProcess::BenchmarkAudio(const PluginCodec_Definition * encoder, const PluginCodec_Definition * decoder)
+{
+  PBoolean streamed = (encoder->flags & PluginCodec_MediaTypeMask) == PluginCodec_MediaTypeAudioStreamed;
+  unsigned samplesPerFrame = encoder->parm.audio.samplesPerFrame;
+  unsigned bytesPerFrame = streamed ? samplesPerFrame*sizeof(int) : encoder->parm.audio.bytesPerFrame;
+  unsigned sampleRate = encoder->sampleRate > 0 ? encoder->sampleRate : 8000;
+  if (samplesPerFrame == 0 || bytesPerFrame == 0)
+    return;
+
+  PTRACE(3, "Bench\tAudio " << encoder->descr << ", " << samplesPerFrame << " samples per frame");
+
+  unsigned total = frameCount + WARMUP_FRAMES;
+
+  // Test vectors and encoded frames are prepared outside of the measurement
+  PShortArray pcm(samplesPerFrame*total);
+  TestSignal signal;
+  signal.Audio(pcm.GetPointer(), samplesPerFrame*total, sampleRate, 0);
+
+  PBYTEArray encoded(bytesPerFrame*total);
+  std::vector<unsigned> encodedLen(total);
+  std::vector<int> status(total);
+  PShortArray decoded(samplesPerFrame*2);
+
+  CodecBenchResult enc(PString(encoder->sourceFormat) + "|" + encoder->destFormat, "audio", "encode",
+                       samplesPerFrame*1000000/sampleRate);
+
+  // The whole batch after the warm up is timed and divided by the frame
+  // count, the clock being too coarse for a single frame
+  void * context = encoder->createCodec != NULL ? (*encoder->createCodec)(encoder) : NULL;
+  PInt64 allocations = 0;
+  PUInt64 start = 0;
+  for (unsigned f = 0; f < total; f++) {
+    if (f == WARMUP_FRAMES) {
+      allocations = AllocationCount();
+      start = Timestamp();
+    }
+
+    const short * from = pcm.GetPointer() + f*samplesPerFrame;
+    BYTE * to = encoded.GetPointer() + f*bytesPerFrame;
+    unsigned flags = 0;
+    if (streamed) {
+      int ok = 1;
+      for (unsigned s = 0; s < samplesPerFrame; s++) {
+        unsigned fromLen = sizeof(short);
+        unsigned toLen = sizeof(int);
+        ok &= (encoder->codecFunction)(encoder, context, from + s, &fromLen, to + s*sizeof(int), &toLen, &flags) != 0;
+      }
+      status[f] = ok;
+      encodedLen[f] = bytesPerFrame;
+    }
+    else {
+      unsigned fromLen = samplesPerFrame*2;
+      unsigned toLen = bytesPerFrame;
+      status[f] = (encoder->codecFunction)(encoder, context, from, &fromLen, to, &toLen, &flags);
+      encodedLen[f] = toLen;
+    }
+  }
+  enc.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    enc.allocations = AllocationCount() - allocations;
+  if (encoder->destroyCodec != NULL)
+    (*encoder->destroyCodec)(encoder, context);
+
+  for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+    enc.frames++;
+    enc.bytesIn += samplesPerFrame*2;
+    enc.bytesOut += encodedLen[f];
+    if (!status[f])
+      enc.failures++;
+  }
+  results.push_back(enc);
+
+  if (decoder == NULL)
+    return;
+
+  CodecBenchResult dec(PString(decoder->sourceFormat) + "|" + decoder->destFormat, "audio", "decode", enc.usPerFrame);
+
+  std::vector<unsigned> decodedLen(total);
+  context = decoder->createCodec != NULL ? (*decoder->createCodec)(decoder) : NULL;
+  for (unsigned f = 0; f < total; f++) {
+    if (f == WARMUP_FRAMES) {
+      allocations = AllocationCount();
+      start = Timestamp();
+    }
+
+    const BYTE * from = encoded.GetPointer() + f*bytesPerFrame;
+    short * to = decoded.GetPointer();
+    unsigned flags = 0;
+    unsigned toLen = samplesPerFrame*2;
+    if (streamed) {
+      int ok = 1;
+      for (unsigned s = 0; s < samplesPerFrame; s++) {
+        unsigned fromLen = sizeof(int);
+        unsigned sampleLen = sizeof(short);
+        ok &= (decoder->codecFunction)(decoder, context, from + s*sizeof(int), &fromLen, to + s, &sampleLen, &flags) != 0;
+      }
+      status[f] = ok;
+    }
+    else {
+      unsigned fromLen = encodedLen[f];
+      status[f] = (decoder->codecFunction)(decoder, context, from, &fromLen, to, &toLen, &flags);
+    }
+    decodedLen[f] = toLen;
+  }
+  dec.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    dec.allocations = AllocationCount() - allocations;
+  if (decoder->destroyCodec != NULL)
+    (*decoder->destroyCodec)(decoder, context);
+
+  for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+    dec.frames++;
+    dec.bytesIn += encodedLen[f];
+    dec.bytesOut += decodedLen[f];
+    if (!status[f])
+      dec.failures++;
+  }
+  results.push_back(dec);
+}
+
+
+#ifdef H323_AUDIO_CODECS
+
+void CodecBenchProcess::BenchmarkG711(const char * format,
+                                      void (*encodeBlock)(const short *, BYTE *, unsigned),
+                                      void (*decodeBlock)(const BYTE *, short *, unsigned),
+                                      int (*encodeSample)(short),
+                                      short (*decodeSample)(int))
+{
+  PTRACE(3, "Bench\tBuilt in " << format);
+
+  const unsigned samplesPerFrame = 160;   // 20ms
+  unsigned total = frameCount + WARMUP_FRAMES;
+
+  PShortArray pcm(samplesPerFrame*total);
+  TestSignal signal;
+  signal.Audio(pcm.GetPointer(), samplesPerFrame*total, 8000, 0);
+
+  PBYTEArray encoded(samplesPerFrame*total);
+  PBYTEArray reference(samplesPerFrame*total);
+  PShortArray decoded(samplesPerFrame*total);
+  PShortArray referenceDecoded(samplesPerFrame*total);
+
+  // Block conversion as used by the streamed codecs, then sample at a time
+  // as before it, each checked against the other after the measurement
+  for (int pass = 0; pass < 2; pass++) {
+    PBoolean block = pass == 0;
+    PString name = PString("L16|") + format + (block ? "{built in}" : "{built in, per sample}");
+    BYTE * to = block ? encoded.GetPointer() : reference.GetPointer();
+
+    CodecBenchResult enc(name, "audio", "encode", samplesPerFrame*125);
+    PUInt64 start = 0;
+    for (unsigned f = 0; f < total; f++) {
+      if (f == WARMUP_FRAMES)
+        start = Timestamp();
+      const short * in = pcm.GetPointer() + f*samplesPerFrame;
+      BYTE * out = to + f*samplesPerFrame;
+      if (block)
+        encodeBlock(in, out, samplesPerFrame);
+      else {
+        for (unsigned s = 0; s < samplesPerFrame; s++)
+          out[s] = (BYTE)encodeSample(in[s]);
+      }
+    }
+    enc.microseconds = Timestamp() - start;
+    enc.frames = frameCount;
+    enc.bytesIn = (PUInt64)frameCount*samplesPerFrame*2;
+    enc.bytesOut = (PUInt64)frameCount*samplesPerFrame;
+
+    CodecBenchResult dec(PString(format) + (block ? "{built in}" : "{built in, per sample}") + "|L16", "audio", "decode", enc.usPerFrame);
+    short * samples = block ? decoded.GetPointer() : referenceDecoded.GetPointer();
+    for (unsigned f = 0; f < total; f++) {
+      if (f == WARMUP_FRAMES)
+        start = Timestamp();
+      const BYTE * in = to + f*samplesPerFrame;
+      short * out = samples + f*samplesPerFrame;
+      if (block)
+        decodeBlock(in, out, samplesPerFrame);
+      else {
+        for (unsigned s = 0; s < samplesPerFrame; s++)
+          out[s] = decodeSample(in[s]);
+      }
+    }
+    dec.microseconds = Timestamp() - start;
+    dec.frames = frameCount;
+    dec.bytesIn = (PUInt64)frameCount*samplesPerFrame;
+    dec.bytesOut = (PUInt64)frameCount*samplesPerFrame*2;
+
+    if (!block) {
+      for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+        PINDEX offset = f*samplesPerFrame;
+        if (memcmp(encoded.GetPointer() + offset, reference.GetPointer() + offset, samplesPerFrame) != 0)
+          enc.failures++;
+        if (memcmp(decoded.GetPointer() + offset, referenceDecoded.GetPointer() + offset, samplesPerFrame*2) != 0)
+          dec.failures++;
+      }
+    }
+
+    results.push_back(enc);
+    results.push_back(dec);
+  }
+}
+
+#endif // H323_AUDIO_CODECS
+
+
+#ifdef H323_VIDEO
+
+static void SetVideoOptions(const PluginCodec_Definition * codec, void * context, unsigned width, unsigned height)
+{
+  PluginCodec_ControlDefn * control = codec->codecControls;
+  while (control != NULL && control->name != NULL) {
+    if (PCaselessString(control->name) == PLUGINCODEC_CONTROL_SET_CODEC_OPTIONS) {
+      PStringArray list;
+      list += "Frame Width";
+      list += PString(width);
+      list += "Frame Height";
+      list += PString(height);
+      char ** options = list.ToCharArray();
+      unsigned len = sizeof(options);
+      (*control->control)(codec, context, PLUGINCODEC_CONTROL_SET_CODEC_OPTIONS, options, &len);
+      free(options);
+      return;
+    }
+    control++;
+  }
+}
+
+
+void CodecBenchProcess::BenchmarkVideo(const PluginCodec_Definition * encoder, const PluginCodec_Definition * decoder)
+{
+  PTRACE(3, "Bench\tVideo " << encoder->descr << ", " << videoWidth << 'x' << videoHeight);
+
+  unsigned frameRate = 30;
+  unsigned total = frameCount + WARMUP_FRAMES;
+  unsigned yuvSize = videoWidth*videoHeight*3/2;
+
+  // Raw frames as the library hands them to the plugin: RTP header, frame
+  // header, YUV420P. A few are generated up front and used in turn so no
+  // test vector is made inside the measurement.
+  PINDEX rawSize = PluginCodec_RTP_MinHeaderSize + sizeof(PluginCodec_Video_FrameHeader) + yuvSize;
+  PBYTEArray raw(rawSize*VIDEO_SOURCE_FRAMES);
+  TestSignal signal;
+  for (unsigned s = 0; s < VIDEO_SOURCE_FRAMES; s++) {
+    BYTE * frame = raw.GetPointer() + s*rawSize;
+    frame[0] = 0x80;
+    PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)(frame + PluginCodec_RTP_MinHeaderSize);
+    header->x = header->y = 0;
+    header->width  = videoWidth;
+    header->height = videoHeight;
+    signal.Video(OPAL_VIDEO_FRAME_DATA_PTR(header), videoWidth, videoHeight, s);
+  }
+
+  // Packets kept for the decode pass, whole frames only
+  PBYTEArray packets(PluginCodec_RTP_MaxPacketSize*MAX_KEPT_PACKETS);
+  PBYTEArray scratch(PluginCodec_RTP_MaxPacketSize);
+  std::vector<unsigned> packetLen;
+  packetLen.reserve(MAX_KEPT_PACKETS);
+  std::vector<unsigned> frameBytes(total);
+  std::vector<int> status(total);
+  PBoolean keep = TRUE;
+  PBYTEArray decoded(PluginCodec_RTP_MinHeaderSize + sizeof(PluginCodec_Video_FrameHeader) + MAX_VIDEO_WIDTH*MAX_VIDEO_HEIGHT*3/2);
+
+  CodecBenchResult enc(PString(encoder->sourceFormat) + "|" + encoder->destFormat, "video", "encode", 1000000/frameRate);
+
+  void * context = encoder->createCodec != NULL ? (*encoder->createCodec)(encoder) : NULL;
+  SetVideoOptions(encoder, context, videoWidth, videoHeight);
+
+  // The whole batch after the warm up is timed and divided by the frame count
+  PINDEX offset = 0;
+  PInt64 allocations = 0;
+  PUInt64 start = 0;
+  for (unsigned f = 0; f < total; f++) {
+    if (f == WARMUP_FRAMES) {
+      allocations = AllocationCount();
+      start = Timestamp();
+    }
+
+    BYTE * frame = raw.GetPointer() + (f % VIDEO_SOURCE_FRAMES)*rawSize;
+    PluginCodec_RTP_SetTimestamp(frame, f*90000/frameRate);
+
+    unsigned bytesOut = 0;
+    int ok = 1;
+    unsigned flags = 0;
+    unsigned packetCount = 0;
+    // Stop keeping packets once a whole frame may no longer fit
+    if (offset + PluginCodec_RTP_MaxPacketSize*MAX_VIDEO_PACKETS > packets.GetSize())
+      keep = FALSE;
+
+    do {
+      BYTE * to = keep ? packets.GetPointer() + offset : scratch.GetPointer();
+      unsigned fromLen = rawSize;
+      unsigned toLen = PluginCodec_RTP_MaxPacketSize;
+      flags = f == 0 ? PluginCodec_CoderForceIFrame : 0;
+      ok &= (encoder->codecFunction)(encoder, context, frame, &fromLen, to, &toLen, &flags) != 0;
+      if (toLen > 0) {
+        bytesOut += toLen;
+        if (keep) {
+          packetLen.push_back(toLen);
+          offset += PluginCodec_RTP_MaxPacketSize;
+        }
+      }
+    } while (ok && (flags & PluginCodec_ReturnCoderLastFrame) == 0 && ++packetCount < MAX_VIDEO_PACKETS);
+
+    frameBytes[f] = bytesOut;
+    status[f] = ok;
+  }
+  enc.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    enc.allocations = AllocationCount() - allocations;
+  if (encoder->destroyCodec != NULL)
+    (*encoder->destroyCodec)(encoder, context);
+
+  for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+    enc.frames++;
+    enc.bytesIn += yuvSize;
+    enc.bytesOut += frameBytes[f];
+    if (!status[f])
+      enc.failures++;
+  }
+  results.push_back(enc);
+
+  if (decoder == NULL || packetLen.empty())
+    return;
+
+  // Decode the packets kept from the encode pass, timed as one batch
+  CodecBenchResult dec(PString(decoder->sourceFormat) + "|" + decoder->destFormat, "video", "decode", enc.usPerFrame);
+
+  context = decoder->createCodec != NULL ? (*decoder->createCodec)(decoder) : NULL;
+  allocations = AllocationCount();
+  start = Timestamp();
+  for (size_t p = 0; p < packetLen.size(); p++) {
+    unsigned fromLen = packetLen[p];
+    unsigned toLen = decoded.GetSize();
+    unsigned flags = 0;
+    int ok = (decoder->codecFunction)(decoder, context, packets.GetPointer() + p*PluginCodec_RTP_MaxPacketSize, &fromLen,
+                                      decoded.GetPointer(), &toLen, &flags);
+    dec.bytesIn += packetLen[p];
+    if (!ok)
+      dec.failures++;
+    if ((flags & PluginCodec_ReturnCoderLastFrame) != 0) {
+      dec.frames++;
+      dec.bytesOut += toLen;
+    }
+  }
+  dec.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    dec.allocations = AllocationCount() - allocations;
+  if (decoder->destroyCodec != NULL)
+    (*decoder->destroyCodec)(decoder, context);
+  results.push_back(dec);
+}
+
+#endif // H323_VIDEO
+
+
+#ifdef H323_H235
+
+void CodecBenchProcess::BenchmarkCrypto(const char * name, const char * oid, PINDEX keyLength, PINDEX payloadSize, PBoolean inPlace)
+{
+  PTRACE(3, "Bench\tCrypto " << name << ", " << payloadSize << " byte payloads" << (inPlace ? " in place" : " copied"));
+
+  TestSignal signal;
+  PBYTEArray key(keyLength);
+  for (PINDEX i = 0; i < keyLength; i++)
+    key[i] = (BYTE)signal.Noise(127);
+
+  H235CryptoEngine encryptor(oid, key);
+  H235CryptoEngine decryptor(oid, key);
+
+  // Payloads and IVs are prepared outside of the measurement, each payload
+  // with room for the padding
+  unsigned total = frameCount + WARMUP_FRAMES;
+  PINDEX stride = payloadSize + encryptor.GetEncryptBlockSize();
+  PBYTEArray plain(payloadSize*total);
+  for (PINDEX i = 0; i < plain.GetSize(); i++)
+    plain[i] = (BYTE)signal.Noise(127);
+
+  PBYTEArray buffers(stride*total);
+  for (unsigned f = 0; f < total; f++)
+    memcpy(buffers.GetPointer() + f*stride, (const BYTE *)plain + f*payloadSize, payloadSize);
+
+  // The IV sequence is the RTP sequence number and timestamp
+  PBYTEArray ivs(6*total);
+  for (unsigned f = 0; f < total; f++) {
+    BYTE * iv = ivs.GetPointer() + f*6;
+    iv[0] = (BYTE)(f >> 8);
+    iv[1] = (BYTE)f;
+    DWORD timestamp = f*160;
+    iv[2] = (BYTE)(timestamp >> 24);
+    iv[3] = (BYTE)(timestamp >> 16);
+    iv[4] = (BYTE)(timestamp >> 8);
+    iv[5] = (BYTE)timestamp;
+  }
+
+  std::vector<PINDEX> lengths(total);
+  std::vector<PBYTEArray> copies(inPlace ? 0 : total);
+
+  CodecBenchResult enc(PString(name) + "|" + PString(payloadSize) + (inPlace ? " bytes in place" : " bytes copied"),
+                       "crypto", "encrypt", payloadSize*125);   // at 64 kbit/s
+
+  // The whole batch is timed and divided by the frame count
+  PInt64 allocations = 0;
+  PUInt64 start = 0;
+  for (unsigned f = 0; f < total; f++) {
+    if (f == WARMUP_FRAMES) {
+      allocations = AllocationCount();
+      start = Timestamp();
+    }
+    bool padding = false;
+    unsigned char * iv = ivs.GetPointer() + f*6;
+    if (inPlace)
+      lengths[f] = encryptor.EncryptInPlace(buffers.GetPointer() + f*stride, payloadSize, iv, padding);
+    else {
+      copies[f] = encryptor.Encrypt(PBYTEArray((const BYTE *)plain + f*payloadSize, payloadSize), iv, padding);
+      lengths[f] = copies[f].GetSize();
+    }
+  }
+  enc.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    enc.allocations = AllocationCount() - allocations;
+
+  for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+    enc.frames++;
+    enc.bytesIn += payloadSize;
+    enc.bytesOut += lengths[f];
+    if (lengths[f] == 0)
+      enc.failures++;
+  }
+  results.push_back(enc);
+
+  CodecBenchResult dec(enc.name, "crypto", "decrypt", enc.usPerFrame);
+
+  std::vector<PINDEX> decodedLengths(total);
+  for (unsigned f = 0; f < total; f++) {
+    if (f == WARMUP_FRAMES) {
+      allocations = AllocationCount();
+      start = Timestamp();
+    }
+    bool padding = lengths[f] > payloadSize;
+    unsigned char * iv = ivs.GetPointer() + f*6;
+    if (inPlace)
+      decodedLengths[f] = decryptor.DecryptInPlace(buffers.GetPointer() + f*stride, lengths[f], iv, padding);
+    else {
+      copies[f] = decryptor.Decrypt(copies[f], iv, padding);
+      decodedLengths[f] = copies[f].GetSize();
+    }
+  }
+  dec.microseconds = Timestamp() - start;
+  if (allocations >= 0)
+    dec.allocations = AllocationCount() - allocations;
+
+  // Checked after the measurement, a wrong result counts as a failure
+  for (unsigned f = WARMUP_FRAMES; f < total; f++) {
+    const BYTE * result = inPlace ? (const BYTE *)buffers + f*stride : (const BYTE *)copies[f];
+    dec.frames++;
+    dec.bytesIn += lengths[f];
+    dec.bytesOut += decodedLengths[f];
+    if (decodedLengths[f] != payloadSize || memcmp(result, (const BYTE *)plain + f*payloadSize, payloadSize) != 0)
+      dec.failures++;
+  }
+  results.push_back(dec);
+}
+
+#endif // H323_H235
+
+
+void CodecBenchProcess::Output(ostream & strm, PBoolean json) const
+{
+  strm << setprecision(6);
+
+  if (json)
+    strm << "[\n";
+  else
+    strm << "codec,media,direction,frames,frames_per_sec,ns_per_frame,realtime_factor,allocs_per_frame,bytes_in,bytes_out,failures\n";
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const CodecBenchResult & r = results[i];
+    double realtime = r.microseconds > 0 ? (double)r.usPerFrame*r.frames/r.microseconds : 0;
+    if (json)
+      strm << "  { \"codec\": \"" << r.name << "\""
+              ", \"media\": \"" << r.mediaType << "\""
+              ", \"direction\": \"" << r.direction << "\""
+              ", \"frames\": " << r.frames <<
+              ", \"frames_per_sec\": " << r.FramesPerSecond() <<
+              ", \"ns_per_frame\": " << r.NanosecondsPerFrame() <<
+              ", \"realtime_factor\": " << realtime <<
+              ", \"allocs_per_frame\": " << r.AllocationsPerFrame() <<
+              ", \"bytes_in\": " << r.bytesIn <<
+              ", \"bytes_out\": " << r.bytesOut <<
+              ", \"failures\": " << r.failures <<
+              " }" << (i+1 < results.size() ? ",\n" : "\n");
+    else
+      strm << r.name << ',' << r.mediaType << ',' << r.direction << ','
+           << r.frames << ',' << r.FramesPerSecond() << ',' << r.NanosecondsPerFrame() << ','
+           << realtime << ',' << r.AllocationsPerFrame() << ','
+           << r.bytesIn << ',' << r.bytesOut << ',' << r.failures << '\n';
+  }
+
+  if (json)
+    strm << "]\n";
+  strm.flush();
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,109 @@
+/*
+ * main.h
+ *
+ * Plugin codec benchmark for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _CodecBench_MAIN_H
+#define _CodecBench_MAIN_H
+
+#include <h323.h>
+#include <h323pluginmgr.h>
+
+#ifdef H323_AUDIO_CODECS
+#include <codecs.h>
+#endif
+
+#ifdef H323_H235
+#include <h235/h235crypto.h>
+#endif
+
+#if PTLIB_VER < 2130
+#if !defined(P_USE_STANDARD_CXX_BOOL) && !defined(P_USE_INTEGER_BOOL)
+    typedef int PBoolean;
+#endif
+#endif
+
+/**Result of one codec direction.
+  */
+struct CodecBenchResult
+{
+  CodecBenchResult(const PString & _name = PString(), const char * _mediaType = "", const char * _direction = "", unsigned _usPerFrame = 0)
+    : name(_name), mediaType(_mediaType), direction(_direction),
+      frames(0), bytesIn(0), bytesOut(0), microseconds(0), allocations(-1), failures(0), usPerFrame(_usPerFrame) { }
+
+  PString  name;            ///< Conversion, eg "L16|GSM-06.10"
+  PString  mediaType;       ///< "audio", "video" or "crypto"
+  PString  direction;       ///< "encode" or "decode", "encrypt" or "decrypt"
+  unsigned frames;          ///< Frames processed
+  PUInt64  bytesIn;         ///< Bytes handed to the codec
+  PUInt64  bytesOut;        ///< Bytes returned by the codec
+  PUInt64  microseconds;    ///< Time taken by the whole batch of frames
+  PInt64   allocations;     ///< Heap allocations, -1 if not available
+  unsigned failures;        ///< Codec function calls returning 0
+  unsigned usPerFrame;      ///< Media time of one frame
+
+  double FramesPerSecond() const { return microseconds > 0 ? frames*1e6/microseconds : 0; }
+  double NanosecondsPerFrame() const { return frames > 0 ? microseconds*1e3/frames : 0; }
+  double AllocationsPerFrame() const { return allocations < 0 || frames == 0 ? -1 : (double)allocations/frames; }
+};
+
+
+class CodecBenchProcess : public PProcess
+{
+  PCLASSINFO(CodecBenchProcess, PProcess)
+
+  public:
+    CodecBenchProcess();
+
+    void Main();
+
+  protected:
+    void BenchmarkAudio(const PluginCodec_Definition * encoder, const PluginCodec_Definition * decoder);
+#ifdef H323_VIDEO
+    void BenchmarkVideo(const PluginCodec_Definition * encoder, const PluginCodec_Definition * decoder);
+#endif
+#ifdef H323_AUDIO_CODECS
+    void BenchmarkG711(const char * format,
+                       void (*encodeBlock)(const short *, BYTE *, unsigned),
+                       void (*decodeBlock)(const BYTE *, short *, unsigned),
+                       int (*encodeSample)(short),
+                       short (*decodeSample)(int));
+#endif
+#ifdef H323_H235
+    void BenchmarkCrypto(const char * name, const char * oid, PINDEX keyLength, PINDEX payloadSize, PBoolean inPlace);
+#endif
+    void Output(ostream & strm, PBoolean json) const;
+
+    static const PluginCodec_Definition * GetDefinition(const PString & name);
+
+    unsigned frameCount;
+    unsigned videoWidth;
+    unsigned videoHeight;
+    std::vector<CodecBenchResult> results;
+};
+
+
+#endif  // _CodecBench_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,323 @@
+/*
+ * main.cxx
+ *
+ * File transfer loopback check for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include "main.h"
+#include "../../version.h"
+
+PCREATE_PROCESS(FTLoopbackProcess);
+
+#define RECEIVER_PORT     1730
+#define SENDER_PORT       1731
+#define CALL_TIMEOUT      10000    // ms
+#define TRANSFER_TIMEOUT  120000   // ms
+
+
+///////////////////////////////////////////////////////////////
+
+#ifdef H323_FILE
+
+FTLoopbackHandler::FTLoopbackHandler(H323Connection & connection,
+                                     unsigned sessionID,
+                                     H323Channel::Directions dir,
+                                     H323FileTransferList & filelist,
+                                     FTLoopbackProcess & _process)
+  : H323FileTransferHandler(connection, sessionID, dir, filelist),
+    process(_process), dataFrames(0), holding(FALSE)
+{
+}
+
+
+void FTLoopbackHandler::OnFileComplete(const PString & filename)
+{
+  PTRACE(3, "FTLoop\tCompleted " << filename);
+  process.finished.Signal();
+}
+
+
+void FTLoopbackHandler::OnError(const PString errMsg)
+{
+  PTRACE(2, "FTLoop\tTransfer error " << errMsg);
+  process.failed = TRUE;
+  process.finished.Signal();
+}
+
+
+PBoolean FTLoopbackHandler::WriteFrame(PBoolean final)
+{
+  H323FilePacket packet;
+  PINDEX size = transmitFrame.GetPayloadSize();
+  memcpy(packet.GetPointer(size), transmitFrame.GetPayloadPtr(), size);
+  if (size == 0 || packet.GetPacketType() != H323FilePacket::e_DATA)
+    return H323FileTransferHandler::WriteFrame(final);
+
+  dataFrames++;
+  if (process.dropEvery > 0 && dataFrames % process.dropEvery == 0) {
+    PTRACE(4, "FTLoop\tDropped DATA packet " << dataFrames);
+    return TRUE;
+  }
+
+  if (!holding && process.reorderEvery > 0 && dataFrames % process.reorderEvery == 0) {
+    PTRACE(4, "FTLoop\tHolding DATA packet " << dataFrames << " back");
+    held = transmitFrame;
+    held.MakeUnique();
+    held.SetMarker(final);
+    holding = TRUE;
+    return TRUE;
+  }
+
+  if (!H323FileTransferHandler::WriteFrame(final))
+    return FALSE;
+
+  if (!holding)
+    return TRUE;
+
+  // Send the held packet after this one, the base class sends transmitFrame
+  holding = FALSE;
+  RTP_DataFrame current = transmitFrame;
+  transmitFrame = held;
+  PBoolean ok = H323FileTransferHandler::WriteFrame(held.GetMarker());
+  transmitFrame = current;
+  return ok;
+}
+
+
+///////////////////////////////////////////////////////////////
+
+FTLoopbackConnection::FTLoopbackConnection(H323EndPoint & endpoint, unsigned callReference, FTLoopbackProcess & _process)
+  : H323Connection(endpoint, callReference), process(_process)
+{
+}
+
+
+H323FileTransferHandler * FTLoopbackConnection::OnCreateFileTransferHandler(unsigned sessionID,
+                                                                          H323Channel::Directions dir,
+                                                                          H323FileTransferList & filelist)
+{
+  return new FTLoopbackHandler(*this, sessionID, dir, filelist, process);
+}
+
+
+///////////////////////////////////////////////////////////////
+
+FTLoopbackEndPoint::FTLoopbackEndPoint(FTLoopbackProcess & _process, const PDirectory & _saveDirectory)
+  : process(_process), saveDirectory(_saveDirectory)
+{
+  DisableFastStart(TRUE);
+  SetCapability(0, 0, new H323FileTransferCapability(1000000, H323FileTransferCapability::e_1428));
+}
+
+
+H323Connection * FTLoopbackEndPoint::CreateConnection(unsigned callReference)
+{
+  return new FTLoopbackConnection(*this, callReference, process);
+}
+
+
+void FTLoopbackEndPoint::OnConnectionEstablished(H323Connection &, const PString & token)
+{
+  PTRACE(3, "FTLoop\tEstablished " << token);
+  process.established.Signal();
+}
+
+
+PBoolean FTLoopbackEndPoint::OpenFileTransferChannel(H323Connection &, PBoolean, H323FileTransferList & filelist)
+{
+  filelist.SetSaveDirectory(saveDirectory);
+  return TRUE;
+}
+
+#endif // H323_FILE
+
+
+///////////////////////////////////////////////////////////////
+
+FTLoopbackProcess::FTLoopbackProcess()
+  : PProcess("H323Plus", "ftloopback", MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER),
+    dropEvery(7), reorderEvery(5), failed(FALSE)
+{
+}
+
+
+void FTLoopbackProcess::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse(
+             "d-drop:"
+             "h-help."
+             "r-reorder:"
+             "s-size:"
+#if PTRACING
+             "t-trace."
+             "-trace-file:"
+#endif
+          , FALSE);
+
+  if (args.HasOption('h')) {
+    cerr << "Usage : " << GetName() << " [options]\n"
+            "Options:\n"
+            "  -s --size n             : Bytes in the test file (default 300000).\n"
+            "  -d --drop n             : Drop every nth DATA packet, 0 for none (default 7).\n"
+            "  -r --reorder n          : Send every nth DATA packet after the next (default 5).\n"
+#if PTRACING
+            "  -t --trace              : Enable trace, use multiple times for more detail.\n"
+            "     --trace-file file    : Specify filename for trace output.\n"
+#endif
+            "  -h --help               : This help message.\n"
+            "\n"
+            "Sends a file between two endpoints over the loopback interface with the\n"
+            "windowed file transfer and checks the received copy is identical.\n";
+    return;
+  }
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption("trace-file") ? (const char *)args.GetOptionString("trace-file") : NULL,
+                     PTrace::Timestamp|PTrace::Thread|PTrace::FileAndLine);
+#endif
+
+#ifndef H323_FILE
+  cerr << "File transfer is not enabled in this build" << endl;
+  SetTerminationValue(1);
+#else
+  if (args.HasOption('d'))
+    dropEvery = args.GetOptionString('d').AsUnsigned();
+  if (args.HasOption('r'))
+    reorderEvery = args.GetOptionString('r').AsUnsigned();
+  PINDEX size = args.HasOption('s') ? (PINDEX)args.GetOptionString('s').AsUnsigned() : 300000;
+
+  // Deterministic contents so a failure can be reproduced
+  PDirectory sendDirectory = PDirectory() + "ftloopback-send";
+  PDirectory saveDirectory = PDirectory() + "ftloopback-recv";
+  PDirectory::Create(sendDirectory);
+  PDirectory::Create(saveDirectory);
+
+  PString filename = "ftloopback.bin";
+  PFilePath sent = sendDirectory + filename;
+  PFilePath received = saveDirectory + filename;
+  PFile::Remove(received);
+  {
+    PBYTEArray data(size);
+    unsigned seed = 0x12345678;
+    for (PINDEX i = 0; i < size; i++) {
+      seed = seed*1103515245 + 12345;
+      data[i] = (BYTE)(seed >> 16);
+    }
+    PFile file(sent, PFile::WriteOnly);
+    if (!file.IsOpen() || !file.Write(data, size)) {
+      cerr << "Could not create " << sent << endl;
+      SetTerminationValue(1);
+      return;
+    }
+  }
+
+  FTLoopbackEndPoint receiver(*this, saveDirectory);
+  FTLoopbackEndPoint sender(*this, sendDirectory);
+  receiver.SetLocalUserName("receiver");
+  sender.SetLocalUserName("sender");
+
+  if (!receiver.StartListener(new H323ListenerTCP(receiver, PIPSocket::Address("127.0.0.1"), RECEIVER_PORT)) ||
+      !sender.StartListener(new H323ListenerTCP(sender, PIPSocket::Address("127.0.0.1"), SENDER_PORT))) {
+    cerr << "Could not listen on ports " << RECEIVER_PORT << " and " << SENDER_PORT << endl;
+    SetTerminationValue(1);
+    return;
+  }
+
+  PString token;
+  if (sender.MakeCall(psprintf("127.0.0.1:%u", RECEIVER_PORT), token) == NULL || !established.Wait(CALL_TIMEOUT)) {
+    cerr << "Loopback call failed" << endl;
+    SetTerminationValue(1);
+    return;
+  }
+
+  H323FileTransferList list;
+  list.Add(filename, sendDirectory, size);
+  list.SetDirection(H323Channel::IsTransmitter);
+
+  H323ChannelNumber channel;
+  PTime start;
+  if (!sender.OpenFileTransferSession(list, token, channel)) {
+    cerr << "Could not open the file transfer channel" << endl;
+    failed = TRUE;
+  }
+  else if (!finished.Wait(TRANSFER_TIMEOUT)) {
+    cerr << "Transfer timed out" << endl;
+    failed = TRUE;
+  }
+
+  PTimeInterval duration = PTime() - start;
+  sender.ClearCallSynchronous(token);
+
+  // The first completion may be the sender's, give the receiver time to flush
+  PFileInfo info;
+  for (int wait = 0; !failed && wait < 50 && !(PFile::GetInfo(received, info) && info.size >= (PUInt64)size); wait++)
+    PThread::Sleep(100);
+
+  if (failed || !Compare(sent, received)) {
+    cout << "FAIL " << filename << " (" << size << " bytes, drop 1/" << dropEvery << ", reorder 1/" << reorderEvery << ")" << endl;
+    SetTerminationValue(1);
+  }
+  else
+    cout << "PASS " << filename << " (" << size << " bytes, drop 1/" << dropEvery << ", reorder 1/" << reorderEvery
+         << ") in " << duration << 's' << endl;
+#endif
+}
+
+
+PBoolean FTLoopbackProcess::Compare(const PFilePath & sent, const PFilePath & received)
+{
+  PFile a(sent, PFile::ReadOnly);
+  PFile b(received, PFile::ReadOnly);
+  if (!a.IsOpen() || !b.IsOpen()) {
+    cerr << "Could not open " << (a.IsOpen() ? received : sent) << endl;
+    return FALSE;
+  }
+
+  if (a.GetLength() != b.GetLength()) {
+    cerr << "Received " << b.GetLength() << " bytes, sent " << a.GetLength() << endl;
+    return FALSE;
+  }
+
+  BYTE bufA[4096], bufB[4096];
+  off_t position = 0;
+  while (a.Read(bufA, sizeof(bufA)) && a.GetLastReadCount() > 0) {
+    PINDEX count = a.GetLastReadCount();
+    if (!b.ReadBlock(bufB, count) || memcmp(bufA, bufB, count) != 0) {
+      cerr << "Files differ in the " << sizeof(bufA) << " bytes at " << position << endl;
+      return FALSE;
+    }
+    position += count;
+  }
+
+  return TRUE;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,133 @@
+/*
+ * main.h
+ *
+ * File transfer loopback check for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _FTLoopback_MAIN_H
+#define _FTLoopback_MAIN_H
+
+#include <h323.h>
+
+#ifdef H323_FILE
+#include <h323filetransfer.h>
+#endif
+
+#if PTLIB_VER < 2130
+#if !defined(P_USE_STANDARD_CXX_BOOL) && !defined(P_USE_INTEGER_BOOL)
+    typedef int PBoolean;
+#endif
+#endif
+
+#ifdef H323_FILE
+
+class FTLoopbackProcess;
+
+/**File transfer handler that drops and reorders the DATA packets it sends,
+   and reports the end of a transfer to the process.
+  */
+class FTLoopbackHandler : public H323FileTransferHandler
+{
+  PCLASSINFO(FTLoopbackHandler, H323FileTransferHandler);
+  public:
+    FTLoopbackHandler(
+      H323Connection & connection,
+      unsigned sessionID,
+      H323Channel::Directions dir,
+      H323FileTransferList & filelist,
+      FTLoopbackProcess & process
+    );
+
+    virtual void OnFileComplete(const PString & filename);
+    virtual void OnError(const PString errMsg);
+
+  protected:
+    virtual PBoolean WriteFrame(PBoolean final);
+
+    FTLoopbackProcess & process;
+    unsigned            dataFrames;
+    RTP_DataFrame       held;         ///< Frame sent after the next one
+    PBoolean            holding;
+};
+
+
+class FTLoopbackConnection : public H323Connection
+{
+  PCLASSINFO(FTLoopbackConnection, H323Connection);
+  public:
+    FTLoopbackConnection(H323EndPoint & endpoint, unsigned callReference, FTLoopbackProcess & process);
+
+    virtual H323FileTransferHandler * OnCreateFileTransferHandler(
+      unsigned sessionID,
+      H323Channel::Directions dir,
+      H323FileTransferList & filelist
+    );
+
+  protected:
+    FTLoopbackProcess & process;
+};
+
+
+class FTLoopbackEndPoint : public H323EndPoint
+{
+  PCLASSINFO(FTLoopbackEndPoint, H323EndPoint);
+  public:
+    FTLoopbackEndPoint(FTLoopbackProcess & process, const PDirectory & saveDirectory);
+
+    virtual H323Connection * CreateConnection(unsigned callReference);
+    virtual void OnConnectionEstablished(H323Connection & connection, const PString & token);
+    virtual PBoolean OpenFileTransferChannel(H323Connection & connection, PBoolean isEncoder, H323FileTransferList & filelist);
+
+  protected:
+    FTLoopbackProcess & process;
+    PDirectory          saveDirectory;
+};
+
+#endif // H323_FILE
+
+
+class FTLoopbackProcess : public PProcess
+{
+  PCLASSINFO(FTLoopbackProcess, PProcess)
+
+  public:
+    FTLoopbackProcess();
+
+    void Main();
+
+    // Loss simulated on the sending side
+    unsigned dropEvery;       ///< Drop every nth DATA packet, 0 for none
+    unsigned reorderEvery;    ///< Delay every nth DATA packet past the next, 0 for none
+
+    PSyncPoint established;
+    PSyncPoint finished;
+    PBoolean   failed;
+
+  protected:
+    PBoolean Compare(const PFilePath & sent, const PFilePath & received);
+};
+
+
+#endif  // _FTLoopback_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,365 @@
+/*
+ * capture.cxx
+ *
+ * pcap and pcap-ng reader for the H323Plus capture replay load test.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "capture.h"
+
+#define PCAP_MAGIC           0xa1b2c3d4
+#define PCAP_MAGIC_NS        0xa1b23c4d
+#define PCAPNG_SECTION       0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER    0x1a2b3c4d
+#define PCAPNG_INTERFACE     1
+#define PCAPNG_PACKET        2     // Obsolete
+#define PCAPNG_SIMPLE        3
+#define PCAPNG_ENHANCED      6
+
+#define LINK_NULL            0
+#define LINK_ETHERNET        1
+#define LINK_RAW             12    // Raw IP on some BSDs
+#define LINK_RAW_IP          101
+#define LINK_LINUX_SLL       113
+#define LINK_IPV4            228
+#define LINK_LINUX_SLL2      276
+
+static inline DWORD Swap32(DWORD v)
+{
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+
+CaptureFile::CaptureFile()
+  : position(0), swapped(FALSE), pcapng(FALSE), nanoseconds(FALSE), legacyLinkType(0), skipped(0)
+{
+}
+
+
+PBoolean CaptureFile::Open(const PFilePath & filename)
+{
+  PFile file;
+  if (!file.Open(filename, PFile::ReadOnly)) {
+    PTRACE(1, "Capture\tCould not open " << filename);
+    return FALSE;
+  }
+
+  PINDEX length = (PINDEX)file.GetLength();
+  if (length < 24 || !file.Read(data.GetPointer(length), length) || file.GetLastReadCount() != length) {
+    PTRACE(1, "Capture\tCould not read " << filename);
+    return FALSE;
+  }
+
+  position = 0;
+  swapped = FALSE;
+  interfaces.clear();
+  skipped = 0;
+
+  DWORD magic = Get32(0);
+  if (magic == PCAPNG_SECTION) {
+    pcapng = TRUE;
+    swapped = *(const DWORD *)((const BYTE *)data + 8) != PCAPNG_BYTE_ORDER;
+    if (swapped && Swap32(*(const DWORD *)((const BYTE *)data + 8)) != PCAPNG_BYTE_ORDER) {
+      PTRACE(1, "Capture\tBad pcap-ng byte order magic in " << filename);
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  pcapng = FALSE;
+  swapped = magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS;
+  if (swapped)
+    magic = Swap32(magic);
+  if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+    PTRACE(1, "Capture\tNot a pcap or pcap-ng file: " << filename);
+    return FALSE;
+  }
+
+  nanoseconds = magic == PCAP_MAGIC_NS;
+  legacyLinkType = Get32(20) & 0xffff;
+  position = 24;
+  return TRUE;
+}
+
+
+PBoolean CaptureFile::ReadPacket(CapturePacket & packet)
+{
+  while (position < data.GetSize()) {
+    if (pcapng ? ReadBlock(packet) : ReadLegacy(packet))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+
+DWORD CaptureFile::Get32(PINDEX offset) const
+{
+  DWORD v = *(const DWORD *)((const BYTE *)data + offset);
+  return swapped ? Swap32(v) : v;
+}
+
+
+WORD CaptureFile::Get16(PINDEX offset) const
+{
+  WORD v = *(const WORD *)((const BYTE *)data + offset);
+  return (WORD)(swapped ? ((v >> 8) | (v << 8)) : v);
+}
+
+
+PBoolean CaptureFile::ReadLegacy(CapturePacket & packet)
+{
+  if (position + 16 > data.GetSize()) {
+    position = data.GetSize();
+    return FALSE;
+  }
+
+  DWORD seconds = Get32(position);
+  DWORD fraction = Get32(position+4);
+  PINDEX captured = Get32(position+8);
+  PINDEX offset = position + 16;
+
+  if (offset + captured > data.GetSize()) {
+    PTRACE(2, "Capture\tTruncated capture file");
+    position = data.GetSize();
+    return FALSE;
+  }
+  position = offset + captured;
+
+  packet.time = (PInt64)seconds*1000000 + (nanoseconds ? fraction/1000 : fraction);
+
+  Interface iface;
+  iface.linkType = legacyLinkType;
+  iface.unitsPerSecond = 1000000;
+  return DecodeLink(iface, offset, captured, packet);
+}
+
+
+PBoolean CaptureFile::ReadBlock(CapturePacket & packet)
+{
+  if (position + 12 > data.GetSize()) {
+    position = data.GetSize();
+    return FALSE;
+  }
+
+  DWORD type = Get32(position);
+  PINDEX length = Get32(position+4);
+  if (length < 12 || position + length > data.GetSize()) {
+    PTRACE(2, "Capture\tTruncated or corrupt pcap-ng block");
+    position = data.GetSize();
+    return FALSE;
+  }
+
+  PINDEX body = position + 8;
+  PINDEX bodyLength = length - 12;
+  position += length;
+
+  switch (type) {
+    case PCAPNG_SECTION :
+      // byte order may change from one section to the next
+      swapped = *(const DWORD *)((const BYTE *)data + body) != PCAPNG_BYTE_ORDER;
+      interfaces.clear();
+      return FALSE;
+
+    case PCAPNG_INTERFACE :
+      ReadInterface(body, bodyLength);
+      return FALSE;
+
+    case PCAPNG_ENHANCED :
+    case PCAPNG_PACKET :
+    {
+      if (bodyLength < 20)
+        return FALSE;
+      unsigned id = type == PCAPNG_ENHANCED ? Get32(body) : Get16(body);
+      if (id >= interfaces.size()) {
+        skipped++;
+        return FALSE;
+      }
+      const Interface & iface = interfaces[id];
+      PInt64 stamp = ((PInt64)Get32(body+4) << 32) | Get32(body+8);
+      packet.time = iface.unitsPerSecond >= 1000000 ? stamp/(iface.unitsPerSecond/1000000)
+                                                    : stamp*(1000000/iface.unitsPerSecond);
+      PINDEX captured = Get32(body+12);
+      if (captured > bodyLength - 20)
+        return FALSE;
+      return DecodeLink(iface, body + 20, captured, packet);
+    }
+
+    case PCAPNG_SIMPLE :
+      // no timestamp, keep the previous one
+      if (interfaces.empty() || bodyLength < 4)
+        return FALSE;
+      return DecodeLink(interfaces[0], body + 4, bodyLength - 4, packet);
+  }
+
+  return FALSE;
+}
+
+
+void CaptureFile::ReadInterface(PINDEX body, PINDEX length)
+{
+  Interface iface;
+  iface.linkType = Get16(body);
+  iface.unitsPerSecond = 1000000;
+
+  // look for if_tsresol among the options
+  PINDEX option = body + 8;
+  PINDEX end = body + length;
+  while (option + 4 <= end) {
+    WORD code = Get16(option);
+    WORD size = Get16(option+2);
+    if (code == 0 || option + 4 + size > end)
+      break;
+    if (code == 9 && size >= 1) {
+      BYTE resolution = ((const BYTE *)data)[option+4];
+      PInt64 units = 1;
+      for (unsigned i = 0; i < (unsigned)(resolution & 0x7f) && units < 1000000000000LL; i++)
+        units *= (resolution & 0x80) != 0 ? 2 : 10;
+      iface.unitsPerSecond = units;
+    }
+    option += 4 + ((size + 3) & ~3);
+  }
+
+  interfaces.push_back(iface);
+}
+
+
+PBoolean CaptureFile::DecodeLink(const Interface & iface, PINDEX offset, PINDEX length, CapturePacket & packet)
+{
+  const BYTE * ptr = (const BYTE *)data + offset;
+
+  // strip the link layer down to the IP header
+  switch (iface.linkType) {
+    case LINK_NULL :
+      if (length < 4 || (ptr[0] != 2 && ptr[3] != 2)) {   // AF_INET in either byte order
+        skipped++;
+        return FALSE;
+      }
+      ptr += 4;
+      length -= 4;
+      break;
+
+    case LINK_ETHERNET :
+    {
+      if (length < 14) {
+        skipped++;
+        return FALSE;
+      }
+      WORD etherType = (WORD)((ptr[12] << 8) | ptr[13]);
+      ptr += 14;
+      length -= 14;
+      while (etherType == 0x8100 && length >= 4) {   // VLAN tags
+        etherType = (WORD)((ptr[2] << 8) | ptr[3]);
+        ptr += 4;
+        length -= 4;
+      }
+      if (etherType != 0x0800) {
+        skipped++;
+        return FALSE;
+      }
+      break;
+    }
+
+    case LINK_LINUX_SLL :
+      if (length < 16 || ptr[14] != 0x08 || ptr[15] != 0x00) {
+        skipped++;
+        return FALSE;
+      }
+      ptr += 16;
+      length -= 16;
+      break;
+
+    case LINK_LINUX_SLL2 :
+      if (length < 20 || ptr[0] != 0x08 || ptr[1] != 0x00) {
+        skipped++;
+        return FALSE;
+      }
+      ptr += 20;
+      length -= 20;
+      break;
+
+    case LINK_RAW :
+    case LINK_RAW_IP :
+    case LINK_IPV4 :
+      break;
+
+    default :
+      skipped++;
+      return FALSE;
+  }
+
+  // IPv4, unfragmented
+  if (length < 20 || (ptr[0] >> 4) != 4) {
+    skipped++;
+    return FALSE;
+  }
+  PINDEX headerLength = (ptr[0] & 0x0f)*4;
+  PINDEX totalLength = (ptr[2] << 8) | ptr[3];
+  if (headerLength < 20 || totalLength < headerLength || (((ptr[6] & 0x3f) << 8) | ptr[7]) != 0) {   // more fragments or offset
+    skipped++;
+    return FALSE;
+  }
+  if (totalLength < length)
+    length = totalLength;    // Ethernet padding
+
+  packet.protocol = ptr[9];
+  packet.srcAddr = PIPSocket::Address(ptr[12], ptr[13], ptr[14], ptr[15]);
+  packet.dstAddr = PIPSocket::Address(ptr[16], ptr[17], ptr[18], ptr[19]);
+  ptr += headerLength;
+  length -= headerLength;
+
+  PINDEX transportLength;
+  switch (packet.protocol) {
+    case CapturePacket::UDP :
+      transportLength = 8;
+      packet.sequence = 0;
+      packet.tcpFlags = 0;
+      break;
+
+    case CapturePacket::TCP :
+      if (length < 20) {
+        skipped++;
+        return FALSE;
+      }
+      transportLength = (ptr[12] >> 4)*4;
+      packet.sequence = (ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
+      packet.tcpFlags = ptr[13];
+      break;
+
+    default :
+      skipped++;
+      return FALSE;
+  }
+
+  if (length < transportLength) {
+    skipped++;
+    return FALSE;
+  }
+
+  packet.srcPort = (WORD)((ptr[0] << 8) | ptr[1]);
+  packet.dstPort = (WORD)((ptr[2] << 8) | ptr[3]);
+  packet.payload = PBYTEArray(ptr + transportLength, length - transportLength);
+  return TRUE;
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,107 @@
+/*
+ * capture.h
+ *
+ * pcap and pcap-ng reader for the H323Plus capture replay load test.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _PcapReplay_CAPTURE_H
+#define _PcapReplay_CAPTURE_H
+
+#include <ptlib/sockets.h>
+#include <vector>
+
+/**One IPv4 TCP or UDP packet from a capture.
+  */
+struct CapturePacket
+{
+  enum {
+    TCP = 6,
+    UDP = 17
+  };
+
+  PInt64              time;         ///< Microseconds since 1970
+  BYTE                protocol;     ///< TCP or UDP
+  PIPSocket::Address  srcAddr;
+  WORD                srcPort;
+  PIPSocket::Address  dstAddr;
+  WORD                dstPort;
+  DWORD               sequence;     ///< TCP sequence number
+  BYTE                tcpFlags;
+  PBYTEArray          payload;
+};
+
+
+/**Read the IPv4 TCP and UDP packets of a libpcap or pcap-ng capture file,
+   in either byte order, on Ethernet, raw IP, BSD loopback and Linux
+   cooked links. Anything else, including fragments, is skipped.
+  */
+class CaptureFile : public PObject
+{
+  PCLASSINFO(CaptureFile, PObject)
+
+  public:
+    CaptureFile();
+
+    /**Read the whole capture into memory.
+      */
+    PBoolean Open(
+      const PFilePath & filename
+    );
+
+    /**Get the next TCP or UDP packet, FALSE at the end of the capture.
+      */
+    PBoolean ReadPacket(
+      CapturePacket & packet
+    );
+
+    /**Get the number of packets skipped as not IPv4 TCP or UDP.
+      */
+    unsigned GetSkipped() const { return skipped; }
+
+  protected:
+    struct Interface {
+      unsigned linkType;
+      PInt64   unitsPerSecond;    ///< Timestamp resolution
+    };
+
+    DWORD Get32(PINDEX offset) const;
+    WORD Get16(PINDEX offset) const;
+    PBoolean ReadLegacy(CapturePacket & packet);
+    PBoolean ReadBlock(CapturePacket & packet);
+    void ReadInterface(PINDEX body, PINDEX length);
+    PBoolean DecodeLink(const Interface & iface, PINDEX offset, PINDEX length, CapturePacket & packet);
+
+    PBYTEArray  data;
+    PINDEX      position;
+    PBoolean    swapped;
+    PBoolean    pcapng;
+    PBoolean    nanoseconds;
+    unsigned    legacyLinkType;
+    std::vector<Interface> interfaces;
+    unsigned    skipped;
+};
+
+
+#endif  // _PcapReplay_CAPTURE_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,1319 @@
+/*
+ * main.cxx
+ *
+ * Capture replay load test for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+#include <ptclib/delaychan.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include "main.h"
+#include "../../version.h"
+
+PCREATE_PROCESS(ReplayProcess);
+
+#define CAPTURE_SIGNALLING_PORT   1720
+#define CAPTURE_RAS_PORT          1719
+#define CAPTURE_DISCOVERY_PORT    1718
+#define RECEIVE_INTERVAL          50000   // Microseconds between checks while waiting
+
+
+static PInt64 Timestamp()
+{
+  PTime now;
+  return (PInt64)now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+}
+
+
+// User and system time of the whole process, including an in process target
+static PInt64 ProcessCPU()
+{
+#ifdef _WIN32
+  FILETIME created, exited, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+    return 0;
+  return ((((PInt64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+          (((PInt64)user.dwHighDateTime << 32) | user.dwLowDateTime))/10;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return (PInt64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000000 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+
+static PString AddressKey(const PIPSocket::Address & addr, WORD port)
+{
+  return addr.AsString() + ':' + PString(PString::Unsigned, port);
+}
+
+
+// An IPv4 address, and port if any, as they appear in an aligned PER encoding
+static PBYTEArray AddressBytes(const PIPSocket::Address & addr, WORD port, PBoolean withPort = TRUE)
+{
+  PBYTEArray bytes(withPort ? 6 : 4);
+  for (PINDEX i = 0; i < 4; i++)
+    bytes[i] = addr[i];
+  if (withPort) {
+    bytes[4] = (BYTE)(port >> 8);
+    bytes[5] = (BYTE)port;
+  }
+  return bytes;
+}
+
+
+struct FoundAddress
+{
+  PIPSocket::Address addr;
+  WORD               port;
+};
+
+// Find the transport addresses in an encoded PDU with one of the given hosts
+static std::vector<FoundAddress> FindAddresses(const PBYTEArray & data, const std::vector<PIPSocket::Address> & hosts)
+{
+  std::vector<FoundAddress> found;
+  const BYTE * ptr = data;
+  PINDEX size = data.GetSize();
+
+  PINDEX pos = 0;
+  while (pos + 6 <= size) {
+    size_t h;
+    for (h = 0; h < hosts.size(); h++) {
+      const PIPSocket::Address & host = hosts[h];
+      if (ptr[pos] == host[0] && ptr[pos+1] == host[1] && ptr[pos+2] == host[2] && ptr[pos+3] == host[3])
+        break;
+    }
+    if (h < hosts.size()) {
+      FoundAddress address;
+      address.addr = hosts[h];
+      address.port = (WORD)((ptr[pos+4] << 8) | ptr[pos+5]);
+      found.push_back(address);
+      pos += 6;
+    }
+    else
+      pos++;
+  }
+
+  return found;
+}
+
+
+static PString PhaseName(const PString & sent, const PString & received)
+{
+  return (sent.IsEmpty() ? PString("start") : sent) + " -> " + received;
+}
+
+
+static void SetIdentifier(PASN_Sequence & pdu, PINDEX field, PASN_BMPString & member, const PString & value)
+{
+  if (!pdu.HasOptionalField(field))
+    return;
+
+  // drop an identifier not yet learned from the target rather than send the captured one
+  if (value.IsEmpty())
+    pdu.RemoveOptionalField(field);
+  else
+    member = value;
+}
+
+
+/**Silent audio device for the in process endpoint, paced like a sound card.
+  */
+class ReplayNullChannel : public PChannel
+{
+  PCLASSINFO(ReplayNullChannel, PChannel);
+
+  public:
+    ReplayNullChannel() { os_handle = 0; }
+
+    virtual PBoolean Read(void * buf, PINDEX len)
+    {
+      memset(buf, 0, len);
+      delay.Delay(len/16);
+      lastReadCount = len;
+      return TRUE;
+    }
+
+    virtual PBoolean Write(const void *, PINDEX len)
+    {
+      delay.Delay(len/16);
+      lastWriteCount = len;
+      return TRUE;
+    }
+
+    virtual PBoolean Close()
+    {
+      os_handle = -1;
+      return TRUE;
+    }
+
+  protected:
+    PAdaptiveDelay delay;
+};
+
+
+///////////////////////////////////////////////////////////////
+
+PBoolean ReplayScript::Load(const PFilePath & filename)
+{
+  CaptureFile capture;
+  if (!capture.Open(filename))
+    return FALSE;
+
+  std::vector<CapturePacket> packets;
+  CapturePacket packet;
+  while (capture.ReadPacket(packet))
+    packets.push_back(packet);
+
+  PTRACE(3, "Replay\tRead " << packets.size() << " TCP and UDP packets, skipped " << capture.GetSkipped());
+
+  // the replayed endpoint is the first to talk to a gatekeeper or call signalling port
+  size_t i;
+  for (i = 0; i < packets.size(); i++) {
+    const CapturePacket & p = packets[i];
+    if (p.protocol == CapturePacket::UDP ? (p.dstPort == CAPTURE_RAS_PORT || p.dstPort == CAPTURE_DISCOVERY_PORT)
+                                         : p.dstPort == CAPTURE_SIGNALLING_PORT)
+      break;
+  }
+  if (i >= packets.size()) {
+    PTRACE(1, "Replay\tNo RAS or call signalling from an endpoint in " << filename);
+    return FALSE;
+  }
+  localAddr = packets[i].srcAddr;
+
+  for (i = 0; i < packets.size(); i++) {
+    const CapturePacket & p = packets[i];
+    if ((p.srcAddr != localAddr) == (p.dstAddr != localAddr))
+      continue;
+
+    PBoolean outgoing = p.srcAddr == localAddr;
+    unsigned channel = GetChannel(p);
+    if (channel == P_MAX_INDEX)
+      continue;
+
+    if (p.protocol == CapturePacket::TCP)
+      AddStream(channel, p, outgoing);
+    else if (p.payload.GetSize() > 0)
+      AddMessage(channel, outgoing, p.time, p.payload);
+  }
+
+  if (messages.empty()) {
+    PTRACE(1, "Replay\tNo H.225, H.245 or RTP for " << localAddr << " in " << filename);
+    return FALSE;
+  }
+
+  // times from the start, and what had been received before each message sent
+  PInt64 start = messages[0].time;
+  for (i = 0; i < messages.size(); i++) {
+    ReplayMessage & message = messages[i];
+    message.time -= start;
+    if (message.time < 0)
+      message.time = 0;
+
+    ReplayChannel & channel = channels[message.channel];
+    if (message.outgoing)
+      message.expected = channel.incoming.size();
+    else
+      channel.incoming.push_back(i);
+  }
+
+  PTRACE(3, "Replay\tScript for " << localAddr << " has " << messages.size() << " messages on "
+         << channels.size() << " channels, " << guids.size() << " call identifiers");
+  return TRUE;
+}
+
+
+PString ReplayScript::GetMessageName(ReplayChannel::Kinds kind, const PBYTEArray & data)
+{
+  switch (kind) {
+    case ReplayChannel::RAS :
+    {
+      H225_RasMessage ras;
+      PPER_Stream strm(data);
+      if (ras.Decode(strm))
+        return ras.GetTagName();
+      break;
+    }
+
+    case ReplayChannel::Signalling :
+    {
+      Q931 q931;
+      if (q931.Decode(data))
+        return q931.GetMessageTypeName();
+      break;
+    }
+
+    case ReplayChannel::H245 :
+    {
+      H245_MultimediaSystemControlMessage pdu;
+      PPER_Stream strm(data);
+      if (pdu.Decode(strm))
+        return ((const PASN_Choice &)pdu.GetObject()).GetTagName();
+      break;
+    }
+
+    case ReplayChannel::Media :
+      return data.GetSize() > 1 && data[1] >= 200 && data[1] <= 204 ? "RTCP" : "RTP";
+  }
+
+  return "undecodable";
+}
+
+
+unsigned ReplayScript::GetChannel(const CapturePacket & p)
+{
+  PBoolean outgoing = p.srcAddr == localAddr;
+  WORD localPort = outgoing ? p.srcPort : p.dstPort;
+  WORD remotePort = outgoing ? p.dstPort : p.srcPort;
+  const PIPSocket::Address & remoteAddr = outgoing ? p.dstAddr : p.srcAddr;
+
+  ReplayChannel::Kinds kind;
+  if (p.protocol == CapturePacket::TCP) {
+    if (localPort == CAPTURE_SIGNALLING_PORT)
+      return P_MAX_INDEX;   // Calls to the replayed endpoint cannot be made by the target
+    kind = remotePort == CAPTURE_SIGNALLING_PORT ? ReplayChannel::Signalling : ReplayChannel::H245;
+  }
+  else if (remotePort == CAPTURE_RAS_PORT || remotePort == CAPTURE_DISCOVERY_PORT)
+    kind = ReplayChannel::RAS;
+  else if (p.payload.GetSize() >= 12 && (p.payload[0] & 0xc0) == 0x80)
+    kind = ReplayChannel::Media;
+  else
+    return P_MAX_INDEX;
+
+  for (size_t i = 0; i < channels.size(); i++) {
+    const ReplayChannel & channel = channels[i];
+    if (channel.kind == kind && channel.localPort == localPort &&
+        channel.remoteAddr == remoteAddr && channel.remotePort == remotePort)
+      return i;
+  }
+
+  ReplayChannel channel;
+  channel.kind = kind;
+  channel.localAddr = localAddr;
+  channel.localPort = localPort;
+  channel.remoteAddr = remoteAddr;
+  channel.remotePort = remotePort;
+  // a SYN from the peer, so the target will have to connect to us
+  channel.accept = p.protocol == CapturePacket::TCP && !outgoing && (p.tcpFlags & 0x12) == 0x02;
+  channels.push_back(channel);
+
+  if (std::find(remoteAddrs.begin(), remoteAddrs.end(), remoteAddr) == remoteAddrs.end())
+    remoteAddrs.push_back(remoteAddr);
+
+  return channels.size() - 1;
+}
+
+
+void ReplayScript::AddStream(unsigned c, const CapturePacket & p, PBoolean outgoing)
+{
+  ReplayChannel::Stream & stream = channels[c].streams[outgoing ? 1 : 0];
+
+  if ((p.tcpFlags & 0x02) != 0) {
+    stream.sequence = p.sequence + 1;
+    stream.synced = TRUE;
+  }
+
+  PINDEX size = p.payload.GetSize();
+  if (size == 0)
+    return;
+
+  PINDEX skip = 0;
+  if (stream.synced) {
+    int offset = (int)(p.sequence - stream.sequence);
+    if (offset + (int)size <= 0)
+      return;   // retransmission
+    if (offset < 0)
+      skip = -offset;
+    else if (offset > 0)
+      PTRACE(2, "Replay\tCapture lost " << offset << " bytes of a TCP stream");
+  }
+  stream.synced = TRUE;
+  stream.sequence = p.sequence + size;
+
+  PINDEX have = stream.data.GetSize();
+  memcpy(stream.data.GetPointer(have + size - skip) + have, (const BYTE *)p.payload + skip, size - skip);
+
+  // split into TPKT frames
+  PINDEX pos = 0;
+  while (stream.data.GetSize() - pos >= 4) {
+    const BYTE * tpkt = (const BYTE *)stream.data + pos;
+    PINDEX length = (tpkt[2] << 8) | tpkt[3];
+    if (tpkt[0] != 3 || length < 4) {
+      PTRACE(2, "Replay\tNot a TPKT on TCP stream, discarding " << stream.data.GetSize() - pos << " bytes");
+      pos = stream.data.GetSize();
+      break;
+    }
+    if (stream.data.GetSize() - pos < length)
+      break;
+    AddMessage(c, outgoing, p.time, PBYTEArray(tpkt + 4, length - 4));
+    pos += length;
+  }
+
+  if (pos > 0)
+    stream.data = PBYTEArray((const BYTE *)stream.data + pos, stream.data.GetSize() - pos);
+}
+
+
+void ReplayScript::AddMessage(unsigned c, PBoolean outgoing, PInt64 time, const PBYTEArray & data)
+{
+  const ReplayChannel & channel = channels[c];
+
+  // media from the peer is not waited for, nor kept
+  if (channel.kind == ReplayChannel::Media && !outgoing)
+    return;
+
+  ReplayMessage message;
+  message.time = time;
+  message.channel = c;
+  message.outgoing = outgoing;
+  message.expected = 0;
+  message.name = GetMessageName(channel.kind, data);
+  message.data = data;
+  messages.push_back(message);
+
+  if (!outgoing)
+    return;
+
+  // collect the call and conference IDs to give each copy its own
+  if (channel.kind == ReplayChannel::RAS) {
+    H225_RasMessage ras;
+    PPER_Stream strm(data);
+    if (ras.Decode(strm) && ras.GetTag() == H225_RasMessage::e_admissionRequest) {
+      const H225_AdmissionRequest & arq = ras;
+      AddGuid(arq.m_conferenceID);
+      if (arq.HasOptionalField(H225_AdmissionRequest::e_callIdentifier))
+        AddGuid(arq.m_callIdentifier.m_guid);
+    }
+  }
+  else if (channel.kind == ReplayChannel::Signalling) {
+    Q931 q931;
+    if (q931.Decode(data) && q931.HasIE(Q931::UserUserIE)) {
+      H225_H323_UserInformation uuie;
+      PPER_Stream strm = q931.GetIE(Q931::UserUserIE);
+      if (uuie.Decode(strm) && uuie.m_h323_uu_pdu.m_h323_message_body.GetTag() == H225_H323_UU_PDU_h323_message_body::e_setup) {
+        const H225_Setup_UUIE & setup = uuie.m_h323_uu_pdu.m_h323_message_body;
+        AddGuid(setup.m_conferenceID);
+        if (setup.HasOptionalField(H225_Setup_UUIE::e_callIdentifier))
+          AddGuid(setup.m_callIdentifier.m_guid);
+      }
+    }
+  }
+}
+
+
+void ReplayScript::AddGuid(const PASN_OctetString & guid)
+{
+  PBYTEArray value = guid.GetValue();
+  if (value.GetSize() != 16)
+    return;
+
+  for (size_t i = 0; i < guids.size(); i++) {
+    if (guids[i] == value)
+      return;
+  }
+  guids.push_back(value);
+}
+
+
+///////////////////////////////////////////////////////////////
+
+ReplayCall::ReplayCall(ReplayProcess & proc, unsigned idx)
+  : PThread(65536, NoAutoDeleteThread, NormalPriority, psprintf("Replay %u", idx)),
+    process(proc),
+    script(proc.script),
+    index(idx),
+    failed(FALSE)
+{
+}
+
+
+ReplayCall::~ReplayCall()
+{
+  for (size_t i = 0; i < sockets.size(); i++) {
+    delete sockets[i].socket;
+    delete sockets[i].listener;
+  }
+}
+
+
+PBoolean ReplayCall::Open()
+{
+  sockets.resize(script.channels.size());
+
+  for (size_t g = 0; g < script.guids.size(); g++)
+    substitutions.push_back(std::make_pair(script.guids[g], (PBYTEArray)OpalGloballyUniqueID()));
+
+  // our own sockets in place of the captured endpoint's
+  for (size_t c = 0; c < script.channels.size(); c++) {
+    const ReplayChannel & channel = script.channels[c];
+    Socket & socket = sockets[c];
+
+    if (channel.kind == ReplayChannel::RAS || (channel.kind == ReplayChannel::Media && process.media)) {
+      PUDPSocket * udp = new PUDPSocket;
+      if (!udp->Listen(process.bindAddr, 0, 0)) {
+        PTRACE(1, "Replay\tCall " << index << " could not open UDP socket: " << udp->GetErrorText());
+        delete udp;
+        return FALSE;
+      }
+      socket.socket = udp;
+      socket.port = udp->GetPort();
+    }
+    else if (channel.kind == ReplayChannel::H245 && channel.accept) {
+      socket.listener = new PTCPSocket;
+      if (!socket.listener->Listen(process.bindAddr, 5, 0)) {
+        PTRACE(1, "Replay\tCall " << index << " could not listen for H.245: " << socket.listener->GetErrorText());
+        return FALSE;
+      }
+      socket.port = socket.listener->GetPort();
+    }
+    else
+      continue;
+
+    substitutions.push_back(std::make_pair(AddressBytes(channel.localAddr, channel.localPort),
+                                           AddressBytes(process.bindAddr, socket.port)));
+  }
+
+  // the captured peers become the target, more addresses are learned from its responses
+  for (size_t r = 0; r < script.remoteAddrs.size(); r++) {
+    AddAddress(script.remoteAddrs[r], CAPTURE_SIGNALLING_PORT, process.targetAddr, process.signallingPort);
+    AddAddress(script.remoteAddrs[r], CAPTURE_RAS_PORT, process.targetAddr, process.rasPort);
+    substitutions.push_back(std::make_pair(AddressBytes(script.remoteAddrs[r], 0, FALSE),
+                                           AddressBytes(process.targetAddr, 0, FALSE)));
+  }
+  substitutions.push_back(std::make_pair(AddressBytes(script.localAddr, 0, FALSE),
+                                         AddressBytes(process.bindAddr, 0, FALSE)));
+
+  return TRUE;
+}
+
+
+void ReplayCall::Main()
+{
+  if (!Open()) {
+    failed = TRUE;
+    return;
+  }
+
+  PTRACE(4, "Replay\tCall " << index << " started");
+
+  PInt64 start = Timestamp();
+  PInt64 waitStart = 0;
+
+  size_t next = 0;
+  while (next < script.messages.size()) {
+    const ReplayMessage & message = script.messages[next];
+    const ReplayChannel & channel = script.channels[message.channel];
+    if (!message.outgoing || (channel.kind == ReplayChannel::Media && !process.media)) {
+      next++;
+      continue;
+    }
+
+    Socket & socket = sockets[message.channel];
+    PInt64 now = Timestamp();
+
+    // wait for the responses the captured endpoint had before sending this,
+    // and for the target to connect if it did so in the capture
+    PBoolean unconnected = socket.socket == NULL && socket.listener != NULL;
+    if (socket.received < message.expected || unconnected) {
+      if (waitStart == 0)
+        waitStart = now;
+      else if (now - waitStart > process.timeout) {
+        PString missing = unconnected ? PString("connection") : script.messages[channel.incoming[socket.received]].name;
+        PTRACE(2, "Replay\tCall " << index << " timed out waiting for " << missing);
+        process.OnTimeout(PhaseName(socket.lastSent, missing));
+        socket.received = message.expected;
+        delete socket.listener;
+        socket.listener = NULL;
+        waitStart = 0;
+        continue;
+      }
+      Receive(RECEIVE_INTERVAL);
+      continue;
+    }
+    waitStart = 0;
+
+    if (process.speed > 0) {
+      PInt64 due = start + (PInt64)(message.time/process.speed);
+      if (now < due) {
+        Receive(due - now);
+        continue;
+      }
+    }
+
+    if (!Send(message) && channel.kind != ReplayChannel::Media)
+      failed = TRUE;
+    next++;
+  }
+
+  // collect the rest of the responses
+  waitStart = Timestamp();
+  for (;;) {
+    PBoolean pending = FALSE;
+    for (size_t c = 0; c < sockets.size(); c++) {
+      if (sockets[c].received < script.channels[c].incoming.size())
+        pending = TRUE;
+    }
+    if (!pending)
+      break;
+
+    if (Timestamp() - waitStart > process.timeout) {
+      for (size_t c = 0; c < sockets.size(); c++) {
+        const ReplayChannel & channel = script.channels[c];
+        if (sockets[c].received < channel.incoming.size())
+          process.OnTimeout(PhaseName(sockets[c].lastSent, script.messages[channel.incoming[sockets[c].received]].name));
+      }
+      break;
+    }
+
+    Receive(RECEIVE_INTERVAL);
+  }
+
+  PTRACE(4, "Replay\tCall " << index << " finished");
+}
+
+
+PBoolean ReplayCall::Send(const ReplayMessage & message)
+{
+  const ReplayChannel & channel = script.channels[message.channel];
+  Socket & socket = sockets[message.channel];
+
+  PBYTEArray data((const BYTE *)message.data, message.data.GetSize());
+
+  switch (channel.kind) {
+    case ReplayChannel::RAS :
+      FixRas(data);
+      Substitute(data);
+      if (!((PUDPSocket *)socket.socket)->WriteTo(data, data.GetSize(), process.targetAddr, process.rasPort)) {
+        PTRACE(2, "Replay\tCall " << index << " RAS write failed: " << socket.socket->GetErrorText());
+        return FALSE;
+      }
+      break;
+
+    case ReplayChannel::Media :
+    {
+      PIPSocket::Address addr;
+      WORD port;
+      if (!GetTarget(channel.remoteAddr, channel.remotePort, addr, port)) {
+        process.OnUnroutable();
+        return FALSE;
+      }
+      if (!((PUDPSocket *)socket.socket)->WriteTo(data, data.GetSize(), addr, port))
+        return FALSE;
+      process.OnSent(channel.kind);
+      return TRUE;
+    }
+
+    case ReplayChannel::Signalling :
+    case ReplayChannel::H245 :
+    {
+      Substitute(data);
+
+      // each copy has its own call reference
+      if (channel.kind == ReplayChannel::Signalling && data.GetSize() >= 4 && data[0] == 0x08 && data[1] == 2) {
+        unsigned callReference = ((((data[2] & 0x7f) << 8) | data[3]) + index) & 0x7fff;
+        if (callReference == 0)
+          callReference = 1;
+        data[2] = (BYTE)((data[2] & 0x80) | (callReference >> 8));
+        data[3] = (BYTE)callReference;
+      }
+
+      if (socket.socket == NULL && (channel.accept || !Connect(message.channel))) {
+        PTRACE(2, "Replay\tCall " << index << " has no connection for " << message.name);
+        return FALSE;
+      }
+
+      PINDEX length = data.GetSize() + 4;
+      PBYTEArray tpkt(length);
+      tpkt[0] = 3;
+      tpkt[2] = (BYTE)(length >> 8);
+      tpkt[3] = (BYTE)length;
+      memcpy(tpkt.GetPointer() + 4, data, data.GetSize());
+      if (!socket.socket->Write(tpkt, length)) {
+        PTRACE(2, "Replay\tCall " << index << " write failed: " << socket.socket->GetErrorText());
+        delete socket.socket;
+        socket.socket = NULL;
+        return FALSE;
+      }
+      break;
+    }
+  }
+
+  socket.lastSent = message.name;
+  socket.lastSentTime = Timestamp();
+  process.OnSent(channel.kind);
+  return TRUE;
+}
+
+
+PBoolean ReplayCall::Connect(unsigned c)
+{
+  const ReplayChannel & channel = script.channels[c];
+
+  PIPSocket::Address addr;
+  WORD port;
+  if (!GetTarget(channel.remoteAddr, channel.remotePort, addr, port)) {
+    PTRACE(2, "Replay\tCall " << index << " has no target for " << AddressKey(channel.remoteAddr, channel.remotePort));
+    return FALSE;
+  }
+
+  PTCPSocket * tcp = new PTCPSocket(port);
+  if (!tcp->Connect(addr)) {
+    PTRACE(2, "Replay\tCall " << index << " could not connect to " << AddressKey(addr, port) << ": " << tcp->GetErrorText());
+    delete tcp;
+    return FALSE;
+  }
+
+  sockets[c].socket = tcp;
+  return TRUE;
+}
+
+
+void ReplayCall::Receive(PInt64 microseconds)
+{
+  PSocket::SelectList selection;
+  for (size_t c = 0; c < sockets.size(); c++) {
+    if (sockets[c].socket != NULL)
+      selection.Append(sockets[c].socket);
+    else if (sockets[c].listener != NULL)
+      selection.Append(sockets[c].listener);
+  }
+
+  PTimeInterval timeout((long)((microseconds + 999)/1000));
+  if (selection.IsEmpty()) {
+    PThread::Sleep(timeout);
+    return;
+  }
+
+  if (PSocket::Select(selection, timeout) != PChannel::NoError)
+    return;
+
+  for (PINDEX i = 0; i < selection.GetSize(); i++) {
+    PSocket * ready = &selection[i];
+
+    size_t c;
+    for (c = 0; c < sockets.size(); c++) {
+      if (sockets[c].socket == ready || sockets[c].listener == ready)
+        break;
+    }
+    if (c >= sockets.size())
+      continue;
+
+    Socket & socket = sockets[c];
+    const ReplayChannel & channel = script.channels[c];
+
+    if (ready == socket.listener) {
+      PTCPSocket * tcp = new PTCPSocket;
+      if (tcp->Accept(*socket.listener))
+        socket.socket = tcp;
+      else
+        delete tcp;
+      delete socket.listener;
+      socket.listener = NULL;
+      continue;
+    }
+
+    BYTE buffer[65536];
+    if (!socket.socket->Read(buffer, sizeof(buffer)) || socket.socket->GetLastReadCount() == 0) {
+      if (channel.kind == ReplayChannel::Signalling || channel.kind == ReplayChannel::H245) {
+        PTRACE(3, "Replay\tCall " << index << " connection closed by target");
+        delete socket.socket;
+        socket.socket = NULL;
+      }
+      continue;
+    }
+    PINDEX count = socket.socket->GetLastReadCount();
+
+    switch (channel.kind) {
+      case ReplayChannel::Media :
+        process.OnReceived(channel.kind);
+        break;
+
+      case ReplayChannel::RAS :
+        OnMessage(c, PBYTEArray(buffer, count));
+        break;
+
+      default :
+      {
+        PINDEX have = socket.stream.GetSize();
+        memcpy(socket.stream.GetPointer(have + count) + have, buffer, count);
+
+        PINDEX pos = 0;
+        while (socket.stream.GetSize() - pos >= 4) {
+          const BYTE * tpkt = (const BYTE *)socket.stream + pos;
+          PINDEX length = (tpkt[2] << 8) | tpkt[3];
+          if (tpkt[0] != 3 || length < 4) {
+            PTRACE(2, "Replay\tCall " << index << " received bad TPKT");
+            pos = socket.stream.GetSize();
+            break;
+          }
+          if (socket.stream.GetSize() - pos < length)
+            break;
+          OnMessage(c, PBYTEArray(tpkt + 4, length - 4));
+          pos += length;
+        }
+        if (pos > 0)
+          socket.stream = PBYTEArray((const BYTE *)socket.stream + pos, socket.stream.GetSize() - pos);
+      }
+    }
+  }
+}
+
+
+void ReplayCall::OnMessage(unsigned c, const PBYTEArray & data)
+{
+  const ReplayChannel & channel = script.channels[c];
+  Socket & socket = sockets[c];
+
+  PString name = ReplayScript::GetMessageName(channel.kind, data);
+  process.OnReceived(channel.kind);
+
+  if (!socket.lastSent.IsEmpty())
+    process.OnLatency(PhaseName(socket.lastSent, name), Timestamp() - socket.lastSentTime);
+
+  // the same response as captured says where the target is listening
+  if (socket.received < channel.incoming.size()) {
+    const ReplayMessage & captured = script.messages[channel.incoming[socket.received]];
+    if (captured.name == name)
+      LearnAddresses(captured.data, data);
+    else
+      PTRACE(4, "Replay\tCall " << index << " received " << name << " where capture has " << captured.name);
+  }
+  socket.received++;
+
+  if (channel.kind != ReplayChannel::RAS)
+    return;
+
+  H225_RasMessage ras;
+  PPER_Stream strm(data);
+  if (!ras.Decode(strm))
+    return;
+
+  switch (ras.GetTag()) {
+    case H225_RasMessage::e_gatekeeperConfirm :
+    {
+      const H225_GatekeeperConfirm & gcf = ras;
+      if (gcf.HasOptionalField(H225_GatekeeperConfirm::e_gatekeeperIdentifier))
+        gatekeeperIdentifier = gcf.m_gatekeeperIdentifier.GetValue();
+      break;
+    }
+
+    case H225_RasMessage::e_registrationConfirm :
+    {
+      const H225_RegistrationConfirm & rcf = ras;
+      if (rcf.HasOptionalField(H225_RegistrationConfirm::e_gatekeeperIdentifier))
+        gatekeeperIdentifier = rcf.m_gatekeeperIdentifier.GetValue();
+      endpointIdentifier = rcf.m_endpointIdentifier.GetValue();
+      break;
+    }
+  }
+}
+
+
+void ReplayCall::Substitute(PBYTEArray & data) const
+{
+  BYTE * ptr = data.GetPointer();
+  PINDEX size = data.GetSize();
+
+  // one pass, longest match first, so a replacement is never replaced again
+  PINDEX pos = 0;
+  while (pos < size) {
+    const std::pair<PBYTEArray, PBYTEArray> * best = NULL;
+    for (size_t i = 0; i < substitutions.size(); i++) {
+      const PBYTEArray & pattern = substitutions[i].first;
+      PINDEX length = pattern.GetSize();
+      if (pos + length <= size && (best == NULL || length > best->first.GetSize()) &&
+          memcmp(ptr + pos, (const BYTE *)pattern, length) == 0)
+        best = &substitutions[i];
+    }
+
+    if (best == NULL)
+      pos++;
+    else {
+      memcpy(ptr + pos, (const BYTE *)best->second, best->second.GetSize());
+      pos += best->first.GetSize();
+    }
+  }
+}
+
+
+void ReplayCall::FixRas(PBYTEArray & data)
+{
+  H225_RasMessage ras;
+  PPER_Stream strm(data);
+  if (!ras.Decode(strm))
+    return;
+
+  switch (ras.GetTag()) {
+    case H225_RasMessage::e_gatekeeperRequest :
+    {
+      H225_GatekeeperRequest & grq = ras;
+      SetIdentifier(grq, H225_GatekeeperRequest::e_gatekeeperIdentifier, grq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      if (grq.HasOptionalField(H225_GatekeeperRequest::e_endpointAlias))
+        FixAliases(grq.m_endpointAlias);
+      break;
+    }
+
+    case H225_RasMessage::e_registrationRequest :
+    {
+      H225_RegistrationRequest & rrq = ras;
+      SetIdentifier(rrq, H225_RegistrationRequest::e_gatekeeperIdentifier, rrq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      SetIdentifier(rrq, H225_RegistrationRequest::e_endpointIdentifier, rrq.m_endpointIdentifier, endpointIdentifier);
+      if (rrq.HasOptionalField(H225_RegistrationRequest::e_terminalAlias))
+        FixAliases(rrq.m_terminalAlias);
+      break;
+    }
+
+    case H225_RasMessage::e_unregistrationRequest :
+    {
+      H225_UnregistrationRequest & urq = ras;
+      SetIdentifier(urq, H225_UnregistrationRequest::e_gatekeeperIdentifier, urq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      SetIdentifier(urq, H225_UnregistrationRequest::e_endpointIdentifier, urq.m_endpointIdentifier, endpointIdentifier);
+      if (urq.HasOptionalField(H225_UnregistrationRequest::e_endpointAlias))
+        FixAliases(urq.m_endpointAlias);
+      break;
+    }
+
+    case H225_RasMessage::e_admissionRequest :
+    {
+      H225_AdmissionRequest & arq = ras;
+      SetIdentifier(arq, H225_AdmissionRequest::e_gatekeeperIdentifier, arq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      if (!endpointIdentifier)
+        arq.m_endpointIdentifier = endpointIdentifier;
+      FixAliases(arq.m_srcInfo);
+      break;
+    }
+
+    case H225_RasMessage::e_bandwidthRequest :
+    {
+      H225_BandwidthRequest & brq = ras;
+      SetIdentifier(brq, H225_BandwidthRequest::e_gatekeeperIdentifier, brq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      if (!endpointIdentifier)
+        brq.m_endpointIdentifier = endpointIdentifier;
+      break;
+    }
+
+    case H225_RasMessage::e_disengageRequest :
+    {
+      H225_DisengageRequest & drq = ras;
+      SetIdentifier(drq, H225_DisengageRequest::e_gatekeeperIdentifier, drq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      if (!endpointIdentifier)
+        drq.m_endpointIdentifier = endpointIdentifier;
+      break;
+    }
+
+    case H225_RasMessage::e_locationRequest :
+    {
+      H225_LocationRequest & lrq = ras;
+      SetIdentifier(lrq, H225_LocationRequest::e_gatekeeperIdentifier, lrq.m_gatekeeperIdentifier, gatekeeperIdentifier);
+      SetIdentifier(lrq, H225_LocationRequest::e_endpointIdentifier, lrq.m_endpointIdentifier, endpointIdentifier);
+      break;
+    }
+
+    case H225_RasMessage::e_infoRequestResponse :
+    {
+      H225_InfoRequestResponse & irr = ras;
+      if (!endpointIdentifier)
+        irr.m_endpointIdentifier = endpointIdentifier;
+      if (irr.HasOptionalField(H225_InfoRequestResponse::e_endpointAlias))
+        FixAliases(irr.m_endpointAlias);
+      break;
+    }
+
+    default :
+      return;
+  }
+
+  PPER_Stream encoded;
+  ras.Encode(encoded);
+  encoded.CompleteEncoding();
+  data = encoded;
+}
+
+
+void ReplayCall::FixAliases(H225_ArrayOf_AliasAddress & aliases)
+{
+  // the first copy keeps the captured aliases, the rest register their own
+  if (index == 0)
+    return;
+
+  for (PINDEX i = 0; i < aliases.GetSize(); i++) {
+    H225_AliasAddress & alias = aliases[i];
+    switch (alias.GetTag()) {
+      case H225_AliasAddress::e_dialedDigits :
+        H323SetAliasAddress(H323GetAliasAddressString(alias) + PString(PString::Unsigned, index), alias, alias.GetTag());
+        break;
+
+      case H225_AliasAddress::e_h323_ID :
+        H323SetAliasAddress(H323GetAliasAddressString(alias) + '-' + PString(PString::Unsigned, index), alias, alias.GetTag());
+        break;
+    }
+  }
+}
+
+
+void ReplayCall::LearnAddresses(const PBYTEArray & captured, const PBYTEArray & actual)
+{
+  std::vector<PIPSocket::Address> capturedHosts = script.remoteAddrs;
+  capturedHosts.push_back(script.localAddr);
+  std::vector<FoundAddress> from = FindAddresses(captured, capturedHosts);
+
+  std::vector<PIPSocket::Address> actualHosts;
+  actualHosts.push_back(process.targetAddr);
+  if (process.bindAddr != process.targetAddr)
+    actualHosts.push_back(process.bindAddr);
+  std::vector<FoundAddress> to = FindAddresses(actual, actualHosts);
+
+  // only when the two line up one for one
+  if (from.empty() || from.size() != to.size()) {
+    PTRACE_IF(4, !from.empty(), "Replay\tCall " << index << " cannot match " << from.size()
+              << " captured addresses with " << to.size() << " from target");
+    return;
+  }
+
+  for (size_t i = 0; i < from.size(); i++) {
+    if (from[i].addr != script.localAddr)
+      AddAddress(from[i].addr, from[i].port, to[i].addr, to[i].port);
+  }
+}
+
+
+void ReplayCall::AddAddress(const PIPSocket::Address & fromAddr, WORD fromPort, const PIPSocket::Address & toAddr, WORD toPort)
+{
+  PString key = AddressKey(fromAddr, fromPort);
+  if (targets.find(key) != targets.end())
+    return;
+
+  PTRACE(4, "Replay\tCall " << index << " maps " << key << " to " << AddressKey(toAddr, toPort));
+  targets[key] = std::make_pair(toAddr, toPort);
+  substitutions.push_back(std::make_pair(AddressBytes(fromAddr, fromPort), AddressBytes(toAddr, toPort)));
+}
+
+
+PBoolean ReplayCall::GetTarget(const PIPSocket::Address & addr, WORD port, PIPSocket::Address & targetAddr, WORD & targetPort) const
+{
+  std::map<PString, std::pair<PIPSocket::Address, WORD> >::const_iterator it = targets.find(AddressKey(addr, port));
+  if (it == targets.end())
+    return FALSE;
+
+  targetAddr = it->second.first;
+  targetPort = it->second.second;
+  return TRUE;
+}
+
+
+///////////////////////////////////////////////////////////////
+
+ReplayEndPoint::ReplayEndPoint()
+{
+  SetLocalUserName("pcapreplay");
+}
+
+
+PBoolean ReplayEndPoint::OpenAudioChannel(H323Connection &, PBoolean, unsigned, H323AudioCodec & codec)
+{
+  return codec.AttachChannel(new ReplayNullChannel, TRUE);
+}
+
+
+///////////////////////////////////////////////////////////////
+
+ReplayProcess::ReplayProcess()
+  : PProcess("H323Plus", "pcapreplay", MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER),
+    bindAddr(127, 0, 0, 1),
+    signallingPort(CAPTURE_SIGNALLING_PORT),
+    rasPort(CAPTURE_RAS_PORT),
+    speed(1.0),
+    timeout(5000000),
+    media(TRUE),
+    unroutable(0)
+{
+  memset(sent, 0, sizeof(sent));
+  memset(received, 0, sizeof(received));
+}
+
+
+void ReplayProcess::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse(
+             "b-bind:"
+             "c-calls:"
+             "-gatekeeper."
+             "h-help."
+             "i-interval:"
+             "j-json."
+             "-no-media."
+             "o-output:"
+             "-ras-port:"
+             "s-speed:"
+             "-signal-port:"
+             "T-target:"
+             "-timeout:"
+#if PTRACING
+             "t-trace."
+             "-trace-file:"
+#endif
+          , FALSE);
+
+  if (args.HasOption('h') || args.GetCount() < 1) {
+    cerr << "Usage : " << GetName() << " [options] capture\n"
+            "Replays the RAS, call signalling, H.245 and RTP sent by the endpoint in a\n"
+            "pcap or pcap-ng capture against a target, as any number of concurrent calls.\n"
+            "Options:\n"
+            "  -c --calls n            : Concurrent copies of the capture (default 1).\n"
+            "  -i --interval ms        : Time between starting copies (default 10).\n"
+            "  -s --speed x            : Replay speed, 0 for as fast as responses arrive (default 1).\n"
+            "  -T --target host        : Replay against this host instead of an in process endpoint.\n"
+            "     --gatekeeper         : Run a gatekeeper in process as well as the endpoint.\n"
+            "     --signal-port n      : Target call signalling port (default 1720).\n"
+            "     --ras-port n         : Target RAS port (default 1719).\n"
+            "  -b --bind addr          : Local interface for the replayed endpoint (default 127.0.0.1).\n"
+            "     --timeout ms         : Time to wait for a response (default 5000).\n"
+            "     --no-media           : Do not replay RTP.\n"
+            "  -j --json               : Output JSON instead of CSV.\n"
+            "  -o --output file        : Write the results to file instead of stdout.\n"
+#if PTRACING
+            "  -t --trace              : Enable trace, use multiple times for more detail.\n"
+            "     --trace-file file    : Specify filename for trace output.\n"
+#endif
+            "  -h --help               : This help message.\n"
+            "\n"
+            "Each copy has its own sockets, call and conference identifiers, call reference\n"
+            "and, after the first, aliases. Addresses of the target are learned from its\n"
+            "responses. CPU time is for the whole process, including an in process target.\n";
+    return;
+  }
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption("trace-file") ? (const char *)args.GetOptionString("trace-file") : NULL,
+                     PTrace::Timestamp|PTrace::Thread|PTrace::FileAndLine);
+#endif
+
+  unsigned calls = args.HasOption('c') ? args.GetOptionString('c').AsUnsigned() : 1;
+  if (calls == 0)
+    calls = 1;
+  unsigned interval = args.HasOption('i') ? args.GetOptionString('i').AsUnsigned() : 10;
+  if (args.HasOption('s'))
+    speed = args.GetOptionString('s').AsReal();
+  if (args.HasOption("timeout"))
+    timeout = (PInt64)args.GetOptionString("timeout").AsUnsigned()*1000;
+  if (args.HasOption("signal-port"))
+    signallingPort = (WORD)args.GetOptionString("signal-port").AsUnsigned();
+  if (args.HasOption("ras-port"))
+    rasPort = (WORD)args.GetOptionString("ras-port").AsUnsigned();
+  media = !args.HasOption("no-media");
+
+  if (args.HasOption('b') && !PIPSocket::GetHostAddress(args.GetOptionString('b'), bindAddr)) {
+    cerr << "Could not resolve " << args.GetOptionString('b') << endl;
+    return;
+  }
+
+  if (!script.Load(args[0])) {
+    cerr << "Could not find anything to replay in " << args[0] << endl;
+    return;
+  }
+
+  cerr << "Replaying " << script.messages.size() << " messages of " << script.localAddr
+       << " on " << script.channels.size() << " channels, " << calls << " copies" << endl;
+
+  ReplayEndPoint * endpoint = NULL;
+  H323GatekeeperServer * gatekeeper = NULL;
+
+  if (args.HasOption('T')) {
+    if (!PIPSocket::GetHostAddress(args.GetOptionString('T'), targetAddr)) {
+      cerr << "Could not resolve " << args.GetOptionString('T') << endl;
+      return;
+    }
+  }
+  else {
+    targetAddr = bindAddr;
+    endpoint = new ReplayEndPoint;
+    if (!endpoint->StartListener(H323TransportAddress(targetAddr, signallingPort))) {
+      cerr << "Could not listen for calls on port " << signallingPort << endl;
+      delete endpoint;
+      return;
+    }
+    if (args.HasOption("gatekeeper")) {
+      gatekeeper = new H323GatekeeperServer(*endpoint);
+      if (!gatekeeper->AddListener(H323TransportAddress(targetAddr, rasPort))) {
+        cerr << "Could not listen for RAS on port " << rasPort << endl;
+        delete gatekeeper;
+        delete endpoint;
+        return;
+      }
+    }
+  }
+
+  PInt64 startCPU = ProcessCPU();
+  PInt64 startTime = Timestamp();
+
+  std::vector<ReplayCall *> threads;
+  for (unsigned i = 0; i < calls; i++) {
+    threads.push_back(new ReplayCall(*this, i));
+    threads.back()->Resume();
+    if (interval > 0 && i+1 < calls)
+      PThread::Sleep(interval);
+  }
+
+  unsigned failed = 0;
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i]->WaitForTermination();
+    if (threads[i]->HasFailed())
+      failed++;
+    delete threads[i];
+  }
+
+  PInt64 elapsed = Timestamp() - startTime;
+  PInt64 cpu = ProcessCPU() - startCPU;
+
+  if (args.HasOption('o')) {
+    PTextFile file;
+    if (!file.Open(args.GetOptionString('o'), PFile::WriteOnly))
+      cerr << "Could not open " << args.GetOptionString('o') << endl;
+    else
+      Output(file, args.HasOption('j'), calls, failed, elapsed, cpu);
+  }
+  else
+    Output(cout, args.HasOption('j'), calls, failed, elapsed, cpu);
+
+  delete gatekeeper;
+  if (endpoint != NULL) {
+    endpoint->ClearAllCalls();
+    delete endpoint;
+  }
+}
+
+
+void ReplayProcess::OnLatency(const PString & phase, PInt64 microseconds)
+{
+  PWaitAndSignal m(mutex);
+  phases[phase].microseconds.push_back((unsigned)microseconds);
+}
+
+
+void ReplayProcess::OnTimeout(const PString & phase)
+{
+  PWaitAndSignal m(mutex);
+  phases[phase].timeouts++;
+}
+
+
+void ReplayProcess::OnSent(ReplayChannel::Kinds kind)
+{
+  PWaitAndSignal m(mutex);
+  sent[kind]++;
+}
+
+
+void ReplayProcess::OnReceived(ReplayChannel::Kinds kind)
+{
+  PWaitAndSignal m(mutex);
+  received[kind]++;
+}
+
+
+void ReplayProcess::OnUnroutable()
+{
+  PWaitAndSignal m(mutex);
+  unroutable++;
+}
+
+
+void ReplayProcess::Output(ostream & strm, PBoolean json, unsigned calls, unsigned failed, PInt64 elapsed, PInt64 cpu) const
+{
+  static const char * const KindNames[4] = { "ras", "signalling", "h245", "rtp" };
+
+  strm << setprecision(6);
+
+  if (json) {
+    strm << "{\n"
+            "  \"calls\": " << calls << ",\n"
+            "  \"failed\": " << failed << ",\n"
+            "  \"elapsed_sec\": " << elapsed/1e6 << ",\n"
+            "  \"cpu_ms_per_call\": " << cpu/1e3/calls << ",\n";
+    for (int k = 0; k < 4; k++)
+      strm << "  \"" << KindNames[k] << "_sent\": " << sent[k] << ", \"" << KindNames[k] << "_received\": " << received[k] << ",\n";
+    strm << "  \"rtp_unroutable\": " << unroutable << ",\n"
+            "  \"phases\": [\n";
+  }
+  else {
+    strm << "# calls=" << calls << " failed=" << failed << " elapsed_sec=" << elapsed/1e6
+         << " cpu_ms_per_call=" << cpu/1e3/calls;
+    for (int k = 0; k < 4; k++)
+      strm << ' ' << KindNames[k] << "_sent=" << sent[k] << ' ' << KindNames[k] << "_received=" << received[k];
+    strm << " rtp_unroutable=" << unroutable << "\n"
+            "phase,count,timeouts,min_ms,mean_ms,p50_ms,p95_ms,max_ms\n";
+  }
+
+  size_t n = 0;
+  for (std::map<PString, ReplayPhase>::const_iterator it = phases.begin(); it != phases.end(); ++it, ++n) {
+    std::vector<unsigned> times = it->second.microseconds;
+    std::sort(times.begin(), times.end());
+
+    double minimum = 0, mean = 0, median = 0, p95 = 0, maximum = 0;
+    if (!times.empty()) {
+      double total = 0;
+      for (size_t i = 0; i < times.size(); i++)
+        total += times[i];
+      minimum = times.front()/1e3;
+      mean = total/times.size()/1e3;
+      median = times[times.size()/2]/1e3;
+      p95 = times[(times.size()*95)/100 < times.size() ? (times.size()*95)/100 : times.size()-1]/1e3;
+      maximum = times.back()/1e3;
+    }
+
+    if (json)
+      strm << "    { \"phase\": \"" << it->first << "\""
+              ", \"count\": " << times.size() <<
+              ", \"timeouts\": " << it->second.timeouts <<
+              ", \"min_ms\": " << minimum <<
+              ", \"mean_ms\": " << mean <<
+              ", \"p50_ms\": " << median <<
+              ", \"p95_ms\": " << p95 <<
+              ", \"max_ms\": " << maximum <<
+              " }" << (n+1 < phases.size() ? ",\n" : "\n");
+    else
+      strm << it->first << ',' << times.size() << ',' << it->second.timeouts << ','
+           << minimum << ',' << mean << ',' << median << ',' << p95 << ',' << maximum << '\n';
+  }
+
+  if (json)
+    strm << "  ]\n}\n";
+  strm.flush();
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
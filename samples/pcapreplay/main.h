@@ -0,0 +1,224 @@
+/*
+ * main.h
+ *
+ * Capture replay load test for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _PcapReplay_MAIN_H
+#define _PcapReplay_MAIN_H
+
+#include <h323.h>
+#include <gkserver.h>
+#include <map>
+#include <vector>
+
+#include "capture.h"
+
+#if PTLIB_VER < 2130
+#if !defined(P_USE_STANDARD_CXX_BOOL) && !defined(P_USE_INTEGER_BOOL)
+    typedef int PBoolean;
+#endif
+#endif
+
+/**One flow between the replayed endpoint and a peer in the capture.
+  */
+struct ReplayChannel
+{
+  enum Kinds {
+    RAS,
+    Signalling,
+    H245,
+    Media
+  };
+
+  Kinds              kind;
+  PIPSocket::Address localAddr;       ///< Replayed side
+  WORD               localPort;
+  PIPSocket::Address remoteAddr;      ///< Peer being replaced by the target
+  WORD               remotePort;
+  PBoolean           accept;          ///< Peer opened the TCP connection
+  std::vector<unsigned> incoming;     ///< Messages from the peer, in order
+
+  struct Stream {
+    Stream() : synced(FALSE), sequence(0) { }
+    PBoolean   synced;
+    DWORD      sequence;              ///< Next TCP sequence number expected
+    PBYTEArray data;                  ///< Bytes not yet making a whole TPKT
+  } streams[2];                       ///< From the peer, to the peer
+};
+
+
+/**One H.225, H.245 or RTP message of the capture.
+  */
+struct ReplayMessage
+{
+  PInt64     time;          ///< Microseconds from the first message
+  unsigned   channel;
+  PBoolean   outgoing;      ///< Sent by the replayed side
+  unsigned   expected;      ///< Messages from the peer on the channel before this one
+  PString    name;
+  PBYTEArray data;
+};
+
+
+/**The messages of the replayed endpoint, extracted from a capture once and
+   replayed by every synthetic call.
+  */
+class ReplayScript : public PObject
+{
+  PCLASSINFO(ReplayScript, PObject)
+
+  public:
+    PBoolean Load(const PFilePath & filename);
+
+    static PString GetMessageName(ReplayChannel::Kinds kind, const PBYTEArray & data);
+
+    PIPSocket::Address          localAddr;
+    std::vector<PIPSocket::Address> remoteAddrs;
+    std::vector<ReplayChannel>  channels;
+    std::vector<ReplayMessage>  messages;
+    std::vector<PBYTEArray>     guids;        ///< Call and conference IDs to replace
+
+  protected:
+    unsigned GetChannel(const CapturePacket & packet);
+    void AddMessage(unsigned channel, PBoolean outgoing, PInt64 time, const PBYTEArray & data);
+    void AddStream(unsigned channel, const CapturePacket & packet, PBoolean outgoing);
+    void AddGuid(const PASN_OctetString & guid);
+};
+
+
+/**Latency of one phase, from the message sent to a response received.
+  */
+struct ReplayPhase
+{
+  ReplayPhase() : timeouts(0) { }
+
+  std::vector<unsigned> microseconds;
+  unsigned timeouts;
+};
+
+
+class ReplayProcess;
+
+/**One synthetic copy of the captured endpoint, replaying the script with
+   its own sockets, call identifiers, call references and aliases.
+  */
+class ReplayCall : public PThread
+{
+  PCLASSINFO(ReplayCall, PThread)
+
+  public:
+    ReplayCall(ReplayProcess & process, unsigned index);
+    ~ReplayCall();
+
+    void Main();
+
+    PBoolean HasFailed() const { return failed; }
+
+  protected:
+    struct Socket {
+      Socket() : socket(NULL), listener(NULL), port(0), received(0) { }
+      PIPSocket     * socket;
+      PTCPSocket    * listener;
+      WORD            port;             ///< Local port
+      PBYTEArray      stream;
+      unsigned        received;         ///< Messages from the target
+      PString         lastSent;
+      PInt64          lastSentTime;     ///< Microseconds
+    };
+
+    PBoolean Open();
+    PBoolean Send(const ReplayMessage & message);
+    PBoolean Connect(unsigned channel);
+    void Receive(PInt64 microseconds);
+    void OnMessage(unsigned channel, const PBYTEArray & data);
+    void Substitute(PBYTEArray & data) const;
+    void FixRas(PBYTEArray & data);
+    void FixAliases(H225_ArrayOf_AliasAddress & aliases);
+    void LearnAddresses(const PBYTEArray & captured, const PBYTEArray & actual);
+    void AddAddress(const PIPSocket::Address & fromAddr, WORD fromPort, const PIPSocket::Address & toAddr, WORD toPort);
+    PBoolean GetTarget(const PIPSocket::Address & addr, WORD port, PIPSocket::Address & targetAddr, WORD & targetPort) const;
+
+    ReplayProcess      & process;
+    const ReplayScript & script;
+    unsigned             index;
+    std::vector<Socket>  sockets;                   ///< One per script channel
+    std::vector< std::pair<PBYTEArray, PBYTEArray> > substitutions;
+    std::map<PString, std::pair<PIPSocket::Address, WORD> > targets;  ///< Captured peer addresses to the target's
+    PString              gatekeeperIdentifier;
+    PString              endpointIdentifier;
+    PBoolean             failed;
+};
+
+
+/**Endpoint answering calls in process when there is no external target.
+  */
+class ReplayEndPoint : public H323EndPoint
+{
+  PCLASSINFO(ReplayEndPoint, H323EndPoint);
+
+  public:
+    ReplayEndPoint();
+
+    virtual PBoolean OpenAudioChannel(H323Connection & connection, PBoolean isEncoding, unsigned bufferSize, H323AudioCodec & codec);
+};
+
+
+class ReplayProcess : public PProcess
+{
+  PCLASSINFO(ReplayProcess, PProcess)
+
+  public:
+    ReplayProcess();
+
+    void Main();
+
+    void OnLatency(const PString & phase, PInt64 microseconds);
+    void OnTimeout(const PString & phase);
+    void OnSent(ReplayChannel::Kinds kind);
+    void OnReceived(ReplayChannel::Kinds kind);
+    void OnUnroutable();
+
+    ReplayScript        script;
+    PIPSocket::Address  bindAddr;
+    PIPSocket::Address  targetAddr;
+    WORD                signallingPort;
+    WORD                rasPort;
+    double              speed;
+    PInt64              timeout;          ///< Microseconds to wait for a response
+    PBoolean            media;
+
+  protected:
+    void Output(ostream & strm, PBoolean json, unsigned calls, unsigned failed, PInt64 elapsed, PInt64 cpu) const;
+
+    PMutex              mutex;
+    std::map<PString, ReplayPhase> phases;
+    unsigned            sent[4];
+    unsigned            received[4];
+    unsigned            unroutable;       ///< RTP with no target address learned
+};
+
+
+#endif  // _PcapReplay_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,316 @@
+/*
+ * main.cxx
+ *
+ * Q.922 encode/decode round trip check for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include "main.h"
+#include "../../version.h"
+
+PCREATE_PROCESS(Q922CheckProcess);
+
+#define MAX_INFORMATION_SIZE  260
+
+
+///////////////////////////////////////////////////////////////
+
+Q922CheckProcess::Q922CheckProcess()
+  : PProcess("H323Plus", "q922check", MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER),
+    seed(0x12345678)
+{
+}
+
+
+unsigned Q922CheckProcess::Random(unsigned range)
+{
+  seed = seed*1103515245 + 12345;
+  return (seed >> 16) % range;
+}
+
+
+void Q922CheckProcess::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse(
+             "h-help."
+             "n-count:"
+             "s-seed:"
+#if PTRACING
+             "t-trace."
+             "-trace-file:"
+#endif
+          , FALSE);
+
+  if (args.HasOption('h')) {
+    cerr << "Usage : " << GetName() << " [options]\n"
+            "Options:\n"
+            "  -n --count n            : Random frames to encode and decode (default 100000).\n"
+            "  -s --seed n             : Seed of the random frames (default 305419896).\n"
+#if PTRACING
+            "  -t --trace              : Enable trace, use multiple times for more detail.\n"
+            "     --trace-file file    : Specify filename for trace output.\n"
+#endif
+            "  -h --help               : This help message.\n"
+            "\n"
+            "Encodes Q.922 frames with bit stuffing at every starting bit position,\n"
+            "including long runs of ones, and checks each encodes to the same octets\n"
+            "as the original bit by bit encoder and decodes to the same frame.\n";
+    return;
+  }
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption("trace-file") ? (const char *)args.GetOptionString("trace-file") : NULL,
+                     PTrace::Timestamp|PTrace::Thread|PTrace::FileAndLine);
+#endif
+
+#ifndef H323_H224
+  cerr << "H.224 is not enabled in this build" << endl;
+  SetTerminationValue(1);
+#else
+  unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 100000;
+  if (args.HasOption('s'))
+    seed = args.GetOptionString('s').AsUnsigned();
+
+  unsigned failures = 0;
+  unsigned test = 0;
+
+  // Fixed patterns first: all ones, flags and alternating runs, every size
+  static const BYTE patterns[] = { 0xff, 0x7e, 0x3f, 0xfe, 0x00, 0xaa };
+  for (PINDEX p = 0; p < (PINDEX)sizeof(patterns); p++) {
+    for (PINDEX size = 1; size <= MAX_INFORMATION_SIZE; size++) {
+      Q922_Frame frame(size);
+      frame.SetHighOrderAddressOctet(patterns[p]);
+      frame.SetLowOrderAddressOctet(patterns[p]);
+      frame.SetControlFieldOctet(patterns[p]);
+      memset(frame.GetInformationFieldPtr(), patterns[p], size);
+      for (BYTE bit = 0; bit < 8; bit++)
+        if (!RoundTrip(frame, bit, ++test))
+          failures++;
+    }
+  }
+
+  // Then random frames, biased towards runs of ones
+  for (unsigned i = 0; i < count; i++) {
+    PINDEX size = Random(MAX_INFORMATION_SIZE) + 1;
+    Q922_Frame frame(size);
+    BYTE * info = frame.GetInformationFieldPtr();
+    PINDEX position = 0;
+    while (position < size) {
+      PINDEX run = Random(16) + 1;
+      if (run > size - position)
+        run = size - position;
+      BYTE value = Random(3) == 0 ? (BYTE)Random(256) : (Random(2) ? 0xff : 0x7f);
+      memset(info + position, value, run);
+      position += run;
+    }
+    frame.SetHighOrderAddressOctet((BYTE)Random(256));
+    frame.SetLowOrderAddressOctet((BYTE)Random(256));
+    frame.SetControlFieldOctet((BYTE)Random(256));
+    if (!RoundTrip(frame, (BYTE)Random(8), ++test))
+      failures++;
+  }
+
+  if (failures > 0) {
+    cout << "FAIL " << failures << " of " << test << " frames" << endl;
+    SetTerminationValue(1);
+  }
+  else
+    cout << "PASS " << test << " frames" << endl;
+#endif
+}
+
+
+#ifdef H323_H224
+
+/////////////////////////////////////////////////////////////////////////////
+// Reference encoder, the bit by bit Q.922 encoder the table driven one in
+// q922.cxx replaced, kept as it was so the two can be compared.
+
+#define Q922_FLAG 0x7e
+
+static void ReferenceEncodeBit(BYTE bit, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex)
+{
+  if(bitIndex == 7) {
+    buffer[octetIndex] = 0;
+  }
+
+  buffer[octetIndex] |= ((bit & 0x01) << bitIndex);
+
+  // adjusting bit/byte index
+  if(bitIndex == 0) {
+    octetIndex++;
+    bitIndex = 8;
+  }
+
+  bitIndex--;
+}
+
+static void ReferenceEncodeOctetNoEscape(BYTE octet, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex)
+{
+  PINDEX i;
+  for(i = 0; i < 8; i++) {
+    BYTE bit = (BYTE)((octet >> i) & 0x01);
+    ReferenceEncodeBit(bit, buffer, octetIndex, bitIndex);
+  }
+}
+
+static void ReferenceEncodeOctet(BYTE octet, BYTE *buffer, PINDEX & octetIndex, BYTE & bitIndex, BYTE & onesCounter)
+{
+  PINDEX i;
+  for(i = 0; i < 8; i++) {
+    BYTE bit = (BYTE)((octet >> i) & 0x01);
+
+    ReferenceEncodeBit(bit, buffer, octetIndex, bitIndex);
+
+    if(bit) {
+      onesCounter++;
+
+      if(onesCounter == 5) {
+        // insert a zero bit
+        ReferenceEncodeBit(0, buffer, octetIndex, bitIndex);
+        onesCounter = 0;
+      }
+    } else {
+      onesCounter = 0;
+    }
+  }
+}
+
+static WORD ReferenceCalculateFCS(const BYTE *data, PINDEX length)
+{
+  // bitwise form of the RFC1549 table, initial value all ones
+  WORD fcs = 0xffff;
+
+  while(length--) {
+    fcs ^= *data++;
+    for (int bit = 0; bit < 8; bit++)
+      fcs = (WORD)((fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1);
+  }
+
+  return (WORD)~fcs;
+}
+
+static PBoolean ReferenceEncode(const Q922_Frame & frame, BYTE *buffer, PINDEX & size, BYTE & theBitIndex)
+{
+  if(frame.GetInformationFieldSize() == 0) {
+    return FALSE;
+  }
+
+  PINDEX octetIndex = 0;
+  BYTE bitIndex = theBitIndex;
+  BYTE onesCounter = 0;
+
+  // storing three FLAG sequencs.
+  // since the FLAG sequences may be not byte-aligned, the first FLAG sequence is encoded
+  // into a dummy buffer and extracted from there
+  buffer[0] = 0;
+  BYTE dummy[3];
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, dummy, octetIndex, bitIndex);
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, dummy, octetIndex, bitIndex);
+  buffer[0] = dummy[1];
+  buffer[1] = dummy[1];
+  octetIndex = 1;
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+
+  const BYTE * data = frame;
+  PINDEX count = Q922_HEADER_SIZE + frame.GetInformationFieldSize();
+  WORD fcs = ReferenceCalculateFCS(data, count);
+
+  PINDEX i;
+  for(i = 0; i < count; i++) {
+    ReferenceEncodeOctet(data[i], buffer, octetIndex, bitIndex, onesCounter);
+  }
+
+  ReferenceEncodeOctet((BYTE)fcs, buffer, octetIndex, bitIndex, onesCounter);
+  ReferenceEncodeOctet((BYTE)(fcs >> 8), buffer, octetIndex, bitIndex, onesCounter);
+
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+  ReferenceEncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+
+  // determining correct number of octets
+  if(bitIndex == 7) {
+    octetIndex--;
+  }
+
+  size = octetIndex;
+  theBitIndex = bitIndex;
+
+  return TRUE;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+PBoolean Q922CheckProcess::RoundTrip(const Q922_Frame & frame, BYTE bitPosition, unsigned test)
+{
+  PINDEX size = frame.GetEncodedSize();
+  PBYTEArray buffer(size);
+  BYTE endPosition = bitPosition;
+  if (!frame.Encode(buffer.GetPointer(), size, endPosition)) {
+    cout << "Test " << test << ": encode failed for " << frame.GetInformationFieldSize() << " octets" << endl;
+    return FALSE;
+  }
+
+  PINDEX referenceSize = frame.GetEncodedSize();
+  PBYTEArray reference(referenceSize);
+  BYTE referenceEnd = bitPosition;
+  if (!ReferenceEncode(frame, reference.GetPointer(), referenceSize, referenceEnd) ||
+      referenceSize != size || referenceEnd != endPosition ||
+      memcmp(reference, buffer, size) != 0) {
+    cout << "Test " << test << ": encoding differs from the reference encoder for "
+         << frame.GetInformationFieldSize() << " octets at bit " << (unsigned)bitPosition << endl;
+    return FALSE;
+  }
+
+  Q922_Frame decoded;
+  if (!decoded.Decode(buffer, size)) {
+    cout << "Test " << test << ": decode failed for " << frame.GetInformationFieldSize()
+         << " octets at bit " << (unsigned)bitPosition << endl;
+    return FALSE;
+  }
+
+  if (decoded.GetInformationFieldSize() != frame.GetInformationFieldSize() ||
+      decoded.GetHighOrderAddressOctet() != frame.GetHighOrderAddressOctet() ||
+      decoded.GetLowOrderAddressOctet() != frame.GetLowOrderAddressOctet() ||
+      decoded.GetControlFieldOctet() != frame.GetControlFieldOctet() ||
+      memcmp(decoded.GetInformationFieldPtr(), frame.GetInformationFieldPtr(), frame.GetInformationFieldSize()) != 0) {
+    cout << "Test " << test << ": decoded frame differs for " << frame.GetInformationFieldSize()
+         << " octets at bit " << (unsigned)bitPosition << endl;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+#endif // H323_H224
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,63 @@
+/*
+ * main.h
+ *
+ * Q.922 encode/decode round trip check for the H323Plus library.
+ *
+ * Copyright (c) 2026 H323plus
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _Q922Check_MAIN_H
+#define _Q922Check_MAIN_H
+
+#include <h323.h>
+
+#ifdef H323_H224
+#include <q922.h>
+#endif
+
+#if PTLIB_VER < 2130
+#if !defined(P_USE_STANDARD_CXX_BOOL) && !defined(P_USE_INTEGER_BOOL)
+    typedef int PBoolean;
+#endif
+#endif
+
+class Q922CheckProcess : public PProcess
+{
+  PCLASSINFO(Q922CheckProcess, PProcess)
+
+  public:
+    Q922CheckProcess();
+
+    void Main();
+
+  protected:
+#ifdef H323_H224
+    PBoolean RoundTrip(const Q922_Frame & frame, BYTE bitPosition, unsigned test);
+#endif
+
+    unsigned seed;
+    unsigned Random(unsigned range);
+};
+
+
+#endif  // _Q922Check_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -1144,6 +1144,13 @@ void H323_RTPChannel::Receive()
     if (payloadSize == 0) {
       rec_ok = codec->Write(NULL, 0, frame, rec_written);
       rtpTimestamp += codecFrameRate;
+#ifdef H323_AUDIO_CODECS
+    } else if (isAudio && frame.GetPayloadType() == RTP_DataFrame::CN && rtpPayloadType != RTP_DataFrame::CN) {
+      // RFC 3389 comfort noise starts a gap, which the codec fills
+      ((H323AudioCodec *)codec)->OnComfortNoise(frame.GetPayloadPtr(), payloadSize);
+      rec_ok = codec->Write(NULL, 0, frame, rec_written);
+      rtpTimestamp += codecFrameRate;
+#endif
     } else {
       silenceStartTick = PTimer::Tick().GetMilliSeconds();
 
@@ -50,10 +50,18 @@
 #include <etc/h323aec.h>
 #endif // H323_AEC
 
+#ifdef H323_AUDIO_CODECS
+#include <etc/h323plc.h>
+#endif
+
 extern "C" {
 #include "g711.h"
 };
 
+#ifdef P_WAVFILE
+#include "opalwavfile.h"
+#endif
+
 #define new PNEW
 
 /////////////////////////////////////////////////////////////////////////////
@@ -500,6 +508,337 @@ PBoolean H323VideoCodec::SetSupportedFormats(std::list<PVideoFrameInfo> & /*info
 
 #ifdef H323_AUDIO_CODECS
 
+// G.711 lookup tables. The encoders only use the top 13 (A-Law) or 14 (uLaw)
+// bits of the sample, so those index the table directly.
+
+class H323_G711Tables
+{
+  public:
+    H323_G711Tables()
+    {
+      int i;
+      for (i = 0; i < 8192; i++)
+        alawEncode[i] = (BYTE)linear2alaw((i - 4096) << 3);
+      for (i = 0; i < 16384; i++)
+        ulawEncode[i] = (BYTE)linear2ulaw((i - 8192) << 2);
+      for (i = 0; i < 256; i++) {
+        alawDecode[i] = (short)alaw2linear(i);
+        ulawDecode[i] = (short)ulaw2linear(i);
+      }
+    }
+
+    BYTE  alawEncode[8192];
+    BYTE  ulawEncode[16384];
+    short alawDecode[256];
+    short ulawDecode[256];
+};
+
+static const H323_G711Tables G711Tables;
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323MediaClock::H323MediaClock()
+  : m_shutdown(FALSE)
+{
+  m_thread = PThread::Create(PCREATE_NOTIFIER(ClockMain), 0,
+                             PThread::NoAutoDeleteThread,
+                             PThread::HighestPriority,
+                             "MediaClock:%x");
+}
+
+
+H323MediaClock::~H323MediaClock()
+{
+  {
+    PWaitAndSignal m(m_mutex);
+    m_shutdown = TRUE;
+    for (std::list<Client *>::iterator i = m_clients.begin(); i != m_clients.end(); ++i) {
+      (*i)->m_active = FALSE;
+      (*i)->m_tick.Signal();
+    }
+    m_clients.clear();
+  }
+
+  m_wakeup.Signal();
+  m_thread->WaitForTermination();
+  delete m_thread;
+}
+
+
+void H323MediaClock::Attach(Client & client, unsigned interval)
+{
+  {
+    PWaitAndSignal m(m_mutex);
+    if (client.m_active)
+      m_clients.remove(&client);
+    client.m_interval = interval;
+    client.m_due = PTimer::Tick().GetMilliSeconds() + interval;
+    client.m_pending = 0;
+    client.m_active = !m_shutdown;
+    if (client.m_active)
+      m_clients.push_back(&client);
+  }
+
+  PTRACE(4, "Codec\tMedia clock attached client every " << interval << "ms");
+  m_wakeup.Signal();
+}
+
+
+void H323MediaClock::Detach(Client & client)
+{
+  PWaitAndSignal m(m_mutex);
+
+  if (!client.m_active)
+    return;
+
+  m_clients.remove(&client);
+  client.m_active = FALSE;
+  client.m_tick.Signal();
+}
+
+
+PBoolean H323MediaClock::Wait(Client & client)
+{
+  for (;;) {
+    {
+      PWaitAndSignal m(m_mutex);
+      if (!client.m_active)
+        return FALSE;
+      if (client.m_pending > 0) {
+        client.m_pending--;
+        return TRUE;
+      }
+    }
+    client.m_tick.Wait();
+  }
+}
+
+
+PINDEX H323MediaClock::GetClientCount() const
+{
+  PWaitAndSignal m(m_mutex);
+  return m_clients.size();
+}
+
+
+void H323MediaClock::ClockMain(PThread &, H323_INT)
+{
+  PTRACE(4, "Codec\tMedia clock started");
+
+  for (;;) {
+    PInt64 now = PTimer::Tick().GetMilliSeconds();
+    PInt64 next = now + 1000;
+    {
+      PWaitAndSignal m(m_mutex);
+      if (m_shutdown)
+        break;
+
+      for (std::list<Client *>::iterator i = m_clients.begin(); i != m_clients.end(); ++i) {
+        Client & client = **i;
+        if (client.m_due <= now) {
+          // Absolute schedule, unless the reader has fallen too far behind
+          client.m_due += client.m_interval;
+          if (client.m_due + MaxPendingTicks*client.m_interval <= now)
+            client.m_due = now + client.m_interval;
+          if (client.m_pending < MaxPendingTicks)
+            client.m_pending++;
+          client.m_tick.Signal();
+        }
+        if (client.m_due < next)
+          next = client.m_due;
+      }
+    }
+
+    PInt64 delay = next - PTimer::Tick().GetMilliSeconds();
+    if (delay > 0)
+      m_wakeup.Wait(PTimeInterval(delay));
+  }
+
+  PTRACE(4, "Codec\tMedia clock ended");
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323AudioFanOut::H323AudioFanOut(PChannel * _source, unsigned _sampleRate, PBoolean _autoDelete)
+  : source(_source),
+    sampleRate(_sampleRate),
+    autoDelete(_autoDelete),
+    history(HistorySamples),
+    samplesRead(0)
+{
+}
+
+
+H323AudioFanOut::~H323AudioFanOut()
+{
+  PWaitAndSignal m(mutex);
+
+  for (StreamMap::iterator r = streams.begin(); r != streams.end(); ++r)
+    delete r->second;
+
+  if (autoDelete)
+    delete source;
+}
+
+
+PBoolean H323AudioFanOut::Subscribe(H323FramedAudioCodec & codec)
+{
+  if (codec.GetDirection() != H323Codec::Encoder ||
+      codec.GetMediaFormat().GetTimeUnits()*1000 != sampleRate) {
+    PTRACE(2, "Codec\tCannot fan out " << sampleRate << "Hz source to " << codec.GetMediaFormat());
+    return FALSE;
+  }
+
+  PWaitAndSignal m(mutex);
+
+  Unsubscribe(codec);
+
+  PString key = codec.GetMediaFormat() + '/' + PString(PString::Unsigned, codec.samplesPerFrame);
+  Stream * & stream = streams[key];
+  if (stream == NULL) {
+    stream = new Stream;
+    stream->samplesPerFrame = codec.samplesPerFrame;
+    stream->firstSample = samplesRead;
+    stream->nextFrame = 0;
+    PTRACE(4, "Codec\tFan out encoding " << key);
+  }
+  stream->encoders.push_back(&codec);
+
+  Subscriber & subscriber = subscribers[&codec];
+  subscriber.stream = stream;
+  subscriber.nextFrame = stream->nextFrame;
+
+  PTRACE(4, "Codec\tFan out " << key << " has " << stream->encoders.size() << " subscribers");
+  return TRUE;
+}
+
+
+void H323AudioFanOut::Unsubscribe(H323FramedAudioCodec & codec)
+{
+  PWaitAndSignal m(mutex);
+
+  SubscriberMap::iterator r = subscribers.find(&codec);
+  if (r == subscribers.end())
+    return;
+
+  Stream * stream = r->second.stream;
+  subscribers.erase(r);
+
+  // the next subscriber takes over encoding, an empty stream is dropped
+  stream->encoders.remove(&codec);
+  if (!stream->encoders.empty())
+    return;
+
+  for (StreamMap::iterator s = streams.begin(); s != streams.end(); ++s) {
+    if (s->second == stream) {
+      PTRACE(4, "Codec\tFan out no longer encoding " << s->first);
+      streams.erase(s);
+      break;
+    }
+  }
+  delete stream;
+}
+
+
+PBoolean H323AudioFanOut::Read(H323FramedAudioCodec & codec, BYTE * buffer, unsigned & length)
+{
+  PWaitAndSignal m(mutex);
+
+  SubscriberMap::iterator r = subscribers.find(&codec);
+  if (r == subscribers.end())
+    return FALSE;
+
+  Subscriber & subscriber = r->second;
+  Stream & stream = *subscriber.stream;
+
+  // a call too far behind skips to the newest frame
+  if (subscriber.nextFrame + HistoryFrames <= stream.nextFrame)
+    subscriber.nextFrame = stream.nextFrame;
+
+  if (subscriber.nextFrame == stream.nextFrame && !Encode(stream))
+    return FALSE;
+
+  PINDEX slot = (PINDEX)(subscriber.nextFrame % HistoryFrames);
+  length = stream.lengths[slot];
+  if (length > 0)
+    memcpy(buffer, stream.frames[slot], length);
+
+  subscriber.nextFrame++;
+  return TRUE;
+}
+
+
+PBoolean H323AudioFanOut::Encode(Stream & stream)
+{
+  // called with the mutex held, so Unsubscribe() waits for the encoder. The
+  // mutex is always taken before a codec's rawChannelMutex, never after it.
+  H323FramedAudioCodec & encoder = *stream.encoders.front();
+  const unsigned count = stream.samplesPerFrame;
+
+  // a format nobody has read for a while restarts at the oldest sample kept
+  PInt64 start = stream.firstSample + stream.nextFrame*count;
+  if (start + (PInt64)history.size() < samplesRead + count) {
+    start = samplesRead + count - history.size();
+    stream.firstSample = start - stream.nextFrame*count;
+  }
+
+  if (!ReadSamples(start + count))
+    return FALSE;
+
+  // the encoder belongs to another call, whose own thread may use it too
+  PWaitAndSignal codecMutex(encoder.rawChannelMutex);
+
+  short * samples = encoder.sampleBuffer.GetPointer(count);
+  for (unsigned i = 0; i < count; i++)
+    samples[i] = history[(size_t)((start + i) % history.size())];
+
+  PINDEX slot = (PINDEX)(stream.nextFrame % HistoryFrames);
+  unsigned length = 0;
+  if (!encoder.DetectSilence()) {
+    length = encoder.bytesPerFrame;
+    if (!encoder.EncodeFrame(stream.frames[slot].GetPointer(length), length))
+      return FALSE;
+  }
+
+  stream.lengths[slot] = length;
+  stream.nextFrame++;
+  return TRUE;
+}
+
+
+PBoolean H323AudioFanOut::ReadSamples(PInt64 upTo)
+{
+  while (samplesRead < upTo) {
+    size_t offset = (size_t)(samplesRead % history.size());
+    PINDEX count = (PINDEX)PMIN((PInt64)(history.size() - offset), upTo - samplesRead);
+    if (source == NULL || !source->Read(&history[offset], count*2) || source->GetLastReadCount() < 2) {
+      PTRACE(3, "Codec\tFan out source ended");
+      return FALSE;
+    }
+    samplesRead += source->GetLastReadCount()/2;
+  }
+  return TRUE;
+}
+
+
+PINDEX H323AudioFanOut::GetSubscriberCount() const
+{
+  PWaitAndSignal m(mutex);
+  return subscribers.size();
+}
+
+
+PINDEX H323AudioFanOut::GetStreamCount() const
+{
+  PWaitAndSignal m(mutex);
+  return streams.size();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
 H323AudioCodec::H323AudioCodec(const OpalMediaFormat & fmt, Direction dir)
   : H323Codec(fmt, dir)
 {
@@ -513,6 +852,8 @@ H323AudioCodec::H323AudioCodec(const OpalMediaFormat & fmt, Direction dir)
 
   IsRawDataHeld = FALSE;
 
+  mediaClock = NULL;
+
   // Initialise the adaptive threshold variables.
   SetSilenceDetectionMode(AdaptiveSilenceDetection);
 }
@@ -530,7 +871,20 @@ H323AudioCodec::~H323AudioCodec()
 
 PBoolean H323AudioCodec::Open(H323Connection & connection)
 {
-  return connection.OpenAudioChannel(direction == Encoder, samplesPerFrame*2, *this);
+  if (!connection.OpenAudioChannel(direction == Encoder, samplesPerFrame*2, *this))
+    return FALSE;
+
+  if (direction == Encoder) {
+    if (mediaClock == NULL)
+      mediaClock = connection.GetEndPoint().GetMediaClock();
+    if (mediaClock != NULL) {
+      unsigned timeUnits = mediaFormat.GetTimeUnits();
+      unsigned interval = samplesPerFrame/(timeUnits > 0 ? timeUnits : 8);
+      mediaClock->Attach(mediaClockClient, interval > 0 ? interval : 1);
+    }
+  }
+
+  return TRUE;
 }
 
 
@@ -538,6 +892,9 @@ void H323AudioCodec::Close()
 {
   //PWaitAndSignal mutex(rawChannelMutex); - TODO: This causes a lockup. Is it needed? -SH
 
+  if (mediaClock != NULL)
+    mediaClock->Detach(mediaClockClient);
+
   if (rawDataChannel != NULL)
     rawDataChannel->Close();
 
@@ -583,7 +940,7 @@ void H323AudioCodec::SetSilenceDetectionMode(SilenceDetectionMode mode,
   // This is the period over which the adaptive algorithm operates
   adaptiveThresholdFrames = (adaptivePeriod+samplesPerFrame-1)/samplesPerFrame;
 
-  if (mode != AdaptiveSilenceDetection) {
+  if (mode == NoSilenceDetection || mode == FixedSilenceDetection) {
     levelThreshold = threshold;
     return;
   }
@@ -608,18 +965,28 @@ PBoolean H323AudioCodec::DetectSilence()
   if (silenceDetectMode == NoSilenceDetection)
     return FALSE;
 
+  SignalFeatures features;
+  PBoolean haveFeatures = silenceDetectMode == VoiceActivityDetection && GetSignalFeatures(features);
+
   // Can never have average signal level that high, this indicates that the
   // hardware cannot do silence detection.
-  unsigned level = GetAverageSignalLevel();
+  unsigned level = haveFeatures ? features.level : GetAverageSignalLevel();
   if (level == UINT_MAX)
     return FALSE;
 
   // Convert to a logarithmic scale - use uLaw which is complemented
-  level = linear2ulaw(level) ^ 0xff;
+  level = ToLogLevel(level);
 
   // Now if signal level above threshold we are "talking"
   PBoolean haveSignal = level > levelThreshold;
 
+  // Less than 6dB over the threshold, check that it does not look like noise
+  if (haveSignal && haveFeatures && level < levelThreshold + 16 && IsNoiseLike(features)) {
+    PTRACE(6, "Codec\tVAD rejected frame level=" << level << " low=" << features.lowLevel
+           << " high=" << features.highLevel << " zc=" << features.zeroCrossings);
+    haveSignal = FALSE;
+  }
+
   // If no change ie still talking or still silent, resent frame counter
   if (inTalkBurst == haveSignal)
     framesReceived = 0;
@@ -721,6 +1088,91 @@ unsigned H323AudioCodec::GetAverageSignalLevel()
   return UINT_MAX;
 }
 
+
+PBoolean H323AudioCodec::GetSignalFeatures(SignalFeatures & /*features*/)
+{
+  return FALSE;
+}
+
+
+unsigned H323AudioCodec::ToLogLevel(unsigned level)
+{
+  if (level > 32767)
+    level = 32767;
+  return G711Tables.ulawEncode[(level >> 2) + 8192] ^ 0xff;
+}
+
+
+unsigned H323AudioCodec::CalculateSignalLevel(const short * pcm, unsigned count)
+{
+  if (count == 0)
+    return 0;
+
+  // Branch free absolute value with independent sums so the compiler can vectorise the loop
+  unsigned sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  unsigned i = 0;
+  for (; i + 4 <= count; i += 4) {
+    int s0 = pcm[i], s1 = pcm[i+1], s2 = pcm[i+2], s3 = pcm[i+3];
+    sum0 += (s0 ^ (s0 >> 31)) - (s0 >> 31);
+    sum1 += (s1 ^ (s1 >> 31)) - (s1 >> 31);
+    sum2 += (s2 ^ (s2 >> 31)) - (s2 >> 31);
+    sum3 += (s3 ^ (s3 >> 31)) - (s3 >> 31);
+  }
+  for (; i < count; i++) {
+    int s0 = pcm[i];
+    sum0 += (s0 ^ (s0 >> 31)) - (s0 >> 31);
+  }
+
+  return (sum0 + sum1 + sum2 + sum3)/count;
+}
+
+
+void H323AudioCodec::CalculateSignalFeatures(const short * pcm, unsigned count, SignalFeatures & features)
+{
+  features.level = features.lowLevel = features.highLevel = features.zeroCrossings = 0;
+  features.samples = count;
+  if (count < 2)
+    return;
+
+  /* Split the frame into two bands with the simplest filters there are,
+     (x[n] + x[n-1]) below and (x[n] - x[n-1]) above a quarter of the sample rate.
+     Same branch free form as CalculateSignalLevel().
+   */
+  unsigned level = 0, low = 0, high = 0, crossings = 0;
+  for (unsigned i = 1; i < count; i++) {
+    int s = pcm[i], p = pcm[i-1];
+    int l = s + p, h = s - p;
+    level += (s ^ (s >> 31)) - (s >> 31);
+    low += (l ^ (l >> 31)) - (l >> 31);
+    high += (h ^ (h >> 31)) - (h >> 31);
+    crossings += (unsigned)(s ^ p) >> 31;
+  }
+
+  int first = pcm[0];
+  level += (first ^ (first >> 31)) - (first >> 31);
+
+  features.level = level/count;
+  features.lowLevel = low/(2*(count-1));
+  features.highLevel = high/(2*(count-1));
+  features.zeroCrossings = crossings;
+}
+
+
+PBoolean H323AudioCodec::IsNoiseLike(const SignalFeatures & features)
+{
+  /* Speech is either voiced, with most energy in the low band and few zero
+     crossings, or fricative with most energy in the high band. Broadband noise
+     has about the same level in both bands and crosses zero on every other sample.
+   */
+  unsigned low = features.lowLevel;
+  unsigned high = features.highLevel;
+  if (low*10 > high*14 || high*10 > low*14)
+    return FALSE;
+
+  unsigned crossings = features.zeroCrossings*100/features.samples;
+  return crossings >= 35 && crossings <= 65;
+}
+
 PBoolean H323AudioCodec::SetRawDataHeld(PBoolean hold) {
 
   PTimedMutex m;
@@ -737,6 +1189,9 @@ H323FramedAudioCodec::H323FramedAudioCodec(const OpalMediaFormat & fmt, Directio
 #ifdef H323_AEC
     aec(NULL),
 #endif
+    concealer(NULL),
+    fanOut(NULL),
+    prompt(NULL), promptFrame(0), promptRepeat(0),
     sampleBuffer(samplesPerFrame), bytesPerFrame(mediaFormat.GetFrameSize()),
     readBytes(samplesPerFrame*2), writeBytes(samplesPerFrame*2), cntBytes(0)
 {
@@ -744,6 +1199,26 @@ H323FramedAudioCodec::H323FramedAudioCodec(const OpalMediaFormat & fmt, Directio
 }
 
 
+H323FramedAudioCodec::~H323FramedAudioCodec()
+{
+  if (fanOut != NULL)
+    fanOut->Unsubscribe(*this);
+  delete concealer;
+  delete prompt;
+}
+
+
+void H323FramedAudioCodec::Close()
+{
+  // Not under rawChannelMutex as Read() may be waiting on the fan out, and
+  // once unsubscribed Read() gets FALSE from it.
+  if (fanOut != NULL)
+    fanOut->Unsubscribe(*this);
+
+  H323AudioCodec::Close();
+}
+
+
 PBoolean H323FramedAudioCodec::Read(BYTE * buffer, unsigned & length, RTP_DataFrame &)
 {
   PWaitAndSignal mutex(rawChannelMutex);
@@ -754,11 +1229,47 @@ PBoolean H323FramedAudioCodec::Read(BYTE * buffer, unsigned & length, RTP_DataFr
   }
 
   if (IsRawDataHeld) {	 // If connection is onHold
-    PThread::Sleep(5);  // Sleep to avoid CPU overload. <--Should be a better method but it works :)
+    if (mediaClock == NULL)
+      PThread::Sleep(5);  // Sleep to avoid CPU overload. <--Should be a better method but it works :)
+    else if (!mediaClock->Wait(mediaClockClient))
+      return FALSE;
     length = 0;
     return TRUE;
   }
 
+  // The raw channel does not block for a frame time when paced by the media clock
+  if (mediaClock != NULL && !mediaClock->Wait(mediaClockClient))
+    return FALSE;
+
+  if (mediaClock == NULL && (fanOut != NULL || prompt != NULL))
+    fanOutDelay.Delay(PMAX(samplesPerFrame/PMAX(mediaFormat.GetTimeUnits(), 1U), 1U));
+
+  if (prompt != NULL) {
+    PINDEX size;
+    const BYTE * frame = prompt->GetFrame(promptFrame, size);
+    memcpy(buffer, frame, size);
+    length = size;
+    if (++promptFrame >= prompt->GetCount()) {
+      promptFrame = 0;
+      if (--promptRepeat <= 0) {
+        PTRACE(4, "Codec\tPrompt ended");
+        delete prompt;
+        prompt = NULL;
+      }
+    }
+    return TRUE;
+  }
+
+  if (fanOut != NULL) {
+    // the fan out may lock this codec to encode with it, so is not called
+    // into with our mutex held
+    H323AudioFanOut * source = fanOut;
+    rawChannelMutex.Signal();
+    PBoolean ok = source->Read(*this, buffer, length);
+    rawChannelMutex.Wait();
+    return ok;
+  }
+
 #ifdef H323_MEDIAENCODED
     bool lastPacket = true;
     if (rawDataChannel->SourceEncoded(lastPacket,length))
@@ -847,6 +1358,8 @@ PBoolean H323FramedAudioCodec::Write(const BYTE * buffer,
 
   if (length == 0)
     DecodeSilenceFrame(sampleBuffer.GetPointer(), writeBytes);
+  else if (concealer != NULL)
+    concealer->Received(sampleBuffer.GetPointer(), writeBytes/2);
 
   // Write as 16bit PCM to sound channel
   if (IsRawDataHeld) {		// If Connection om Hold
@@ -870,22 +1383,18 @@ PBoolean H323FramedAudioCodec::Write(const BYTE * buffer,
 
 unsigned H323FramedAudioCodec::GetAverageSignalLevel()
 {
-  if (!samplesPerFrame)
-      return 0;
-
   // Calculate the average signal level of this frame
-  int sum = 0;
-
-  const short * pcm = sampleBuffer;
-  const short * end = pcm + samplesPerFrame;
-  while (pcm != end) {
-    if (*pcm < 0)
-      sum -= *pcm++;
-    else
-      sum += *pcm++;
-  }
+  return CalculateSignalLevel(sampleBuffer, samplesPerFrame);
+}
+
 
-  return sum/samplesPerFrame;
+PBoolean H323FramedAudioCodec::GetSignalFeatures(SignalFeatures & features)
+{
+  if (!samplesPerFrame)
+    return FALSE;
+
+  CalculateSignalFeatures(sampleBuffer, samplesPerFrame, features);
+  return TRUE;
 }
 
 
@@ -906,6 +1415,91 @@ PBoolean H323FramedAudioCodec::DecodeFrame(const BYTE * /*buffer*/,
   return FALSE;
 }
 
+void H323FramedAudioCodec::DecodeSilenceFrame(void * buffer, unsigned length)
+{
+  if (concealer != NULL)
+    concealer->Conceal((short *)buffer, length/2);
+  else
+    memset(buffer, 0, length);
+}
+
+
+void H323FramedAudioCodec::EnableConcealment(PBoolean enable)
+{
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  delete concealer;
+  concealer = NULL;
+
+  if (enable && direction == Decoder) {
+    concealer = new H323AudioConcealer(mediaFormat.GetTimeUnits()*1000);
+    PTRACE(4, "Codec	Packet loss concealment enabled for " << mediaFormat);
+  }
+}
+
+
+void H323FramedAudioCodec::OnComfortNoise(const BYTE * payload, PINDEX size)
+{
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  if (concealer != NULL)
+    concealer->SetComfortNoise(payload, size);
+}
+
+
+PBoolean H323FramedAudioCodec::AttachFanOut(H323AudioFanOut * _fanOut)
+{
+  // The fan out takes its encoder's rawChannelMutex, so (un)subscribing is
+  // done without holding it.
+  rawChannelMutex.Wait();
+  H323AudioFanOut * previous = fanOut;
+  fanOut = NULL;
+  rawChannelMutex.Signal();
+
+  if (previous != NULL)
+    previous->Unsubscribe(*this);
+
+  if (_fanOut == NULL)
+    return TRUE;
+
+  if (!_fanOut->Subscribe(*this))
+    return FALSE;
+
+  PWaitAndSignal mutex(rawChannelMutex);
+  fanOut = _fanOut;
+  return TRUE;
+}
+
+#ifdef P_WAVFILE
+PBoolean H323FramedAudioCodec::AttachPrompt(const PFilePath & name, PINDEX repeat)
+{
+  // Encoded by a codec of the cache's own, so the frames are made without
+  // holding up this codec
+  OpalPromptFrames * frames = NULL;
+  if (!name.IsEmpty()) {
+    if (direction != Encoder || repeat <= 0)
+      return FALSE;
+
+    frames = new OpalPromptFrames;
+    if (!OpalPromptCache::GetInstance().GetEncodedPrompt(name, *this, *frames)) {
+      delete frames;
+      return FALSE;
+    }
+  }
+
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  delete prompt;
+  prompt = frames;
+  if (prompt == NULL)
+    return TRUE;
+
+  promptFrame = 0;
+  promptRepeat = repeat;
+  return TRUE;
+}
+#endif
+
 #ifdef H323_AEC
 void H323FramedAudioCodec::AttachAEC(H323Aec * _aec)
 {
@@ -938,138 +1532,37 @@ H323StreamedAudioCodec::H323StreamedAudioCodec(const OpalMediaFormat & fmt,
 
 PBoolean H323StreamedAudioCodec::EncodeFrame(BYTE * buffer, unsigned &)
 {
-  PINDEX i;
-  unsigned short position = 0;
-  BYTE encoded;
+  const short * samples = sampleBuffer;
+
   switch (bitsPerSample) {
     case 8 :
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++)
-        *buffer++ = (BYTE)Encode(sampleBuffer[i]);
-      break;
-    case 5 : // g.726-40 payload encoding....
-      for (i = 0; i < (PINDEX)samplesPerFrame;i++)
-      {
-        // based on a 40 bits encoding, we have 8 words of 5 bits each
-        encoded = (BYTE)Encode(sampleBuffer[i]);
-        switch(position)
-        {
-          case 0: // 0 bits overflow
-            *buffer = encoded;
-            position++;
-            break;
-          case 1: // 2 bits overflow
-            *buffer++ |= (encoded << 5);
-            *buffer = (BYTE)(encoded >> 3);
-            position++;
-            break;
-          case 2:
-            *buffer |= (encoded << 2);
-            position++;
-            break;
-          case 3: // one bit left for word 4
-            *buffer++ |= (encoded << 7);
-            *buffer = (BYTE)(encoded >> 1);
-            position++;
-            break;
-          case 4:
-            *buffer++ |= (encoded << 4);
-            *buffer = (BYTE)(encoded >> 4);
-            position++;
-            break;
-          case 5:
-            *buffer |= (encoded << 1);
-            position++;
-            break;
-          case 6: //two bits left for the new encoded word
-            *buffer++ |= (encoded << 6);
-            *buffer =  (BYTE)(encoded >> 2);
-            position++;
-            break;
-          case 7: // now five bits left for the last word
-            *buffer++ |= (encoded << 3);
-            position = 0;
-            break;
-        }
+      if (!EncodeBlock(samples, buffer, samplesPerFrame)) {
+        for (unsigned i = 0; i < samplesPerFrame; i++)
+          *buffer++ = (BYTE)Encode(samples[i]);
       }
       break;
 
+    // those case are for ADPCM G.726, code words are packed least significant bit first
+    case 5 :
     case 4 :
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++) {
-        if ((i&1) == 0)
-          *buffer = (BYTE)Encode(sampleBuffer[i]);
-        else
-          *buffer++ |= (BYTE)(Encode(sampleBuffer[i]) << 4);
-      }
-      break;
-
     case 3 :
-      for (i = 0;i < (PINDEX)samplesPerFrame;i++)
-      {
-        encoded = (BYTE)Encode(sampleBuffer[i]);
-        switch(position)
-        {
-          case 0: // 0 bits overflow
-            *buffer = encoded;
-            position++;
-            break;
-          case 1: // 2 bits overflow
-            *buffer |= (encoded << 3);
-            position++;
-            break;
-          case 2:
-            *buffer++ |= (encoded << 6);
-            *buffer = (BYTE)(encoded >> 2);
-            position++;
-            break;
-          case 3: // one bit left for word 4
-            *buffer |= (encoded << 1);
-            position++;
-            break;
-          case 4:
-            *buffer |= (encoded << 4);
-            position++;
-            break;
-          case 5:
-            *buffer++ |= (encoded << 7);
-            *buffer = (BYTE)(encoded >> 1);
-            position++;
-            break;
-          case 6: //two bits left for the new encoded word
-            *buffer |= (encoded << 2);
-            position++;
-            break;
-          case 7: // now five bits left for the last word
-            *buffer++ |= (encoded << 5);
-            position = 0;
-            break;
-        }
-      }
-      break;
-
-    case 2:
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++)
-      {
-        switch(position)
-        {
-          case 0:
-            *buffer = (BYTE)Encode(sampleBuffer[i]);
-            position++;
-            break;
-          case 1:
-            *buffer |= (BYTE)(Encode(sampleBuffer[i]) << 2);
-            position++;
-            break;
-          case 2:
-            *buffer |= (BYTE)(Encode(sampleBuffer[i]) << 4);
-            position++;
-            break;
-          case 3:
-            *buffer++ |= (BYTE)(Encode(sampleBuffer[i]) << 6);
-            position = 0;
-            break;
+    case 2 : {
+      unsigned mask = (1 << bitsPerSample) - 1;
+      unsigned bits = 0;
+      unsigned word = 0;
+      for (unsigned i = 0; i < samplesPerFrame; i++) {
+        word |= (Encode(samples[i]) & mask) << bits;
+        bits += bitsPerSample;
+        while (bits >= 8) {
+          *buffer++ = (BYTE)word;
+          word >>= 8;
+          bits -= 8;
         }
       }
+      if (bits > 0)
+        *buffer = (BYTE)word;
       break;
+    }
 
     default :
       PTRACE(1, "Codec\tUnsupported bit size");
@@ -1085,109 +1578,38 @@ PBoolean H323StreamedAudioCodec::DecodeFrame(const BYTE * buffer,
                                          unsigned & written,
                                          unsigned & decodedBytes)
 {
-  unsigned i;
-
   short * sampleBufferPtr = sampleBuffer.GetPointer(samplesPerFrame);
   short * out = sampleBufferPtr;
-  unsigned short position = 0;
-  unsigned remaining = 0;
 
   switch (bitsPerSample) {
     case 8 :
-      for (i = 0; i < length; i++)
-        *out++ = Decode(*buffer++);
-      break;
-
-    // those case are for ADPCM G.726
-    case 5 :
-      for (i = 0; i < length; i++) {
-        switch(position)
-        {
-          case 0:
-            *out++ = Decode(*buffer & 31);
-            remaining = *buffer >> 5; // get the three remaining bytes for the next word
-            buffer++;
-            position++;
-            break;
-          case 1: // we can decode more than one word in second buffer
-            *out++ = Decode (((*buffer&3) << 3) | remaining);
-            *out++ = Decode( (*buffer >> 2) & 31);
-            remaining = *buffer >> 7;
-            buffer++;
-            position++;
-            break;
-          case 2:
-            *out++ = Decode( remaining | ((*buffer&15) << 1));
-            remaining = *buffer >> 4;
-            buffer++;
-            position++;
-            break;
-          case 3:
-            *out++ = Decode( remaining | ((*buffer&1) << 4));
-            *out++ = Decode( (*buffer >> 1) & 31);
-            remaining = *buffer >> 6;
-            buffer++;
-            position++;
-            break;
-          case 4 :
-            *out++ = Decode( remaining | ((*buffer&7) << 2));
-            *out++ = Decode(*buffer >> 3);
-            buffer++;
-            position = 0;
-            break;
-        }
+      if (DecodeBlock(buffer, out, length))
+        out += length;
+      else {
+        for (unsigned i = 0; i < length; i++)
+          *out++ = Decode(*buffer++);
       }
       break;
 
+    // those case are for ADPCM G.726, code words are packed least significant bit first
+    case 5 :
     case 4 :
-      for (i = 0; i < length; i++) {
-        *out++ = Decode(*buffer & 15);
-        *out++ = Decode(*buffer >> 4);
-        buffer++;
-      }
-      break;
-
-    case 3:
-      for (i = 0; i < length; i++) {
-        switch(position)
-        {
-        case 0:
-          *out++ = Decode(*buffer & 7);
-          *out++ = Decode((*buffer>>3)&7);
-          remaining = *buffer >> 6;
-          buffer++;
-          position++;
-          break;
-        case 1:
-          *out++ = Decode(remaining | ((*buffer&1) << 2));
-          *out++ = Decode((*buffer >> 1) & 7);
-          *out++ = Decode((*buffer >> 4)&7);
-          remaining = *buffer >> 7;
-          buffer++;
-          position++;
-          break;
-        case 2:
-          *out++ = Decode(remaining | ((*buffer&3) << 1));
-          *out++ = Decode((*buffer >> 2) & 7);
-          *out++ = Decode((*buffer >> 5) & 7);
-          buffer++;
-          position = 0;
-          break;
+    case 3 :
+    case 2 : {
+      unsigned mask = (1 << bitsPerSample) - 1;
+      unsigned bits = 0;
+      unsigned word = 0;
+      for (unsigned i = 0; i < length; i++) {
+        word |= *buffer++ << bits;
+        bits += 8;
+        while (bits >= bitsPerSample) {
+          *out++ = Decode(word & mask);
+          word >>= bitsPerSample;
+          bits -= bitsPerSample;
         }
       }
       break;
-
-    case 2:
-      for (i = 0; i < length; i++)
-      {
-        *out++ = Decode(*buffer & 3);
-        *out++ = Decode((*buffer >> 2) & 3);
-        *out++ = Decode((*buffer >> 4) & 3);
-        *out++ = Decode((*buffer >> 6) & 3);
-        buffer++;
-
-      }
-      break;
+    }
 
     default :
       PTRACE(1, "Codec\tUnsupported bit size");
@@ -1201,6 +1623,18 @@ PBoolean H323StreamedAudioCodec::DecodeFrame(const BYTE * buffer,
 }
 
 
+PBoolean H323StreamedAudioCodec::EncodeBlock(const short *, BYTE *, unsigned) const
+{
+  return FALSE;
+}
+
+
+PBoolean H323StreamedAudioCodec::DecodeBlock(const BYTE *, short *, unsigned) const
+{
+  return FALSE;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323_ALawCodec::H323_ALawCodec(Direction dir,
@@ -1219,13 +1653,29 @@ H323_ALawCodec::H323_ALawCodec(Direction dir,
 
 int H323_ALawCodec::EncodeSample(short sample)
 {
-  return linear2alaw(sample);
+  return G711Tables.alawEncode[(sample >> 3) + 4096];
 }
 
 
 short H323_ALawCodec::DecodeSample(int sample)
 {
-  return (short)alaw2linear((unsigned char)sample);
+  return G711Tables.alawDecode[(BYTE)sample];
+}
+
+
+void H323_ALawCodec::EncodeSamples(const short * samples, BYTE * encoded, unsigned count)
+{
+  const BYTE * table = G711Tables.alawEncode + 4096;
+  while (count-- > 0)
+    *encoded++ = table[*samples++ >> 3];
+}
+
+
+void H323_ALawCodec::DecodeSamples(const BYTE * encoded, short * samples, unsigned count)
+{
+  const short * table = G711Tables.alawDecode;
+  while (count-- > 0)
+    *samples++ = table[*encoded++];
 }
 
 
@@ -1246,13 +1696,29 @@ H323_muLawCodec::H323_muLawCodec(Direction dir,
 
 int H323_muLawCodec::EncodeSample(short sample)
 {
-  return linear2ulaw(sample);
+  return G711Tables.ulawEncode[(sample >> 2) + 8192];
 }
 
 
 short H323_muLawCodec::DecodeSample(int sample)
 {
-  return (short)ulaw2linear((unsigned char)sample);
+  return G711Tables.ulawDecode[(BYTE)sample];
+}
+
+
+void H323_muLawCodec::EncodeSamples(const short * samples, BYTE * encoded, unsigned count)
+{
+  const BYTE * table = G711Tables.ulawEncode + 8192;
+  while (count-- > 0)
+    *encoded++ = table[*samples++ >> 2];
+}
+
+
+void H323_muLawCodec::DecodeSamples(const BYTE * encoded, short * samples, unsigned count)
+{
+  const short * table = G711Tables.ulawDecode;
+  while (count-- > 0)
+    *samples++ = table[*encoded++];
 }
 
 
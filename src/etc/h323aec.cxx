@@ -40,6 +40,7 @@
 
 #include <ptlib.h>
 #include "openh323buildopts.h"
+#include "ptlib_extras.h"
 
 #ifdef H323_AEC
 #include "etc/h323aec.h"
@@ -50,114 +51,125 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 
-H323AEC::BufferFrame::BufferFrame() 
-: receiveTime(0), echoTime(0), frame(0)
-{
-}
-
-H323AEC::BufferFrame::BufferFrame(PINDEX sz) 
-: receiveTime(0), echoTime(0), frame(sz)
-{
-    memset(frame.GetPointer(),0,sz);
-}
-
-H323AEC::BufferFrame::~BufferFrame()
-{
-    frame.SetSize(0);
-}
-
 H323_AECBuffer::H323_AECBuffer()
-: m_bufferTime(0), m_curPos(0)
+: m_bufferTime(0), m_frameTime(0), m_frameBytes(0), m_slots(0), m_frames(NULL), m_echoTime(NULL), m_read(0)
 {
 
 }
     
 H323_AECBuffer::~H323_AECBuffer()
 {
- 
+    ShutDown();
 }
 
 void H323_AECBuffer::Initialise(PINDEX size, PINDEX byteSize, PINDEX clockRate)
 {
-    PWaitAndSignal m(m_bufferMutex);
+    ShutDown();
+
+    m_frameTime = byteSize/(clockRate/1000)/2;
+    m_bufferTime = size * m_frameTime;
+    m_frameBytes = byteSize;
 
-    m_bufferTime = size * (byteSize/(clockRate/1000)/2);
+    // Twice the playout depth so the reader may lag a little behind
+    m_slots = 4;
+    while (m_slots < (unsigned)size*2)
+        m_slots <<= 1;
 
-    for (PINDEX i=0; i < size; ++i)
-        (*this)[i] = *new H323AEC::BufferFrame(byteSize);
+    m_frames = (BYTE *)calloc(m_slots, m_frameBytes);
+    m_echoTime = new PInt64[m_slots];
+    for (unsigned i = 0; i < m_slots; ++i)
+        m_echoTime[i] = 0;
+
+    m_written = 0;
+    m_read = 0;
 }
 
 void H323_AECBuffer::ShutDown()
 {
-    PWaitAndSignal m(m_bufferMutex);
-
-    if (this->empty()) 
-        return;
+    free(m_frames);
+    m_frames = NULL;
+    delete [] m_echoTime;
+    m_echoTime = NULL;
+    m_slots = 0;
+}
 
-    std::map<unsigned, H323AEC::BufferFrame>::iterator it;
-    for (it= this->begin(); it!= this->end(); ++it)
-        this->erase(it++);
+PBoolean H323_AECBuffer::IsOverwritten(unsigned index) const
+{
+    return (unsigned)(long)m_written - index >= m_slots;
 }
 
 PBoolean H323_AECBuffer::Send(BYTE * buffer, unsigned & length)
 {
-    PWaitAndSignal m(m_bufferMutex);
-
-    if (this->empty()) {
+    if (m_frames == NULL) {
         PTRACE(6,"AEC\tEmpty!");
         return false;
     }
 
-    const H323AEC::BufferFrame & entry = (*this)[m_curPos];
+    if (length != (unsigned)m_frameBytes) {
+        PTRACE(3,"AEC\tSend buffer size " << length << " does not match receive " << m_frameBytes);
+        return false;
+    }
 
-    if (entry.receiveTime == 0) {
+    unsigned written = (unsigned)(long)m_written;
+    if (written == m_read) {
         PTRACE(6,"AEC\tFilling AEC Buffer");
         return false;
     }
 
-    if (length != (unsigned)entry.frame.GetSize()) {
-        PTRACE(3,"AEC\tSend buffer size " << length << " does not match receive " << entry.frame.GetSize());
+    // Lapped by the writer, restart from the oldest frame still intact
+    if (written - m_read >= m_slots)
+        m_read = written - m_slots + 1;
+
+    PInt64 now = PTimer::Tick().GetMilliSeconds();
+    unsigned mask = m_slots - 1;
+
+    if (m_echoTime[m_read & mask] > now + m_frameTime) {
+        PTRACE(6,"AEC\tFilling AEC Buffer");
+        return false;
+    }
+
+    // Catch up when the playing side has moved on by more than a frame
+    while (m_read + 1 != written && m_echoTime[(m_read + 1) & mask] <= now)
+        m_read++;
+
+    memcpy(buffer, m_frames + (m_read & mask)*m_frameBytes, length);
+    if (IsOverwritten(m_read)) {
+        PTRACE(5,"AEC\tReference frame overwritten while reading");
         return false;
     }
 
-    memcpy(buffer, (const void *)entry.frame, length);
-    PTRACE(6,"AEC\tPlay Pos " << m_curPos << " " << entry.receiveTime << " " << PTimer::Tick().GetMilliSeconds() - entry.echoTime);
+    PTRACE(6,"AEC\tPlay Pos " << m_read << " " << now - m_echoTime[m_read & mask]);
+    m_read++;
     return true;
 }
 
 void H323_AECBuffer::Receive(BYTE * buffer, unsigned & length)
 {
-    PWaitAndSignal m(m_bufferMutex);
-
-    if (this->empty()) 
+    if (m_frames == NULL) 
         return;
 
-    H323AEC::BufferFrame & entry = (*this)[m_curPos];
-    entry.receiveTime = PTimer::Tick().GetMilliSeconds();
-    entry.echoTime = entry.receiveTime + m_bufferTime;
-    memcpy(entry.frame.GetPointer(), buffer, length);
-
-    m_curPos++;
-    if (m_curPos >= this->size())
-        m_curPos = 0;
-
-#if 0  // debugging
-    PTRACE(6,"AEC\tPosition " << m_curPos);
-    std::map<unsigned, H323AEC::BufferFrame>::const_iterator r = this->begin();
-    for (r = this->begin(); r != this->end(); ++r)
-        PTRACE(6,"AEC\t" << r->first << " " << r->second.receiveTime);
-#endif
+    unsigned index = (unsigned)(long)m_written & (m_slots - 1);
+    BYTE * frame = m_frames + index*m_frameBytes;
+    if (length < (unsigned)m_frameBytes) {
+        memcpy(frame, buffer, length);
+        memset(frame + length, 0, m_frameBytes - length);
+    }
+    else
+        memcpy(frame, buffer, m_frameBytes);
+    m_echoTime[index] = PTimer::Tick().GetMilliSeconds() + m_bufferTime;
 
+    // Publish the frame to the reader
+    ++m_written;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////
 #define TAIL 5
 
-H323Aec::H323Aec(int _clock, int _sampletime, int _buffers)
+H323Aec::H323Aec(int _clock, int _sampletime, int _buffers, unsigned _offload)
   :  m_echoState(NULL), m_preprocessState(NULL), m_clockrate(_clock), m_samplesFrame(_sampletime*(m_clockrate/1000)), m_BufferBytes(2*m_samplesFrame),
      m_echo_buf((spx_int16_t *)malloc(m_BufferBytes)), m_ref_buf((spx_int16_t *)malloc(m_BufferBytes)), m_temp_buf((spx_int16_t *)malloc(m_BufferBytes)),
-     m_tail(TAIL * m_samplesFrame)
+     m_tail(TAIL * m_samplesFrame), m_worker(NULL), m_offload(_offload), m_shutdown(FALSE), m_overruns(0)
 {
 
     m_buffer.Initialise( _buffers, m_BufferBytes, _clock);
@@ -180,12 +192,26 @@ H323Aec::H323Aec(int _clock, int _sampletime, int _buffers)
        f=.0;
        speex_preprocess_ctl(m_preprocessState, SPEEX_PREPROCESS_SET_DEREVERB_LEVEL, &f);
 
-    PTRACE(3, "AEC\tcreated AEC " << m_clockrate << " hz " << " buffer Size " << _buffers );
+    if (m_offload > 0)
+        m_worker = PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0,
+                                   PThread::NoAutoDeleteThread,
+                                   PThread::HighPriority,
+                                   "AEC:%x");
+
+    PTRACE(3, "AEC\tcreated AEC " << m_clockrate << " hz " << " buffer Size " << _buffers
+              << (m_worker != NULL ? " offloaded" : ""));
 }
 
 
 H323Aec::~H323Aec()
 {
+    if (m_worker != NULL) {
+        m_shutdown = TRUE;
+        m_jobReady.Signal();
+        m_worker->WaitForTermination();
+        delete m_worker;
+    }
+
     m_buffer.ShutDown();
 
     free(m_echo_buf);
@@ -212,23 +238,66 @@ void H323Aec::Receive(BYTE * buffer, unsigned & length)
 
 }
 
+void H323Aec::Cancel()
+{
+  speex_echo_cancellation(m_echoState, m_ref_buf,
+                          m_echo_buf, m_temp_buf);
+
+  speex_preprocess_run(m_preprocessState, m_temp_buf);
+}
+
 void H323Aec::Send(BYTE * buffer, unsigned & length)
 {
+  // The worker owns the buffers until it has finished the previous frame
+  if (m_worker != NULL && m_jobPending > 0) {
+      m_overruns++;
+      return;
+  }
 
   if (!m_buffer.Send((BYTE *)m_echo_buf,length))
       return;
 
   memcpy(m_ref_buf,buffer,length);
 
-  speex_echo_cancellation(m_echoState, m_ref_buf,
-                          m_echo_buf, m_temp_buf);
-
-  speex_preprocess_run(m_preprocessState, m_temp_buf);
+  if (m_worker == NULL)
+      Cancel();
+  else {
+      ++m_jobPending;
+      m_jobReady.Signal();
+
+      // Send the frame unprocessed rather than stall the encoder
+      PTimeInterval deadline = PTimer::Tick() + PTimeInterval(m_offload);
+      while (m_jobPending > 0) {
+          PTimeInterval remaining = deadline - PTimer::Tick();
+          if (remaining <= 0 || !m_jobDone.Wait(remaining)) {
+              PTRACE(5, "AEC\tCancellation exceeded " << m_offload << "ms budget");
+              m_overruns++;
+              return;
+          }
+      }
+  }
 
   memcpy(buffer,m_temp_buf,length);
 
 }
 
-#endif // H323_AEC
+void H323Aec::WorkerMain(PThread &, H323_INT)
+{
+  PTRACE(4, "AEC\tWorker started");
+
+  for (;;) {
+      m_jobReady.Wait();
+      if (m_shutdown)
+          break;
 
+      if (m_jobPending > 0) {
+          Cancel();
+          --m_jobPending;
+          m_jobDone.Signal();
+      }
+  }
 
+  PTRACE(4, "AEC\tWorker ended");
+}
+
+#endif // H323_AEC
@@ -0,0 +1,300 @@
+/*
+ * h323plc.cxx
+ *
+ * Packet loss concealment and comfort noise for the h323plus Library.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the General Public License (the  "GNU License"), in which case the
+ * provisions of GNU License are applicable instead of those
+ * above. If you wish to allow use of your version of this file only
+ * under the terms of the GNU License and not to allow others to use
+ * your version of this file under the MPL, indicate your decision by
+ * deleting the provisions above and replace them with the notice and
+ * other provisions required by the GNU License. If you do not delete
+ * the provisions above, a recipient may use your version of this file
+ * under either the MPL or the GNU License."
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is derived from and used in conjunction with the
+ * H323plus Project (www.h323plus.org/)
+ *
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+#include "openh323buildopts.h"
+
+#ifdef H323_AUDIO_CODECS
+
+#ifdef __GNUC__
+#pragma implementation "h323plc.h"
+#endif
+
+#include "etc/h323plc.h"
+
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Loudest background accepted as noise, -30 dBov
+static const float MaxNoiseFloor = 1036.0f;
+
+static inline short Saturate(float value)
+{
+  if (value > 32767.0f)
+    return 32767;
+  if (value < -32768.0f)
+    return -32768;
+  return (short)value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+H323AudioConcealer::H323AudioConcealer(unsigned sampleRate)
+  : m_sampleRate(sampleRate > 0 ? sampleRate : 8000),
+    m_pitch(0), m_overlap(0), m_position(0), m_missing(0),
+    m_noiseFloor(0), m_noiseLevel(0), m_noiseReceived(FALSE), m_noiseOrder(0),
+    m_excitation(1), m_noiseSeed(22222)
+{
+  // G.711 Appendix I dimensions at 8 kHz, scaled to the actual rate
+  m_pitchMin = 40 * m_sampleRate / 8000;
+  m_pitchMax = 120 * m_sampleRate / 8000;
+  m_correlationSpan = 160 * m_sampleRate / 8000;
+  m_gapStep = m_sampleRate / 100;
+  m_fadeLength = 5 * m_gapStep;
+
+  m_history.assign(3 * m_pitchMax + m_pitchMax / 4, 0.0f);
+  m_pitchBuffer.assign(m_history.size(), 0.0f);
+
+  memset(m_lpc, 0, sizeof(m_lpc));
+  memset(m_noiseState, 0, sizeof(m_noiseState));
+}
+
+
+void H323AudioConcealer::Received(short * samples, unsigned count)
+{
+  if (count == 0)
+    return;
+
+  if (m_missing > 0) {
+    // overlap add the synthetic signal into the start of the real one
+    unsigned blend = m_overlap < count ? m_overlap : count;
+    for (unsigned i = 0; i < blend; i++) {
+      float weight = (float)(i + 1) / (blend + 1);
+      samples[i] = Saturate(Synthesise() * (1.0f - weight) + samples[i] * weight);
+    }
+    PTRACE(6, "PLC\tConcealed gap of " << m_missing - blend << " samples");
+    m_missing = 0;
+    m_noiseReceived = FALSE;
+  }
+
+  // track the background level, following it down at once and up slowly
+  float energy = 0;
+  for (unsigned i = 0; i < count; i++)
+    energy += (float)samples[i] * samples[i];
+  float rms = sqrtf(energy / count);
+
+  if (rms < m_noiseFloor)
+    m_noiseFloor = rms;
+  else {
+    m_noiseFloor += m_noiseFloor * 0.01f * count / m_gapStep + 1.0f;
+    if (m_noiseFloor > MaxNoiseFloor)
+      m_noiseFloor = MaxNoiseFloor;
+  }
+
+  SaveHistory(samples, count);
+}
+
+
+void H323AudioConcealer::Conceal(short * samples, unsigned count)
+{
+  if (m_missing == 0)
+    StartGap();
+
+  for (unsigned i = 0; i < count; i++)
+    samples[i] = Saturate(Synthesise());
+
+  SaveHistory(samples, count);
+}
+
+
+void H323AudioConcealer::SetComfortNoise(const BYTE * payload, PINDEX size)
+{
+  if (payload == NULL || size < 1)
+    return;
+
+  // noise level in -dBov, relative to a full scale square wave
+  m_noiseLevel = (float)(32767.0 * pow(10.0, -(double)(payload[0] & 0x7f) / 20.0));
+
+  m_noiseOrder = size - 1;
+  if (m_noiseOrder > MaxNoiseOrder)
+    m_noiseOrder = MaxNoiseOrder;
+
+  // step up from the reflection coefficients to the direct form synthesis
+  // filter, the product of (1 - k^2) being the filter's prediction gain
+  float prediction = 1.0f;
+  for (unsigned m = 0; m < m_noiseOrder; m++) {
+    float k = (payload[m + 1] - 127) / 128.0f;
+    if (k > 0.99f)
+      k = 0.99f;
+    else if (k < -0.99f)
+      k = -0.99f;
+
+    float previous[MaxNoiseOrder];
+    memcpy(previous, m_lpc, m * sizeof(float));
+    for (unsigned i = 0; i < m; i++)
+      m_lpc[i] = previous[i] + k * previous[m - 1 - i];
+    m_lpc[m] = k;
+
+    prediction *= 1.0f - k * k;
+  }
+
+  m_excitation = sqrtf(prediction);
+  memset(m_noiseState, 0, sizeof(m_noiseState));
+  m_noiseReceived = TRUE;
+
+  PTRACE(5, "PLC\tComfort noise at -" << (payload[0] & 0x7f) << " dBov, order " << m_noiseOrder);
+}
+
+
+void H323AudioConcealer::StartGap()
+{
+  const float * end = &m_history[0] + m_history.size();
+  const float * window = end - m_correlationSpan;
+
+  // pitch by average magnitude difference over the last 20 ms, searching
+  // every other lag on every other sample first and then refining
+  float best = FLT_MAX;
+  unsigned coarse = m_pitchMin;
+  for (unsigned lag = m_pitchMin; lag <= m_pitchMax; lag += 2) {
+    const float * lagged = window - lag;
+    float sum = 0;
+    for (unsigned i = 0; i < m_correlationSpan && sum < best; i += 2)
+      sum += fabsf(window[i] - lagged[i]);
+    if (sum < best) {
+      best = sum;
+      coarse = lag;
+    }
+  }
+
+  best = FLT_MAX;
+  m_pitch = coarse;
+  for (unsigned lag = coarse > m_pitchMin ? coarse - 1 : coarse; lag <= coarse + 1 && lag <= m_pitchMax; lag++) {
+    const float * lagged = window - lag;
+    float sum = 0;
+    for (unsigned i = 0; i < m_correlationSpan && sum < best; i++)
+      sum += fabsf(window[i] - lagged[i]);
+    if (sum < best) {
+      best = sum;
+      m_pitch = lag;
+    }
+  }
+
+  // keep the last three periods and a quarter period before them
+  m_overlap = m_pitch / 4;
+  unsigned length = 3 * m_pitch + m_overlap;
+  std::copy(end - length, end, m_pitchBuffer.begin());
+  m_position = 2 * m_pitch;
+
+  PTRACE(6, "PLC\tConcealing with pitch period of " << m_pitch << " samples");
+}
+
+
+float H323AudioConcealer::Synthesise()
+{
+  float gain = 1.0f;
+  if (m_missing >= m_gapStep) {
+    gain -= (float)(m_missing - m_gapStep) / m_fadeLength;
+    if (gain < 0)
+      gain = 0;
+  }
+
+  float value = 0;
+  if (gain > 0) {
+    // repeat one period for the first 10 ms, then two, then three
+    const unsigned cycle = 3 * m_pitch;
+    unsigned periods = m_missing / m_gapStep + 1;
+    if (periods > 3)
+      periods = 3;
+    const int start = cycle - periods * m_pitch;
+    const float * periodBuffer = &m_pitchBuffer[m_overlap];
+
+    value = periodBuffer[m_position];
+
+    // cross fade into what precedes the first repeated period before wrapping to it
+    if (m_position + m_overlap >= cycle) {
+      float weight = (float)(m_position + m_overlap + 1 - cycle) / (m_overlap + 1);
+      value += (periodBuffer[start - (int)(cycle - m_position)] - value) * weight;
+    }
+    if (++m_position >= cycle)
+      m_position = start;
+
+    // join the start of the gap to the history, fading out the step between
+    // the last sample heard and the one preceding the repeated period
+    if (m_missing < m_overlap) {
+      float weight = (float)(m_missing + 1) / (m_overlap + 1);
+      value += (m_history.back() - periodBuffer[2 * m_pitch - 1]) * (1.0f - weight);
+    }
+
+    value *= gain;
+  }
+
+  m_missing++;
+
+  if (gain < 1.0f)
+    value += NextNoise() * (1.0f - gain);
+
+  return value;
+}
+
+
+float H323AudioConcealer::NextNoise()
+{
+  float level = m_noiseReceived ? m_noiseLevel : m_noiseFloor;
+  if (level <= 0)
+    return 0;
+
+  // uniform white noise of unit rms
+  m_noiseSeed = m_noiseSeed * 1103515245 + 12345;
+  float white = ((float)((m_noiseSeed >> 16) & 0x7fff) / 16384.0f - 1.0f) * 1.7320508f;
+
+  if (!m_noiseReceived || m_noiseOrder == 0)
+    return white * level;
+
+  float value = white * level * m_excitation;
+  for (unsigned i = 0; i < m_noiseOrder; i++)
+    value -= m_lpc[i] * m_noiseState[i];
+
+  memmove(m_noiseState + 1, m_noiseState, (m_noiseOrder - 1) * sizeof(float));
+  m_noiseState[0] = value;
+
+  return value;
+}
+
+
+void H323AudioConcealer::SaveHistory(const short * samples, unsigned count)
+{
+  const unsigned length = m_history.size();
+  if (count >= length) {
+    std::copy(samples + count - length, samples + count, m_history.begin());
+    return;
+  }
+
+  std::copy(m_history.begin() + count, m_history.end(), m_history.begin());
+  std::copy(samples, samples + count, m_history.end() - count);
+}
+
+#endif // H323_AUDIO_CODECS
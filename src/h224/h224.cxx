@@ -43,6 +43,11 @@
 #include <h235/h235chan.h>
 #endif
 
+#include <algorithm>
+
+// Longest the dispatcher waits on the sockets before checking the receivers and timers again
+#define H224_DISPATCH_INTERVAL 100
+
 
 H224_Frame::H224_Frame(PINDEX size)
 : Q922_Frame(H224_HEADER_SIZE + size)
@@ -244,7 +249,7 @@ H224_Handler::H224_Handler(const PString & name)
 
 H224_Handler::~H224_Handler()
 {
-
+  OpalH224Dispatcher::Instance().StopTimers(this);
 }
 
 void H224_Handler::AttachH224Handler(OpalH224Handler * h224Handler)
@@ -255,6 +260,16 @@ void H224_Handler::AttachH224Handler(OpalH224Handler * h224Handler)
     }
 }
 
+void H224_Handler::StartTimer(unsigned id, unsigned milliseconds, PBoolean repeat)
+{
+  OpalH224Dispatcher::Instance().StartTimer(this, id, milliseconds, repeat);
+}
+
+void H224_Handler::StopTimer(unsigned id)
+{
+  OpalH224Dispatcher::Instance().StopTimer(this, id);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static const char H224HandlerBaseClass[] = "H224_Handler";
@@ -319,6 +334,7 @@ OpalH224Handler::OpalH224Handler(H323Channel::Directions dir,
                                  unsigned sessionID)
 : session(NULL), canTransmit(FALSE), transmitMutex(),
   transmitFrame(NULL), transmitBitIndex(0), transmitStartTime(NULL),
+  receiveShared(FALSE), receivePacket(NULL), receiveFrame(NULL), receiveTimeStamp(0),
   sessionDirection(dir)
 #ifdef H323_H235
   ,secChannel(NULL)
@@ -335,7 +351,13 @@ OpalH224Handler::OpalH224Handler(H323Channel::Directions dir,
 
 OpalH224Handler::~OpalH224Handler()
 {
+    if (receiveShared)
+      OpalH224Dispatcher::Instance().RemoveReceiver(this);
+
     DeleteHandlers();
+
+    delete receivePacket;
+    delete receiveFrame;
 }
 
 void OpalH224Handler::CreateHandlers(H323Connection & connection)
@@ -401,17 +423,32 @@ void OpalH224Handler::StopTransmit()
 
 void OpalH224Handler::StartReceive()
 {
-  if(receiverThread != NULL) {
+  if(receiverThread != NULL || receiveShared) {
     PTRACE(5, "H.224 handler is already receiving");
     return;
   }
 
+  if (receivePacket == NULL) {
+    receivePacket = new RTP_DataFrame(300);
+    receiveFrame = new H224_Frame();
+  }
+
+  if (OpalH224Dispatcher::Instance().AddReceiver(this)) {
+    receiveShared = TRUE;
+    return;
+  }
+
   receiverThread = CreateH224ReceiverThread();
   receiverThread->Resume();
 }
 
 void OpalH224Handler::StopReceive()
 {
+  if (receiveShared) {
+    OpalH224Dispatcher::Instance().RemoveReceiver(this);
+    receiveShared = FALSE;
+  }
+
   if(receiverThread != NULL) {
     receiverThread->Close();
   }
@@ -724,6 +761,36 @@ PBoolean OpalH224Handler::OnWriteFrame(RTP_DataFrame & frame)
         return true;
 }
 
+void OpalH224Handler::OnReceivedPacket(RTP_DataFrame & packet, H224_Frame & frame, unsigned & lastTimeStamp)
+{
+  if (!OnReadFrame(packet))
+    return;
+
+  unsigned timestamp = packet.GetTimestamp();
+  if (timestamp == lastTimeStamp)
+    return;
+
+  if (!frame.Decode(packet.GetPayloadPtr(), packet.GetPayloadSize()) ||
+      !OnReceivedFrame(frame)) {
+    PTRACE(3, "Decoding of H.224 frame failed");
+  }
+  lastTimeStamp = timestamp;
+}
+
+PBoolean OpalH224Handler::OnReceiveReady()
+{
+  // only control packets may have been waiting
+  receivePacket->SetPayloadSize(0);
+
+  if (!session->ReadData(*receivePacket, FALSE))
+    return FALSE;
+
+  if (receivePacket->GetPayloadSize() > 0)
+    OnReceivedPacket(*receivePacket, *receiveFrame, receiveTimeStamp);
+
+  return TRUE;
+}
+
 ////////////////////////////////////
 
 OpalH224ReceiverThread::OpalH224ReceiverThread(OpalH224Handler *theH224Handler, RTP_Session & session)
@@ -751,18 +818,8 @@ void OpalH224ReceiverThread::Main()
     if(!rtpSession.ReadBufferedData(timestamp, packet))
         break;
 
-    if (!h224Handler->OnReadFrame(packet))
-        continue;
-
     timestamp = packet.GetTimestamp();
-    if (timestamp == lastTimeStamp)
-        continue;
-
-    if (!h224Frame.Decode(packet.GetPayloadPtr(), packet.GetPayloadSize()) ||
-        !h224Handler->OnReceivedFrame(h224Frame)) {
-           PTRACE(3, "Decoding of H.224 frame failed");
-    }
-    lastTimeStamp = timestamp;
+    h224Handler->OnReceivedPacket(packet, h224Frame, lastTimeStamp);
   }
 
   threadClosed = true;
@@ -778,5 +835,292 @@ void OpalH224ReceiverThread::Close()
 
 }
 
+////////////////////////////////////
+
+static PBoolean IsSelectable(const PUDPSocket & socket)
+{
+  // NAT methods derive their own sockets, which may be read through
+  // another channel rather than the socket handle
+  return socket.IsOpen() && strcmp(socket.GetClass(), H323UDPSocket::Class()) == 0;
+}
+
+OpalH224Dispatcher & OpalH224Dispatcher::Instance()
+{
+  static OpalH224Dispatcher dispatcher;
+  return dispatcher;
+}
+
+OpalH224Dispatcher::OpalH224Dispatcher()
+: m_selecting(FALSE), m_running(NULL), m_cycle(0), m_thread(NULL), m_exit(FALSE)
+{
+}
+
+OpalH224Dispatcher::~OpalH224Dispatcher()
+{
+  if (m_thread == NULL)
+    return;
+
+  m_exit = TRUE;
+  m_wakeup.Signal();
+  m_thread->WaitForTermination();
+  delete m_thread;
+}
+
+void OpalH224Dispatcher::Start()
+{
+  if (m_thread == NULL)
+    m_thread = PThread::Create(PCREATE_NOTIFIER(DispatchMain), 0,
+                               PThread::NoAutoDeleteThread,
+                               PThread::NormalPriority,
+                               "H.224 Dispatcher");
+  m_wakeup.Signal();
+}
+
+PBoolean OpalH224Dispatcher::AddReceiver(OpalH224Handler * handler)
+{
+  if (handler->GetSession() == NULL || !PIsDescendant(handler->GetSession(), RTP_UDP))
+    return FALSE;
+
+  RTP_UDP * session = (RTP_UDP *)handler->GetSession();
+  if (session->IsMediaTunneled() ||
+      !IsSelectable(session->GetDataSocket()) || !IsSelectable(session->GetControlSocket()))
+    return FALSE;
+
+  PWaitAndSignal m(m_mutex);
+
+  m_receivers.push_back(handler);
+  Start();
+
+  PTRACE(4, "H224\tSession " << session->GetSessionID() << " received by shared dispatcher");
+  return TRUE;
+}
+
+void OpalH224Dispatcher::RemoveReceiver(OpalH224Handler * handler)
+{
+  m_mutex.Wait();
+  m_receivers.remove(handler);
+
+  // the thread may still be waiting on the sockets of the handler
+  PBoolean selecting = m_selecting && PThread::Current() != m_thread;
+  unsigned cycle = m_cycle;
+  m_mutex.Signal();
+
+  while (selecting) {
+    m_selected.Wait(H224_DISPATCH_INTERVAL);
+    PWaitAndSignal m(m_mutex);
+    selecting = m_selecting && m_cycle == cycle;
+  }
+
+  // or be reading its frames
+  WaitIdle(handler);
+}
+
+void OpalH224Dispatcher::StartTimer(H224_Handler * client, unsigned id, unsigned milliseconds, PBoolean repeat)
+{
+  PWaitAndSignal m(m_mutex);
+
+  PInt64 due = PTimer::Tick().GetMilliSeconds() + milliseconds;
+
+  std::list<Timer>::iterator it;
+  for (it = m_timers.begin(); it != m_timers.end(); ++it) {
+    if (it->client == client && it->id == id)
+      break;
+  }
+
+  if (it == m_timers.end()) {
+    Timer timer;
+    timer.client = client;
+    timer.id = id;
+    it = m_timers.insert(m_timers.end(), timer);
+  }
+
+  it->due = due;
+  it->repeat = repeat ? milliseconds : 0;
+
+  Start();
+}
+
+void OpalH224Dispatcher::StopTimer(H224_Handler * client, unsigned id)
+{
+  m_mutex.Wait();
+
+  for (std::list<Timer>::iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+    if (it->client == client && it->id == id) {
+      m_timers.erase(it);
+      break;
+    }
+  }
+
+  m_mutex.Signal();
+
+  WaitIdle(client);
+}
+
+void OpalH224Dispatcher::StopTimers(H224_Handler * client)
+{
+  m_mutex.Wait();
+
+  std::list<Timer>::iterator it = m_timers.begin();
+  while (it != m_timers.end()) {
+    if (it->client == client)
+      it = m_timers.erase(it);
+    else
+      ++it;
+  }
+
+  m_mutex.Signal();
+
+  WaitIdle(client);
+}
+
+void OpalH224Dispatcher::WaitIdle(const void * user)
+{
+  // Called back from the dispatcher itself, eg stopping a timer in OnTimer()
+  if (PThread::Current() == m_thread)
+    return;
+
+  m_mutex.Wait();
+  while (m_running == user) {
+    m_mutex.Signal();
+    m_selected.Wait(H224_DISPATCH_INTERVAL);
+    m_mutex.Wait();
+  }
+  m_mutex.Signal();
+}
+
+PInt64 OpalH224Dispatcher::RunTimers(PInt64 now)
+{
+  // Entered with the mutex held, it is released while each client runs.
+  // The clients may start and stop timers from OnTimer(), so the
+  // list is scanned again after each one
+  for (;;) {
+    std::list<Timer>::iterator it = m_timers.begin();
+    while (it != m_timers.end() && it->due > now)
+      ++it;
+
+    if (it == m_timers.end())
+      break;
+
+    H224_Handler * client = it->client;
+    unsigned id = it->id;
+
+    if (it->repeat > 0) {
+      it->due += it->repeat;
+      if (it->due <= now)
+        it->due = now + it->repeat;
+    } else
+      m_timers.erase(it);
+
+    m_running = client;
+    m_mutex.Signal();
+
+    client->OnTimer(id);
+
+    m_mutex.Wait();
+    m_running = NULL;
+    m_selected.Signal();
+  }
+
+  PInt64 next = now + H224_DISPATCH_INTERVAL;
+  for (std::list<Timer>::iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+    if (it->due < next)
+      next = it->due;
+  }
+
+  return next;
+}
+
+void OpalH224Dispatcher::DispatchMain(PThread &, H323_INT)
+{
+  while (!m_exit) {
+    PSocket::SelectList readers;
+    std::map<PSocket *, OpalH224Handler *> owners;
+
+    m_mutex.Wait();
+
+    PInt64 next = RunTimers(PTimer::Tick().GetMilliSeconds());
+
+    std::list<OpalH224Handler *>::iterator it = m_receivers.begin();
+    while (it != m_receivers.end()) {
+      RTP_UDP * session = (RTP_UDP *)(*it)->GetSession();
+
+      if (!session->GetDataSocket().IsOpen() || !session->GetControlSocket().IsOpen()) {
+        PTRACE(3, "H224\tSession " << session->GetSessionID() << " closed, no longer received");
+        it = m_receivers.erase(it);
+        continue;
+      }
+
+      // reports are otherwise sent when a read times out
+      session->SendReport();
+
+      readers.Append(&session->GetDataSocket());
+      readers.Append(&session->GetControlSocket());
+      owners[&session->GetDataSocket()] = *it;
+      owners[&session->GetControlSocket()] = *it;
+      ++it;
+    }
+
+    m_selecting = !readers.IsEmpty();
+    if (m_selecting)
+      m_cycle++;
+
+    m_mutex.Signal();
+
+    PInt64 delay = next - PTimer::Tick().GetMilliSeconds();
+    if (delay < 0)
+      delay = 0;
+
+    if (readers.IsEmpty()) {
+      m_wakeup.Wait(PTimeInterval(delay));
+      continue;
+    }
+
+    PChannel::Errors result = PSocket::Select(readers, PTimeInterval(delay));
+
+    m_mutex.Wait();
+    m_selecting = FALSE;
+
+    if (result == PChannel::NoError) {
+      // read each session once, both of its sockets are read if ready
+      std::list<OpalH224Handler *> ready;
+      for (PINDEX i = 0; i < readers.GetSize(); i++) {
+        OpalH224Handler * handler = owners[&readers[i]];
+        if (std::find(ready.begin(), ready.end(), handler) == ready.end())
+          ready.push_back(handler);
+      }
+
+      // The frames go up to the application, so each handler is read
+      // without the mutex held, marked as running for RemoveReceiver()
+      for (std::list<OpalH224Handler *>::iterator it = ready.begin(); it != ready.end(); ++it) {
+        // removed while waiting
+        if (std::find(m_receivers.begin(), m_receivers.end(), *it) == m_receivers.end())
+          continue;
+
+        m_running = *it;
+        m_mutex.Signal();
+
+        PBoolean open = (*it)->OnReceiveReady();
+
+        m_mutex.Wait();
+        m_running = NULL;
+        m_selected.Signal();
+
+        if (!open) {
+          PTRACE(3, "H224\tSession " << (*it)->GetSession()->GetSessionID() << " closed, no longer received");
+          m_receivers.remove(*it);
+        }
+      }
+    }
+
+    m_mutex.Signal();
+    m_selected.Signal();
+
+    if (result != PChannel::NoError && result != PChannel::Timeout) {
+      PTRACE(2, "H224\tDispatcher select error " << result);
+      PThread::Sleep(H224_DISPATCH_INTERVAL);
+    }
+  }
+}
+
 #endif // H323_H224
 
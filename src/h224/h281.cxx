@@ -488,21 +488,18 @@ void H224_H281Handler::Initialise()
   transmitFrame.SetBS(TRUE);
   transmitFrame.SetES(TRUE);
 	
-  transmitTimer.SetNotifier(PCREATE_NOTIFIER(ContinueAction));
-	
   requestedPanDirection = H281_Frame::NoPan;
   requestedTiltDirection = H281_Frame::NoTilt;
   requestedZoomDirection = H281_Frame::NoZoom;
   requestedFocusDirection = H281_Frame::NoFocus;
-  receiveTimer.SetNotifier(PCREATE_NOTIFIER(StopActionLocally));
 }
 
 H224_H281Handler::~H224_H281Handler()
 {
 
   shutDown = true;
-  transmitTimer.Stop();
-  receiveTimer.Stop();
+  StopTimer(ContinueActionTimer);
+  StopTimer(StopActionTimer);
 }
 
 H281VideoSource & H224_H281Handler::GetLocalVideoSource(VideoSource source)
@@ -545,7 +542,7 @@ void H224_H281Handler::StartAction(H281_Frame::PanDirection panDirection,
   m_h224Handler->TransmitClientFrame(H281_CLIENT_ID, transmitFrame);
 
   // send a ContinueAction every 400msec
-  transmitTimer.RunContinuous(400);
+  StartTimer(ContinueActionTimer, 400, TRUE);
 }
 
 void H224_H281Handler::StopAction()
@@ -556,7 +553,7 @@ void H224_H281Handler::StopAction()
   m_h224Handler->TransmitClientFrame(H281_CLIENT_ID, transmitFrame);
 	
   transmitFrame.SetRequestType(H281_Frame::IllegalRequest);
-  transmitTimer.Stop();
+  StopTimer(ContinueActionTimer);
 }
 
 void H224_H281Handler::SelectVideoSource(BYTE videoSourceNumber, H281_Frame::VideoMode videoMode)
@@ -703,7 +700,7 @@ void H224_H281Handler::OnReceivedMessage(const H224_Frame & msg)
 				  requestedFocusDirection);
 		
     // timeout is always 800 msec
-    receiveTimer = 800;
+    StartTimer(StopActionTimer, 800);
 		
   } else if(requestType == H281_Frame::ContinueAction) {
 	
@@ -722,7 +719,7 @@ void H224_H281Handler::OnReceivedMessage(const H224_Frame & msg)
 		zoomDirection != H281_Frame::NoZoom ||
 		focusDirection != H281_Frame::NoFocus))
 	{
-      receiveTimer = 800;
+      StartTimer(StopActionTimer, 800);
     }
 	
   } else if(requestType == H281_Frame::StopAction){
@@ -798,7 +795,15 @@ void H224_H281Handler::OnActivatePreset(BYTE /*presetNumber*/)
   // not handled
 }
 
-void H224_H281Handler::ContinueAction(PTimer &, H323_INT)
+void H224_H281Handler::OnTimer(unsigned id)
+{
+  if (id == ContinueActionTimer)
+    ContinueAction();
+  else if (id == StopActionTimer)
+    StopActionLocally();
+}
+
+void H224_H281Handler::ContinueAction()
 {
 
   if (shutDown)
@@ -809,7 +814,7 @@ void H224_H281Handler::ContinueAction(PTimer &, H323_INT)
   m_h224Handler->TransmitClientFrame(H281_CLIENT_ID, transmitFrame);
 }
 
-void H224_H281Handler::StopActionLocally(PTimer &, H323_INT)
+void H224_H281Handler::StopActionLocally()
 {
   requestedPanDirection = H281_Frame::NoPan;
   requestedTiltDirection = H281_Frame::NoTilt;
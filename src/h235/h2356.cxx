@@ -167,6 +167,183 @@ void LoadH235_DHMap(H235_DHMap & dhmap, H235_DHMap & dhcache, H235Authenticators
 
 /////////////////////////////////////////////////////////////////////////////////////
 
+H235_DHKeyPool::H235_DHKeyPool()
+: m_depth(0), m_active(false), m_shutdown(false), m_hits(0), m_misses(0), m_generating(0)
+{
+    m_threads.DisallowDeleteObjects();
+}
+
+H235_DHKeyPool::~H235_DHKeyPool()
+{
+    Shutdown();
+}
+
+void H235_DHKeyPool::Initialise(H235_DHMap & templates, PINDEX depth, PINDEX threads)
+{
+    Shutdown();
+
+    PWaitAndSignal m(m_mutex);
+
+    m_templates = templates;
+    templates.clear();
+    m_depth = depth;
+    m_hits = 0;
+    m_misses = 0;
+    m_shutdown = false;
+    m_active = (m_depth > 0 && threads > 0);
+
+    if (!m_active) {
+        DeleteObjectsInMap(m_templates);
+        return;
+    }
+
+    for (PINDEX i = 0; i < threads; ++i)
+        m_threads.Append(PThread::Create(PCREATE_NOTIFIER(RefillMain), 0,
+                                 PThread::NoAutoDeleteThread,
+                                 PThread::LowPriority,
+                                 "H235DHPool:%x"));
+
+    PTRACE(4, "H2356\tDH key pool started depth " << m_depth << " threads " << threads);
+}
+
+void H235_DHKeyPool::Shutdown()
+{
+    {
+        PWaitAndSignal m(m_mutex);
+        m_active = false;
+        m_shutdown = true;
+    }
+
+    for (PINDEX i = 0; i < m_threads.GetSize(); ++i) {
+        m_refill.Signal();
+        m_threads[i].WaitForTermination();
+        delete &m_threads[i];
+    }
+    m_threads.RemoveAll();
+
+    // let a call setup generating a missing pair finish with the templates
+    for (;;) {
+        {
+            PWaitAndSignal m(m_mutex);
+            if (m_generating == 0)
+                break;
+        }
+        PThread::Sleep(10);
+    }
+
+    PWaitAndSignal m(m_mutex);
+    for (std::map<PString, H235_DHKeyList>::iterator k = m_keys.begin(); k != m_keys.end(); ++k) {
+        for (H235_DHKeyList::iterator l = k->second.begin(); l != k->second.end(); ++l)
+            delete *l;
+    }
+    m_keys.clear();
+    DeleteObjectsInMap(m_templates);
+}
+
+PBoolean H235_DHKeyPool::LoadKeyPairs(H235_DHMap & dhmap)
+{
+    H235_DHMap missing;
+    {
+        PWaitAndSignal m(m_mutex);
+
+        if (!m_active)
+            return false;
+
+        for (H235_DHMap::iterator i = m_templates.begin(); i != m_templates.end(); ++i) {
+            H235_DiffieHellman * dh = NULL;
+            if (i->second) {
+                H235_DHKeyList & keys = m_keys[i->first];
+                if (keys.empty()) {
+                    PTRACE(3, "H2356\tDH key pool empty for " << i->first);
+                    missing.insert(*i);
+                    m_misses++;
+                    continue;
+                }
+                dh = keys.front();
+                keys.pop_front();
+                m_hits++;
+            }
+            dhmap.insert(pair<PString, H235_DiffieHellman*>(i->first, dh));
+        }
+
+        if (!missing.empty())
+            m_generating++;
+    }
+
+    m_refill.Signal();
+
+    if (missing.empty())
+        return true;
+
+    // The exponentiation is done without the lock so other calls and the
+    // refill threads carry on, the templates live until Shutdown()
+    for (H235_DHMap::iterator i = missing.begin(); i != missing.end(); ++i)
+        dhmap.insert(pair<PString, H235_DiffieHellman*>(i->first, i->second->CreateNewKeyPair()));
+
+    PWaitAndSignal m(m_mutex);
+    m_generating--;
+    return true;
+}
+
+unsigned H235_DHKeyPool::GetPoolHits() const
+{
+    PWaitAndSignal m(m_mutex);
+    return m_hits;
+}
+
+unsigned H235_DHKeyPool::GetPoolMisses() const
+{
+    PWaitAndSignal m(m_mutex);
+    return m_misses;
+}
+
+void H235_DHKeyPool::RefillMain(PThread &, H323_INT)
+{
+    PTRACE(4, "H2356\tDH key pool refill thread started");
+
+    for (;;) {
+        PString oid;
+        H235_DiffieHellman * dhTemplate = NULL;
+        {
+            PWaitAndSignal m(m_mutex);
+            if (m_shutdown)
+                break;
+
+            for (H235_DHMap::iterator i = m_templates.begin(); i != m_templates.end(); ++i) {
+                if (i->second && m_keys[i->first].size() < (size_t)m_depth) {
+                    oid = i->first;
+                    dhTemplate = i->second;
+                    break;
+                }
+            }
+        }
+
+        if (dhTemplate == NULL) {
+            m_refill.Wait(1000);
+            continue;
+        }
+
+        // Do the expensive exponentiation outside the lock, templates live until Shutdown()
+        H235_DiffieHellman * dh = dhTemplate->CreateNewKeyPair();
+        if (dh == NULL) {
+            PTRACE(1, "H2356\tDH key pool failed to generate key for " << oid);
+            m_refill.Wait(1000);
+            continue;
+        }
+
+        PWaitAndSignal m(m_mutex);
+        if (m_shutdown) {
+            delete dh;
+            break;
+        }
+        m_keys[oid].push_back(dh);
+    }
+
+    PTRACE(4, "H2356\tDH key pool refill thread ended");
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
 #if PTLIB_VER >= 2110
 #ifdef H323_SSL
 H235SECURITY(Std6);
@@ -176,6 +353,7 @@ static PFactory<H235Authenticator>::Worker<H2356_Authenticator> factoryH2356_Aut
 #endif
 
 H235_DHMap H2356_Authenticator::m_dhCachedMap;
+H235_DHKeyPool H2356_Authenticator::m_dhKeyPool;
 
 H2356_Authenticator::H2356_Authenticator()
 : m_tokenState(e_clearNone)
@@ -187,7 +365,8 @@ H2356_Authenticator::H2356_Authenticator()
 
     m_algOIDs.SetSize(0);
     if (m_enabled) {
-        LoadH235_DHMap(m_dhLocalMap, m_dhCachedMap, H235Authenticators::GetDHDataList(), H235Authenticators::GetDHParameterFile(), H235Authenticators::GetMaxCipherLength(), H235Authenticators::GetMaxTokenLength());
+        if (!m_dhKeyPool.LoadKeyPairs(m_dhLocalMap))
+            LoadH235_DHMap(m_dhLocalMap, m_dhCachedMap, H235Authenticators::GetDHDataList(), H235Authenticators::GetDHParameterFile(), H235Authenticators::GetMaxCipherLength(), H235Authenticators::GetMaxTokenLength());
         InitialiseSecurity(); // make sure m_algOIDs gets filled
     }
 }
@@ -227,6 +406,18 @@ void H2356_Authenticator::RemoveCache()
    m_dhCachedMap.clear();
 }
 
+void H2356_Authenticator::InitialiseKeyPool(PINDEX depth, PINDEX threads, int cipherlength, unsigned maxTokenLength)
+{
+   H235_DHMap templates, empty;
+   LoadH235_DHMap(templates, empty, H235Authenticators::GetDHDataList(), H235Authenticators::GetDHParameterFile(), cipherlength, maxTokenLength);
+   m_dhKeyPool.Initialise(templates, depth, threads);
+}
+
+void H2356_Authenticator::RemoveKeyPool()
+{
+   m_dhKeyPool.Shutdown();
+}
+
 PBoolean H2356_Authenticator::IsMatch(const PString & identifier) const
 {
     PStringArray ids;
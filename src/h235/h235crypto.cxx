@@ -730,6 +730,78 @@ PINDEX H235CryptoEngine::DecryptInPlace(const BYTE * inData, PINDEX inLength, BY
     return inSize + outSize;
 }
 
+PINDEX H235CryptoEngine::EncryptInPlace(BYTE * data, PINDEX length, unsigned char * ivSequence, bool & rtpPadding)
+{
+    if (!m_initialised) {
+        PTRACE(1, "H235\tERROR: Encryption not initialised!!");
+        memset(data,0,length);
+        return length;
+    }
+
+    int outSize = 0;
+    int finalSize = 0;
+
+    SetIV(m_iv, ivSequence, m_enc_ivLength);
+    EVP_EncryptInit_ex(m_encryptCtx, NULL, NULL, NULL, m_iv);
+
+    // always pad partial blocks, see Encrypt()
+    rtpPadding = (length % m_enc_blockSize > 0);
+    EVP_CIPHER_CTX_set_padding(m_encryptCtx, rtpPadding ? 1 : 0);
+
+    // OpenSSL allows the output to exactly overlap the input
+    if (!EVP_EncryptUpdate(m_encryptCtx, data, &outSize, data, length)) {
+        PTRACE(1, "H235\tEVP_EncryptUpdate() failed");
+        return 0;
+    }
+    if (!EVP_EncryptFinal_ex(m_encryptCtx, data + outSize, &finalSize)) {
+        PTRACE(1, "H235\tEVP_EncryptFinal_ex() failed");
+        return 0;
+    }
+
+    m_operationCnt++;
+    return outSize + finalSize;
+}
+
+PINDEX H235CryptoEngine::DecryptInPlace(BYTE * data, PINDEX length, unsigned char * ivSequence, bool & rtpPadding)
+{
+    if (!m_initialised || length == 0)
+        return 0;
+
+    if (length % m_dec_blockSize > 0) {
+        // Ciphertext stealing needs to look ahead over the last two blocks,
+        // so it can't be done in a single pass over the buffer.
+        PTRACE(4, "H235\tCTS payload, not decrypted in place");
+        return 0;
+    }
+
+    int outSize = 0;
+
+    SetIV(m_iv, ivSequence, m_dec_ivLength);
+    EVP_DecryptInit_ex(m_decryptCtx, NULL, NULL, NULL, m_iv);
+
+    // Padding is removed below so it isn't checked as strictly as OpenSSL does,
+    // see DecryptFinalRelaxed()
+    EVP_CIPHER_CTX_set_padding(m_decryptCtx, 0);
+
+    if (!EVP_DecryptUpdate(m_decryptCtx, data, &outSize, data, length)) {
+        PTRACE(1, "H235\tEVP_DecryptUpdate() failed");
+        return 0;
+    }
+
+    if (rtpPadding) {
+        int n = data[outSize - 1];
+        if (n == 0 || n > m_dec_blockSize) {
+            PTRACE(1, "H235\tDecrypt error: bad decrypt");
+            return 0;
+        }
+        outSize -= n;
+    }
+
+    rtpPadding = false;	// we return the real length of the decrypted data without padding
+    m_operationCnt++;
+    return outSize;
+}
+
 PBYTEArray H235CryptoEngine::GenerateRandomKey()
 {
     PBYTEArray result = GenerateRandomKey(m_algorithmOID);
@@ -861,8 +933,16 @@ PBoolean H235Session::ReadFrameInPlace(RTP_DataFrame & frame)
 {
     memcpy(m_ivSequence, frame.GetSequenceNumberPtr(), 6);
     m_padding = frame.GetPadding();
-    frame.SetPayloadSize(m_context.DecryptInPlace(frame.GetPayloadPtr(), frame.GetPayloadSize(), m_frameBuffer.GetPointer(), m_ivSequence, m_padding));
-    memmove(frame.GetPayloadPtr(), m_frameBuffer.GetPointer(), frame.GetPayloadSize());
+
+    PINDEX payloadSize = frame.GetPayloadSize();
+    int blockSize = m_context.GetEncryptBlockSize();
+    if (blockSize == 0 || payloadSize % blockSize == 0) {
+        frame.SetPayloadSize(m_context.DecryptInPlace(frame.GetPayloadPtr(), payloadSize, m_ivSequence, m_padding));
+    } else {
+        // ciphertext stealing
+        frame.SetPayloadSize(m_context.DecryptInPlace(frame.GetPayloadPtr(), payloadSize, m_frameBuffer.GetPointer(), m_ivSequence, m_padding));
+        memmove(frame.GetPayloadPtr(), m_frameBuffer.GetPointer(), frame.GetPayloadSize());
+    }
     frame.SetPadding(m_padding);
     return true;	// don't stop on decoding errors
 }
@@ -886,8 +966,11 @@ PBoolean H235Session::WriteFrameInPlace(RTP_DataFrame & frame)
 {
     memcpy(m_ivSequence, frame.GetSequenceNumberPtr(), 6);
     m_padding = frame.GetPadding();
-    frame.SetPayloadSize(m_context.EncryptInPlace(frame.GetPayloadPtr(), frame.GetPayloadSize(), m_frameBuffer.GetPointer(), m_ivSequence, m_padding));
-    memmove(frame.GetPayloadPtr(), m_frameBuffer.GetPointer(), frame.GetPayloadSize());
+
+    // make room for the padding block, SetPayloadSize() keeps the payload
+    PINDEX payloadSize = frame.GetPayloadSize();
+    frame.SetPayloadSize(payloadSize + m_context.GetEncryptBlockSize());
+    frame.SetPayloadSize(m_context.EncryptInPlace(frame.GetPayloadPtr(), payloadSize, m_ivSequence, m_padding));
     frame.SetPadding(m_padding);
     return (frame.GetPayloadSize() > 0);
 }
@@ -230,6 +230,14 @@ H235_DiffieHellman::H235_DiffieHellman(const H235_DiffieHellman & diffie)
 }
 
 
+H235_DiffieHellman::H235_DiffieHellman(dh_st * params, const H235_DiffieHellman & settings)
+: m_remKey(NULL), m_toSend(settings.GetToSend()), m_wasReceived(settings.ReceivedFromRemote()), m_wasDHReceived(settings.DHReceived()),
+  m_keySize(settings.GetKeySize()), m_loadFromFile(settings.LoadFile())
+{
+  dh = params;
+}
+
+
 H235_DiffieHellman & H235_DiffieHellman::operator=(const H235_DiffieHellman & other)
 {
   if (this != &other) {
@@ -458,6 +466,35 @@ PBoolean H235_DiffieHellman::GenerateHalfKey()
   return TRUE;
 }
 
+H235_DiffieHellman * H235_DiffieHellman::CreateNewKeyPair() const
+{
+  DH * ndh;
+  {
+    PWaitAndSignal m(vbMutex);
+
+    if (dh == NULL)
+      return NULL;
+
+    // Copy P & G only so DH_generate_key() creates a new private key
+    ndh = DH_new();
+    if (ndh == NULL)
+      return NULL;
+
+    const BIGNUM *p = NULL, *q = NULL, *g = NULL;
+    DH_get0_pqg(dh, &p, &q, &g);
+    DH_set0_pqg(ndh, p ? BN_dup(p) : NULL, q ? BN_dup(q) : NULL, g ? BN_dup(g) : NULL);
+  }
+
+  // The exponentiation runs unlocked, so pool refills and call setups
+  // for the same group generate keys in parallel
+  H235_DiffieHellman * newKey = new H235_DiffieHellman(ndh, *this);
+  if (!newKey->GenerateHalfKey()) {
+    delete newKey;
+    return NULL;
+  }
+  return newKey;
+}
+
 void H235_DiffieHellman::SetDHReceived(const PASN_BitString & p, const PASN_BitString & g)
 {
     PTRACE(4, "H235\tReplacing local DH parameters with those of remote");
@@ -147,65 +147,35 @@ static void truncate(unsigned char*    d1,    /* data to be truncated */
     d2[i] = d1[i];
 }
 
-/* Function to compute the digest */
-static void hmac_sha (const unsigned char*    k,      /* secret key */
-                      int      lk,              /* length of the key in bytes */
-                      const unsigned char*    d,      /* data */
-                      int      ld,              /* length of data in bytes */
-                      char*    out,             /* output buffer, at least "t" bytes */
-                      int      t)
+/* Function to compute the digest from the precomputed key pads */
+static void hmac_sha_pads(const unsigned char*  ipad,   /* key ^ 0x36, SHA_BLOCKSIZE bytes */
+                          const unsigned char*  opad,   /* key ^ 0x5C, SHA_BLOCKSIZE bytes */
+                          const unsigned char*  d,      /* data */
+                          int      ld,                  /* length of data in bytes */
+                          char*    out,                 /* output buffer, at least "t" bytes */
+                          int      t)
 {
-        EvpMdContext ictx, octx;
+        EvpMdContext ctx;
         unsigned char isha[SHA_DIGESTSIZE], osha[SHA_DIGESTSIZE];
-        unsigned char key[SHA_DIGESTSIZE];
-        char buf[SHA_BLOCKSIZE];
-        int i;
 
         const EVP_MD * sha1 = EVP_sha1();
 
-        if (lk > SHA_BLOCKSIZE) {
-
-                EvpMdContext tctx;
-
-                EVP_DigestInit_ex(tctx, sha1, NULL);
-                EVP_DigestUpdate(tctx, k, lk);
-                EVP_DigestFinal_ex(tctx, key, NULL);
-
-                k = key;
-                lk = SHA_DIGESTSIZE;
-        }
-
         /**** Inner Digest ****/
 
-        EVP_DigestInit_ex(ictx, sha1, NULL);
-
-        /* Pad the key for inner digest */
-        for (i = 0 ; i < lk ; ++i) buf[i] = (char)(k[i] ^ 0x36);
-        for (i = lk ; i < SHA_BLOCKSIZE ; ++i) buf[i] = 0x36;
-
-        EVP_DigestUpdate(ictx, buf, SHA_BLOCKSIZE);
-        EVP_DigestUpdate(ictx, d, ld) ;
-
-        EVP_DigestFinal_ex(ictx, isha, NULL);
+        EVP_DigestInit_ex(ctx, sha1, NULL);
+        EVP_DigestUpdate(ctx, ipad, SHA_BLOCKSIZE);
+        EVP_DigestUpdate(ctx, d, ld);
+        EVP_DigestFinal_ex(ctx, isha, NULL);
 
         /**** Outer Digest ****/
 
-        EVP_DigestInit_ex(octx, sha1, NULL);
-
-        /* Pad the key for outer digest */
-
-        for (i = 0 ; i < lk ; ++i) buf[i] = (char)(k[i] ^ 0x5C);
-        for (i = lk ; i < SHA_BLOCKSIZE ; ++i) buf[i] = 0x5C;
+        EVP_DigestInit_ex(ctx, sha1, NULL);
+        EVP_DigestUpdate(ctx, opad, SHA_BLOCKSIZE);
+        EVP_DigestUpdate(ctx, isha, SHA_DIGESTSIZE);
+        EVP_DigestFinal_ex(ctx, osha, NULL);
 
-        EVP_DigestUpdate(octx, buf, SHA_BLOCKSIZE);
-        EVP_DigestUpdate(octx, isha, SHA_DIGESTSIZE);
-
-        EVP_DigestFinal_ex(octx, osha, NULL);
-
-        /* truncate and print the results */
         t = t > SHA_DIGESTSIZE ? SHA_DIGESTSIZE : t;
         truncate(osha, out, t);
-
 }
 
 static void SHA1(const unsigned char * data, unsigned len, unsigned char * hash)
@@ -238,6 +208,9 @@ H2351_Authenticator::H2351_Authenticator()
   //m_fullQ931Checking = true; // H.235.1 clause 13.2 requires full Q.931 checking
   m_fullQ931Checking = false; // remain compatible with old versions for now
   m_verifyRandomNumber = true; // switch off check for possible bug in ASN decoder
+  m_hashOffset = 0;
+  memset(m_innerPad, 0, sizeof(m_innerPad));
+  memset(m_outerPad, 0, sizeof(m_outerPad));
 }
 
 
@@ -350,22 +323,67 @@ H225_CryptoH323Token * H2351_Authenticator::CreateCryptoToken()
 }
 
 
-PBoolean H2351_Authenticator::Finalise(PBYTEArray & rawPDU)
+void H2351_Authenticator::DeriveKey()
 {
-  if (!IsActive())
-    return FALSE;
+  if (!m_derivedPassword.IsEmpty() && m_derivedPassword == password)
+    return;
 
-  // Find the pattern
+  /** make a SHA1 hash before send to the hmac_sha1 */
+  unsigned char secretkey[SHA_DIGESTSIZE];
+  SHA1(password, password.GetLength(), secretkey);
 
-  int foundat = -1;
-  for (PINDEX i = 0; i <= rawPDU.GetSize() - HASH_SIZE; i++) {
-    if (memcmp(&rawPDU[i], SearchPattern, HASH_SIZE) == 0) { // i'v found it !
-      foundat = i;
+  int i;
+  for (i = 0; i < SHA_DIGESTSIZE; ++i) {
+    m_innerPad[i] = (BYTE)(secretkey[i] ^ 0x36);
+    m_outerPad[i] = (BYTE)(secretkey[i] ^ 0x5C);
+  }
+  for (; i < SHA_BLOCKSIZE; ++i) {
+    m_innerPad[i] = 0x36;
+    m_outerPad[i] = 0x5C;
+  }
+
+  m_derivedPassword = password;
+  m_derivedPassword.MakeUnique();
+}
+
+
+PINDEX H2351_Authenticator::FindHashField(const BYTE * pdu, PINDEX length, const BYTE * hash, PINDEX start)
+{
+  if (length < HASH_SIZE)
+    return P_MAX_INDEX;
+
+  // PDUs of the same type are usually laid out the same way
+  if (m_hashOffset >= start && m_hashOffset <= length - HASH_SIZE &&
+      memcmp(pdu + m_hashOffset, hash, HASH_SIZE) == 0)
+    return m_hashOffset;
+
+  const BYTE * last = pdu + length - HASH_SIZE;
+  const BYTE * ptr = pdu + start;
+  while (ptr <= last) {
+    ptr = (const BYTE *)memchr(ptr, hash[0], last - ptr + 1);
+    if (ptr == NULL)
       break;
+    if (memcmp(ptr, hash, HASH_SIZE) == 0) { // i'v found it !
+      m_hashOffset = ptr - pdu;
+      return m_hashOffset;
     }
+    ++ptr;
   }
 
-  if (foundat == -1) {
+  return P_MAX_INDEX;
+}
+
+
+PBoolean H2351_Authenticator::Finalise(PBYTEArray & rawPDU)
+{
+  if (!IsActive())
+    return FALSE;
+
+  PWaitAndSignal m(mutex);
+
+  // Find the pattern
+  PINDEX foundat = FindHashField(rawPDU, rawPDU.GetSize(), SearchPattern);
+  if (foundat == P_MAX_INDEX) {
     //Can't find the search pattern in the ASN1 packet.
     PTRACE(2, "H235RAS\tPDU not prepared for H2351_Authenticator");
     return FALSE;
@@ -383,12 +401,8 @@ PBoolean H2351_Authenticator::Finalise(PBYTEArray & rawPDU)
 
   char key[HASH_SIZE];
 
-  /** make a SHA1 hash before send to the hmac_sha1 */
-  unsigned char secretkey[20];
-
-  SHA1(password, password.GetLength(), secretkey);
-
-  hmac_sha(secretkey, 20, rawPDU.GetPointer(), rawPDU.GetSize(), key, HASH_SIZE);
+  DeriveKey();
+  hmac_sha_pads(m_innerPad, m_outerPad, rawPDU.GetPointer(), rawPDU.GetSize(), key, HASH_SIZE);
 
   memcpy(&rawPDU[foundat], key, HASH_SIZE);
 
@@ -541,8 +555,7 @@ H235Authenticator::ValidationResult H2351_Authenticator::ValidateCryptoToken(
   const unsigned char *data = crHashed.m_token.m_hash.GetDataPointer();
   memcpy(RV, data, HASH_SIZE);
 
-  unsigned char secretkey[20];
-  SHA1(password, password.GetLength(), secretkey);
+  DeriveKey();
 
 
   /****
@@ -550,30 +563,15 @@ H235Authenticator::ValidationResult H2351_Authenticator::ValidateCryptoToken(
   * lookup the variable int the orginal ASN1 packet
   * and set it to 0.
   */
-  PINDEX foundat = 0;
-  bool found = false;
-
   const BYTE * asnPtr = rawPDU;
   PINDEX asnLen = rawPDU.GetSize();
-  while (foundat < asnLen - HASH_SIZE) {
-    for (PINDEX i = foundat; i <= asnLen - HASH_SIZE; i++) {
-      if (memcmp(asnPtr+i, data, HASH_SIZE) == 0) { // i'v found it !
-        foundat = i;
-        found = true;
-        break;
-      }
-    }
-
-    if (!found) {
-      if (foundat != 0)
-        break;
-
-      PTRACE(2, "H235RAS\tH2351_Authenticator could not locate embedded hash!");
-      return e_Error;
-    }
-
-    found = false;
+  PINDEX foundat = FindHashField(asnPtr, asnLen, data);
+  if (foundat == P_MAX_INDEX) {
+    PTRACE(2, "H235RAS\tH2351_Authenticator could not locate embedded hash!");
+    return e_Error;
+  }
 
+  while (foundat != P_MAX_INDEX) {
     memset((BYTE *)asnPtr+foundat, 0, HASH_SIZE);
 
     /****
@@ -583,7 +581,7 @@ H235Authenticator::ValidationResult H2351_Authenticator::ValidateCryptoToken(
     */
 
     char key[HASH_SIZE];
-    hmac_sha(secretkey, 20, asnPtr, asnLen, key, HASH_SIZE);
+    hmac_sha_pads(m_innerPad, m_outerPad, asnPtr, asnLen, key, HASH_SIZE);
 
     /****
     * step 6
@@ -600,7 +598,7 @@ H235Authenticator::ValidationResult H2351_Authenticator::ValidateCryptoToken(
 
     // Put it back and look for another
     memcpy((BYTE *)asnPtr+foundat, data, HASH_SIZE);
-    foundat++;
+    foundat = FindHashField(asnPtr, asnLen, data, foundat+1);
   }
 
   PTRACE(1, "H235RAS\tH2351_Authenticator hash does not match.");
@@ -5013,13 +5013,33 @@ PBoolean H323Connection::OpenAudioChannel(PBoolean isEncoding, unsigned bufferSi
   if (endpoint.AECEnabled() && (aec == NULL)) {
     PTRACE(2, "H323\tCreating AEC instance.");
     int rate = codec.GetMediaFormat().GetTimeUnits() * 1000;
-    aec = new H323Aec(rate, codec.GetMediaFormat().GetFrameTime(), endpoint.GetSoundChannelBufferDepth());
+    aec = new H323Aec(rate, codec.GetMediaFormat().GetFrameTime(), endpoint.GetSoundChannelBufferDepth(),
+                      endpoint.GetAECOffload());
   }
    codec.AttachAEC(aec);
 #endif
 
+  if (!isEncoding && endpoint.GetAudioConcealment())
+    codec.EnableConcealment(TRUE);
+
   return endpoint.OpenAudioChannel(*this, isEncoding, bufferSize, codec);
 }
+
+
+PBoolean H323Connection::PlayPrompt(const PFilePath & name, PINDEX repeat)
+{
+  if (!Lock())
+    return FALSE;
+
+  H323Channel * channel = FindChannel(RTP_Session::DefaultAudioSessionID, FALSE);
+  H323AudioCodec * codec = channel != NULL ? dynamic_cast<H323AudioCodec *>(channel->GetCodec()) : NULL;
+  PBoolean ok = codec != NULL && codec->AttachPrompt(name, repeat);
+
+  Unlock();
+
+  PTRACE_IF(2, !ok, "H323\tCannot play prompt " << name);
+  return ok;
+}
 #endif
 
 #ifdef H323_VIDEO
@@ -246,6 +246,10 @@ class H323_TLSContext : public PSSLContext
     */
     PBoolean SetDHParameters(const PBYTEArray & dh_p, const PBYTEArray & dh_g);
 
+    /**Set the session cache size and timeout (seconds)
+    */
+    PBoolean SetSessionCache(PINDEX size, unsigned timeout);
+
     /**Initialise Context
     */
     PBoolean Initialise();
@@ -282,6 +286,32 @@ H323_TLSContext::H323_TLSContext()
     PString cipherList = "ALL:!ADH:!LOW:!EXP:!MD5:!RC4:!ECDH:!ECDSA:@STRENGTH";
     SetCipherList(cipherList);
     SSL_CTX_set_info_callback(m_context, tls_info_cb);
+
+    // Let reconnecting endpoints resume their session by session ID or ticket
+    static const unsigned char sessionContext[] = "H323plus";
+    SSL_CTX_set_session_id_context(m_context, sessionContext, sizeof(sessionContext) - 1);
+    SetSessionCache(1024, 1800);
+}
+
+PBoolean H323_TLSContext::SetSessionCache(PINDEX size, unsigned timeout)
+{
+#if PTLIB_VER < 2120
+    ssl_ctx_st * m_context = context;
+#endif
+
+    if (size == 0) {
+        SSL_CTX_set_session_cache_mode(m_context, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(m_context, SSL_OP_NO_TICKET);
+        PTRACE(4, "TLS\tSession resumption disabled");
+        return true;
+    }
+
+    SSL_CTX_clear_options(m_context, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_cache_mode(m_context, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(m_context, size);
+    SSL_CTX_set_timeout(m_context, timeout);
+    PTRACE(4, "TLS\tSession cache size " << size << " timeout " << timeout << 's');
+    return true;
 }
 
 PBoolean H323_TLSContext::UseCAFile(const PFilePath & caFile)
@@ -762,6 +792,10 @@ H323EndPoint::H323EndPoint()
 
 #ifdef H323_AUDIO_CODECS
   defaultSilenceDetection = H323AudioCodec::NoSilenceDetection;  //AdaptiveSilenceDetection; TODO Till Encryption fixed
+  audioConcealment = FALSE;
+  mediaClock = NULL;
+  mediaClockEnabled = FALSE;
+  codecEngine = NULL;
 #endif
 
   defaultSendUserInputMode = H323Connection::SendUserInputAsString;
@@ -924,6 +958,7 @@ H323EndPoint::H323EndPoint()
 
 #ifdef H323_AEC
   enableAEC = false;
+  aecOffload = 0;
 #endif
 
 #ifdef H323_GNUGK
@@ -932,6 +967,8 @@ H323EndPoint::H323EndPoint()
 
 #ifdef H323_TLS
   m_transportContext = NULL;
+  m_tlsHandshakeThreads = 2;
+  m_tlsHandshakeQueueSize = 32;
 #endif
 
 #ifdef H323_FRAMEBUFFER
@@ -986,7 +1023,15 @@ H323EndPoint::~H323EndPoint()
   // Clean up any connections that the cleaner thread missed
   CleanUpConnections();
 
+#ifdef H323_AUDIO_CODECS
+  delete mediaClock;
+  delete codecEngine;
+  for (size_t i = 0; i < retiredCodecEngines.size(); i++)
+    delete retiredCodecEngines[i];
+#endif
+
 #ifdef H323_TLS
+  m_tlsSessionCache.RemoveAll();
   if (m_transportContext) {
     delete m_transportContext;
   }
@@ -1724,6 +1769,25 @@ void H323EndPoint::EncryptionCacheRemove()
 {
   H2356_Authenticator::RemoveCache();
 }
+
+void H323EndPoint::EncryptionKeyPoolInitialise(PINDEX depth, PINDEX threads)
+{
+  if (H235Authenticators::GetEncryptionPolicy()) {
+       H2356_Authenticator::InitialiseKeyPool(depth, threads,
+                                              H235Authenticators::GetMaxCipherLength(),
+                                              H235Authenticators::GetMaxTokenLength());
+  }
+}
+
+void H323EndPoint::EncryptionKeyPoolRemove()
+{
+  H2356_Authenticator::RemoveKeyPool();
+}
+
+unsigned H323EndPoint::GetEncryptionKeyPoolMisses() const
+{
+  return H2356_Authenticator::GetKeyPool().GetPoolMisses();
+}
 #endif
 
 H323Connection * H323EndPoint::MakeSupplimentaryCall(const PString & remoteParty,
@@ -3545,6 +3609,37 @@ void H323EndPoint::SetSoundChannelBufferDepth(unsigned depth)
 
 #endif  // P_AUDIO
 
+
+void H323EndPoint::EnableMediaClock(PBoolean enable)
+{
+  // Codecs keep the clock pointer from Open() until they are destroyed, so
+  // it is never deleted here, disabling just stops new codecs from using it
+  if (enable && mediaClock == NULL)
+    mediaClock = new H323MediaClock();
+
+  PTRACE_IF(3, !enable && mediaClock != NULL && mediaClock->GetClientCount() > 0,
+            "H323\tMedia clock disabled, still ticking " << mediaClock->GetClientCount() << " open codecs");
+
+  mediaClockEnabled = enable;
+}
+
+
+void H323EndPoint::EnableCodecEngine(unsigned threads, unsigned maxBatch)
+{
+  // Codecs read the engine pointer unlocked when opening, so it is never
+  // deleted here. It stops taking codecs and is kept with the endpoint.
+  H323PluginCodecEngine * engine = threads > 0 ? new H323PluginCodecEngine(threads, maxBatch) : NULL;
+  H323PluginCodecEngine * retired = codecEngine;
+  codecEngine = engine;
+
+  if (retired != NULL) {
+    PTRACE_IF(3, retired->GetChannelCount() > 0,
+              "H323\tCodec engine replaced, still running " << retired->GetChannelCount() << " codecs");
+    retired->Stop();
+    retiredCodecEngines.push_back(retired);
+  }
+}
+
 #endif  // H323_AUDIO_CODECS
 
 
@@ -4239,6 +4334,25 @@ PBoolean H323EndPoint::TLS_SetDHParameters(const PBYTEArray & dh_p, const PBYTEA
     return ((H323_TLSContext*)m_transportContext)->SetDHParameters(dh_p,dh_g);
 }
 
+PBoolean H323EndPoint::TLS_SetSessionCache(PINDEX size, unsigned timeout)
+{
+    if (!InitialiseTransportContext())
+        return false;
+
+    return ((H323_TLSContext*)m_transportContext)->SetSessionCache(size, timeout);
+}
+
+void H323EndPoint::TLS_SetClientSessionCache(PINDEX size)
+{
+    m_tlsSessionCache.SetMaxSessions(size);
+}
+
+void H323EndPoint::TLS_SetHandshakeThreads(PINDEX threads, PINDEX queueSize)
+{
+    m_tlsHandshakeThreads = threads;
+    m_tlsHandshakeQueueSize = queueSize;
+}
+
 PBoolean H323EndPoint::TLS_Initialise(const PIPSocket::Address & binding, WORD port)
 {
     if (!InitialiseTransportContext())
@@ -50,6 +50,12 @@
 
 #include <h323pdu.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
 
 static const char * FileTransferOID = "1.3.6.1.4.1.17090.1.2";
 static const char * FileTransferListOID = "1.3.6.1.4.1.17090.1.2.1";
@@ -91,6 +97,7 @@ H323FileTransferCapability::H323FileTransferCapability()
 {
     m_blockSize = SetParameterBlockSize(m_blockOctets);  // parameter block size
     m_transferMode = 1;                                     // Transfer mode is RTP encapsulated
+    m_windowSize = e_DefaultWindow;
 }
 
 H323FileTransferCapability::H323FileTransferCapability(unsigned maxBitRate, unsigned maxBlockSize)
@@ -98,6 +105,7 @@ H323FileTransferCapability::H323FileTransferCapability(unsigned maxBitRate, unsi
 {
     m_blockSize = SetParameterBlockSize(m_blockOctets);  // parameter block size
     m_transferMode = 1;                                     // Transfer mode is RTP encapsulated
+    m_windowSize = e_DefaultWindow;
 }
 
 PBoolean H323FileTransferCapability::OnReceivedPDU(const H245_DataApplicationCapability & pdu)
@@ -158,6 +166,9 @@ PBoolean H323FileTransferCapability::OnReceivedPDU(const H245_GenericCapability
    if (!pdu.HasOptionalField(H245_GenericCapability::e_collapsing))
         return FALSE;
 
+   // A remote that does not signal a window can only do stop and wait
+   m_windowSize = e_StopAndWait;
+
    const H245_ArrayOf_GenericParameter & params = pdu.m_collapsing;
    for (PINDEX j=0; j<params.GetSize(); j++) {
      const H245_GenericParameter & content = params[j];
@@ -171,6 +182,8 @@ PBoolean H323FileTransferCapability::OnReceivedPDU(const H245_GenericCapability
             }
             if (id == 2)
                m_transferMode = val;
+            if (id == 3)
+               SetWindowSize(val);
         }
       }
     }
@@ -213,9 +226,29 @@ PBoolean H323FileTransferCapability::OnSendingPDU(H245_GenericCapability & pdu)
    pdu.m_collapsing.Append(blockparam);
    pdu.m_collapsing.Append(modeparam);
 
+   // Add the Window size parameter, left out for stop and wait as older versions do
+   if (m_windowSize > e_StopAndWait) {
+     H245_GenericParameter * windowparam = new H245_GenericParameter;
+     windowparam->m_parameterIdentifier.SetTag(H245_ParameterIdentifier::e_standard);
+     (PASN_Integer &)windowparam->m_parameterIdentifier = 3;
+     windowparam->m_parameterValue.SetTag(H245_ParameterValue::e_booleanArray);
+     (PASN_Integer &)windowparam->m_parameterValue = m_windowSize;
+     pdu.m_collapsing.Append(windowparam);
+   }
+
    return TRUE;
 }
 
+void H323FileTransferCapability::SetWindowSize(unsigned size)
+{
+    if (size < e_StopAndWait)
+        m_windowSize = e_StopAndWait;
+    else if (size > e_MaxWindow)
+        m_windowSize = e_MaxWindow;
+    else
+        m_windowSize = size;
+}
+
 void H323FileTransferCapability::SetFileTransferList(const H323FileTransferList & list)
 {
     m_filelist.clear();
@@ -323,6 +356,9 @@ PBoolean H323FileTransferChannel::Start()
   if (fileHandler->GetBlockRate() == 0)
        fileHandler->SetMaxBlockRate(((H323FileTransferCapability *)capability)->GetBlockRate());
 
+  // Both ends see the window of the capability in the OpenLogicalChannel
+  fileHandler->SetWindowSize(((H323FileTransferCapability *)capability)->GetWindowSize());
+
   return fileHandler->Start(direction);
 }
 
@@ -906,6 +942,16 @@ H323FileTransferHandler::H323FileTransferHandler(H323Connection & connection,
   currentState = e_error;
   blockState = recOK;
 
+  windowSize = H323FileTransferCapability::e_StopAndWait;
+  windowBase = 0;
+  windowNext = 0;
+  windowLast = 0;
+  srtt = 0;
+  rttvar = 0;
+  rto = responseTimeOut;
+  recvNext = 0;
+  windowLastAck = 0;
+  writeFill = 0;
 }
 
 H323FileTransferHandler::~H323FileTransferHandler()
@@ -970,6 +1016,12 @@ void H323FileTransferHandler::SetMaxBlockRate(unsigned rate)
     msBetweenBlocks = (int)((1.000/((double)rate))*1000);
 }
 
+void H323FileTransferHandler::SetWindowSize(unsigned size)
+{
+    windowSize = PMIN(PMAX(size, (unsigned)H323FileTransferCapability::e_StopAndWait),
+                      (unsigned)H323FileTransferCapability::e_MaxWindow);
+}
+
 void H323FileTransferHandler::ChangeState(transferState newState)
 {
    PWaitAndSignal m(stateMutex);
@@ -997,14 +1049,19 @@ void H323FileTransferHandler::SetBlockState(receiveStates state)
 PBoolean H323FileTransferHandler::TransmitFrame(H323FilePacket & buffer, PBoolean final)
 {
 
+  transmitFrame.SetPayloadSize(buffer.GetSize());
+  memmove(transmitFrame.GetPayloadPtr(),buffer.GetPointer(), buffer.GetSize());
+  return WriteFrame(final);
+}
+
+PBoolean H323FileTransferHandler::WriteFrame(PBoolean final)
+{
   // determining correct timestamp
   PTime currentTime = PTime();
   PTimeInterval timePassed = currentTime - *StartTime;
   transmitFrame.SetTimestamp((DWORD)timePassed.GetMilliSeconds() * 8);
   transmitFrame.SetMarker(final);
 
-  transmitFrame.SetPayloadSize(buffer.GetSize());
-  memmove(transmitFrame.GetPayloadPtr(),buffer.GetPointer(), buffer.GetSize());
   // TODO: Add Support for Encryption. -SH
   return (session && session->PreWriteData(transmitFrame) && session->WriteData(transmitFrame));
 }
@@ -1068,6 +1125,11 @@ void H323FileTransferHandler::Transmit(PThread &, H323_INT)
 
         H323FilePacket packet;
         PBoolean final = FALSE;
+
+        // ACKs of the windowed transfer queued by the receive thread
+        if (windowSize > H323FileTransferCapability::e_StopAndWait)
+            SendWindowAcks();
+
         switch (currentState) {
            case e_probing:
                 probMutex.Wait(50);
@@ -1158,6 +1220,14 @@ void H323FileTransferHandler::Transmit(PThread &, H323_INT)
 
                 if (blockState != recPartial) {
                     if (blockState == recOK) {
+                        if (windowSize > H323FileTransferCapability::e_StopAndWait && !lastFrame) {
+                            // Returns once every block of the file has been acknowledged
+                            if (!TransmitWindow()) {
+                                success = (currentState != e_sending);
+                                continue;
+                            }
+                            lastFrame = TRUE;
+                        }
                         if (lastFrame) {
                             // We have successfully sent the last frame of data.
                             // switch back to waiting to queue the next file
@@ -1215,6 +1285,18 @@ void H323FileTransferHandler::Transmit(PThread &, H323_INT)
                    final = TRUE;
                    SetBlockState(recOK);
                    break;
+               } else if (windowSize > H323FileTransferCapability::e_StopAndWait) {
+                   // Each block is acknowledged as it arrives
+                   nextFrame.Wait(responseTimeOut);
+                   SendWindowAcks();
+                   if (blockState == recComplete) {
+                       lastBlockNo = 0;
+                       curProgSize = 0;
+                       curFile->Close();
+                       ChangeState(e_waiting);
+                       waitforResponse = FALSE;
+                   }
+                   continue;
                } else if (sentBlock == lastBlockNo) {
                    nextFrame.Wait(responseTimeOut);
                }
@@ -1356,6 +1438,7 @@ void H323FileTransferHandler::Receive(PThread &, H323_INT)
                         break;
                    }
                    SetBlockState(recReady);
+                   StartWindowReceive();
                    ChangeState(e_receiving);
                    OnFileStart(p, curFileSize,FALSE);  // Notify to start receive
                    shutdownTimer.SetInterval(0);
@@ -1391,6 +1474,7 @@ void H323FileTransferHandler::Receive(PThread &, H323_INT)
                             break;
                         }
                        SetBlockState(recOK);
+                       StartWindowReceive();
                        ChangeState(e_receiving);
                        OnFileStart(curFileName, curFileSize, false);  // Notify to start receive
                        nextFrame.Signal();
@@ -1400,11 +1484,19 @@ void H323FileTransferHandler::Receive(PThread &, H323_INT)
                           nextFrame.Signal();
                    }
                    break;
+               } else if ((ptype == H323FilePacket::e_DATA) && (windowLastAck > 0) &&
+                          (packet.GetBlockNo() == windowLastAck)) {
+                   // The ACK of the last block was lost and the sender is repeating it
+                   QueueWindowAck(windowLastAck);
+                   nextFrame.Signal();
                }
 
                break;
            case e_receiving:
-               if (ptype == H323FilePacket::e_DATA) {
+               if ((ptype == H323FilePacket::e_DATA) && (windowSize > H323FileTransferCapability::e_StopAndWait)) {
+                   OnWindowData(packet);
+                   nextFrame.Signal();
+               } else if (ptype == H323FilePacket::e_DATA) {
                    PBoolean OKtoWrite = FALSE;
                    int blockNo = 0;
                    if ((packet.GetDataSize() == blockSize) ||  // We have complete block
@@ -1446,7 +1538,9 @@ void H323FileTransferHandler::Receive(PThread &, H323_INT)
                if (ptype == H323FilePacket::e_ACK) {
                     if (packet.GetACKBlockNo() == 0)  // Control ACKs = 0 so ignore.
                         continue;
-                    if (packet.GetACKBlockNo() == lastBlockNo) {
+                    if (windowSize > H323FileTransferCapability::e_StopAndWait)
+                        OnWindowAck(packet.GetACKBlockNo());
+                    else if (packet.GetACKBlockNo() == lastBlockNo) {
                         curProgSize = curProgSize + lastBlockSize;
                         OnFileProgress(curFileName, lastBlockNo, curProgSize, TRUE);
                         SetBlockState(recOK);
@@ -1474,6 +1568,342 @@ void H323FileTransferHandler::Receive(PThread &, H323_INT)
     PTRACE(6,"FILE\tClosing Receive Thread");
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Windowed transfer
+//
+// Rather than waiting for the ACK of each block, up to windowSize blocks
+// are in flight and each is acknowledged by its own block number. A block is
+// sent again when its retransmission timeout, taken from the measured round
+// trip time, expires or when enough later blocks have been acknowledged
+// before it. The receiver holds blocks that arrive ahead of a missing one
+// and writes the file in large sequential chunks.
+
+static const int MinRetransmitTime = 200;        // ms
+static const unsigned FastRetransmitAcks = 3;    // Later blocks acknowledged before a block is presumed lost
+static const PINDEX WriteBufferSize = 65536;
+
+static int WindowBlockNo(unsigned index)
+{
+    return (int)((index - 1) % 99) + 1;
+}
+
+PBoolean H323FileTransferHandler::TransmitWindow()
+{
+    if (curFile->GetFileSize() < curFileSize) {
+        PTRACE(2, "FT\tFile " << curFileName << " is shorter than the " << curFileSize << " bytes announced");
+        ioerr = H323FileIOChannel::e_AccessDenied;
+        ChangeState(e_error);
+        return FALSE;
+    }
+
+    PBoolean mapped = curFile->MapData();
+
+    {
+      PWaitAndSignal m(windowMutex);
+      windowBlocks.assign(windowSize, WindowBlock());
+      windowBase = 1;
+      windowNext = 1;
+      windowLast = curFileSize / blockSize + 1;
+      curProgSize = 0;
+    }
+
+    PTRACE(4, "FT\tSending " << curFileName << " as " << windowLast << " blocks with a window of " << windowSize
+              << (mapped ? " from the mapped file" : ""));
+
+    while (!exitTransmit.Wait(0) && currentState == e_sending) {
+        unsigned index = 0;
+        PInt64 wait = rto;
+        int interval = msBetweenBlocks;
+
+        {
+          PWaitAndSignal m(windowMutex);
+
+          if (windowBase > windowLast)
+              return TRUE;
+
+          // A block presumed lost or timed out goes before any new one
+          PInt64 now = PTimer::Tick().GetMilliSeconds();
+          for (unsigned i = windowBase; i < windowNext; i++) {
+              WindowBlock & block = windowBlocks[i % windowSize];
+              if (block.acked)
+                  continue;
+              PInt64 due = block.sent + rto;
+              if (block.resend || due <= now) {
+                  if (!block.resend)
+                      rto = PMIN(rto * 2, 4 * (int)responseTimeOut);
+                  index = i;
+                  break;
+              }
+              if (due - now < wait)
+                  wait = due - now;
+          }
+
+          if (index == 0 && windowNext <= windowLast && windowNext < windowBase + windowSize) {
+              index = windowNext++;
+              WindowBlock & block = windowBlocks[index % windowSize];
+              block = WindowBlock();
+              block.offset = (index - 1) * blockSize;
+              block.size = index < windowLast ? blockSize : curFileSize % blockSize;
+              if (!mapped && block.size > 0) {
+                  // Blocks are read in order, keep a copy in case it is sent again
+                  PINDEX amount = block.size;
+                  if (!curFile->Read(block.data.GetPointer(amount), amount) || amount != block.size) {
+                      PTRACE(2, "FT\tCould not read block " << index << " of " << curFileName);
+                      ioerr = H323FileIOChannel::e_AccessDenied;
+                      ChangeState(e_error);
+                      return FALSE;
+                  }
+              }
+          }
+
+          if (index != 0) {
+              WindowBlock & block = windowBlocks[index % windowSize];
+              block.resend = FALSE;
+              block.later = 0;
+              block.transmissions++;
+          }
+
+          // Spread the window over the round trip rather than sending it in a burst
+          if (srtt > 0)
+              interval = PMAX(interval, srtt / (int)windowSize);
+        }
+
+        if (index == 0) {
+            // Window full, wait for an ACK or the next timeout
+            nextFrame.Wait(PTimeInterval(wait));
+            continue;
+        }
+
+        sendwait.Delay(interval);
+
+        const BYTE * data;
+        PINDEX offset;
+        PINDEX size;
+        PBoolean retransmit;
+        {
+          PWaitAndSignal m(windowMutex);
+          WindowBlock & block = windowBlocks[index % windowSize];
+          if (block.acked)
+              continue;
+          block.sent = PTimer::Tick().GetMilliSeconds();
+          // Only this thread replaces a block, so the copy outlives the send
+          data = mapped ? NULL : (const BYTE *)block.data;
+          offset = block.offset;
+          size = block.size;
+          retransmit = block.transmissions > 1;
+        }
+
+        if (retransmit)
+            OnFileError(curFileName, WindowBlockNo(index), TRUE);
+
+        if (!TransmitBlock(index, offset, data, size))
+            return FALSE;
+    }
+
+    return FALSE;
+}
+
+PBoolean H323FileTransferHandler::TransmitBlock(unsigned index, PINDEX offset, const BYTE * data, PINDEX size)
+{
+    // data is the copy of the block, or NULL to copy from the mapped file
+    H323FilePacket header;
+    header.BuildData(WindowBlockNo(index), 0);
+
+    // Segment as for stop and wait, the marker is set on the last segment
+    PINDEX headerSize = header.GetSize();
+    PINDEX total = headerSize + size;
+    PINDEX segment = blockSize > H323FileTransferCapability::e_1428 ? (PINDEX)H323FileTransferCapability::e_1428 : total;
+
+    for (PINDEX position = 0; position < total; position += segment) {
+        PINDEX length = PMIN(segment, total - position);
+        transmitFrame.SetPayloadSize(length);
+        BYTE * payload = transmitFrame.GetPayloadPtr();
+        PINDEX start = position;
+        PINDEX amount = length;
+        if (position == 0) {
+            memcpy(payload, header.GetPointer(), headerSize);
+            payload += headerSize;
+            amount -= headerSize;
+        } else
+            start -= headerSize;
+
+        if (amount > 0) {
+            if (data != NULL)
+                memcpy(payload, data + start, amount);
+            else if (!curFile->ReadMapped(offset + start, payload, amount)) {
+                PTRACE(2, "FT\tFile " << curFileName << " was closed or truncated while sending");
+                ioerr = H323FileIOChannel::e_AccessDenied;
+                ChangeState(e_error);
+                return FALSE;
+            }
+        }
+
+        if (!WriteFrame(position + length == total))
+            return FALSE;
+    }
+
+    PTRACE(6, "FT\t<- blk " << WindowBlockNo(index) << " : " << total << " bytes");
+    return TRUE;
+}
+
+void H323FileTransferHandler::OnWindowAck(int blockNo)
+{
+    PWaitAndSignal m(windowMutex);
+
+    for (unsigned i = windowBase; i < windowNext; i++) {
+        if (WindowBlockNo(i) != blockNo)
+            continue;
+
+        WindowBlock & block = windowBlocks[i % windowSize];
+        if (block.acked)
+            return;
+        block.acked = TRUE;
+
+        // Only a block sent once gives an unambiguous round trip time
+        if (block.transmissions == 1) {
+            int rtt = (int)(PTimer::Tick().GetMilliSeconds() - block.sent);
+            if (srtt == 0) {
+                srtt = rtt;
+                rttvar = rtt / 2;
+            } else {
+                rttvar = (3 * rttvar + PABS(srtt - rtt)) / 4;
+                srtt = (7 * srtt + rtt) / 8;
+            }
+            rto = PMIN(PMAX(srtt + 4 * rttvar, MinRetransmitTime), 4 * (int)responseTimeOut);
+        }
+
+        curProgSize = curProgSize + block.size;
+        OnFileProgress(curFileName, blockNo, curProgSize, TRUE);
+
+        // Earlier blocks still outstanding are presumed lost once enough later ones got through
+        for (unsigned j = windowBase; j < i; j++) {
+            WindowBlock & earlier = windowBlocks[j % windowSize];
+            if (!earlier.acked && ++earlier.later == FastRetransmitAcks)
+                earlier.resend = TRUE;
+        }
+        break;
+    }
+
+    while (windowBase < windowNext && windowBlocks[windowBase % windowSize].acked)
+        windowBase++;
+}
+
+void H323FileTransferHandler::StartWindowReceive()
+{
+    if (windowSize <= H323FileTransferCapability::e_StopAndWait)
+        return;
+
+    windowLast = curFileSize / blockSize + 1;
+    recvNext = 1;
+    recvBlocks.assign(windowSize, PBYTEArray());
+    recvHave.assign(windowSize, false);
+    writeBuffer.SetSize(PMAX(WriteBufferSize, (PINDEX)(windowSize * blockSize)));
+    writeFill = 0;
+    windowLastAck = 0;
+}
+
+void H323FileTransferHandler::OnWindowData(H323FilePacket & packet)
+{
+    int blockNo = packet.GetBlockNo();
+    if (blockNo < 1 || blockNo > 99)
+        return;
+
+    unsigned ahead = (blockNo - WindowBlockNo(recvNext) + 99) % 99;
+    if (ahead >= windowSize) {
+        // Already written, the sender did not get the ACK
+        if (99 - ahead <= windowSize)
+            QueueWindowAck(blockNo);
+        return;
+    }
+
+    unsigned index = recvNext + ahead;
+    if (index > windowLast)
+        return;
+
+    PINDEX expected = index < windowLast ? blockSize : curFileSize % blockSize;
+    if ((PINDEX)packet.GetDataSize() != expected) {
+        // A segment was lost, the block is sent again when it is not acknowledged
+        OnFileError(curFileName, blockNo, FALSE);
+        return;
+    }
+
+    QueueWindowAck(blockNo);
+
+    if (ahead > 0) {
+        unsigned slot = index % windowSize;
+        if (!recvHave[slot]) {
+            recvBlocks[slot] = PBYTEArray(packet.GetDataPtr(), expected);
+            recvHave[slot] = true;
+        }
+        return;
+    }
+
+    WriteWindowData(packet.GetDataPtr(), expected);
+    recvNext++;
+
+    // Blocks held back waiting for this one follow it
+    while (recvNext <= windowLast && recvHave[recvNext % windowSize]) {
+        unsigned slot = recvNext % windowSize;
+        WriteWindowData(recvBlocks[slot].GetPointer(), recvBlocks[slot].GetSize());
+        recvBlocks[slot].SetSize(0);
+        recvHave[slot] = false;
+        recvNext++;
+    }
+
+    OnFileProgress(curFileName, WindowBlockNo(recvNext - 1), curProgSize, FALSE);
+
+    if (recvNext > windowLast) {
+        FlushWindowData();
+        windowLastAck = WindowBlockNo(windowLast);
+        SetBlockState(recComplete);
+    }
+}
+
+void H323FileTransferHandler::WriteWindowData(const BYTE * data, PINDEX size)
+{
+    if (writeFill + size > writeBuffer.GetSize())
+        FlushWindowData();
+
+    memcpy(writeBuffer.GetPointer() + writeFill, data, size);
+    writeFill += size;
+    curProgSize = curProgSize + size;
+}
+
+void H323FileTransferHandler::FlushWindowData()
+{
+    if (writeFill == 0)
+        return;
+
+    if (!curFile->Write(writeBuffer.GetPointer(), writeFill)) {
+        PTRACE(2, "FT\tCould not write " << writeFill << " bytes to " << curFileName);
+    }
+    writeFill = 0;
+}
+
+void H323FileTransferHandler::QueueWindowAck(int blockNo)
+{
+    PWaitAndSignal m(windowMutex);
+    pendingAcks.push_back(blockNo);
+}
+
+void H323FileTransferHandler::SendWindowAcks()
+{
+    std::list<int> acks;
+    {
+      PWaitAndSignal m(windowMutex);
+      acks.swap(pendingAcks);
+    }
+
+    for (std::list<int>::iterator r = acks.begin(); r != acks.end(); ++r) {
+        H323FilePacket packet;
+        packet.BuildACK(*r);
+#if PTRACING
+        PTRACE(5,"FT\t" << DataPacketAnalysis(true,packet,TRUE));
+#endif
+        TransmitFrame(packet, TRUE);
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 static PString opStr[] = {
@@ -1649,8 +2079,12 @@ H323FilePacket::opcodes H323FilePacket::GetPacketType() const
 ////////////////////////////////////////////////////////////////////
 
 H323FileIOChannel::H323FileIOChannel(PFilePath _file, PBoolean read)
-: fileopen(false), filesize(0), IOError(e_NotFound)
+: fileopen(false), filesize(0), IOError(e_NotFound), mappedData(NULL)
 {
+#ifdef _WIN32
+    mapping = NULL;
+#endif
+
     if (!CheckFile(_file,read,IOError))
         return;
 
@@ -1681,6 +2115,7 @@ H323FileIOChannel::H323FileIOChannel(PFilePath _file, PBoolean read)
 
 H323FileIOChannel::~H323FileIOChannel()
 {
+    UnmapData();
 }
 
 PBoolean H323FileIOChannel::IsError(fileError & err)
@@ -1732,6 +2167,7 @@ PBoolean H323FileIOChannel::Close()
   if (!fileopen)
         return TRUE;
 
+  UnmapData();
   PIndirectChannel::Close();
   return TRUE;
 }
@@ -1741,6 +2177,75 @@ unsigned H323FileIOChannel::GetFileSize()
     return filesize;
 }
 
+PBoolean H323FileIOChannel::MapData()
+{
+    PWaitAndSignal mutex(chanMutex);
+
+    if (mappedData != NULL || !fileopen || filesize == 0)
+        return mappedData != NULL;
+
+    PChannel * channel = GetReadChannel();
+    if (channel == NULL || !PIsDescendant(channel, PFile))
+        return FALSE;
+
+    PFile * file = (PFile *)channel;
+
+#if defined(_WIN32_WCE)
+    // No mapping, blocks are read
+#elif defined(_WIN32)
+    mapping = CreateFileMapping((HANDLE)_get_osfhandle(file->GetHandle()), NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL) {
+        mappedData = (const BYTE *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (mappedData == NULL) {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+    }
+#else
+    void * data = mmap(NULL, filesize, PROT_READ, MAP_SHARED, file->GetHandle(), 0);
+    if (data != MAP_FAILED) {
+        mappedData = (const BYTE *)data;
+#ifdef MADV_SEQUENTIAL
+        madvise(data, filesize, MADV_SEQUENTIAL);
+#endif
+    }
+#endif
+
+    PTRACE_IF(4, mappedData == NULL, "FT\tCould not map " << file->GetFilePath() << ", reading it instead");
+    return mappedData != NULL;
+}
+
+PBoolean H323FileIOChannel::ReadMapped(PINDEX offset, void * buffer, PINDEX amount)
+{
+    PWaitAndSignal mutex(chanMutex);
+
+    if (mappedData == NULL || offset + amount > (PINDEX)filesize)
+        return FALSE;
+
+    // Another process may have truncated the file since it was mapped
+    PChannel * channel = GetReadChannel();
+    if (channel == NULL || ((PFile *)channel)->GetLength() < (off_t)(offset + amount))
+        return FALSE;
+
+    memcpy(buffer, mappedData + offset, amount);
+    return TRUE;
+}
+
+void H323FileIOChannel::UnmapData()
+{
+    if (mappedData == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mappedData);
+    CloseHandle(mapping);
+    mapping = NULL;
+#else
+    munmap((void *)mappedData, filesize);
+#endif
+    mappedData = NULL;
+}
+
 PBoolean H323FileIOChannel::Read(void * buffer, PINDEX & amount)
 {
     PWaitAndSignal mutex(chanMutex);
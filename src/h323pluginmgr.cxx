@@ -43,6 +43,7 @@
 #include <rtp.h>
 #include <mediafmt.h>
 #include <openh323buildopts.h>
+#include <algorithm>
 
 #define H323CAP_TAG_PREFIX    "h323"
 static const char GET_CODEC_OPTIONS_CONTROL[]       = "get_codec_options";
@@ -197,13 +198,6 @@ class OpalPluginCodec : public OpalFactoryCodec {
 
 #ifdef H323_AUDIO_CODECS
 
-extern "C" {
-  unsigned char linear2ulaw(int pcm_val);
-  int ulaw2linear(unsigned char u_val);
-  unsigned char linear2alaw(int pcm_val);
-  int alaw2linear(unsigned char u_val);
-};
-
 #define DECLARE_FIXED_CODEC(name, format, bps, frameTime, samples, bytes, fpp, maxfpp, payload, sdp) \
 class name##_Base : public OpalFactoryCodec { \
   PCLASSINFO(name##_Base, OpalFactoryCodec) \
@@ -260,8 +254,7 @@ int OpalG711ALaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeSamples(from, to, count);
 
   return 1;
 }
@@ -277,8 +270,7 @@ int OpalG711ALaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeSamples(from, to, count);
 
   return 1;
 }
@@ -296,8 +288,7 @@ int OpalG711ALaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeSamples(from, to, count);
 
   return 1;
 }
@@ -313,8 +304,7 @@ int OpalG711ALaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeSamples(from, to, count);
 
   return 1;
 }
@@ -332,8 +322,7 @@ int OpalG711uLaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeSamples(from, to, count);
 
   return 1;
 }
@@ -349,8 +338,7 @@ int OpalG711uLaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeSamples(from, to, count);
 
   return 1;
 }
@@ -368,8 +356,7 @@ int OpalG711uLaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeSamples(from, to, count);
 
   return 1;
 }
@@ -385,8 +372,7 @@ int OpalG711uLaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeSamples(from, to, count);
 
   return 1;
 }
@@ -888,6 +874,7 @@ class OpalPluginAudioMediaFormat : public OpalMediaFormat
     ~OpalPluginAudioMediaFormat()
     {
       OpalMediaFormatFactory::Unregister(*this);
+      OpalMediaFormat::RegistryChanged();
     }
     PluginCodec_Definition * encoderCodec;
 };
@@ -957,6 +944,7 @@ class OpalPluginVideoMediaFormat : public OpalVideoFormat
     ~OpalPluginVideoMediaFormat()
     {
       OpalMediaFormatFactory::Unregister(*this);
+      OpalMediaFormat::RegistryChanged();
     }
 
     PObject * Clone() const
@@ -1110,6 +1098,287 @@ static bool UpdatePluginOptions(const PluginCodec_Definition * codec, void * con
 }
 #endif
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Plugin codec engine
+//
+
+#ifdef H323_AUDIO_CODECS
+
+// CPU time of the calling thread in microseconds, so time the worker is
+// preempted or waiting is not counted against the codec
+static PInt64 CodecEngineThreadTime()
+{
+#if defined(_WIN32)
+  FILETIME created, exited, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+    return 0;
+  return ((((PInt64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+          (((PInt64)user.dwHighDateTime << 32) | user.dwLowDateTime))/10;
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return (PInt64)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#else
+  PTime now;
+  return now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+#endif
+}
+
+
+H323PluginCodecEngine::Channel::Channel()
+  : m_worker(P_MAX_INDEX), m_codec(NULL),
+    m_context(NULL), m_from(NULL), m_fromLen(NULL), m_to(NULL), m_toLen(NULL), m_flags(NULL),
+    m_result(0), m_next(NULL)
+{
+}
+
+
+H323PluginCodecEngine::H323PluginCodecEngine(unsigned threads, unsigned maxBatch)
+  : m_maxBatch(maxBatch > 0 ? maxBatch : 1), m_shutdown(FALSE), m_stopped(FALSE)
+{
+  if (threads == 0)
+    threads = 1;
+
+  PINDEX i;
+  for (i = 0; i < (PINDEX)threads; ++i) {
+    Worker * worker = new Worker;
+    worker->m_batch.reserve(m_maxBatch);
+    m_workers.push_back(worker);
+  }
+
+  for (i = 0; i < (PINDEX)threads; ++i)
+    m_workers[i]->m_thread = PThread::Create(PCREATE_NOTIFIER(WorkerMain), i,
+                                             PThread::NoAutoDeleteThread,
+                                             PThread::HighPriority,
+                                             "CodecEngine:%x");
+
+  PTRACE(3, "H323PLUGIN\tCodec engine started with " << threads << " workers");
+}
+
+
+H323PluginCodecEngine::~H323PluginCodecEngine()
+{
+  {
+    PWaitAndSignal m(m_mutex);
+    m_shutdown = TRUE;
+  }
+
+  for (std::vector<Worker *>::iterator w = m_workers.begin(); w != m_workers.end(); ++w) {
+    (*w)->m_wakeup.Signal();
+    (*w)->m_thread->WaitForTermination();
+    delete (*w)->m_thread;
+    delete *w;
+  }
+  m_workers.clear();
+}
+
+
+PBoolean H323PluginCodecEngine::Attach(Channel & channel, const PluginCodec_Definition * codec)
+{
+  if (codec == NULL)
+    return FALSE;
+
+  PWaitAndSignal m(m_mutex);
+
+  if (m_shutdown || m_stopped)
+    return FALSE;
+
+  if (channel.IsAttached())
+    return channel.m_codec == codec;
+
+  // Prefer a worker already running this codec, unless another worker
+  // has more than one channel less.
+  PINDEX best = 0;
+  unsigned bestLoad = UINT_MAX;
+  for (PINDEX i = 0; i < (PINDEX)m_workers.size(); ++i) {
+    Worker & worker = *m_workers[i];
+    unsigned load = worker.m_channels*2;
+    if (worker.m_codecs.find(codec) == worker.m_codecs.end())
+      load += 3;
+    if (load < bestLoad) {
+      best = i;
+      bestLoad = load;
+    }
+  }
+
+  Worker & worker = *m_workers[best];
+  worker.m_channels++;
+  worker.m_codecs[codec]++;
+  m_statistics[codec].channels++;
+
+  channel.m_worker = best;
+  channel.m_codec = codec;
+
+  PTRACE(4, "H323PLUGIN\tCodec engine pinned " << codec->descr << " to worker " << best);
+  return TRUE;
+}
+
+
+void H323PluginCodecEngine::Stop()
+{
+  PWaitAndSignal m(m_mutex);
+  m_stopped = TRUE;
+}
+
+
+void H323PluginCodecEngine::Detach(Channel & channel)
+{
+  PWaitAndSignal m(m_mutex);
+
+  if (!channel.IsAttached())
+    return;
+
+  Worker & worker = *m_workers[channel.m_worker];
+  worker.m_channels--;
+  std::map<const PluginCodec_Definition *, unsigned>::iterator r = worker.m_codecs.find(channel.m_codec);
+  if (r != worker.m_codecs.end() && --r->second == 0)
+    worker.m_codecs.erase(r);
+  m_statistics[channel.m_codec].channels--;
+
+  channel.m_worker = P_MAX_INDEX;
+  channel.m_codec = NULL;
+}
+
+
+int H323PluginCodecEngine::Execute(Channel & channel,
+                                   void * context,
+                                   const void * from,
+                                   unsigned * fromLen,
+                                   void * to,
+                                   unsigned * toLen,
+                                   unsigned * flags)
+{
+  Worker * worker;
+  {
+    PWaitAndSignal m(m_mutex);
+
+    if (!channel.IsAttached() || m_shutdown)
+      return 0;
+
+    channel.m_context = context;
+    channel.m_from    = from;
+    channel.m_fromLen = fromLen;
+    channel.m_to      = to;
+    channel.m_toLen   = toLen;
+    channel.m_flags   = flags;
+    channel.m_result  = 0;
+    channel.m_next    = NULL;
+
+    worker = m_workers[channel.m_worker];
+    if (worker->m_tail != NULL)
+      worker->m_tail->m_next = &channel;
+    else
+      worker->m_head = &channel;
+    worker->m_tail = &channel;
+  }
+
+  worker->m_wakeup.Signal();
+  channel.m_done.Wait();
+  return channel.m_result;
+}
+
+
+H323PluginCodecEngine::StatisticsMap H323PluginCodecEngine::GetStatistics() const
+{
+  StatisticsMap statistics;
+
+  PWaitAndSignal m(m_mutex);
+  std::map<const PluginCodec_Definition *, CodecStatistics>::const_iterator r;
+  for (r = m_statistics.begin(); r != m_statistics.end(); ++r)
+    statistics[PString(r->first->sourceFormat) + "->" + r->first->destFormat] = r->second;
+
+  return statistics;
+}
+
+
+PINDEX H323PluginCodecEngine::GetChannelCount() const
+{
+  PWaitAndSignal m(m_mutex);
+
+  PINDEX count = 0;
+  for (std::vector<Worker *>::const_iterator w = m_workers.begin(); w != m_workers.end(); ++w)
+    count += (*w)->m_channels;
+  return count;
+}
+
+
+void H323PluginCodecEngine::WorkerMain(PThread &, H323_INT index)
+{
+  Worker & worker = *m_workers[index];
+
+  PTRACE(4, "H323PLUGIN\tCodec engine worker " << index << " started");
+
+  for (;;) {
+    {
+      PWaitAndSignal m(m_mutex);
+      while (worker.m_head != NULL && worker.m_batch.size() < m_maxBatch) {
+        worker.m_batch.push_back(worker.m_head);
+        worker.m_head = worker.m_head->m_next;
+      }
+      if (worker.m_head == NULL)
+        worker.m_tail = NULL;
+
+      // Frames already queued are still run so no channel is left waiting
+      if (worker.m_batch.empty() && m_shutdown)
+        break;
+    }
+
+    if (worker.m_batch.empty())
+      worker.m_wakeup.Wait();
+    else
+      ProcessBatch(worker);
+  }
+
+  PTRACE(4, "H323PLUGIN\tCodec engine worker " << index << " ended");
+}
+
+
+bool H323PluginCodecEngine::CompareCodec(const Channel * a, const Channel * b)
+{
+  return a->m_codec < b->m_codec;
+}
+
+
+void H323PluginCodecEngine::ProcessBatch(Worker & worker)
+{
+  std::vector<Channel *> & batch = worker.m_batch;
+
+  // Run the frames of each codec back to back
+  std::stable_sort(batch.begin(), batch.end(), CompareCodec);
+
+  size_t i = 0;
+  while (i < batch.size()) {
+    const PluginCodec_Definition * codec = batch[i]->m_codec;
+    size_t first = i;
+
+    PInt64 start = CodecEngineThreadTime();
+    for (; i < batch.size() && batch[i]->m_codec == codec; ++i) {
+      Channel & channel = *batch[i];
+      channel.m_result = (codec->codecFunction)(codec, channel.m_context,
+                                                channel.m_from, channel.m_fromLen,
+                                                channel.m_to, channel.m_toLen,
+                                                channel.m_flags);
+    }
+    PInt64 elapsed = CodecEngineThreadTime() - start;
+
+    for (size_t j = first; j < i; ++j)
+      batch[j]->m_done.Signal();
+
+    PWaitAndSignal m(m_mutex);
+    CodecStatistics & stats = m_statistics[codec];
+    stats.frames += i - first;
+    stats.batches++;
+    if (elapsed > 0)
+      stats.cpuTime += elapsed;
+  }
+
+  batch.clear();
+}
+
+#endif // H323_AUDIO_CODECS
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Plugin framed audio codec classes
@@ -1122,7 +1391,7 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
   PCLASSINFO(H323PluginFramedAudioCodec, H323FramedAudioCodec);
   public:
     H323PluginFramedAudioCodec(const OpalMediaFormat & fmtName, Direction direction, PluginCodec_Definition * _codec)
-      : H323FramedAudioCodec(fmtName, direction), codec(_codec)
+      : H323FramedAudioCodec(fmtName, direction), codec(_codec), codecEngine(NULL)
     {
       if (codec && codec->createCodec) {
          context = (*codec->createCodec)(codec);
@@ -1131,7 +1400,53 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
     }
 
     ~H323PluginFramedAudioCodec()
-    { if (codec != NULL && codec->destroyCodec != NULL) (*codec->destroyCodec)(codec, context); }
+    {
+      // other calls must stop encoding with the context before it is destroyed
+      if (fanOut != NULL)
+        fanOut->Unsubscribe(*this);
+      DetachEngine();
+      if (codec != NULL && codec->destroyCodec != NULL) (*codec->destroyCodec)(codec, context);
+    }
+
+    PBoolean Open(H323Connection & connection)
+    {
+      if (!H323FramedAudioCodec::Open(connection))
+        return FALSE;
+
+      PWaitAndSignal m(engineMutex);
+      if (codec != NULL && codecEngine == NULL) {
+        codecEngine = connection.GetEndPoint().GetCodecEngine();
+        if (codecEngine != NULL && !codecEngine->Attach(engineChannel, codec))
+          codecEngine = NULL;
+      }
+      return TRUE;
+    }
+
+    void Close()
+    {
+      DetachEngine();
+      H323FramedAudioCodec::Close();
+    }
+
+    int CallCodec(const void * from, unsigned * fromLen, void * to, unsigned * toLen, unsigned * flags)
+    {
+      {
+        // held across the frame so the engine is not detached while it runs
+        PWaitAndSignal m(engineMutex);
+        if (codecEngine != NULL && engineChannel.IsAttached())
+          return codecEngine->Execute(engineChannel, context, from, fromLen, to, toLen, flags);
+      }
+      return (codec->codecFunction)(codec, context, from, fromLen, to, toLen, flags);
+    }
+
+    void DetachEngine()
+    {
+      PWaitAndSignal m(engineMutex);
+      if (codecEngine != NULL) {
+        codecEngine->Detach(engineChannel);
+        codecEngine = NULL;
+      }
+    }
 
     PBoolean EncodeFrame(
       BYTE * buffer,        /// Buffer into which encoded bytes are placed
@@ -1144,10 +1459,9 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
       unsigned int fromLen = codec->parm.audio.samplesPerFrame*2;
       toLen                = codec->parm.audio.bytesPerFrame;
       unsigned flags = 0;
-      return (codec->codecFunction)(codec, context,
-                                 (const unsigned char *)sampleBuffer.GetPointer(), &fromLen,
-                                 buffer, &toLen,
-                                 &flags) != 0;
+      return CallCodec((const unsigned char *)sampleBuffer.GetPointer(), &fromLen,
+                       buffer, &toLen,
+                       &flags) != 0;
     };
 
     PBoolean DecodeFrame(
@@ -1160,10 +1474,9 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
       if (codec == NULL || direction != Decoder)
         return FALSE;
       unsigned flags = 0;
-      if ((codec->codecFunction)(codec, context,
-                                 buffer, &length,
-                                 (unsigned char *)sampleBuffer.GetPointer(), &bytesDecoded,
-                                 &flags) == 0)
+      if (CallCodec(buffer, &length,
+                    (unsigned char *)sampleBuffer.GetPointer(), &bytesDecoded,
+                    &flags) == 0)
         return FALSE;
 
       written = length;
@@ -1176,13 +1489,12 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
     )
     {
       if ((codec->flags & PluginCodec_DecodeSilence) == 0)
-        memset(buffer, 0, length);
+        H323FramedAudioCodec::DecodeSilenceFrame(buffer, length);
       else {
         unsigned flags = PluginCodec_CoderSilenceFrame;
-        (codec->codecFunction)(codec, context,
-                                 NULL, NULL,
-                                 buffer, &length,
-                                 &flags);
+        CallCodec(NULL, NULL,
+                  buffer, &length,
+                  &flags);
       }
     }
 
@@ -1192,6 +1504,9 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
   protected:
     void * context;
     PluginCodec_Definition * codec;
+    H323PluginCodecEngine * codecEngine;
+    H323PluginCodecEngine::Channel engineChannel;
+    PMutex engineMutex;       // Not rawChannelMutex, a fan out encodes with this codec from other calls
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1285,15 +1600,24 @@ public:
     H323PluginFrameBuffer()
         : codec(NULL), m_noError(true), m_flowControl(false) {};
 
+    ~H323PluginFrameBuffer() {
+        Stop();
+    }
+
     void SetCodec(H323Codec * _codec) {
         codec = _codec;
         Start();
     }
 
-    virtual void FrameOut(PBYTEArray & frame, PInt64 receiveTime, unsigned clock , PBoolean fup, PBoolean flow)  {
+    // The pooled packets are RTP frames so they go to the codec as they are
+    virtual PBYTEArray * CreatePacket() {
+        return new RTP_DataFrame(0);
+    }
+
+    virtual void FrameOut(PBYTEArray & frame, PINDEX length, PInt64 receiveTime, unsigned clock , PBoolean fup, PBoolean flow)  {
         m_flowControl = flow;
-        frameData.SetPayloadSize(frame.GetSize()-12);
-        memmove(frameData.GetPointer(), frame.GetPointer(), frame.GetSize());
+        RTP_DataFrame & frameData = (RTP_DataFrame &)frame;
+        frameData.SetPayloadSize(length-12);
         unsigned written = 0;
         H323Codec::H323_RTPInformation  rtpInformation;
           rtpInformation.m_recvTime = receiveTime;
@@ -1302,7 +1626,6 @@ public:
           codec->CalculateRTPSendTime(rtpInformation.m_timeStamp, rtpInformation.m_clockRate, rtpInformation.m_sendTime);
           rtpInformation.m_frame = &frameData;
         m_noError = codec->WriteInternal(frameData.GetPointer(), frameData.GetSize(), frameData, written, rtpInformation);
-        //frameData.SetPayloadSize(0);
     }
 
     virtual PBoolean FrameIn(unsigned seq, unsigned time, PBoolean marker, unsigned payload, const PBYTEArray & frame) {
@@ -1318,8 +1641,6 @@ public:
     }
 
 protected:
-    RTP_DataFrame frameData;
-
     H323Codec * codec;
     PBoolean m_noError;
     PBoolean m_flowControl;
@@ -1625,8 +1946,7 @@ H323PluginVideoCodec::~H323PluginVideoCodec()
     //PWaitAndSignal mutex(videoHandlerActive);
 
 #ifdef H323_FRAMEBUFFER
-    m_frameBuffer.Terminate();
-    m_frameBuffer.WaitForTermination();
+    m_frameBuffer.Stop();
 #endif
     // Set the buffer memory to zero to prevent
     // memory leak
@@ -2697,6 +3017,7 @@ void H323PluginCodecManager::OnShutdown()
 {
   // unregister the plugin media formats
   OpalMediaFormatFactory::UnregisterAll();
+  OpalMediaFormat::RegistryChanged();
 
   // Unregister the codec factory
   OpalPluginCodecFactory::UnregisterAll();
@@ -4042,6 +4363,7 @@ void H323PluginCodecManager::Reboot()
 {
       // unregister the plugin media formats
       OpalMediaFormatFactory::UnregisterAll();
+      OpalMediaFormat::RegistryChanged();
 
       // Unregister the codec factory
       OpalPluginCodecFactory::UnregisterAll();
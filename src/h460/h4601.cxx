@@ -936,6 +936,43 @@ PBoolean H460_Feature::FeatureList(int type, H460FeatureList & plist, H323EndPoi
    return (!plist.empty());
 }
 
+PBoolean H460_Feature::FeaturePrototypes(H460_FeaturePrototypes & plist, PPluginManager * pluginMgr)
+{
+  if (pluginMgr == NULL)
+    pluginMgr = &PPluginManager::GetPluginManager();
+
+   // Resolve in the same order FeatureList() would load them.
+   std::map<PString, H460_FeaturePrototype, featOrder<PString> > ordered;
+
+   PStringList featurelist = H460_Feature::GetFeatureNames(pluginMgr);
+   for (PINDEX i = 0; i<featurelist.GetSize(); i++) {
+     PDevicePluginServiceDescriptor * desc =
+            (PDevicePluginServiceDescriptor *)pluginMgr->GetServiceDescriptor(featurelist[i], H460FeaturePluginBaseClass);
+     if (desc == NULL)
+         continue;
+
+     H460_FeaturePrototype proto;
+     proto.name = featurelist[i];
+     proto.desc = desc;
+
+     PString feat = featurelist[i].Left(3);
+     if (feat == "Std")
+         proto.id = H460_FeatureID(featurelist[i].Mid(3).AsInteger());
+     else if (feat == "OID")
+         proto.id = H460_FeatureID(OpalOID(desc->GetDeviceNames(1)[0]));
+     else
+         proto.id = H460_FeatureID(feat);
+
+     ordered.insert(pair<PString,H460_FeaturePrototype>(featurelist[i], proto));
+   }
+
+   plist.clear();
+   for (std::map<PString, H460_FeaturePrototype, featOrder<PString> >::const_iterator it = ordered.begin(); it != ordered.end(); ++it)
+       plist.push_back(it->second);
+
+   return (!plist.empty());
+}
+
 /////////////////////////////////////////////////////////////////////
 
 H460_FeatureStd::H460_FeatureStd(unsigned Identifier)
@@ -1149,7 +1186,7 @@ PBoolean H460_FeatureSet::ProcessFirstPDU(const H225_FeatureSet & fs)
 {
     PTRACE(6, "H460\tCreate Common FeatureSet");
 
-    H460_FeatureSet remote = H460_FeatureSet(fs);
+    H460_FeatureSet remote(fs);
 
     /// Remove the features the remote does not support.
     for (PINDEX i = Features.GetSize()-1;  i > -1;  i--) {
@@ -1212,6 +1249,42 @@ PBoolean H460_FeatureSet::LoadFeatureSet(int inst, H323Connection * con)
   if ((ep) && (ep->FeatureSetDisabled()))
      return FALSE;
 
+  if (!baseSet) {
+      // Endpoint FeatureSet: resolve the plugins once for all derived FeatureSets.
+      BuildPrototypes();
+  } else if (baseSet->GetPrototypes().size() > 0) {
+      const H460_FeaturePrototypes & protos = baseSet->GetPrototypes();
+      for (H460_FeaturePrototypes::const_iterator it = protos.begin(); it != protos.end(); ++it) {
+          if (ep && !ep->OnFeatureInstance(inst,it->name))
+              continue;
+
+          if (!it->desc->ValidateDeviceName(it->name, inst))
+              continue;
+
+          H460_Feature * feat = NULL;
+          H460_Feature * tempfeat = baseSet->GetFeature(it->id);
+          if (tempfeat) {
+              if (tempfeat->GetFeaturePurpose() == H460_Feature::FeatureBaseAll)
+                  feat = tempfeat;
+              else
+                  feat = (H460_Feature*)(tempfeat->Clone());
+          } else {
+              feat = (H460_Feature *)it->desc->CreateInstance(inst);
+              if ((feat) && (ep))
+                  feat->AttachEndPoint(ep);
+          }
+
+          if (feat) {
+              if (con)
+                  feat->AttachConnection(con);
+
+              AddFeature(feat);
+              PTRACE(4, "H460\tLoaded Feature " << it->name);
+          }
+      }
+      return TRUE;
+  }
+
   H460FeatureList featurelist;
   H460_Feature::FeatureList(inst,featurelist,ep);
 
@@ -1245,6 +1318,23 @@ PBoolean H460_FeatureSet::LoadFeatureSet(int inst, H323Connection * con)
   return TRUE;
 }
 
+void H460_FeatureSet::BuildPrototypes()
+{
+  if (m_prototypes.size() > 0)
+      return;
+
+  H460_Feature::FeaturePrototypes(m_prototypes);
+  PTRACE(4, "H460\tResolved " << m_prototypes.size() << " Feature prototypes");
+}
+
+const H460_FeaturePrototypes & H460_FeatureSet::GetPrototypes() const
+{
+  if (baseSet)
+      return baseSet->GetPrototypes();
+
+  return m_prototypes;
+}
+
 PBoolean H460_FeatureSet::LoadFeature(const PString & featid)
 {
     H460_Feature * newfeat = H460_Feature::CreateFeature(featid);
@@ -1265,6 +1355,7 @@ PBoolean H460_FeatureSet::AddFeature(H460_Feature * Nfeat)
 {
     PTRACE(4, "H460\tLoaded " << Nfeat->GetFeatureIDAsString());
 
+    InvalidateDispatch();
     return Features.SetAt(Nfeat->GetFeatureID(), Nfeat);
 
 }
@@ -1288,6 +1379,7 @@ void H460_FeatureSet::RemoveFeature(H460_FeatureID id)
     }
     PTRACE(4, info);
 
+    InvalidateDispatch();
     Features.RemoveAt(id);
 }
 
@@ -1310,11 +1402,12 @@ PBoolean H460_FeatureSet::CreateFeatureSetPDU(H225_FeatureSet & fs, unsigned Mes
 
     PBoolean buildPDU = FALSE;
 
-    for (PINDEX i = 0; i < Features.GetSize(); i++) {    // Iterate thru the features
-       H460_Feature & feat = Features.GetDataAt(i);
+    H460_FeatureDispatch dispatch = GetDispatchList(MessageID, advertise);
+    for (H460_FeatureDispatch::iterator i = dispatch.begin(); i != dispatch.end(); ++i) {    // Iterate thru the features
+       H460_Feature & feat = **i;
 
         PTRACE(6, "H460\tExamining " << feat.GetFeatureIDAsString());
-        if (advertise != feat.FeatureAdvertised(MessageID)) {
+        if (feat.FeatureAdvertisedDynamic() && (advertise != feat.FeatureAdvertised(MessageID))) {
             PTRACE(6, "H460\tIgnoring " << feat.GetFeatureIDAsString() << " not Advertised.");
             continue;
         }
@@ -1772,6 +1865,7 @@ void H460_FeatureSet::DisableAllFeatures(int msgtype)
            }
         }
 
+        InvalidateDispatch();
         while (!removelist.empty()) {
             Features.RemoveAt(removelist.front());
             removelist.pop_front();
@@ -1802,13 +1896,7 @@ void H460_FeatureSet::AttachBaseFeatureSet(H460_FeatureSet * _baseSet)
 
 PBoolean H460_FeatureSet::HasFeature(const H460_FeatureID & id)
 {
-    for (PINDEX i = 0; i < Features.GetSize(); i++) {
-       H460_Feature & feat = Features.GetDataAt(i);
-        if (feat.GetFeatureID() == id) {
-            return TRUE;
-        }
-    }
-    return FALSE;
+    return Features.Contains(id);
 }
 
 PBoolean H460_FeatureSet::SupportNonCallService(const H460_FeatureID & id) const
@@ -1830,4 +1918,30 @@ H460_Feature * H460_FeatureSet::GetFeature(const H460_FeatureID & id)
        return NULL;
 }
 
+H460_FeatureSet::H460_FeatureDispatch H460_FeatureSet::GetDispatchList(unsigned MessageID, PBoolean advertise)
+{
+    PWaitAndSignal m(m_dispatchMutex);
+
+    H460_FeatureDispatchMap & dispatchMap = advertise ? m_advertiseDispatch : m_genericDispatch;
+    H460_FeatureDispatchMap::const_iterator r = dispatchMap.find(MessageID);
+    if (r != dispatchMap.end())
+        return r->second;
+
+    // Features which never take part in this message are left out so they cost nothing per PDU.
+    H460_FeatureDispatch & list = dispatchMap[MessageID];
+    for (PINDEX i = 0; i < Features.GetSize(); i++) {
+        H460_Feature & feat = Features.GetDataAt(i);
+        if (feat.FeatureAdvertisedDynamic() || (advertise == feat.FeatureAdvertised(MessageID)))
+            list.push_back(&feat);
+    }
+    return list;
+}
+
+void H460_FeatureSet::InvalidateDispatch()
+{
+    PWaitAndSignal m(m_dispatchMutex);
+    m_advertiseDispatch.clear();
+    m_genericDispatch.clear();
+}
+
 #endif // H323_H460
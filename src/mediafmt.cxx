@@ -39,6 +39,9 @@
 
 #include <ptclib/cypher.h>
 
+#include <map>
+#include <list>
+
 #ifndef _Ios_Fmtflags
   #define _Ios_Fmtflags ios::fmtflags
 #endif
@@ -617,6 +620,162 @@ void OpalMediaOptionOctets::SetValue(const BYTE * data, PINDEX length)
 
 /////////////////////////////////////////////////////////////////////////////
 
+// Snapshot of the registered media formats indexed by factory key. A snapshot
+// is never changed once built, so lookups need neither the factory mutex nor
+// a scan of the keys. A change to the registrations retires the snapshot and
+// the next lookup builds another. Each lookup holds a reference to the
+// snapshot it uses, and whichever of RegistryChanged() and the lookups drops
+// the last reference to a retired snapshot frees it, so RegistryChanged()
+// never waits and may be called while holding a snapshot.
+
+class OpalMediaFormatIndex
+{
+  public:
+    typedef std::map<std::string, OpalMediaFormat *> ByName;
+
+    OpalMediaFormatIndex()
+      : references(1)
+    {
+#if PTLIB_VER < 2110
+      PWaitAndSignal m(OpalMediaFormatFactory::GetMutex());
+      OpalMediaFormatFactory::KeyMap_T & keyMap = OpalMediaFormatFactory::GetKeyMap();
+      OpalMediaFormatFactory::KeyMap_T::const_iterator r;
+      for (r = keyMap.begin(); r != keyMap.end(); ++r)
+        Add(r->first);
+#else
+      OpalMediaFormatFactory::KeyList_T keyList = OpalMediaFormatFactory::GetKeyList();
+      OpalMediaFormatFactory::KeyList_T::const_iterator r;
+      for (r = keyList.begin(); r != keyList.end(); ++r)
+        Add(*r);
+#endif
+    }
+
+    OpalMediaFormat * Find(const char * name) const
+    {
+      ByName::const_iterator r = byName.find(name);
+      return r != byName.end() ? r->second : NULL;
+    }
+
+    OpalMediaFormat * Search(const char * search) const
+    {
+      for (ByName::const_iterator r = byName.begin(); r != byName.end(); ++r) {
+        if (r->first.find(search) != std::string::npos)
+          return r->second;
+      }
+      return NULL;
+    }
+
+    unsigned references;    // Guarded by the registry mutex, one is the registry's while current
+
+  protected:
+    void Add(const std::string & key)
+    {
+      OpalMediaFormat * format = OpalMediaFormatFactory::CreateInstance(key);
+      if (format != NULL)
+        byName[key] = format;
+    }
+
+    ByName byName;
+};
+
+
+class OpalMediaFormatRegistry
+{
+  public:
+    OpalMediaFormatRegistry()
+      : current(NULL)
+    { }
+
+    OpalMediaFormatIndex * Acquire()
+    {
+      {
+        PWaitAndSignal m(mutex);
+        if (current != NULL) {
+          current->references++;
+          return current;
+        }
+      }
+
+      // build outside the lock, instantiating a format may look up others
+      OpalMediaFormatIndex * index = new OpalMediaFormatIndex;
+
+      OpalMediaFormatIndex * acquired;
+      {
+        PWaitAndSignal m(mutex);
+        if (current == NULL) {
+          current = index;
+          index = NULL;
+        }
+        current->references++;
+        acquired = current;
+      }
+
+      // another lookup built one first
+      delete index;
+      return acquired;
+    }
+
+    void Release(OpalMediaFormatIndex * index)
+    {
+      {
+        PWaitAndSignal m(mutex);
+        if (--index->references > 0)
+          return;
+      }
+
+      // retired and this was the last lookup using it
+      delete index;
+    }
+
+    void Changed()
+    {
+      OpalMediaFormatIndex * retired;
+      {
+        PWaitAndSignal m(mutex);
+        retired = current;
+        current = NULL;
+      }
+
+      // new lookups get a new snapshot, the ones already using this one free it
+      if (retired != NULL)
+        Release(retired);
+    }
+
+  protected:
+    PMutex mutex;
+    OpalMediaFormatIndex * current;
+};
+
+
+// Never destroyed, media formats are still being destroyed and calling
+// RegistryChanged() during static destruction
+static OpalMediaFormatRegistry & GetMediaFormatRegistry()
+{
+  static OpalMediaFormatRegistry * registry = new OpalMediaFormatRegistry;
+  return *registry;
+}
+
+
+// A reference to the current snapshot for the duration of one lookup
+class OpalMediaFormatSnapshot
+{
+  public:
+    OpalMediaFormatSnapshot()
+      : index(GetMediaFormatRegistry().Acquire())
+    { }
+
+    ~OpalMediaFormatSnapshot()
+    {
+      GetMediaFormatRegistry().Release(index);
+    }
+
+    const OpalMediaFormatIndex * operator->() const { return index; }
+
+  protected:
+    OpalMediaFormatIndex * index;
+};
+
+
 OpalMediaFormat::OpalMediaFormat()
 {
   rtpPayloadType = RTP_DataFrame::IllegalPayloadType;
@@ -643,34 +802,49 @@ OpalMediaFormat::OpalMediaFormat(const char * search, PBoolean exact)
   codecBaseTime = 0;
   defaultSessionID = NonRTPSessionID; 
 
-  // look for the media type in the factory. 
-  // Don't make a copy of the list - lock the list and use the raw data
-  if (exact) {
-    OpalMediaFormat * registeredFormat = OpalMediaFormatFactory::CreateInstance(search);
-    if (registeredFormat != NULL)
+  // look for the media type in the index of registered formats, only going
+  // to the factory for a format registered since the index was built
+  OpalMediaFormat * registeredFormat;
+  {
+    OpalMediaFormatSnapshot index;
+    registeredFormat = exact ? index->Find(search) : index->Search(search);
+    if (registeredFormat != NULL) {
       *this = *registeredFormat;
+      return;
+    }
   }
-  else {
+
+  {
+    if (exact)
+      registeredFormat = OpalMediaFormatFactory::CreateInstance(search);
+    else {
 #if PTLIB_VER < 2110
-    PWaitAndSignal m(OpalMediaFormatFactory::GetMutex());
-    OpalMediaFormatFactory::KeyMap_T & keyMap = OpalMediaFormatFactory::GetKeyMap();
-    OpalMediaFormatFactory::KeyMap_T::const_iterator r;
-    for (r = keyMap.begin(); r != keyMap.end(); ++r) {
-      if (r->first.find(search) != std::string::npos) {
-        *this = *OpalMediaFormatFactory::CreateInstance(r->first);
-        break;
+      PWaitAndSignal m(OpalMediaFormatFactory::GetMutex());
+      OpalMediaFormatFactory::KeyMap_T & keyMap = OpalMediaFormatFactory::GetKeyMap();
+      OpalMediaFormatFactory::KeyMap_T::const_iterator r;
+      for (r = keyMap.begin(); r != keyMap.end(); ++r) {
+        if (r->first.find(search) != std::string::npos) {
+          registeredFormat = OpalMediaFormatFactory::CreateInstance(r->first);
+          break;
+        }
       }
-    }
 #else
-    OpalMediaFormatFactory::KeyList_T keyList = OpalMediaFormatFactory::GetKeyList();
-    OpalMediaFormatFactory::KeyList_T::const_iterator r;
-    for (r = keyList.begin(); r != keyList.end(); ++r) {
-      if (r->find(search) != std::string::npos) {
-         *this = *OpalMediaFormatFactory::CreateInstance(*r);
-         break;
+      OpalMediaFormatFactory::KeyList_T keyList = OpalMediaFormatFactory::GetKeyList();
+      OpalMediaFormatFactory::KeyList_T::const_iterator r;
+      for (r = keyList.begin(); r != keyList.end(); ++r) {
+        if (r->find(search) != std::string::npos) {
+          registeredFormat = OpalMediaFormatFactory::CreateInstance(*r);
+          break;
+        }
       }
-    }
 #endif
+    }
+  }
+
+  if (registeredFormat != NULL) {
+    *this = *registeredFormat;
+    // the index is missing it, so the next lookup builds another
+    RegistryChanged();
   }
 }
 
@@ -699,48 +873,36 @@ OpalMediaFormat::OpalMediaFormat(const char * fullName,
   if (rtpPayloadType < RTP_DataFrame::DynamicBase || rtpPayloadType == RTP_DataFrame::IllegalPayloadType)
     return;
 
-  // find the next unused dynamic number, and find anything with the new 
-  // rtp payload type if it is explicitly required
-
-
-
+  // index the payload types in use by the other formats in one pass, and find
+  // anything with the new rtp payload type if it is explicitly required
   OpalMediaFormat * match = NULL;
-  RTP_DataFrame::PayloadTypes nextUnused = RTP_DataFrame::DynamicBase;
+  bool inUse[RTP_DataFrame::MaxPayloadType+1];
+  memset(inUse, 0, sizeof(inUse));
 #if PTLIB_VER < 2110
   PWaitAndSignal m(OpalMediaFormatFactory::GetMutex());
   OpalMediaFormatFactory::KeyMap_T & keyMap = OpalMediaFormatFactory::GetKeyMap();
   OpalMediaFormatFactory::KeyMap_T::iterator r;
-
-  do {
-    for (r = keyMap.begin(); r != keyMap.end(); ++r) {
-      if (r->first == fullName)
-        continue;
-      OpalMediaFormat & fmt = *OpalMediaFormatFactory::CreateInstance(r->first);
-      if (fmt.GetPayloadType() == nextUnused) {
-        nextUnused = (RTP_DataFrame::PayloadTypes)(nextUnused + 1);
-        break; // restart the search
-      }
-      if (fmt.GetPayloadType() == rtpPayloadType)
-        match = &fmt;
-    }
-  } while (r != keyMap.end());
+  for (r = keyMap.begin(); r != keyMap.end(); ++r) {
+    if (r->first == fullName)
+      continue;
+    OpalMediaFormat & fmt = *OpalMediaFormatFactory::CreateInstance(r->first);
 #else
   OpalMediaFormatFactory::KeyList_T keyList = OpalMediaFormatFactory::GetKeyList();
   OpalMediaFormatFactory::KeyList_T::iterator r;
-  do {
-    for (r = keyList.begin(); r != keyList.end(); ++r) {
-      if (*r == fullName)
-        continue;
-      OpalMediaFormat & fmt = *OpalMediaFormatFactory::CreateInstance(*r);
-      if (fmt.GetPayloadType() == nextUnused) {
-        nextUnused = (RTP_DataFrame::PayloadTypes)(nextUnused + 1);
-        break; // restart the search
-      }
-      if (fmt.GetPayloadType() == rtpPayloadType)
-        match = &fmt;
-    }
-  } while (r != keyList.end());
+  for (r = keyList.begin(); r != keyList.end(); ++r) {
+    if (*r == fullName)
+      continue;
+    OpalMediaFormat & fmt = *OpalMediaFormatFactory::CreateInstance(*r);
 #endif
+    if (fmt.GetPayloadType() <= RTP_DataFrame::MaxPayloadType)
+      inUse[fmt.GetPayloadType()] = true;
+    if (fmt.GetPayloadType() == rtpPayloadType)
+      match = &fmt;
+  }
+
+  RTP_DataFrame::PayloadTypes nextUnused = RTP_DataFrame::DynamicBase;
+  while (nextUnused < RTP_DataFrame::MaxPayloadType && inUse[nextUnused])
+    nextUnused = (RTP_DataFrame::PayloadTypes)(nextUnused + 1);
 
   // If we found a match to the payload type, then it needs to be deconflicted
   // If the new format is just requesting any dynamic payload number, then give it the next unused one
@@ -755,13 +917,20 @@ OpalMediaFormat::OpalMediaFormat(const char * fullName,
   }
 }
 
+
+void OpalMediaFormat::RegistryChanged()
+{
+  GetMediaFormatRegistry().Changed();
+}
+
+
 OpalMediaFormat & OpalMediaFormat::operator=(const OpalMediaFormat &format)
 {
   PWaitAndSignal m1(media_format_mutex);
   PWaitAndSignal m2(format.media_format_mutex);
   *static_cast<PCaselessString *>(this) = *static_cast<const PCaselessString *>(&format);
+  // share the option list, each setter makes its own copy before changing it
   options = format.options;
-  options.MakeUnique();
   rtpPayloadType = format.rtpPayloadType;
   defaultSessionID = format.defaultSessionID;
   needsJitter = format.NeedsJitterBuffer();
@@ -773,6 +942,14 @@ OpalMediaFormat & OpalMediaFormat::operator=(const OpalMediaFormat &format)
 }
 
 
+void OpalMediaFormat::RemoveAllOptions()
+{
+  PWaitAndSignal m(media_format_mutex);
+  // drop the reference rather than emptying a list that may be shared
+  options = PSortedList<OpalMediaOption>();
+}
+
+
 void OpalMediaFormat::GetRegisteredMediaFormats(OpalMediaFormat::List & list)
 {
   list.DisallowDeleteObjects();
@@ -803,6 +980,7 @@ bool OpalMediaFormat::Merge(const OpalMediaFormat & mediaFormat)
 {
   PWaitAndSignal m1(media_format_mutex);
   PWaitAndSignal m2(mediaFormat.media_format_mutex);
+  options.MakeUnique();
   for (PINDEX i = 0; i < options.GetSize(); i++) {
     OpalMediaOption * option = mediaFormat.FindOption(options[i].GetName());
     if (option != NULL && !options[i].Merge(*option))
@@ -1019,6 +1197,8 @@ bool OpalMediaFormat::AddOption(OpalMediaOption * option, PBoolean overwrite)
   if (PAssertNULL(option) == NULL)
     return false;
 
+  options.MakeUnique();
+
   PINDEX index = options.GetValuesIndex(*option);
   if (index != P_MAX_INDEX) {
     if (!overwrite) {
@@ -1029,7 +1209,6 @@ bool OpalMediaFormat::AddOption(OpalMediaOption * option, PBoolean overwrite)
     options.RemoveAt(index);
   }
 
-  options.MakeUnique();
   options.Append(option);
   return true;
 }
@@ -108,7 +108,8 @@ H323Codec * G7231_File_Capability::CreateCodec(H323Codec::Direction direction) c
 ///////////////////////////////////////////////////////////////
 
 G7231_File_Codec::G7231_File_Codec(Direction dir)
-  : H323AudioCodec(OPAL_G7231_6k3, dir)
+  : H323AudioCodec(OPAL_G7231_6k3, dir),
+    promptFrame(0), promptRepeat(0)
 {
   lastFrameLen = 4;
 }
@@ -122,6 +123,22 @@ int G7231_File_Codec::GetFrameLen(int val)
 
 PBoolean G7231_File_Codec::Read(BYTE * buffer, unsigned & length, RTP_DataFrame &)
 {
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  if (promptRepeat > 0) {
+    promptDelay.Delay(30);
+    PINDEX size;
+    const BYTE * frame = prompt.GetFrame(promptFrame, size);
+    memcpy(buffer, frame, size);
+    lastFrameLen = length = size;
+    if (++promptFrame >= prompt.GetCount()) {
+      promptFrame = 0;
+      if (--promptRepeat == 0)
+        prompt = OpalPromptFrames();
+    }
+    return TRUE;
+  }
+
   if (rawDataChannel == NULL)
     return FALSE;
 
@@ -132,6 +149,58 @@ PBoolean G7231_File_Codec::Read(BYTE * buffer, unsigned & length, RTP_DataFrame
 
   lastFrameLen = length = G7231_File_Codec::GetFrameLen(buffer[0]);
 
+  // a short read at the end of the file is not a whole frame
+  if (rawDataChannel->GetLastReadCount() < (PINDEX)length) {
+    PTRACE(3, "G7231WAV\tPartial frame at end of file");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+PBoolean G7231_File_Codec::AttachPrompt(const PFilePath & name, PINDEX repeat)
+{
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  prompt = OpalPromptFrames();
+  promptFrame = 0;
+  promptRepeat = 0;
+
+  if (name.IsEmpty())
+    return TRUE;
+
+  if (direction != Encoder || repeat <= 0)
+    return FALSE;
+
+  OpalPromptCache & cache = OpalPromptCache::GetInstance();
+  PBYTEArray data;
+  if (!cache.GetPrompt(name, data, TRUE))
+    return FALSE;
+
+  if (!cache.GetFrames(name, "G.723.1", data, prompt)) {
+    // the file holds frames of varying length, as written by Write()
+    const BYTE * raw = data;
+    OpalPromptFrames frames;
+    PINDEX position = 0;
+    while (position < data.GetSize()) {
+      PINDEX length = GetFrameLen(raw[position]);
+      if (position + length > data.GetSize())
+        break;
+      frames.Append(raw + position, length);
+      position += length;
+    }
+
+    if (frames.GetCount() == 0) {
+      PTRACE(2, "G7231WAV\tNo whole frames in " << name);
+      return FALSE;
+    }
+
+    cache.SetFrames(name, "G.723.1", data, frames);
+    prompt = frames;
+  }
+
+  promptRepeat = repeat;
   return TRUE;
 }
 
@@ -36,8 +36,10 @@
 
 #ifdef _MSC_VER
 #include "../include/codecs.h"
+#include "../include/h323caps.h"
 #else
 #include "codecs.h"
+#include "h323caps.h"
 #endif
 
 
@@ -79,6 +81,327 @@ OpalWAVFile::OpalWAVFile(const PFilePath & name,
 
 /////////////////////////////////////////////////////////////////////////////////
 
+OpalPromptFrames::OpalPromptFrames()
+  : size(0)
+{
+}
+
+
+const BYTE * OpalPromptFrames::GetFrame(PINDEX index, PINDEX & length) const
+{
+  PINDEX start = index > 0 ? ends[index-1] : 0;
+  length = ends[index] - start;
+  return (const BYTE *)data + start;
+}
+
+
+void OpalPromptFrames::Append(const BYTE * frame, PINDEX length)
+{
+  // copies made before this still see only their own frames
+  if (size + length > data.GetSize())
+    data.SetSize(PMAX(size + length, data.GetSize()*2));
+  if (length > 0)
+    memcpy(data.GetPointer() + size, frame, length);
+  size += length;
+  ends.push_back(size);
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+OpalPromptCache & OpalPromptCache::GetInstance()
+{
+  static OpalPromptCache cache;
+  return cache;
+}
+
+
+PBoolean OpalPromptCache::GetPrompt(const PFilePath & name, PBYTEArray & data, PBoolean raw, unsigned * sampleRate)
+{
+  PFileInfo info;
+  if (!PFile::GetInfo(name, info)) {
+    PTRACE(2, "Prompt\tCannot find " << name);
+    return FALSE;
+  }
+
+  PString key = raw ? name + "|raw" : (PString)name;
+
+  {
+    PWaitAndSignal m(mutex);
+    EntryMap::iterator r = entries.find(key);
+    if (r != entries.end() && r->second.modified == info.modified && r->second.size == (PInt64)info.size) {
+      data = r->second.data;
+      if (sampleRate != NULL)
+        *sampleRate = r->second.sampleRate;
+      return TRUE;
+    }
+  }
+
+  // read outside the lock so other prompts can be played meanwhile, two
+  // calls starting the same new prompt at once just both read it
+  unsigned rate;
+  if (!Load(name, raw, data, rate))
+    return FALSE;
+  if (sampleRate != NULL)
+    *sampleRate = rate;
+
+  PWaitAndSignal m(mutex);
+  Entry & entry = entries[key];
+  entry.data = data;
+  entry.modified = info.modified;
+  entry.size = info.size;
+  entry.sampleRate = rate;
+  PTRACE(4, "Prompt\tCached " << data.GetSize() << " bytes from " << name);
+  return TRUE;
+}
+
+
+#ifdef H323_AUDIO_CODECS
+
+// A codec of the media format's own, so the encoder state and partly filled
+// frame of the call sending the prompt are left alone
+static H323FramedAudioCodec * CreatePromptEncoder(const OpalMediaFormat & mediaFormat)
+{
+  H323Capability * capability = H323Capability::Create(mediaFormat);
+  if (capability == NULL)
+    capability = H323Capability::Create(mediaFormat + "{sw}");
+  if (capability == NULL)
+    return NULL;
+
+  H323Codec * codec = capability->CreateCodec(H323Codec::Encoder);
+  delete capability;
+
+  H323FramedAudioCodec * encoder = dynamic_cast<H323FramedAudioCodec *>(codec);
+  if (encoder == NULL)
+    delete codec;
+  return encoder;
+}
+
+
+PBoolean OpalPromptCache::GetEncodedPrompt(const PFilePath & name, const H323FramedAudioCodec & encoder, OpalPromptFrames & frames)
+{
+  PBYTEArray audio;
+  unsigned sampleRate = 0;
+  if (!GetPrompt(name, audio, FALSE, &sampleRate))
+    return FALSE;
+
+  const OpalMediaFormat & mediaFormat = encoder.GetMediaFormat();
+  if (sampleRate != mediaFormat.GetTimeUnits()*1000) {
+    PTRACE(2, "Prompt\tCannot play " << name << " at " << sampleRate << "Hz as " << mediaFormat);
+    return FALSE;
+  }
+
+  const unsigned count = encoder.samplesPerFrame;
+  PString format = mediaFormat + "/" + PString(PString::Unsigned, count);
+  if (GetFrames(name, format, audio, frames))
+    return TRUE;
+
+  H323FramedAudioCodec * codec = CreatePromptEncoder(mediaFormat);
+  if (codec == NULL || codec->samplesPerFrame != count) {
+    PTRACE(2, "Prompt\tCannot create an encoder for " << name << " as " << format);
+    delete codec;
+    return FALSE;
+  }
+
+  // Every frame is sent, there is no silence detection and the last frame
+  // is padded with silence before encoding.
+  const short * pcm = (const short *)(const BYTE *)audio;
+  PINDEX samples = audio.GetSize()/2;
+  OpalPromptFrames encoded;
+  PBYTEArray frame;
+  for (PINDEX i = 0; i < samples; i += count) {
+    short * buffer = codec->sampleBuffer.GetPointer(count);
+    PINDEX n = PMIN((PINDEX)count, samples - i);
+    memcpy(buffer, pcm + i, n*2);
+    if (n < (PINDEX)count)
+      memset(buffer + n, 0, (count - n)*2);
+
+    unsigned length = codec->bytesPerFrame;
+    if (!codec->EncodeFrame(frame.GetPointer(length), length)) {
+      PTRACE(2, "Prompt\tCannot encode " << name << " as " << format);
+      delete codec;
+      return FALSE;
+    }
+    encoded.Append(frame, length);
+  }
+  delete codec;
+
+  SetFrames(name, format, audio, encoded);
+  PTRACE(4, "Prompt\tEncoded " << encoded.GetCount() << " frames of " << name << " as " << format);
+  frames = encoded;
+  return TRUE;
+}
+
+#endif // H323_AUDIO_CODECS
+
+
+PBoolean OpalPromptCache::GetFrames(const PFilePath & name, const PString & format, const PBYTEArray & source, OpalPromptFrames & frames)
+{
+  PWaitAndSignal m(mutex);
+  FrameMap::iterator r = frameEntries.find(name + "|" + format);
+  // the entry holds its source, so the same data means the same file load
+  if (r == frameEntries.end() || (const BYTE *)r->second.source != (const BYTE *)source)
+    return FALSE;
+
+  frames = r->second.frames;
+  return TRUE;
+}
+
+
+void OpalPromptCache::SetFrames(const PFilePath & name, const PString & format, const PBYTEArray & source, const OpalPromptFrames & frames)
+{
+  PWaitAndSignal m(mutex);
+  FrameEntry & entry = frameEntries[name + "|" + format];
+  entry.source = source;
+  entry.frames = frames;
+}
+
+
+PBoolean OpalPromptCache::Load(const PFilePath & name, PBoolean raw, PBYTEArray & data, unsigned & sampleRate)
+{
+  PWAVFile * file;
+  if (raw)
+    file = new PWAVFile(name, PFile::ReadOnly);
+  else
+    file = new OpalWAVFile(name, PFile::ReadOnly);
+
+  if (!file->IsOpen()) {
+    PTRACE(2, "Prompt\tCannot open " << name);
+    delete file;
+    return FALSE;
+  }
+
+  // The audio is used as it is, so it must already be what the codecs take
+  if (!raw && (file->GetFormat() != PWAVFile::fmt_PCM || file->GetChannels() != 1 || file->GetSampleSize() != 16)) {
+    PTRACE(2, "Prompt\t" << name << " is not 16 bit mono PCM");
+    delete file;
+    return FALSE;
+  }
+  sampleRate = raw ? 0 : file->GetSampleRate();
+
+  PINDEX length = (PINDEX)file->GetDataLength();
+  PBYTEArray audio(length);
+  PINDEX count = 0;
+  while (count < length && file->Read(audio.GetPointer() + count, length - count) && file->GetLastReadCount() > 0)
+    count += file->GetLastReadCount();
+  delete file;
+
+  if (count == 0) {
+    PTRACE(2, "Prompt\tNo audio in " << name);
+    return FALSE;
+  }
+
+  audio.SetSize(count);
+  data = audio;
+  return TRUE;
+}
+
+
+void OpalPromptCache::Remove(const PFilePath & name)
+{
+  PWaitAndSignal m(mutex);
+  entries.erase(name);
+  entries.erase(name + "|raw");
+
+  PString prefix = name + "|";
+  FrameMap::iterator r = frameEntries.lower_bound(prefix);
+  while (r != frameEntries.end() && r->first.Find(prefix) == 0)
+    frameEntries.erase(r++);
+}
+
+
+void OpalPromptCache::RemoveAll()
+{
+  PWaitAndSignal m(mutex);
+  entries.clear();
+  frameEntries.clear();
+}
+
+
+PINDEX OpalPromptCache::GetMemoryUsed() const
+{
+  PWaitAndSignal m(mutex);
+  PINDEX total = 0;
+  for (EntryMap::const_iterator r = entries.begin(); r != entries.end(); ++r)
+    total += r->second.data.GetSize();
+  for (FrameMap::const_iterator f = frameEntries.begin(); f != frameEntries.end(); ++f)
+    total += f->second.frames.GetSize();
+  return total;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+OpalPromptChannel::OpalPromptChannel()
+  : position(0), repeat(0), open(FALSE)
+{
+}
+
+
+OpalPromptChannel::OpalPromptChannel(const PBYTEArray & _data, PINDEX _repeat)
+  : data(_data), position(0), repeat(_repeat), open(TRUE)
+{
+}
+
+
+PBoolean OpalPromptChannel::Open(const PFilePath & name, PBoolean raw, PINDEX _repeat)
+{
+  Close();
+
+  if (!OpalPromptCache::GetInstance().GetPrompt(name, data, raw))
+    return FALSE;
+
+  position = 0;
+  repeat = _repeat;
+  open = TRUE;
+  return TRUE;
+}
+
+
+PBoolean OpalPromptChannel::IsOpen() const
+{
+  return open;
+}
+
+
+PBoolean OpalPromptChannel::Read(void * buf, PINDEX len)
+{
+  lastReadCount = 0;
+  if (!open || len <= 0)
+    return FALSE;
+
+  BYTE * ptr = (BYTE *)buf;
+  PINDEX size = data.GetSize();
+  while (lastReadCount < len && repeat > 0 && size > 0) {
+    PINDEX count = PMIN(len - lastReadCount, size - position);
+    memcpy(ptr + lastReadCount, (const BYTE *)data + position, count);
+    lastReadCount += count;
+    position += count;
+    if (position >= size) {
+      position = 0;
+      repeat--;
+    }
+  }
+
+  return lastReadCount > 0;
+}
+
+
+PBoolean OpalPromptChannel::Write(const void *, PINDEX)
+{
+  lastWriteCount = 0;
+  return FALSE;
+}
+
+
+PBoolean OpalPromptChannel::Close()
+{
+  open = FALSE;
+  data = PBYTEArray();
+  position = 0;
+  return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 class PWAVFileConverterXLaw : public PWAVFileConverter
 {
   public:
@@ -90,6 +413,12 @@ class PWAVFileConverterXLaw : public PWAVFileConverter
     PBoolean Write            (PWAVFile & file, const void * buf, PINDEX len);
 
     virtual short DecodeSample(int sample) = 0;
+
+    virtual void DecodeSamples(const BYTE * xlaw, short * pcm, PINDEX count)
+    {
+      while (count-- > 0)
+        *pcm++ = DecodeSample(*xlaw++);
+    }
 };
 
 off_t PWAVFileConverterXLaw::GetPosition(const PWAVFile & file) const
@@ -123,10 +452,7 @@ PBoolean PWAVFileConverterXLaw::Read(PWAVFile & file, void * buf, PINDEX len)
     return FALSE;
 
   // convert to PCM
-  PINDEX i;
-  short * pcmPtr = (short *)buf;
-  for (i = 0; i < samples; i++)
-    *pcmPtr++ = DecodeSample(xlaw[i]);
+  DecodeSamples(xlaw, (short *)buf, samples);
 
   // fake the lastReadCount
   file.SetLastReadCount(len);
@@ -152,6 +478,9 @@ class PWAVFileConverterULaw : public PWAVFileConverterXLaw
 
     short DecodeSample(int sample)
     { return H323_muLawCodec::DecodeSample(sample);}
+
+    void DecodeSamples(const BYTE * xlaw, short * pcm, PINDEX count)
+    { H323_muLawCodec::DecodeSamples(xlaw, pcm, count); }
 };
 
 class PWAVFileConverterALaw : public PWAVFileConverterXLaw
@@ -162,6 +491,9 @@ class PWAVFileConverterALaw : public PWAVFileConverterXLaw
 
     short DecodeSample(int sample)
     { return H323_ALawCodec::DecodeSample(sample);}
+
+    void DecodeSamples(const BYTE * xlaw, short * pcm, PINDEX count)
+    { H323_ALawCodec::DecodeSamples(xlaw, pcm, count); }
 };
 
 PWAVFileConverterFactory::Worker<PWAVFileConverterULaw> uLawConverter(PWAVFile::fmt_uLaw, true);
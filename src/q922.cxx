@@ -64,7 +64,7 @@
  * FCS lookup table.
  * Code based on implementation in RFC1549
  */
-static WORD fcstable[256] = {
+static const WORD fcstable[256] = {
 	0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
 	0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
 	0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
@@ -99,6 +99,105 @@ static WORD fcstable[256] = {
 	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
 };
 
+/*
+ * Bit stuffing lookup tables, indexed by the number of consecutive ones
+ * sent or received before an octet, and the octet.
+ */
+struct Q922_Stuffed {
+  WORD bits;      // stuffed bits, the first to send being the MSB
+  BYTE count;     // number of stuffed bits, 8 to 10
+  BYTE ones;      // consecutive ones sent at the end
+};
+
+struct Q922_Unstuffed {
+  BYTE octet;     // decoded bits, LSB first
+  BYTE count;     // number of decoded bits
+  BYTE ones;      // consecutive ones received at the end
+  BYTE flagBits;  // if not zero, the bits read up to the sixth consecutive one
+};
+
+class Q922_StuffingTables
+{
+public:
+  Q922_StuffingTables();
+
+  Q922_Stuffed stuff[5][256];
+  Q922_Unstuffed unstuff[6][256];
+};
+
+static void StuffBits(BYTE octet, BYTE ones, Q922_Stuffed & result)
+{
+  result.bits = 0;
+  result.count = 0;
+
+  // data is sent out with LSB first. A zero bit is
+  // inserted after 5 consecutive ones
+  for(unsigned i = 0; i < 8; i++) {
+    BYTE bit = (BYTE)((octet >> i) & 0x01);
+
+    result.bits = (WORD)((result.bits << 1) | bit);
+    result.count++;
+
+    if(bit) {
+      ones++;
+      if(ones == 5) {
+        result.bits <<= 1;
+        result.count++;
+        ones = 0;
+      }
+    } else {
+      ones = 0;
+    }
+  }
+
+  result.ones = ones;
+}
+
+static void UnstuffBits(BYTE bits, BYTE count, BYTE ones, Q922_Unstuffed & result)
+{
+  result.octet = 0;
+  result.count = 0;
+  result.flagBits = 0;
+
+  // bits are received MSB first, decoded bits are stored LSB first.
+  // A zero bit after 5 consecutive ones is discarded, a sixth one
+  // indicates either FLAG or ERROR
+  for(BYTE i = 0; i < count; i++) {
+    BYTE bit = (BYTE)((bits >> (7 - i)) & 0x01);
+
+    if(bit) {
+      ones++;
+      if(ones == 6) {
+        result.flagBits = i + 1;
+        break;
+      }
+      result.octet |= (BYTE)(1 << result.count);
+      result.count++;
+    } else {
+      if(ones != 5) {
+        result.count++;
+      }
+      ones = 0;
+    }
+  }
+
+  result.ones = ones;
+}
+
+Q922_StuffingTables::Q922_StuffingTables()
+{
+  for(BYTE ones = 0; ones < 6; ones++) {
+    for(unsigned octet = 0; octet < 256; octet++) {
+      if(ones < 5) {
+        StuffBits((BYTE)octet, ones, stuff[ones][octet]);
+      }
+      UnstuffBits((BYTE)octet, 8, ones, unstuff[ones][octet]);
+    }
+  }
+}
+
+static const Q922_StuffingTables stuffingTables;
+
 Q922_Frame::Q922_Frame(PINDEX size)
 : PBYTEArray(Q922_HEADER_SIZE + size)
 {
@@ -125,64 +224,78 @@ PBoolean Q922_Frame::Decode(const BYTE *data, PINDEX size)
   if(size < 2+3+2+1)
     return FALSE;
 
-  PINDEX octetIndex = 0;
-  BYTE bitIndex = 7;
-  BYTE onesCounter = 0;
-
-  if(!FindFlagEnd(data, size, octetIndex, bitIndex))
+  PINDEX bitPosition = 0;
+  if(!FindFlagEnd(data, size, bitPosition))
 	return FALSE;
 
-  BYTE firstOctet = 0;
-  BYTE secondOctet = 0;
+  // collecting the octets up to the end flag, the last two being the FCS
+  BYTE octets[260+Q922_HEADER_SIZE+Q922_FCS_SIZE];
+  PINDEX octetCount = 0;
 
-  // read the two first octets
-  if(octetIndex >= size || DecodeByte(data, &firstOctet, octetIndex, bitIndex, onesCounter) != Q922_OK)
-    return FALSE;
+  const PINDEX endPosition = size*8;
+  DWORD bitBuffer = 0;
+  BYTE bitCount = 0;
+  BYTE onesCounter = 0;
 
-  if(octetIndex >= size || DecodeByte(data, &secondOctet, octetIndex, bitIndex, onesCounter) != Q922_OK)
-	return FALSE;
+  while(bitPosition < endPosition) {
 
-  PINDEX arrayIndex = 0;
-  while(octetIndex < size) {
+    PINDEX available = endPosition - bitPosition;
+    Q922_Unstuffed result;
+    if(available >= 8) {
+      result = stuffingTables.unstuff[onesCounter][GetOctet(data, size, bitPosition)];
+    } else {
+      UnstuffBits(GetOctet(data, size, bitPosition), (BYTE)available, onesCounter, result);
+    }
 
-    BYTE decodedByte = 0;
-    BYTE result = DecodeByte(data, &decodedByte, octetIndex, bitIndex, onesCounter);
+    bitBuffer |= (DWORD)result.octet << bitCount;
+    bitCount += result.count;
+    onesCounter = result.ones;
 
-	if(result == Q922_ERROR) {
-	  return FALSE;
+    if(bitCount >= 8) {
+      // Q922-frames must not exceed an information field size of 260 octets
+      if(octetCount >= 260+Q922_HEADER_SIZE+Q922_FCS_SIZE) {
+        return FALSE;
+      }
 
-	} else if(result == Q922_FLAG) {
+      octets[octetCount] = (BYTE)bitBuffer;
+      octetCount++;
+      bitBuffer >>= 8;
+      bitCount -= 8;
+    }
 
-      // Found end flag
-      // FCS is contained in firstOctet and secondOctet.
-      WORD fcs = (secondOctet << 8) | firstOctet;
+    if(result.flagBits == 0) {
+      bitPosition += available >= 8 ? 8 : available;
+      continue;
+    }
 
-      // Calculate FCS from data to check
-      WORD calculatedFCS = CalculateFCS((const BYTE *)theArray, arrayIndex);
+    // Six consecutive ones, either FLAG or ERROR. The FLAG must be byte aligned,
+    // its leading zero and five ones being left in the bit buffer, and must
+    // end with a zero.
+    bitPosition += result.flagBits;
+    if(bitPosition >= endPosition || ((data[bitPosition/8] >> (7 - bitPosition%8)) & 0x01) != 0 ||
+       bitCount != 6 || octetCount < Q922_FCS_SIZE) {
+      return FALSE;
+    }
 
-	  if(fcs != calculatedFCS) {
-	    PTRACE(3, "Q.922 frame has incorrect checksum");
-		return FALSE;
-      }
+    // Found end flag
+    PINDEX arrayIndex = octetCount - Q922_FCS_SIZE;
+    WORD fcs = (octets[arrayIndex+1] << 8) | octets[arrayIndex];
 
-      if(arrayIndex > Q922_HEADER_SIZE) {
-        SetInformationFieldSize(arrayIndex - Q922_HEADER_SIZE);
-        return TRUE;
-      }
+    // Calculate FCS from data to check
+    WORD calculatedFCS = CalculateFCS(octets, arrayIndex);
 
+	if(fcs != calculatedFCS) {
+	  PTRACE(3, "Q.922 frame has incorrect checksum");
 	  return FALSE;
-	}
-
-    theArray[arrayIndex] = firstOctet;
-    arrayIndex++;
+    }
 
-    firstOctet = secondOctet;
-    secondOctet = decodedByte;
+    if(arrayIndex > Q922_HEADER_SIZE) {
+      SetInformationFieldSize(arrayIndex - Q922_HEADER_SIZE);
+      memcpy(theArray, octets, arrayIndex);
+      return TRUE;
+    }
 
-	// Q922-frames must not exceed an information field size of 260 octets
-    if(arrayIndex >= 260+Q922_HEADER_SIZE) {
-      return FALSE;
-	}
+	return FALSE;
   }
 
   return FALSE;
@@ -237,22 +350,33 @@ PBoolean Q922_Frame::Encode(BYTE *buffer, PINDEX & size, BYTE & theBitIndex) con
   PINDEX dataSize = GetInformationFieldSize() + Q922_HEADER_SIZE;
   WORD fcs = CalculateFCS((const BYTE *)theArray, dataSize);
 
+  // The remaining bits are collected in a bit buffer, starting with
+  // those already written to the current octet
+  DWORD bitBuffer = bitIndex == 7 ? 0 : (buffer[octetIndex] >> (bitIndex + 1));
+  BYTE bitCount = 7 - bitIndex;
+
   // Encoding the data byte-by-byte
   PINDEX i;
   PINDEX count = Q922_HEADER_SIZE + informationFieldSize;
   for(i = 0; i < count; i++) {
-    EncodeOctet(theArray[i], buffer, octetIndex, bitIndex, onesCounter);
+    EncodeOctet(theArray[i], buffer, octetIndex, bitBuffer, bitCount, onesCounter);
   }
 
   // Encoding the FCS
-  EncodeOctet((BYTE)fcs, buffer, octetIndex, bitIndex, onesCounter);
-  EncodeOctet((BYTE)(fcs >> 8), buffer, octetIndex, bitIndex, onesCounter);
+  EncodeOctet((BYTE)fcs, buffer, octetIndex, bitBuffer, bitCount, onesCounter);
+  EncodeOctet((BYTE)(fcs >> 8), buffer, octetIndex, bitBuffer, bitCount, onesCounter);
 
   // Appending three FLAG sequences to the buffer
   // the buffer is not necessary byte aligned!
-  EncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
-  EncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
-  EncodeOctetNoEscape(Q922_FLAG, buffer, octetIndex, bitIndex);
+  EncodeBits(Q922_FLAG, 8, buffer, octetIndex, bitBuffer, bitCount);
+  EncodeBits(Q922_FLAG, 8, buffer, octetIndex, bitBuffer, bitCount);
+  EncodeBits(Q922_FLAG, 8, buffer, octetIndex, bitBuffer, bitCount);
+
+  // writing the incomplete last octet
+  if(bitCount > 0) {
+    buffer[octetIndex] = (BYTE)(bitBuffer << (8 - bitCount));
+  }
+  bitIndex = 7 - bitCount;
 
   // determining correct number of octets
   if(bitIndex == 7) {
@@ -268,202 +392,102 @@ PBoolean Q922_Frame::Encode(BYTE *buffer, PINDEX & size, BYTE & theBitIndex) con
 
 PBoolean Q922_Frame::FindFlagEnd(const BYTE *buffer,
 							 PINDEX bufferSize,
-							 PINDEX & octetIndex, BYTE & bitIndex)
+							 PINDEX & bitPosition) const
 {
-  BYTE positionsCorrect = 0;
-
-  while(octetIndex < bufferSize) {
-
-    BYTE bit = DecodeBit(buffer, octetIndex, bitIndex);
-
-    switch(positionsCorrect) {
-      case 0:
-		if(bit == 0) {
-		  positionsCorrect = 1;
-		}
-		break;
-      case 1:
-      case 2:
-      case 3:
-      case 4:
-      case 5:
-      case 6:
-        if(bit == 1) {
-          positionsCorrect++;
-		} else {
-          positionsCorrect = 1;
-        }
-        break;
-      case 7:
-        if(bit == 0) {
-          positionsCorrect = 0xff;
-        } else {
-          // got 0x7f, ABORT sequence
-          return FALSE;
-        }
-        break;
-      default:
-        return FALSE;
+  const PINDEX endPosition = bufferSize*8;
+
+  // The first FLAG sequence may start at any bit. A zero followed by
+  // seven ones before is the ABORT sequence
+  for(;;) {
+    if(bitPosition + 8 > endPosition) {
+      return FALSE;
     }
 
-    if(positionsCorrect == 0xff) {
+    BYTE octet = GetOctet(buffer, bufferSize, bitPosition);
+    if((octet & 0xfe) == Q922_FLAG) {
+      if(octet == Q922_ERROR) {
+        return FALSE;
+      }
+      bitPosition += 8;
       break;
     }
-  }
 
-  if(positionsCorrect != 0xff) {
-    return FALSE;
+    // skip past the leading ones, which cannot start a FLAG sequence
+    if(octet == 0xff) {
+      bitPosition += 8;
+    } else {
+      bitPosition++;
+    }
   }
 
   // First FLAG sequence found, bit index determined.
   // now check for additinal FLAG sequences
-  BYTE octet = Q922_FLAG;
-
-  while(octet == Q922_FLAG && octetIndex < bufferSize) {
-
-    PINDEX startOctetIndex = octetIndex;
-    BYTE startBitIndex = bitIndex;
-
-    BYTE positionsCorrect = 0;
-
-    unsigned i;
-    for(i = 0; i < 8; i++) {
-
-      BYTE bit = DecodeBit(buffer, octetIndex, bitIndex);
-
-      switch(positionsCorrect) {
-	    case 0:
-          if(bit == 1) {
-            positionsCorrect = 0xf0;
-          } else {
-            positionsCorrect++;
-		  }
-          break;
-        case 1:
-        case 2:
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-          if(bit == 0) {
-		    positionsCorrect = 0xf0;
-          } else {
-            positionsCorrect++;
-          }
-          break;
-		case 7:
-		  if(bit == 1) {
-			// 0x7f read
-		    return FALSE;
-		  }
-		  break;
-        default:
-          return FALSE;
-      }
+  while(bitPosition + 8 <= endPosition) {
 
-      if(positionsCorrect == 0xf0) {
-        octetIndex = startOctetIndex;
-        bitIndex = startBitIndex;
-        return TRUE;
-      }
+    BYTE octet = GetOctet(buffer, bufferSize, bitPosition);
+    if(octet == Q922_ERROR) {
+      // 0x7f read
+      return FALSE;
     }
-  }
-
-  return FALSE;
-}
-
-BYTE Q922_Frame::DecodeByte(const BYTE *buffer,
-							BYTE *destination,
-							PINDEX & octetIndex,
-							BYTE & bitIndex,
-							BYTE & onesCounter)
-{
-  // decoded byte is copied to destination.
-  // returns Q922_OK if decoding succesful,
-  // returns Q922_FLAG if ending FLAG detected,
-  // returns Q922_ERROR if there was an error
-
-  BYTE decodedByte = 0x00;
-
-  PINDEX i;
-  for(i = 0; i < 8; i++) {
 
-	BYTE bit = DecodeBit(buffer, octetIndex, bitIndex);
-
-	if(bit) {
-      onesCounter++;
-
-      if(onesCounter == 6) {
-
-        // Either FLAG or ERROR
-        bit = DecodeBit(buffer, octetIndex, bitIndex);
-
-		if(i == 6 && !bit)  { // FLAG is byte aligned AND has only 6 consecutive ones
-          return Q922_FLAG;
-        } else {
-          return Q922_ERROR;
-        }
-      }
-
-    } else {
-	  if(onesCounter == 5) {
-	    // discard bit, read again
-		bit = DecodeBit(buffer, octetIndex, bitIndex);
-	  }
-
-      onesCounter = 0;
+    if(octet != Q922_FLAG) {
+      return TRUE;
     }
 
-    decodedByte |= (bit << i);
+    bitPosition += 8;
   }
 
-  *destination = decodedByte;
-  return Q922_OK;
+  return FALSE;
 }
 
-BYTE Q922_Frame::DecodeBit(const BYTE *buffer,
-						   PINDEX & octetIndex,
-						   BYTE & bitIndex)
+BYTE Q922_Frame::GetOctet(const BYTE *buffer, PINDEX bufferSize, PINDEX bitPosition)
 {
-  BYTE bit = (buffer[octetIndex] >> bitIndex) & 0x01;
+  // returns the eight bits at bitPosition in transmission order, MSB first.
+  // Past the end of the buffer, the missing bits are zero
+  PINDEX octetIndex = bitPosition/8;
+  BYTE shift = (BYTE)(bitPosition%8);
 
-  if(bitIndex == 0) {
-    octetIndex++;
-    bitIndex = 8;
+  if(shift == 0) {
+    return buffer[octetIndex];
+  }
+
+  if(octetIndex+1 >= bufferSize) {
+    return (BYTE)(buffer[octetIndex] << shift);
   }
-  bitIndex--;
 
-  return bit;
+  return (BYTE)((buffer[octetIndex] << shift) | (buffer[octetIndex+1] >> (8 - shift)));
 }
 
 void Q922_Frame::EncodeOctet(BYTE octet, BYTE *buffer,
 							 PINDEX & octetIndex,
-							 BYTE & bitIndex,
+							 DWORD & bitBuffer,
+							 BYTE & bitCount,
 							 BYTE & onesCounter) const
 {
-  // data is sent out with LSB first, so we need
-  // to reverse the bit direction.
-  // In addition, it is required to insert a zero
-  // bit after 5 consecutive ones to avoid FLAG emulation
-
-  PINDEX i;
-  for(i = 0; i < 8; i++) {
-    // reading one bit from the octet and write it to the buffer
-    BYTE bit = (BYTE)((octet >> i) & 0x01);
-
-    EncodeBit(bit, buffer, octetIndex, bitIndex);
+  // the table holds the octet LSB first, with a zero bit
+  // inserted after 5 consecutive ones to avoid FLAG emulation
+  const Q922_Stuffed & stuffed = stuffingTables.stuff[onesCounter][octet];
 
-    if(bit) {
-      onesCounter++;
+  EncodeBits(stuffed.bits, stuffed.count, buffer, octetIndex, bitBuffer, bitCount);
+  onesCounter = stuffed.ones;
+}
 
-      if(onesCounter == 5) {
-        // insert a zero bit
-        EncodeBit(0, buffer, octetIndex, bitIndex);
-        onesCounter = 0;
-      }
-    } else {
-      onesCounter = 0;
-    }
+void Q922_Frame::EncodeBits(WORD bits,
+							BYTE count,
+							BYTE *buffer,
+							PINDEX & octetIndex,
+							DWORD & bitBuffer,
+							BYTE & bitCount) const
+{
+  // appends count bits, the first bit to send being the MSB,
+  // and writes out the complete octets
+  bitBuffer = (bitBuffer << count) | bits;
+  bitCount += count;
+
+  while(bitCount >= 8) {
+    bitCount -= 8;
+    buffer[octetIndex] = (BYTE)(bitBuffer >> bitCount);
+    octetIndex++;
   }
 }
 
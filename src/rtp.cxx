@@ -515,7 +515,7 @@ RTP_Session::RTP_Session(
                          PHandleAggregator * _aggregator,
 #endif
                          unsigned id, RTP_UserData * data)
-  : sessionID(id), canonicalName(PProcess::Current().GetUserName()), toolName(PProcess::Current().GetName()), referenceCount(1), userData(data),
+  : sessionID(id), canonicalName(PProcess::Current().GetUserName()), toolName(PProcess::Current().GetName()), referenceCount(1), userData(data), packetTap(NULL),
 #ifdef H323_AUDIO_CODECS
     jitter(NULL),
 #endif
@@ -560,6 +560,8 @@ RTP_Session::~RTP_Session()
             "    maximumJitter     = " << (maximumJitterLevel >> 7)
             );
 
+  SetPacketTap(NULL);
+
   if (userData) {
     //userData->OnFinalStatistics(*this);  TODO fix sending end of call stats
     delete userData;
@@ -617,6 +619,48 @@ void RTP_Session::SetUserData(RTP_UserData * data)
 }
 
 
+// Guards the links between sessions and taps, taken before a session's
+// packetTapMutex so a tap can detach from a session being destroyed.
+static PMutex & PacketTapLinkMutex()
+{
+  static PMutex mutex;
+  return mutex;
+}
+
+
+void RTP_Session::SetPacketTap(RTP_PacketTap * tap)
+{
+  PWaitAndSignal link(PacketTapLinkMutex());
+
+  if (tap != NULL && tap->tapSession != NULL && tap->tapSession != this) {
+    PWaitAndSignal m(tap->tapSession->packetTapMutex);
+    tap->tapSession->packetTap = NULL;
+  }
+
+  PWaitAndSignal m(packetTapMutex);
+
+  if (packetTap != NULL)
+    packetTap->tapSession = NULL;
+
+  packetTap = tap;
+  if (tap != NULL)
+    tap->tapSession = this;
+}
+
+
+void RTP_PacketTap::Detach()
+{
+  PWaitAndSignal link(PacketTapLinkMutex());
+
+  if (tapSession == NULL)
+    return;
+
+  PWaitAndSignal m(tapSession->packetTapMutex);
+  tapSession->packetTap = NULL;
+  tapSession = NULL;
+}
+
+
 void RTP_Session::SetJitterBufferSize(unsigned minJitterDelay,
                                       unsigned maxJitterDelay,
                                       PINDEX stackSize)
@@ -740,6 +784,12 @@ RTP_Session::SendReceiveStatus RTP_Session::OnSendData(RTP_DataFrame & frame)
   frame.SetSequenceNumber(++lastSentSequenceNumber);
   frame.SetSyncSource(syncSourceOut);
 
+  if (packetTap != NULL) {
+    PWaitAndSignal m(packetTapMutex);
+    if (packetTap != NULL)
+      packetTap->OnTapPacket(*this, frame, TRUE);
+  }
+
   if (packetsSent != 0 && !frame.GetMarker()) {
     // Only do statistics on subsequent packets
     DWORD diff = tick - lastSentPacketTime;
@@ -803,6 +853,12 @@ RTP_Session::SendReceiveStatus RTP_Session::OnReceiveData(const RTP_DataFrame &
   if (frame.GetPayloadType() > RTP_DataFrame::MaxPayloadType)
     return e_IgnorePacket; // Non fatal error, just ignore
 
+  if (packetTap != NULL) {
+    PWaitAndSignal m(packetTapMutex);
+    if (packetTap != NULL)
+      packetTap->OnTapPacket(*this, frame, FALSE);
+  }
+
   PInt64 tick = PTimer::Tick().GetMilliSeconds();  // Get timestamp now
 
   // Have not got SSRC yet, so grab it now
@@ -34,6 +34,12 @@
 
 #include "rtp2wav.h"
 
+#ifdef H323_AUDIO_CODECS
+#include "codecs.h"
+#endif
+
+#include <list>
+
 
 #define new PNEW
 
@@ -142,4 +148,536 @@ void OpalRtpToWavFile::ReceivedPacket(RTP_DataFrame & frame,  H323_INT)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+// pcap-ng block types and the raw IPv4 link type
+static const DWORD BlockSectionHeader  = 0x0A0D0D0A;
+static const DWORD BlockInterface      = 0x00000001;
+static const DWORD BlockEnhancedPacket = 0x00000006;
+static const DWORD ByteOrderMagic      = 0x1A2B3C4D;
+static const WORD  LinkTypeRawIPv4     = 101;
+
+static const PINDEX IPHeaderSize = 20 + 8;     // IPv4 and UDP headers
+static const PINDEX FlushSize = 65536;         // Write out when this much is pending
+static const unsigned DrainInterval = 20;      // Milliseconds between emptying queues
+static const unsigned FlushInterval = 1000;    // Write out at least this often
+
+static inline PINDEX PadTo4(PINDEX size)
+{
+  return (size + 3) & ~3;
+}
+
+
+/**The one thread emptying the queues of all open recorders.
+  */
+class OpalRtpRecorderWriter : public PObject
+{
+    PCLASSINFO(OpalRtpRecorderWriter, PObject);
+  public:
+    OpalRtpRecorderWriter() : thread(NULL) { }
+
+    static OpalRtpRecorderWriter & Instance()
+    {
+      static OpalRtpRecorderWriter writer;
+      return writer;
+    }
+
+    void Add(OpalRtpRecorder * recorder)
+    {
+      PWaitAndSignal m(mutex);
+      recorders.push_back(recorder);
+      if (thread == NULL)
+        thread = PThread::Create(PCREATE_NOTIFIER(WriterMain), 0,
+                                 PThread::AutoDeleteThread,
+                                 PThread::LowPriority,
+                                 "RTP Recorder");
+    }
+
+    // Once this returns the recorder is no longer being drained
+    void Remove(OpalRtpRecorder * recorder)
+    {
+      PWaitAndSignal m(mutex);
+      recorders.remove(recorder);
+    }
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, OpalRtpRecorderWriter, WriterMain);
+
+    PMutex                        mutex;
+    std::list<OpalRtpRecorder *>  recorders;
+    PThread                     * thread;
+};
+
+
+void OpalRtpRecorderWriter::WriterMain(PThread &, H323_INT)
+{
+  PTRACE(4, "rtp2wav\tRecorder writer started");
+
+  for (;;) {
+    PThread::Sleep(DrainInterval);
+
+    PWaitAndSignal m(mutex);
+    if (recorders.empty()) {
+      thread = NULL;
+      break;
+    }
+
+    for (std::list<OpalRtpRecorder *>::iterator i = recorders.begin(); i != recorders.end(); ++i)
+      (*i)->Drain(FALSE);
+  }
+
+  PTRACE(4, "rtp2wav\tRecorder writer finished");
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalRtpRecorder::Queue::Queue()
+  : interfaceId(0), port(0), transmit(FALSE),
+    m_slots(0), m_data(NULL), m_lengths(NULL), m_originals(NULL), m_times(NULL)
+{
+}
+
+
+OpalRtpRecorder::Queue::~Queue()
+{
+  delete [] m_data;
+  delete [] m_lengths;
+  delete [] m_originals;
+  delete [] m_times;
+}
+
+
+void OpalRtpRecorder::Queue::SetSize(unsigned slots)
+{
+  m_slots = 1;
+  while (m_slots < slots)
+    m_slots <<= 1;
+
+  m_data = new BYTE[m_slots*MaxPacketSize];
+  m_lengths = new PINDEX[m_slots];
+  m_originals = new PINDEX[m_slots];
+  m_times = new PInt64[m_slots];
+}
+
+
+void OpalRtpRecorder::Queue::Push(const RTP_DataFrame & frame)
+{
+  unsigned written = (unsigned)(long)m_written;
+  if (written - (unsigned)(long)m_read >= m_slots) {
+    ++m_dropped;
+    return;
+  }
+
+  unsigned index = written & (m_slots - 1);
+  PINDEX original = frame.GetHeaderSize() + frame.GetPayloadSize();
+  PINDEX length = original < MaxPacketSize ? original : (PINDEX)MaxPacketSize;
+
+  memcpy(m_data + index*MaxPacketSize, (const BYTE *)frame, length);
+  m_lengths[index] = length;
+  m_originals[index] = original;
+  PTime now;
+  m_times[index] = (PInt64)now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+
+  ++m_written;
+}
+
+
+PBoolean OpalRtpRecorder::Queue::Pop(PInt64 & time, const BYTE * & data, PINDEX & length, PINDEX & original)
+{
+  unsigned read = (unsigned)(long)m_read;
+  if (read == (unsigned)(long)m_written)
+    return FALSE;
+
+  unsigned index = read & (m_slots - 1);
+  time = m_times[index];
+  data = m_data + index*MaxPacketSize;
+  length = m_lengths[index];
+  original = m_originals[index];
+  return TRUE;
+}
+
+
+void OpalRtpRecorder::Queue::Release()
+{
+  ++m_read;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalRtpRecorder::Tap::Tap(unsigned sessionID, unsigned slots, unsigned firstInterface)
+{
+  for (PINDEX i = 0; i < 2; i++) {
+    queues[i].SetSize(slots);
+    queues[i].interfaceId = firstInterface + i;
+    queues[i].port = 5000 + 2*sessionID;
+    queues[i].transmit = i > 0;
+  }
+}
+
+
+void OpalRtpRecorder::Tap::OnTapPacket(const RTP_Session &, const RTP_DataFrame & frame, PBoolean transmit)
+{
+  // called under the session's tap mutex, so Detach() waits for this
+  queues[transmit ? 1 : 0].Push(frame);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+OpalRtpRecorder::OpalRtpRecorder(unsigned queueSlots)
+  : slots(queueSlots > 0 ? queueSlots : (unsigned)DefaultSlots),
+    pendingSize(0),
+    packetCount(0),
+    droppedCount(0)
+{
+}
+
+
+OpalRtpRecorder::~OpalRtpRecorder()
+{
+  Close();
+}
+
+
+PBoolean OpalRtpRecorder::Open(const PFilePath & filename)
+{
+  Close();
+
+  {
+    PWaitAndSignal m(mutex);
+
+    if (!file.Open(filename, PFile::WriteOnly)) {
+      PTRACE(1, "rtp2wav\tCould not create recording " << filename << ": " << file.GetErrorText());
+      return FALSE;
+    }
+
+    pendingSize = 0;
+    packetCount = 0;
+    droppedCount = 0;
+    lastWrite = PTimer::Tick();
+
+    BYTE * body = AppendBlock(BlockSectionHeader, 16);
+    *(DWORD *)body = ByteOrderMagic;
+    *(WORD *)(body+4) = 1;              // version 1.0
+    *(WORD *)(body+6) = 0;
+    *(PInt64 *)(body+8) = -1;           // section length not known
+  }
+
+  // not under our mutex, the writer takes its own then ours
+  OpalRtpRecorderWriter::Instance().Add(this);
+
+  PTRACE(3, "rtp2wav\tStarted recording to " << filename);
+  return TRUE;
+}
+
+
+PBoolean OpalRtpRecorder::IsOpen() const
+{
+  return file.IsOpen();
+}
+
+
+PBoolean OpalRtpRecorder::Attach(RTP_Session & session)
+{
+  PWaitAndSignal m(mutex);
+
+  if (!file.IsOpen())
+    return FALSE;
+
+  if (session.GetPacketTap() != NULL) {
+    PTRACE(2, "rtp2wav\tSession " << session.GetSessionID() << " already has a packet tap");
+    return FALSE;
+  }
+
+  Tap * tap = new Tap(session.GetSessionID(), slots, taps.size()*2);
+  taps.push_back(tap);
+
+  // interfaces are described before any packet on them is drained
+  AppendInterface(tap->queues[0], session.GetSessionID());
+  AppendInterface(tap->queues[1], session.GetSessionID());
+
+  session.SetPacketTap(tap);
+
+  PTRACE(3, "rtp2wav\tRecording session " << session.GetSessionID());
+  return TRUE;
+}
+
+
+void OpalRtpRecorder::Close()
+{
+  {
+    PWaitAndSignal m(mutex);
+    for (std::vector<Tap *>::iterator i = taps.begin(); i != taps.end(); ++i)
+      (*i)->Detach();
+  }
+
+  OpalRtpRecorderWriter::Instance().Remove(this);
+
+  Drain(TRUE);
+
+  PWaitAndSignal m(mutex);
+
+  for (std::vector<Tap *>::iterator i = taps.begin(); i != taps.end(); ++i) {
+    droppedCount += (long)(*i)->queues[0].m_dropped + (long)(*i)->queues[1].m_dropped;
+    delete *i;
+  }
+  taps.clear();
+
+  if (file.IsOpen()) {
+    PTRACE(3, "rtp2wav\tFinished recording " << packetCount << " packets, "
+           << droppedCount << " dropped, to " << file.GetFilePath());
+    file.Close();
+  }
+  pending.SetSize(0);
+}
+
+
+DWORD OpalRtpRecorder::GetPacketCount() const
+{
+  PWaitAndSignal m(mutex);
+  return packetCount;
+}
+
+
+DWORD OpalRtpRecorder::GetDroppedCount() const
+{
+  PWaitAndSignal m(mutex);
+
+  DWORD count = droppedCount;
+  for (std::vector<Tap *>::const_iterator i = taps.begin(); i != taps.end(); ++i)
+    count += (long)(*i)->queues[0].m_dropped + (long)(*i)->queues[1].m_dropped;
+  return count;
+}
+
+
+void OpalRtpRecorder::Drain(PBoolean flush)
+{
+  PWaitAndSignal m(mutex);
+
+  for (std::vector<Tap *>::iterator i = taps.begin(); i != taps.end(); ++i) {
+    for (PINDEX q = 0; q < 2; q++) {
+      Queue & queue = (*i)->queues[q];
+      PInt64 time;
+      const BYTE * data;
+      PINDEX length, original;
+      while (queue.Pop(time, data, length, original)) {
+        AppendPacket(queue, time, data, length, original);
+        queue.Release();
+        packetCount++;
+      }
+    }
+  }
+
+  PTimeInterval now = PTimer::Tick();
+  if (pendingSize == 0 || (!flush && pendingSize < FlushSize && (now - lastWrite).GetMilliSeconds() < FlushInterval))
+    return;
+
+  if (file.IsOpen() && !file.Write(pending, pendingSize)) {
+    PTRACE(1, "rtp2wav\tError writing recording: " << file.GetErrorText(PChannel::LastWriteError));
+    file.Close();
+  }
+
+  pendingSize = 0;
+  lastWrite = now;
+}
+
+
+BYTE * OpalRtpRecorder::AppendBlock(DWORD type, PINDEX bodySize)
+{
+  PINDEX blockSize = 12 + PadTo4(bodySize);
+
+  BYTE * block = pending.GetPointer(pendingSize + blockSize) + pendingSize;
+  memset(block, 0, blockSize);
+  *(DWORD *)block = type;
+  *(DWORD *)(block+4) = blockSize;
+  *(DWORD *)(block+blockSize-4) = blockSize;
+
+  pendingSize += blockSize;
+  return block + 8;
+}
+
+
+void OpalRtpRecorder::AppendInterface(const Queue & queue, unsigned sessionID)
+{
+  PString name = psprintf("session %u %s", sessionID, queue.transmit ? "sent" : "received");
+  PINDEX nameSize = name.GetLength();
+
+  BYTE * body = AppendBlock(BlockInterface, 8 + 4 + PadTo4(nameSize) + 4);
+  *(WORD *)body = LinkTypeRawIPv4;
+  *(DWORD *)(body+4) = IPHeaderSize + MaxPacketSize;
+  *(WORD *)(body+8) = 2;                // if_name, end of options left zero
+  *(WORD *)(body+10) = (WORD)nameSize;
+  memcpy(body+12, (const char *)name, nameSize);
+}
+
+
+void OpalRtpRecorder::AppendPacket(const Queue & queue, PInt64 time, const BYTE * data, PINDEX length, PINDEX original)
+{
+  BYTE * body = AppendBlock(BlockEnhancedPacket, 20 + IPHeaderSize + length);
+  *(DWORD *)body = queue.interfaceId;
+  *(DWORD *)(body+4) = (DWORD)(time >> 32);
+  *(DWORD *)(body+8) = (DWORD)time;
+  *(DWORD *)(body+12) = IPHeaderSize + length;
+  *(DWORD *)(body+16) = IPHeaderSize + original;
+
+  // synthetic IPv4 and UDP headers in network byte order
+  BYTE * ip = body + 20;
+  PINDEX ipLength = IPHeaderSize + original;
+  ip[0] = 0x45;
+  ip[2] = (BYTE)(ipLength >> 8);
+  ip[3] = (BYTE)ipLength;
+  ip[6] = 0x40;                         // don't fragment
+  ip[8] = 64;                           // time to live
+  ip[9] = 17;                           // UDP
+  ip[12] = ip[16] = 127;
+  ip[15] = (BYTE)(queue.transmit ? 1 : 2);
+  ip[19] = (BYTE)(queue.transmit ? 2 : 1);
+
+  DWORD sum = 0;
+  for (PINDEX i = 0; i < 20; i += 2)
+    sum += (ip[i] << 8) | ip[i+1];
+  while (sum > 0xffff)
+    sum = (sum & 0xffff) + (sum >> 16);
+  ip[10] = (BYTE)(~sum >> 8);
+  ip[11] = (BYTE)~sum;
+
+  BYTE * udp = ip + 20;
+  PINDEX udpLength = 8 + original;
+  udp[0] = udp[2] = (BYTE)(queue.port >> 8);
+  udp[1] = udp[3] = (BYTE)queue.port;
+  udp[4] = (BYTE)(udpLength >> 8);
+  udp[5] = (BYTE)udpLength;             // checksum left zero, not used
+
+  memcpy(udp + 8, data, length);
+}
+
+
+#ifdef H323_AUDIO_CODECS
+
+PBoolean OpalRtpRecorder::ExportWAV(const PFilePath & recording, const PFilePath & wavFile, unsigned sessionID)
+{
+  PFile file;
+  if (!file.Open(recording, PFile::ReadOnly)) {
+    PTRACE(1, "rtp2wav\tCould not open recording " << recording);
+    return FALSE;
+  }
+
+  PBYTEArray data;
+  PINDEX length = (PINDEX)file.GetLength();
+  if (!file.Read(data.GetPointer(length), length)) {
+    PTRACE(1, "rtp2wav\tCould not read recording " << recording);
+    return FALSE;
+  }
+  PINDEX size = file.GetLastReadCount();
+  file.Close();
+
+  if (size < 28 || *(const DWORD *)(const BYTE *)data != BlockSectionHeader ||
+                   *(const DWORD *)((const BYTE *)data + 8) != ByteOrderMagic) {
+    PTRACE(1, "rtp2wav\tNot a pcap-ng recording in this byte order: " << recording);
+    return FALSE;
+  }
+
+  // start time and RTP timestamp of the first packet in each direction
+  PBoolean started[2] = { FALSE, FALSE };
+  PInt64 startTime[2] = { 0, 0 };
+  DWORD startTimestamp[2] = { 0, 0 };
+  PInt64 firstTime = 0;
+  PBoolean anyStarted = FALSE;
+
+  // no more than an hour of audio in case of a corrupt timestamp
+  static const PINDEX MaxSamples = 8000*3600;
+  std::vector<int> mix;
+
+  unsigned port = 5000 + 2*sessionID;
+  const BYTE * ptr = data;
+  PINDEX offset = 0;
+  while (offset + 12 <= size) {
+    const BYTE * block = ptr + offset;
+    DWORD blockSize = *(const DWORD *)(block+4);
+    if (blockSize < 12 || (blockSize & 3) != 0 || offset + (PINDEX)blockSize > size)
+      break;
+    offset += blockSize;
+
+    if (*(const DWORD *)block != BlockEnhancedPacket || blockSize < 32 + IPHeaderSize + RTP_DataFrame::MinHeaderSize)
+      continue;
+
+    PInt64 time = ((PInt64)*(const DWORD *)(block+12) << 32) | *(const DWORD *)(block+16);
+    PINDEX captured = *(const DWORD *)(block+20);
+    if (captured > (PINDEX)blockSize - 32)
+      continue;
+
+    const BYTE * ip = block + 28;
+    if (captured < IPHeaderSize + RTP_DataFrame::MinHeaderSize)
+      continue;
+    if (ip[9] != 17 || ((ip[22] << 8) | ip[23]) != port)
+      continue;
+    int dir = ip[15] == 1 ? 1 : 0;
+
+    RTP_DataFrame frame(0);
+    frame.SetSize(captured - IPHeaderSize);
+    memcpy(frame.GetPointer(), ip + IPHeaderSize, captured - IPHeaderSize);
+    PINDEX headerSize = frame.GetHeaderSize();
+    if (headerSize > frame.GetSize())
+      continue;
+    frame.SetPayloadSize(frame.GetSize() - headerSize);
+
+    short (*decode)(int);
+    switch (frame.GetPayloadType()) {
+      case RTP_DataFrame::PCMU :
+        decode = H323_muLawCodec::DecodeSample;
+        break;
+      case RTP_DataFrame::PCMA :
+        decode = H323_ALawCodec::DecodeSample;
+        break;
+      default :
+        continue;
+    }
+
+    if (!anyStarted) {
+      firstTime = time;
+      anyStarted = TRUE;
+    }
+    if (!started[dir]) {
+      startTime[dir] = time;
+      startTimestamp[dir] = frame.GetTimestamp();
+      started[dir] = TRUE;
+    }
+
+    PInt64 position = (startTime[dir] - firstTime)/125 + (int)(frame.GetTimestamp() - startTimestamp[dir]);
+    PINDEX count = frame.GetPayloadSize();
+    if (position < 0 || position + count > MaxSamples)
+      continue;
+
+    if ((PINDEX)mix.size() < position + count)
+      mix.resize((size_t)(position + count), 0);
+
+    const BYTE * payload = frame.GetPayloadPtr();
+    for (PINDEX i = 0; i < count; i++)
+      mix[(size_t)position + i] += decode(payload[i]);
+  }
+
+  if (mix.empty()) {
+    PTRACE(2, "rtp2wav\tNo G.711 audio for session " << sessionID << " in " << recording);
+    return FALSE;
+  }
+
+  PShortArray samples(mix.size());
+  for (size_t i = 0; i < mix.size(); i++)
+    samples[i] = (short)(mix[i] > 32767 ? 32767 : (mix[i] < -32768 ? -32768 : mix[i]));
+
+  PWAVFile wav(wavFile, PFile::WriteOnly, PFile::ModeDefault, PWAVFile::fmt_PCM);
+  if (!wav.IsOpen() || !wav.Write(samples, samples.GetSize()*sizeof(short))) {
+    PTRACE(1, "rtp2wav\tCould not write " << wavFile << ": " << wav.GetErrorText());
+    return FALSE;
+  }
+
+  PTRACE(3, "rtp2wav\tExported " << samples.GetSize() << " samples of session " << sessionID << " to " << wavFile);
+  return TRUE;
+}
+
+#endif // H323_AUDIO_CODECS
+
+
 /////////////////////////////////////////////////////////////////////////////
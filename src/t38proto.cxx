@@ -164,21 +164,11 @@ PBoolean OpalT38Protocol::Originate()
 
 PBoolean OpalT38Protocol::WritePacket(const T38_IFPPacket & ifp)
 {
-  T38_UDPTLPacket udptl;
-
-  // If there are redundant frames saved from last time, put them in
-  if (!redundantIFPs.IsEmpty()) {
-    udptl.m_error_recovery.SetTag(T38_UDPTLPacket_error_recovery::e_secondary_ifp_packets);
-    T38_UDPTLPacket_error_recovery_secondary_ifp_packets & secondary = udptl.m_error_recovery;
-    secondary.SetSize(redundantIFPs.GetSize());
-    for (PINDEX i = 0; i < redundantIFPs.GetSize(); i++)
-      secondary[i].SetValue(redundantIFPs[i]);
-  }
-
   // Encode the current ifp, but need to do stupid things as there are two
   // versions of the ASN out there, completely incompatible.
+  PPER_Stream ifpData;
   if (corrigendumASN || !ifp.HasOptionalField(T38_IFPPacket::e_data_field))
-    udptl.m_primary_ifp_packet.EncodeSubType(ifp);
+    ifp.Encode(ifpData);
   else {
     T38_PreCorrigendum_IFPPacket old_ifp;
 
@@ -197,21 +187,36 @@ PBoolean OpalT38Protocol::WritePacket(const T38_IFPPacket & ifp)
       }
     }
 
-    udptl.m_primary_ifp_packet.PASN_OctetString::EncodeSubType(old_ifp);
+    old_ifp.Encode(ifpData);
   }
+  ifpData.CompleteEncoding();
+
+  // Calculate the level of redundency for this data phase
+  unsigned maxRedundancy;
+  if (ifp.m_type_of_msg.GetTag() == T38_Type_of_msg::e_t30_indicator)
+    maxRedundancy = indicatorRedundancy;
+  else if ((T38_Type_of_msg_data)ifp.m_type_of_msg  == T38_Type_of_msg_data::e_v21)
+    maxRedundancy = lowSpeedRedundancy;
+  else
+    maxRedundancy = highSpeedRedundancy;
 
-  lastSentSequenceNumber = (lastSentSequenceNumber + 1) & 0xffff;
-  udptl.m_seq_number = lastSentSequenceNumber;
+  PWaitAndSignal mutex(writeMutex);
 
-  PPER_Stream rawData;
-  udptl.Encode(rawData);
+  PINDEX length;
+  const BYTE * packet = udptl.Encode(ifpData, ifpData.GetSize(), maxRedundancy, length);
+  if (packet == NULL) {
+    PTRACE(1, "T38\tWritePacket error: IFP of " << ifpData.GetSize() << " bytes is too large");
+    return FALSE;
+  }
+
+  lastSentSequenceNumber = udptl.GetSentSequenceNumber();
 
 #if PTRACING
   if (PTrace::CanTrace(4)) {
     PTRACE(4, "T38\tSending PDU:\n  "
            << setprecision(2) << ifp << "\n "
-           << setprecision(2) << udptl << "\n "
-           << setprecision(2) << rawData);
+           << " seq=" << lastSentSequenceNumber << "\n "
+           << setprecision(2) << PBYTEArray(packet, length, FALSE));
   }
   else {
     PTRACE(3, "T38\tSending PDU:"
@@ -220,29 +225,19 @@ PBoolean OpalT38Protocol::WritePacket(const T38_IFPPacket & ifp)
   }
 #endif
 
-  if (!transport->WritePDU(rawData)) {
+  if (!transport->WritePDU(PBYTEArray(packet, length, FALSE))) {
     PTRACE(1, "T38\tWritePacket error: " << transport->GetErrorText());
     return FALSE;
   }
 
-  // Calculate the level of redundency for this data phase
-  PINDEX maxRedundancy;
-  if (ifp.m_type_of_msg.GetTag() == T38_Type_of_msg::e_t30_indicator)
-    maxRedundancy = indicatorRedundancy;
-  else if ((T38_Type_of_msg_data)ifp.m_type_of_msg  == T38_Type_of_msg_data::e_v21)
-    maxRedundancy = lowSpeedRedundancy;
-  else
-    maxRedundancy = highSpeedRedundancy;
-
-  // Push down the current ifp into redundant data
-  if (maxRedundancy > 0)
-    redundantIFPs.InsertAt(0, new PBYTEArray(udptl.m_primary_ifp_packet.GetValue()));
+  return TRUE;
+}
 
-  // Remove redundant data that are surplus to requirements
-  while (redundantIFPs.GetSize() > maxRedundancy)
-    redundantIFPs.RemoveAt(maxRedundancy);
 
-  return TRUE;
+void OpalT38Protocol::SetErrorRecovery(OpalT38UDPTL::ErrorRecovery mode, unsigned span)
+{
+  PWaitAndSignal mutex(writeMutex);
+  udptl.SetErrorRecovery(mode, span);
 }
 
 
@@ -298,16 +293,15 @@ PBoolean OpalT38Protocol::Answer()
   int expectedSequenceNumber = 0;	// 16 bit
   PBoolean firstPacket = TRUE;
 
+  PBYTEArray rawData;
   for (;;) {
-    PPER_Stream rawData;
     if (!transport->ReadPDU(rawData)) {
       PTRACE(1, "T38\tError reading PDU: " << transport->GetErrorText(PChannel::LastReadError));
       return FALSE;
     }
 
     // Decode the PDU
-    T38_UDPTLPacket udptl;
-    if (udptl.Decode(rawData)) {
+    if (udptl.Decode(rawData, rawData.GetSize())) {
       consecutiveBadPackets = 0;
 
       // When we get the first packet, we know sender's address and port,
@@ -319,9 +313,7 @@ PBoolean OpalT38Protocol::Answer()
       }
     } else {
       consecutiveBadPackets++;
-      PTRACE(2, "T38\tRaw data decode failure:\n  "
-             << setprecision(2) << rawData << "\n  UDPTL = "
-             << setprecision(2) << udptl);
+      PTRACE(2, "T38\tRaw data decode failure:\n  " << setprecision(2) << rawData);
       if (consecutiveBadPackets > 3) {
         PTRACE(1, "T38\tRaw data decode failed multiple times, aborting!");
         return FALSE;
@@ -329,16 +321,12 @@ PBoolean OpalT38Protocol::Answer()
       continue;
     }
 
-    unsigned receivedSequenceNumber = udptl.m_seq_number;
+    unsigned receivedSequenceNumber = udptl.GetSequenceNumber();
 
 #if PTRACING
-    if (PTrace::CanTrace(5)) {
-      PTRACE(4, "T38\tReceived UDPTL packet:\n  "
-             << setprecision(2) << rawData << "\n  "
-             << setprecision(2) << udptl);
-    }
     if (PTrace::CanTrace(4)) {
-      PTRACE(4, "T38\tReceived UDPTL packet:\n  " << setprecision(2) << udptl);
+      PTRACE(4, "T38\tReceived UDPTL packet: seq=" << receivedSequenceNumber << "\n  "
+             << setprecision(2) << rawData);
     }
     else {
       PTRACE(3, "T38\tReceived UDPTL packet: seq=" << receivedSequenceNumber);
@@ -355,35 +343,42 @@ PBoolean OpalT38Protocol::Answer()
 
     expectedSequenceNumber = (WORD)(receivedSequenceNumber+1);
 
-    // See if this is the expected packet
-    if (lostPackets > 0) {
-      // Not what was expected, see if we have enough redundant data
-      if (udptl.m_error_recovery.GetTag() == T38_UDPTLPacket_error_recovery::e_secondary_ifp_packets) {
-        T38_UDPTLPacket_error_recovery_secondary_ifp_packets & secondary = udptl.m_error_recovery;
-        int nRedundancy = secondary.GetSize();
-        if (lostPackets >= nRedundancy) {
-          if (!HandlePacketLost(lostPackets - nRedundancy)) {
-            PTRACE(1, "T38\tHandle packet failed, aborting answer");
-            return FALSE;
-          }
-          lostPackets = nRedundancy;
-        }
-        while (lostPackets > 0) {
-          if (!HandleRawIFP(secondary[lostPackets++])) {
-            PTRACE(1, "T38\tHandle packet failed, aborting answer");
-            return FALSE;
-          }
-        }
+    // Pass on the lost packets the error recovery gives back, in order,
+    // and the number lost between them
+    unsigned unrecovered = 0;
+    if (lostPackets > OpalT38UDPTL::HistorySize) {
+      unrecovered = lostPackets - OpalT38UDPTL::HistorySize;
+      lostPackets = OpalT38UDPTL::HistorySize;
+    }
+
+    while (lostPackets > 0) {
+      const BYTE * ifp;
+      PINDEX size;
+      if (!udptl.Recover((receivedSequenceNumber - lostPackets--) & 0xffff, ifp, size)) {
+        unrecovered++;
+        continue;
       }
-      else {
-        if (!HandlePacketLost(lostPackets)) {
+
+      if (unrecovered > 0) {
+        if (!HandlePacketLost(unrecovered)) {
           PTRACE(1, "T38\tHandle lost packet, aborting answer");
           return FALSE;
         }
+        unrecovered = 0;
       }
+
+      if (!HandleRawIFP(ifp, size)) {
+        PTRACE(1, "T38\tHandle packet failed, aborting answer");
+        return FALSE;
+      }
+    }
+
+    if (unrecovered > 0 && !HandlePacketLost(unrecovered)) {
+      PTRACE(1, "T38\tHandle lost packet, aborting answer");
+      return FALSE;
     }
 
-    if (!HandleRawIFP(udptl.m_primary_ifp_packet)) {
+    if (!HandleRawIFP(udptl.GetPrimary(), udptl.GetPrimarySize())) {
       PTRACE(1, "T38\tHandle packet failed, aborting answer");
       return FALSE;
     }
@@ -393,10 +388,18 @@ PBoolean OpalT38Protocol::Answer()
 
 PBoolean OpalT38Protocol::HandleRawIFP(const PASN_OctetString & pdu)
 {
+  const PBYTEArray & value = pdu.GetValue();
+  return HandleRawIFP(value, value.GetSize());
+}
+
+
+PBoolean OpalT38Protocol::HandleRawIFP(const BYTE * data, PINDEX size)
+{
+  PPER_Stream pdu(data, size);
   T38_IFPPacket ifp;
 
   if (corrigendumASN) {
-    if (pdu.DecodeSubType(ifp))
+    if (ifp.Decode(pdu))
       return HandlePacket(ifp);
 
     PTRACE(2, "T38\tIFP decode failure:\n  " << setprecision(2) << ifp);
@@ -404,7 +407,7 @@ PBoolean OpalT38Protocol::HandleRawIFP(const PASN_OctetString & pdu)
   }
 
   T38_PreCorrigendum_IFPPacket old_ifp;
-  if (!pdu.DecodeSubType(old_ifp)) {
+  if (!old_ifp.Decode(pdu)) {
     PTRACE(2, "T38\tPre-corrigendum IFP decode failure:\n  " << setprecision(2) << old_ifp);
     return TRUE;
   }
@@ -520,4 +523,288 @@ PBoolean OpalT38Protocol::HandlePacketLost(unsigned PTRACE_PARAM(nLost))
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+OpalT38UDPTL::OpalT38UDPTL()
+{
+  mode = e_Redundancy;
+  fecSpan = 3;
+
+  txSequence = 0xffff;
+  txDepth = 0;
+
+  rxSequence = 0;
+  primary = NULL;
+  primarySize = 0;
+  rxMode = e_Redundancy;
+  rxCount = 0;
+  rxSpan = 0;
+}
+
+
+void OpalT38UDPTL::SetErrorRecovery(ErrorRecovery newMode, unsigned span)
+{
+  mode = newMode;
+  fecSpan = span < 1 ? 1 : (span > MaxEntries ? MaxEntries : span);
+  txDepth = 0;
+}
+
+
+const BYTE * OpalT38UDPTL::Encode(const BYTE * ifp, PINDEX size, unsigned level, PINDEX & length)
+{
+  // Two octet length determinants at most
+  if (size > 16383)
+    return NULL;
+
+  txSequence = (txSequence + 1) & 0xffff;
+
+  // Size the buffer for the worst case, it only ever grows
+  PINDEX maxLength = 2 + 2 + size + 4;
+  unsigned i;
+  for (i = 1; i <= txDepth; i++)
+    maxLength += 2 + txHistory[(txSequence - i) & (HistorySize-1)].size;
+
+  BYTE * start = txPacket.GetPointer(maxLength);
+  BYTE * ptr = start;
+
+  *ptr++ = (BYTE)(txSequence >> 8);
+  *ptr++ = (BYTE)txSequence;
+
+  ptr += EncodeLength(ptr, size);
+  memcpy(ptr, ifp, size);
+  ptr += size;
+
+  if (mode == e_Redundancy) {
+    // secondary-ifp-packets, most recent first
+    *ptr++ = 0x00;
+    ptr += EncodeLength(ptr, txDepth);
+    for (i = 1; i <= txDepth; i++) {
+      const Entry & earlier = txHistory[(txSequence - i) & (HistorySize-1)];
+      ptr += EncodeLength(ptr, earlier.size);
+      memcpy(ptr, (const BYTE *)earlier.data, earlier.size);
+      ptr += earlier.size;
+    }
+  }
+  else {
+    // Each of the entries is the XOR of span packets, taking every
+    // entries'th packet so a burst of losses falls in different entries
+    unsigned span = fecSpan;
+    unsigned entries = txDepth / span;
+    if (entries == 0 && txDepth > 0) {
+      span = txDepth;
+      entries = 1;
+    }
+    unsigned first = txSequence - span*entries;
+
+    // fec-info, the fec-npackets integer as one octet
+    *ptr++ = 0x80;
+    *ptr++ = 1;
+    *ptr++ = (BYTE)span;
+    ptr += EncodeLength(ptr, entries);
+
+    for (unsigned m = 0; m < entries; m++) {
+      PINDEX fecSize = 0;
+      unsigned k;
+      for (k = 0; k < span; k++) {
+        const Entry & earlier = txHistory[(first + m + k*entries) & (HistorySize-1)];
+        if (fecSize < earlier.size)
+          fecSize = earlier.size;
+      }
+
+      ptr += EncodeLength(ptr, fecSize);
+      memset(ptr, 0, fecSize);
+      for (k = 0; k < span; k++) {
+        const Entry & earlier = txHistory[(first + m + k*entries) & (HistorySize-1)];
+        const BYTE * data = earlier.data;
+        for (PINDEX j = 0; j < earlier.size; j++)
+          ptr[j] ^= data[j];
+      }
+      ptr += fecSize;
+    }
+  }
+
+  Store(txHistory[txSequence & (HistorySize-1)], txSequence, ifp, size);
+
+  // The number of later packets carrying this one, as redundancy has always done
+  unsigned maxDepth = mode == e_Redundancy ? level : level*fecSpan;
+  if (maxDepth > MaxEntries)
+    maxDepth = MaxEntries;
+  txDepth = level == 0 ? 0 : (txDepth < maxDepth ? txDepth + 1 : maxDepth);
+
+  length = ptr - start;
+  return start;
+}
+
+
+PBoolean OpalT38UDPTL::Decode(const BYTE * data, PINDEX length)
+{
+  const BYTE * ptr = data;
+  const BYTE * end = data + length;
+
+  primary = NULL;
+  primarySize = 0;
+  rxCount = 0;
+  rxSpan = 0;
+
+  if (length < 4)
+    return FALSE;
+
+  rxSequence = (ptr[0] << 8) | ptr[1];
+  ptr += 2;
+
+  if (!DecodeLength(ptr, end, primarySize) || primarySize > end - ptr)
+    return FALSE;
+  primary = ptr;
+  ptr += primarySize;
+
+  // error-recovery choice, then the octet aligned contents
+  if (ptr >= end)
+    return FALSE;
+  rxMode = (*ptr++ & 0x80) != 0 ? e_ForwardErrorCorrection : e_Redundancy;
+
+  if (rxMode == e_ForwardErrorCorrection) {
+    PINDEX intLength;
+    if (!DecodeLength(ptr, end, intLength) || intLength < 1 || intLength > 2 || intLength > end - ptr)
+      return FALSE;
+    while (intLength-- > 0)
+      rxSpan = (rxSpan << 8) | *ptr++;
+  }
+
+  PINDEX count;
+  if (!DecodeLength(ptr, end, count))
+    return FALSE;
+
+  for (PINDEX i = 0; i < count; i++) {
+    PINDEX size;
+    if (!DecodeLength(ptr, end, size) || size > end - ptr)
+      return FALSE;
+    // Older secondary IFPs than can be used are skipped
+    if (i < MaxEntries) {
+      rxEntries[i] = ptr;
+      rxSizes[i] = size;
+      rxCount = i + 1;
+    }
+    ptr += size;
+  }
+
+  // FEC entries are only of use if all are there
+  if (rxMode == e_ForwardErrorCorrection && count > MaxEntries)
+    rxCount = 0;
+
+  // Keep the primary for FEC, unless a later packet already took its place
+  Entry & entry = rxHistory[rxSequence & (HistorySize-1)];
+  unsigned newer = (entry.sequence - rxSequence) & 0xffff;
+  if (entry.sequence < 0 || newer == 0 || newer > 0x7fff)
+    Store(entry, rxSequence, primary, primarySize);
+
+  return TRUE;
+}
+
+
+PBoolean OpalT38UDPTL::Recover(unsigned sequence, const BYTE * & ifp, PINDEX & size)
+{
+  Entry & entry = rxHistory[sequence & (HistorySize-1)];
+  if (entry.sequence == (int)sequence) {
+    ifp = entry.data;
+    size = entry.size;
+    return TRUE;
+  }
+
+  unsigned back = (rxSequence - sequence) & 0xffff;
+  if (back == 0 || rxCount == 0)
+    return FALSE;
+
+  if (rxMode == e_Redundancy) {
+    if (back > rxCount)
+      return FALSE;
+
+    ifp = rxEntries[back-1];
+    size = rxSizes[back-1];
+    Store(entry, sequence, ifp, size);
+    return TRUE;
+  }
+
+  unsigned covered = rxSpan * rxCount;
+  if (back > covered)
+    return FALSE;
+
+  // The entry covering the lost packet gives it back if every other packet
+  // of the entry has been received
+  unsigned m = (covered - back) % rxCount;
+  unsigned first = rxSequence - covered + m;
+  PINDEX fecSize = rxSizes[m];
+  unsigned k;
+  for (k = 0; k < rxSpan; k++) {
+    unsigned other = (first + k*rxCount) & 0xffff;
+    if (other == sequence)
+      continue;
+    const Entry & received = rxHistory[other & (HistorySize-1)];
+    if (received.sequence != (int)other || received.size > fecSize)
+      return FALSE;
+  }
+
+  BYTE * recovered = entry.data.GetPointer(fecSize);
+  memcpy(recovered, rxEntries[m], fecSize);
+  for (k = 0; k < rxSpan; k++) {
+    unsigned other = (first + k*rxCount) & 0xffff;
+    if (other == sequence)
+      continue;
+    const Entry & received = rxHistory[other & (HistorySize-1)];
+    const BYTE * data = received.data;
+    for (PINDEX j = 0; j < received.size; j++)
+      recovered[j] ^= data[j];
+  }
+
+  // Any zeros padding the IFP to the longest of the entry are ignored when decoding
+  entry.sequence = sequence;
+  entry.size = fecSize;
+
+  ifp = recovered;
+  size = fecSize;
+  return TRUE;
+}
+
+
+void OpalT38UDPTL::Store(Entry & entry, unsigned sequence, const BYTE * data, PINDEX size)
+{
+  entry.sequence = sequence;
+  entry.size = size;
+  if (size > 0)
+    memcpy(entry.data.GetPointer(size), data, size);
+}
+
+
+PINDEX OpalT38UDPTL::EncodeLength(BYTE * ptr, PINDEX length)
+{
+  if (length < 128) {
+    ptr[0] = (BYTE)length;
+    return 1;
+  }
+
+  ptr[0] = (BYTE)(0x80 | (length >> 8));
+  ptr[1] = (BYTE)length;
+  return 2;
+}
+
+
+PBoolean OpalT38UDPTL::DecodeLength(const BYTE * & ptr, const BYTE * end, PINDEX & length)
+{
+  if (ptr >= end)
+    return FALSE;
+
+  if ((*ptr & 0x80) == 0) {
+    length = *ptr++;
+    return TRUE;
+  }
+
+  // Fragmented lengths of 16K or more are never used for UDPTL
+  if ((*ptr & 0xc0) != 0x80 || ptr + 1 >= end)
+    return FALSE;
+
+  length = ((ptr[0] & 0x3f) << 8) | ptr[1];
+  ptr += 2;
+  return TRUE;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
@@ -1332,6 +1332,16 @@ H323Transport * H323ListenerTCP::CreateTransport(const PIPSocket::Address & addr
 }
 
 H323Transport * H323ListenerTCP::Accept(const PTimeInterval & timeout)
+{
+  PTCPSocket * socket = AcceptSocket(timeout);
+  if (socket == NULL)
+    return NULL;
+
+  return OpenTransport(socket);
+}
+
+
+PTCPSocket * H323ListenerTCP::AcceptSocket(const PTimeInterval & timeout)
 {
   if (!listener.IsOpen())
     return NULL;
@@ -1340,18 +1350,8 @@ H323Transport * H323ListenerTCP::Accept(const PTimeInterval & timeout)
 
   PTRACE(4, TypeAsString() << "\tWaiting on socket accept on " << GetTransportAddress());
   PTCPSocket * socket = new PTCPSocket;
-  if (socket->Accept(listener)) {
-    unsigned m_version = GetTransportAddress().GetIpVersion();
-    H323Transport * transport = CreateTransport(PIPSocket::Address::GetAny(m_version));
-    transport->FinaliseSecurity(socket);
-    if (transport->Open(socket) && transport->SecureAccept()) {
-        return transport;
-    }
-
-    PTRACE(1, TypeAsString() << "\tFailed to open transport, connection not started.");
-    delete transport;
-    return NULL;
-  }
+  if (socket->Accept(listener))
+    return socket;
 
   if (socket->GetErrorCode() != PChannel::Interrupted) {
     PTRACE(1, TypeAsString() << "\tAccept error:" << socket->GetErrorText());
@@ -1363,6 +1363,21 @@ H323Transport * H323ListenerTCP::Accept(const PTimeInterval & timeout)
 }
 
 
+H323Transport * H323ListenerTCP::OpenTransport(PTCPSocket * socket)
+{
+  unsigned m_version = GetTransportAddress().GetIpVersion();
+  H323Transport * transport = CreateTransport(PIPSocket::Address::GetAny(m_version));
+  transport->FinaliseSecurity(socket);
+  if (transport->Open(socket) && transport->SecureAccept()) {
+      return transport;
+  }
+
+  PTRACE(1, TypeAsString() << "\tFailed to open transport, connection not started.");
+  delete transport;
+  return NULL;
+}
+
+
 H323TransportAddress H323ListenerTCP::GetTransportAddress() const
 {
     return H323TransportAddress(localAddress, listener.GetPort());
@@ -1408,15 +1423,249 @@ void H323ListenerTCP::Main()
 /////////////////////////////////////////////////////////////////////////////
 
 #ifdef H323_TLS
-H323ListenerTLS::H323ListenerTLS(H323EndPoint & endpoint, PIPSocket::Address binding, WORD port, PBoolean exclusive)
-: H323ListenerTCP(endpoint, binding, port, exclusive, H323TransportSecurity::e_tls)
+H323TLSSessionCache::H323TLSSessionCache(PINDEX maxSessions)
+: m_maxSessions(maxSessions)
+{
+}
+
+H323TLSSessionCache::~H323TLSSessionCache()
+{
+    RemoveAll();
+}
+
+PBoolean H323TLSSessionCache::Resume(ssl_st * ssl, const H323TransportAddress & remote)
+{
+    if (ssl == NULL)
+        return false;
+
+    PWaitAndSignal m(m_mutex);
+
+    std::map<PString, ssl_session_st *>::iterator i = m_sessions.find(remote);
+    if (i == m_sessions.end())
+        return false;
+
+    if (SSL_set_session(ssl, i->second) != 1) {
+        PTRACE(2, "TLS\tCould not set cached session for " << remote);
+        return false;
+    }
+
+    PTRACE(4, "TLS\tResuming session with " << remote);
+    return true;
+}
+
+void H323TLSSessionCache::Save(ssl_st * ssl, const H323TransportAddress & remote)
+{
+    if (ssl == NULL || m_maxSessions == 0)
+        return;
+
+    ssl_session_st * session = SSL_get1_session(ssl);
+    if (session == NULL)
+        return;
+
+    PWaitAndSignal m(m_mutex);
+
+    std::map<PString, ssl_session_st *>::iterator i = m_sessions.find(remote);
+    if (i != m_sessions.end()) {
+        SSL_SESSION_free(i->second);
+        i->second = session;
+        m_order.remove(remote);
+    } else
+        m_sessions.insert(std::pair<PString, ssl_session_st *>(remote, session));
+    m_order.push_back(remote);
+
+    while (m_order.size() > (size_t)m_maxSessions) {
+        i = m_sessions.find(m_order.front());
+        if (i != m_sessions.end()) {
+            SSL_SESSION_free(i->second);
+            m_sessions.erase(i);
+        }
+        m_order.pop_front();
+    }
+}
+
+void H323TLSSessionCache::Remove(const H323TransportAddress & remote)
+{
+    PWaitAndSignal m(m_mutex);
+
+    std::map<PString, ssl_session_st *>::iterator i = m_sessions.find(remote);
+    if (i == m_sessions.end())
+        return;
+
+    SSL_SESSION_free(i->second);
+    m_sessions.erase(i);
+    m_order.remove(remote);
+}
+
+void H323TLSSessionCache::SetMaxSessions(PINDEX maxSessions)
+{
+    PWaitAndSignal m(m_mutex);
+
+    m_maxSessions = maxSessions;
+    while (m_order.size() > (size_t)m_maxSessions) {
+        std::map<PString, ssl_session_st *>::iterator i = m_sessions.find(m_order.front());
+        if (i != m_sessions.end()) {
+            SSL_SESSION_free(i->second);
+            m_sessions.erase(i);
+        }
+        m_order.pop_front();
+    }
+}
+
+void H323TLSSessionCache::RemoveAll()
+{
+    PWaitAndSignal m(m_mutex);
+
+    for (std::map<PString, ssl_session_st *>::iterator i = m_sessions.begin(); i != m_sessions.end(); ++i)
+        SSL_SESSION_free(i->second);
+    m_sessions.clear();
+    m_order.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323TLSHandshakePool::H323TLSHandshakePool(H323EndPoint & endpoint, H323ListenerTCP & listener, PINDEX threads, PINDEX maxQueue)
+: m_endpoint(endpoint), m_listener(listener), m_maxQueue(maxQueue), m_shutdown(false)
+{
+    m_threads.DisallowDeleteObjects();
+
+    for (PINDEX i = 0; i < threads; ++i)
+        m_threads.Append(PThread::Create(PCREATE_NOTIFIER(HandshakeMain), 0,
+                                 PThread::NoAutoDeleteThread,
+                                 PThread::NormalPriority,
+                                 "TLSHandshake:%x"));
+
+    PTRACE(4, "TLS\tHandshake pool started threads " << threads << " queue " << maxQueue);
+}
+
+H323TLSHandshakePool::~H323TLSHandshakePool()
+{
+    Shutdown();
+}
+
+PBoolean H323TLSHandshakePool::Enqueue(PTCPSocket * socket)
+{
+    {
+        PWaitAndSignal m(m_mutex);
+        if (m_shutdown || m_queue.size() >= (size_t)m_maxQueue)
+            return false;
+
+        m_queue.push_back(socket);
+    }
+    m_ready.Signal();
+    return true;
+}
+
+void H323TLSHandshakePool::Shutdown()
+{
+    {
+        PWaitAndSignal m(m_mutex);
+        m_shutdown = true;
+    }
+
+    for (PINDEX i = 0; i < m_threads.GetSize(); ++i) {
+        m_ready.Signal();
+        m_threads[i].WaitForTermination();
+        delete &m_threads[i];
+    }
+    m_threads.RemoveAll();
+
+    PWaitAndSignal m(m_mutex);
+    for (std::list<PTCPSocket *>::iterator i = m_queue.begin(); i != m_queue.end(); ++i)
+        delete *i;
+    m_queue.clear();
+}
+
+// OpenSSL reads and writes the socket handle directly, so the channel
+// timeouts do not apply to it. 0 waits forever.
+static void SetHandleTimeout(PTCPSocket & socket, const PTimeInterval & timeout)
+{
+#ifdef _WIN32
+    DWORD tv = (DWORD)timeout.GetMilliSeconds();
+#else
+    struct timeval tv;
+    tv.tv_sec = (long)(timeout.GetMilliSeconds()/1000);
+    tv.tv_usec = (long)(timeout.GetMilliSeconds()%1000)*1000;
+#endif
+    if (!socket.SetOption(SO_RCVTIMEO, &tv, sizeof(tv)) || !socket.SetOption(SO_SNDTIMEO, &tv, sizeof(tv))) {
+        PTRACE(2, "TLS\tCould not set handshake timeout: " << socket.GetErrorText());
+    }
+}
+
+void H323TLSHandshakePool::HandshakeMain(PThread &, H323_INT)
 {
+    PTRACE(4, "TLS\tHandshake thread started");
+
+    for (;;) {
+        PTCPSocket * socket = NULL;
+        {
+            PWaitAndSignal m(m_mutex);
+            if (m_shutdown)
+                break;
+
+            if (!m_queue.empty()) {
+                socket = m_queue.front();
+                m_queue.pop_front();
+            }
+        }
+
+        if (socket == NULL) {
+            m_ready.Wait();
+            continue;
+        }
+
+        // Don't let a stalled peer hold the thread, SSL_accept() blocks on
+        // the handle until each read or write times out
+        socket->SetReadTimeout(m_endpoint.GetSignallingChannelConnectTimeout());
+        SetHandleTimeout(*socket, m_endpoint.GetSignallingChannelConnectTimeout());
+        H323Transport * transport = m_listener.OpenTransport(socket);
+        if (transport != NULL) {
+            SetHandleTimeout(*socket, 0);
+            socket->SetReadTimeout(PMaxTimeInterval);
+            new H225TransportThread(m_endpoint, transport);
+        }
+    }
+
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+    ERR_remove_thread_state(NULL);
+#endif
+    PTRACE(4, "TLS\tHandshake thread ended");
+}
+
+/////////////////////////////////////////////////////////////////////////////
 
+H323ListenerTLS::H323ListenerTLS(H323EndPoint & endpoint, PIPSocket::Address binding, WORD port, PBoolean exclusive)
+: H323ListenerTCP(endpoint, binding, port, exclusive, H323TransportSecurity::e_tls), m_handshakePool(NULL)
+{
+    if (endpoint.GetTLSHandshakeThreads() > 0)
+        m_handshakePool = new H323TLSHandshakePool(endpoint, *this, endpoint.GetTLSHandshakeThreads(),
+                                                                    endpoint.GetTLSHandshakeQueueSize());
 }
 
 H323ListenerTLS::~H323ListenerTLS()
 {
    Close();
+   delete m_handshakePool;
+}
+
+void H323ListenerTLS::Main()
+{
+  if (m_handshakePool == NULL) {
+    H323ListenerTCP::Main();
+    return;
+  }
+
+  PTRACE(2, TypeAsString() << "\tAwaiting " << TypeAsString() << " connections on port " << listener.GetPort());
+
+  while (listener.IsOpen()) {
+    PTCPSocket * socket = AcceptSocket(PMaxTimeInterval);
+    if (socket != NULL && !m_handshakePool->Enqueue(socket)) {
+      PTRACE(2, TypeAsString() << "\tHandshake queue full, dropping connection");
+      delete socket;
+    }
+  }
+#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
+  ERR_remove_thread_state(NULL);
+#endif
 }
 
 H323Transport * H323ListenerTLS::CreateTransport(const PIPSocket::Address & address)
@@ -1536,6 +1785,9 @@ H323TransportTCP::H323TransportTCP(H323EndPoint & end,
 #endif
 {
   h245listener = NULL;
+#ifdef H323_TLS
+  m_tlsClient = false;
+#endif
 
   // construct listener socket if required
   if (listen) {
@@ -1644,6 +1896,9 @@ PBoolean H323TransportTCP::Close()
     ssl_st * m_ssl = ssl;
 #endif
     if (m_ssl) {
+        // Any session ticket sent after the handshake has arrived by now
+        if (m_tlsClient && SSL_is_init_finished(m_ssl))
+            endpoint.GetTLSSessionCache().Save(m_ssl, GetRemoteAddress());
         SSL_shutdown(m_ssl);
         m_ssl = NULL;
     }
@@ -1838,6 +2093,11 @@ PBoolean H323TransportTCP::SecureConnect()
 #if PTLIB_VER < 2120
     ssl_st * m_ssl = ssl;
 #endif
+    H323TLSSessionCache & sessions = endpoint.GetTLSSessionCache();
+    H323TransportAddress remote = GetRemoteAddress();
+    sessions.Resume(m_ssl, remote);
+    m_tlsClient = true;
+
     int ret = 0;
     do {
         ret = SSL_connect(m_ssl);
@@ -1850,6 +2110,7 @@ PBoolean H323TransportTCP::SecureConnect()
                 case SSL_ERROR_SSL:
                     ERR_error_string(ERR_get_error(), msg);
                     PTRACE(1, "TLS\tTLS protocol error in SSL_connect(): " << err << " / " << msg);
+                    sessions.Remove(remote);
                     SSL_shutdown(m_ssl);
                     return false;
                     break;
@@ -1864,6 +2125,7 @@ PBoolean H323TransportTCP::SecureConnect()
                         default:
                             ERR_error_string(ERR_get_error(), msg);
                             PTRACE(1, "TLS\tTerminating connection: " << msg);
+                            sessions.Remove(remote);
                             SSL_shutdown(m_ssl);
                             return false;
                     };
@@ -1877,11 +2139,15 @@ PBoolean H323TransportTCP::SecureConnect()
                 default:
                     ERR_error_string(ERR_get_error(), msg);
                     PTRACE(1, "TLS\tUnknown error in SSL_connect(): " << err << " / " << msg);
+                    sessions.Remove(remote);
                     SSL_shutdown(m_ssl);
                     return false;
             }
         }
     } while (ret <= 0);
+
+    PTRACE(4, "TLS\tHandshake with " << remote << (SSL_session_reused(m_ssl) ? " resumed" : " completed"));
+    sessions.Save(m_ssl, remote);
 #endif
     return true;
 }